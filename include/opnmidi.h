@@ -57,6 +57,17 @@ typedef char            OPN2_SInt8;
 typedef short           OPN2_SInt16;
 #endif
 
+#if defined(_MSC_VER) && (_MSC_VER < 1600)
+typedef unsigned __int64 OPN2_UInt64;
+#elif (defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L)) || defined(__cplusplus)
+#include <stdint.h>
+typedef uint64_t        OPN2_UInt64;
+#elif defined(__GNUC__)
+__extension__ typedef unsigned long long OPN2_UInt64;
+#else
+typedef unsigned long long OPN2_UInt64;
+#endif
+
 
 /* == Deprecated function markers == */
 
@@ -202,6 +213,28 @@ extern OPNMIDI_DECLSPEC int  opn2_getNumChips(struct OPN2_MIDIPlayer *device);
  */
 extern OPNMIDI_DECLSPEC int opn2_getNumChipsObtained(struct OPN2_MIDIPlayer *device);
 
+/**
+ * @brief Enable or disable dynamic scaling of the chips pool
+ *
+ * When enabled, playback starts with a single active chip, and the next one gets activated
+ * when a new note would otherwise steal a playing voice, up to the count set by opn2_setNumChips().
+ * The last active chip gets retired after it stays silent for a while. Only active chips
+ * are rendered, so the CPU cost follows the actual polyphony of the song.
+ * When enabled during playback, the pool shrinks as soon as the last chips become silent.
+ *
+ * @param device Instance of the library
+ * @param enabled 0 - disabled (default), 1 - enabled
+ * @return 0 on success, <0 when any error has occurred
+ */
+extern OPNMIDI_DECLSPEC int opn2_setDynamicChips(struct OPN2_MIDIPlayer *device, int enabled);
+
+/**
+ * @brief Get number of currently active chips
+ * @param device Instance of the library
+ * @return Count of rendered chip emulators
+ */
+extern OPNMIDI_DECLSPEC int opn2_getNumChipsActive(struct OPN2_MIDIPlayer *device);
+
 /**
  * @brief Reference to dynamic bank
  */
@@ -431,6 +464,40 @@ extern OPNMIDI_DECLSPEC void opn2_setAutoArpeggio(struct OPN2_MIDIPlayer *device
  */
 extern OPNMIDI_DECLSPEC void opn2_setLoopEnabled(struct OPN2_MIDIPlayer *device, int loopEn);
 
+/**
+ * @brief Enable or disable the replay of the cached output of repeated loops
+ *
+ * The state of the player (registers, whole state of chip emulators, voices, MIDI channels,
+ * sequencer position and the phase of the clock) is compared at every jump to the loop start.
+ * Once two loops have started with the same state, every next loop sounds the same, so the
+ * output of the next loop gets recorded, and then opn2_play() and opn2_playFormat() give
+ * the recorded output instead of emulating chips. The replayed output is bit-identical to
+ * the rendered one. Nothing gets recorded while the state doesn't repeat: global envelope
+ * counters of MAME and Nuked emulators repeat only every few thousands of samples, and
+ * the running LFO of GENS emulator has other phase at every loop start, so loops are rarely
+ * replayed with these emulators. Loops are cached only with the integer clock
+ * (see `opn2_setIntegerClock`), the time counted in floating point seconds doesn't repeat
+ * by whole frames.
+ *
+ * Real-time events (`opn2_rt_*` functions and `opn2_panic`) stop the replay once it reaches
+ * the next state of the player saved every 1/10 of second while recording, and are applied
+ * there, so the live rendering continues without extra work. Any change of the setup stops
+ * the replay at once: the player restores the previous saved state, renders the rest of
+ * frames up to the replayed position silently and then handles the change. The loop gets
+ * cached again once it repeats without changes. Note hooks aren't called while the output
+ * is replayed.
+ *
+ * The loop isn't cached while stems, the trace or the parallel render are used, or when the
+ * emulator can't save its state.
+ *
+ * Available when library is built with built-in MIDI Sequencer support.
+ *
+ * @param device Instance of the library
+ * @param maxSeconds Maximal length of the cached loop in seconds, 0 disables the cache
+ * @return 0 on success, <0 when any error has occurred
+ */
+extern OPNMIDI_DECLSPEC int opn2_setLoopCache(struct OPN2_MIDIPlayer *device, double maxSeconds);
+
 /**
  * @brief Enable or disable soft panning with chip emulators
  * @param device Instance of the library
@@ -464,6 +531,7 @@ extern OPNMIDI_DECLSPEC int opn2_getVolumeRangeModel(struct OPN2_MIDIPlayer *dev
  * @brief Load WOPN bank file from File System
  *
  * Is recommended to call adl_reset() to apply changes to already-loaded file player or real-time.
+ * Pre-baked bank images made by opn2_saveBankImage() are accepted too.
  *
  * @param device Instance of the library
  * @param filePath Absolute or relative path to the WOPL bank file. UTF8 encoding is required, even on Windows.
@@ -475,6 +543,8 @@ extern OPNMIDI_DECLSPEC int opn2_openBankFile(struct OPN2_MIDIPlayer *device, co
  * @brief Load WOPN bank file from memory data
  *
  * Is recommended to call adl_reset() to apply changes to already-loaded file player or real-time.
+ * Pre-baked bank images made by opn2_saveBankImage() are read in place, so the memory
+ * may be a read-only mapping of the image file and may be unmapped after the call.
  *
  * @param device Instance of the library
  * @param mem Pointer to memory block where is raw data of WOPL bank file is stored
@@ -483,6 +553,35 @@ extern OPNMIDI_DECLSPEC int opn2_openBankFile(struct OPN2_MIDIPlayer *device, co
  */
 extern OPNMIDI_DECLSPEC int opn2_openBankData(struct OPN2_MIDIPlayer *device, const void *mem, long size);
 
+/**
+ * @brief Decode WOPN banks lazily, only instruments which are in use
+ *
+ * Applies to the next opn2_openBankFile() or opn2_openBankData() call. The raw bank file is
+ * kept in the memory, the loaded music file is pre-scanned for the used banks and programs,
+ * and only them are decoded. Any other instrument is decoded on its first note. Banks missed
+ * by the pre-scan are created on the first note, which allocates the memory on the audio thread,
+ * so keep the default complete loading for real-time playback. Bank images are always loaded
+ * completely. Any of opn2_getBank() and opn2_getFirstBank() calls decodes all remaining banks.
+ *
+ * @param device Instance of the library
+ * @param enabled 1 - decode instruments on demand, 0 - decode the whole bank on loading (default)
+ */
+extern OPNMIDI_DECLSPEC void opn2_setLazyBankLoading(struct OPN2_MIDIPlayer *device, int enabled);
+
+/**
+ * @brief Save currently loaded banks as the pre-baked bank image file
+ *
+ * The bank image keeps instruments in the ready internal layout of the library,
+ * so opn2_openBankFile() and opn2_openBankData() take it without of any per-instrument
+ * conversion. Images are little-endian and versioned, they are portable between
+ * machines, but must be re-made when the library rejects them as incompatible.
+ *
+ * @param device Instance of the library
+ * @param filePath Path to the output file. UTF8 encoding is required, even on Windows.
+ * @return 0 on success, <0 when any error has occurred
+ */
+extern OPNMIDI_DECLSPEC int opn2_saveBankImage(struct OPN2_MIDIPlayer *device, const char *filePath);
+
 
 /**
  * @brief [DEPRECATED] Dummy function
@@ -534,6 +633,48 @@ enum Opn2_Emulator
  */
 extern OPNMIDI_DECLSPEC int opn2_switchEmulator(struct OPN2_MIDIPlayer *device, int emulator);
 
+/**
+ * @brief Run the first chips by the separate emulator
+ *
+ * Lead chips run the given emulator, the rest of chips run the one selected by
+ * opn2_switchEmulator(). For example, two lead chips by Nuked OPN2 and the rest
+ * by MAME or GENS give the most of accuracy of Nuked OPN2 for a part of its CPU cost.
+ * Free channels of lead chips are preferred by exposed notes (melody lines which
+ * hold less than two notes at once), while chords and drums take other chips first,
+ * so the lead emulator plays what is heard the best.
+ *
+ * The quality governor (see `opn2_setQualityGovernor`) migrates only the chips which
+ * run the emulator selected by opn2_switchEmulator(). The VGM dumper can't be mixed
+ * with other emulators. The player gets reset like on the emulator switch.
+ *
+ * @param device Instance of the library
+ * @param emulator Type of emulator of lead chips (#Opn2_Emulator), -1 runs all chips by the same emulator
+ * @param chips Count of lead chips, 0 runs all chips by the same emulator
+ * @return 0 on success, <0 when any error has occurred
+ */
+extern OPNMIDI_DECLSPEC int opn2_setLeadChipsEmulator(struct OPN2_MIDIPlayer *device, int emulator, int chips);
+
+/**
+ * @brief Enable or disable the adaptive quality governor
+ *
+ * When enabled, the render time of every opn2_play() / opn2_generate() call gets compared
+ * with the duration of the generated audio. While the rendering doesn't fit the real-time
+ * budget, chips are migrated to the cheaper emulator (Nuked -> MAME -> Gens, or MAME YM2608 -> NP2)
+ * by moving the register state without reset, so playing notes are kept.
+ * When there is enough headroom, the governor migrates back to the emulator selected
+ * by opn2_switchEmulator(), which is never exceeded. Use opn2_setEmulatorSwitchHook()
+ * to get notified about every switch.
+ *
+ * Chips of cheaper emulators are created when the governor gets enabled and on every reset
+ * of the player, so the switch doesn't allocate memory on the audio thread. The governor
+ * doesn't switch emulators while the stem mode is set (see `opn2_setStemMode`).
+ *
+ * @param device Instance of the library
+ * @param enabled 0 - disabled (default), 1 - enabled
+ * @return 0 on success, <0 when any error has occurred
+ */
+extern OPNMIDI_DECLSPEC int opn2_setQualityGovernor(struct OPN2_MIDIPlayer *device, int enabled);
+
 /**
  * @brief Library version context
  */
@@ -645,6 +786,98 @@ extern OPNMIDI_DECLSPEC int opn2_openFile(struct OPN2_MIDIPlayer *device, const
  */
 extern OPNMIDI_DECLSPEC int opn2_openData(struct OPN2_MIDIPlayer *device, const void *mem, unsigned long size);
 
+/**
+ * @brief Read callback of the music data received progressively
+ * @param userdata Pointer to user data
+ * @param buffer Destination of the data
+ * @param size Count of bytes to read
+ * @return Count of bytes read, 0 at the end of data, <0 on error
+ */
+typedef long (*OPN2_StreamReadFunc)(void *userdata, void *buffer, unsigned long size);
+
+/**
+ * @brief Load and play the music file which data is received progressively by the read callback
+ *
+ * Available when library is built with built-in MIDI Sequencer and stream loading support.
+ *
+ * The call blocks until the beginning of the song is received for the prebuffer time,
+ * the rest is received and parsed on the background thread. The Standard MIDI file
+ * starts playing before its data is received fully, other formats are loaded once their
+ * data ends. When the playback reaches the end of the received events, the output is
+ * silent until the next prebuffer time is received. Song length, loop points and meta-data
+ * are provisional until `opn2_streamState` returns 2. Tracks of the multi-track file are
+ * stored one after another, so its playback starts once the beginning of the last track
+ * is received. Debug messages of the parser are sent from the background thread.
+ *
+ * @param device Instance of the library
+ * @param read Read callback, called by the calling thread and then by the background thread
+ * @param userData Pointer to user data given to the read callback
+ * @param prebuffer Time of the song to receive before the playback, in seconds
+ * @return 0 on success, <0 when any error has occurred
+ */
+extern OPNMIDI_DECLSPEC int opn2_openStream(struct OPN2_MIDIPlayer *device, OPN2_StreamReadFunc read, void *userData, double prebuffer);
+
+/**
+ * @brief Get the state of the music file opened by `opn2_openStream`
+ * @param device Instance of the library
+ * @return 0 when no stream is opened, 1 while the song data is being received,
+ * 2 when the song is received fully, <0 when the song data can't be received or parsed,
+ * use opn2_errorInfo() to get the reason, the song ends at the end of received events
+ */
+extern OPNMIDI_DECLSPEC int opn2_streamState(struct OPN2_MIDIPlayer *device);
+
+/**
+ * @brief Queue the music file to play right after the current song without of a gap
+ *
+ * Available when library is built with built-in MIDI Sequencer and gapless playlist support.
+ *
+ * The file gets parsed on the background thread. Once the current song reaches its end,
+ * the output continues by the queued song inside of the same opn2_play* call. Chips are
+ * not reset, so the release of the last notes keeps ringing (see `opn2_setGaplessTails`).
+ * Loop and tempo settings are kept. A song with enabled loop never ends, so disable
+ * the loop to let the queued song start. The new call replaces the previously queued song.
+ * Debug messages of the parser are sent from the background thread.
+ *
+ * @param device Instance of the library
+ * @param filePath Absolute or relative path to the music file. UTF8 encoding is required, even on Windows.
+ * @return 0 on success, <0 when any error has occurred. Parsing errors are reported by `opn2_nextSongState`
+ */
+extern OPNMIDI_DECLSPEC int opn2_queueNextFile(struct OPN2_MIDIPlayer *device, const char *filePath);
+
+/**
+ * @brief Queue the music file from memory data to play right after the current song without of a gap
+ *
+ * Same as `opn2_queueNextFile`, the data is copied before return.
+ *
+ * @param device Instance of the library
+ * @param mem Pointer to memory block where is raw data of music file is stored
+ * @param size Size of given memory block
+ * @return 0 on success, <0 when any error has occurred. Parsing errors are reported by `opn2_nextSongState`
+ */
+extern OPNMIDI_DECLSPEC int opn2_queueNextData(struct OPN2_MIDIPlayer *device, const void *mem, unsigned long size);
+
+/**
+ * @brief Drop the queued song
+ * @param device Instance of the library
+ */
+extern OPNMIDI_DECLSPEC void opn2_clearNextSong(struct OPN2_MIDIPlayer *device);
+
+/**
+ * @brief Get the state of the queued song
+ * @param device Instance of the library
+ * @return 0 when nothing is queued or the queued song has started, 1 while the song is being parsed,
+ * 2 when the song is ready and waits for the end of the current one, <0 when the song can't be loaded,
+ * use opn2_errorInfo() to get the reason
+ */
+extern OPNMIDI_DECLSPEC int opn2_nextSongState(struct OPN2_MIDIPlayer *device);
+
+/**
+ * @brief Let the release of notes ring when the queued song starts
+ * @param device Instance of the library
+ * @param enabled 1 - notes of the previous song fade out by their release (default), 0 - cut them at once
+ */
+extern OPNMIDI_DECLSPEC void opn2_setGaplessTails(struct OPN2_MIDIPlayer *device, int enabled);
+
 /**
  * @brief Resets MIDI player (per-channel setup) into initial state
  * @param device Instance of the library
@@ -720,6 +953,37 @@ extern OPNMIDI_DECLSPEC void opn2_positionRewind(struct OPN2_MIDIPlayer *device)
  */
 extern OPNMIDI_DECLSPEC void opn2_setTempo(struct OPN2_MIDIPlayer *device, double tempo);
 
+/**
+ * @brief Count the song time by integer count of output frames
+ *
+ * Available when library is built with built-in MIDI Sequencer support.
+ *
+ * By default, the time between events is counted in floating point seconds.
+ * With the integer clock, delays are converted from MIDI ticks into output
+ * frames exactly by the tempo, so events are handled on the same frames
+ * on every platform and the output is reproducible. Disabled by default.
+ *
+ * @param device Instance of the library
+ * @param enabled 0 - count time in seconds, 1 - count time by output frames
+ */
+extern OPNMIDI_DECLSPEC void opn2_setIntegerClock(struct OPN2_MIDIPlayer *device, int enabled);
+
+/**
+ * @brief Decode tracks of the loaded MIDI files by several threads
+ *
+ * Applied to files loaded by `opn2_openFile()`, `opn2_openData()`, `opn2_queueNextFile()`
+ * or `opn2_queueNextData()` after this call. Tracks are decoded concurrently and then
+ * merged in their order, so the loaded song is the same as one loaded by the single
+ * thread. Helps with files of many long tracks. The single thread is used by default.
+ *
+ * Available when library is built with built-in MIDI Sequencer and threads support,
+ * otherwise files are always decoded by the calling thread.
+ *
+ * @param device Instance of the library
+ * @param threads Count of threads, including the calling one, <= 1 to decode by the calling thread
+ */
+extern OPNMIDI_DECLSPEC void opn2_setParseThreads(struct OPN2_MIDIPlayer *device, int threads);
+
 /**
  * @brief Returns 1 if music position has reached end
  * @param device Instance of the library
@@ -798,11 +1062,82 @@ extern OPNMIDI_DECLSPEC size_t opn2_metaMarkerCount(struct OPN2_MIDIPlayer *devi
  */
 extern OPNMIDI_DECLSPEC struct Opn2_MarkerEntry opn2_metaMarker(struct OPN2_MIDIPlayer *device, size_t index);
 
+/**
+ * @brief Timing and meta-data of the music file, given by the probe
+ */
+struct Opn2_ProbeInfo
+{
+    /*! Total length of the song in seconds, same as given by `opn2_totalTimeLength` */
+    double          totalTimeLength;
+    /*! Loop start time in seconds, or -1 when the song has no loop */
+    double          loopStartTime;
+    /*! Loop end time in seconds, or -1 when the song has no loop */
+    double          loopEndTime;
+    /*! Count of tracks in the song */
+    size_t          trackCount;
+    /*! Music title, empty string when absent */
+    const char      *musicTitle;
+    /*! Copyright notice, empty string when absent */
+    const char      *musicCopyright;
+    /*! Count of track titles */
+    size_t          trackTitleCount;
+    /*! Array of track titles */
+    const char *const *trackTitles;
+    /*! Count of MIDI markers */
+    size_t          markerCount;
+    /*! Array of MIDI markers */
+    const struct Opn2_MarkerEntry *markers;
+    /*! Storage of strings and arrays, don't touch, release it by `opn2_probeFree` */
+    void            *storage;
+};
+
+/**
+ * @brief Probe the music file from File System without of loading it
+ *
+ * Available when library is built with built-in MIDI Sequencer support.
+ *
+ * Only the tempo map, loop points, markers and meta-strings of the file are collected,
+ * events are not kept, so this is much faster than `opn2_openFile`. The player instance
+ * is not required. All formats supported by `opn2_openFile` are accepted.
+ * Release the filled structure by `opn2_probeFree` once it's not needed.
+ *
+ * @param filePath Absolute or relative path to the music file. UTF8 encoding is required, even on Windows.
+ * @param info Receives the timing and meta-data of the file
+ * @return 0 on success, <0 when any error has occurred, use opn2_errorString() to get the reason
+ */
+extern OPNMIDI_DECLSPEC int opn2_probeFile(const char *filePath, struct Opn2_ProbeInfo *info);
+
+/**
+ * @brief Probe the music file from memory data without of loading it
+ *
+ * Same as `opn2_probeFile`, but the file is taken from the memory block.
+ *
+ * @param mem Pointer to memory block where is raw data of music file is stored
+ * @param size Size of given memory block
+ * @param info Receives the timing and meta-data of the file
+ * @return 0 on success, <0 when any error has occurred, use opn2_errorString() to get the reason
+ */
+extern OPNMIDI_DECLSPEC int opn2_probeData(const void *mem, unsigned long size, struct Opn2_ProbeInfo *info);
+
+/**
+ * @brief Release the data of the probe
+ * @param info The structure filled by `opn2_probeFile` or by `opn2_probeData`
+ */
+extern OPNMIDI_DECLSPEC void opn2_probeFree(struct Opn2_ProbeInfo *info);
+
 
 
 
 /* ======== Audio output Generation ======== */
 
+/*
+ * Once a bank and a music file are loaded, the opn2_play*, opn2_generate*, opn2_panic
+ * and opn2_rt_* calls don't allocate heap memory, so they are safe to call from the
+ * audio thread. Exceptions are: the running trace, the device names which were not
+ * mentioned by the loaded file, and the start of the queued song which has more tracks
+ * or new device names.
+ */
+
 /**
  * @brief Generate PCM signed 16-bit stereo audio output and iterate MIDI timers
  *
@@ -841,6 +1176,37 @@ extern OPNMIDI_DECLSPEC int  opn2_play(struct OPN2_MIDIPlayer *device, int sampl
  */
 extern OPNMIDI_DECLSPEC int  opn2_playFormat(struct OPN2_MIDIPlayer *device, int sampleCount, OPN2_UInt8 *left, OPN2_UInt8 *right, const struct OPNMIDI_AudioFormat *format);
 
+/**
+ * @brief Render the song by several threads, emulated chips are running concurrently
+ *
+ * Intended for the offline export: the output is bit-identical to the output of
+ * opn2_playFormat() called with the same arguments, but every emulated chip runs on its
+ * own thread, so the rendering gets faster by up to the count of chips set by
+ * opn2_setNumChips(). Pass the buffer which fits the whole song to render it at once,
+ * or call this function repeatedly like opn2_playFormat().
+ *
+ * The song is played in blocks: the sequencer processes the block without emulation of
+ * chips and records register writes, then chips replay them in parallel. Splitting the
+ * song by the time isn't possible without the loss of accuracy: emulated chips have the
+ * free-running envelope and LFO counters, their state at any point depends on the whole
+ * song played before it.
+ *
+ * The quality governor doesn't switch emulators during this call. When the library was
+ * built without parallel render support, or when the running emulator can't be used
+ * concurrently (the VGM dumper), the song is rendered by the calling thread.
+ *
+ * Available when library is built with built-in MIDI Sequencer support.
+ *
+ * @param device Instance of the library
+ * @param threads Count of threads, including the calling one, <= 0 to use one thread per chip
+ * @param sampleCount Count of samples (not frames!)
+ * @param left Left channel buffer output (Must be casted into bytes array)
+ * @param right Right channel buffer output (Must be casted into bytes array)
+ * @param format Destination PCM format format context
+ * @return Count of given samples, 0 at the end of song or on wrong format, -1 when the render-ahead thread is running
+ */
+extern OPNMIDI_DECLSPEC int  opn2_renderSongParallel(struct OPN2_MIDIPlayer *device, int threads, int sampleCount, OPN2_UInt8 *left, OPN2_UInt8 *right, const struct OPNMIDI_AudioFormat *format);
+
 /**
  * @brief Generate PCM signed 16-bit stereo audio output without iteration of MIDI timers
  *
@@ -881,6 +1247,85 @@ extern OPNMIDI_DECLSPEC int  opn2_generate(struct OPN2_MIDIPlayer *device, int s
  */
 extern OPNMIDI_DECLSPEC int  opn2_generateFormat(struct OPN2_MIDIPlayer *device, int sampleCount, OPN2_UInt8 *left, OPN2_UInt8 *right, const struct OPNMIDI_AudioFormat *format);
 
+/**
+ * @brief Separation of the output into stems
+ */
+enum OPNMIDI_StemMode
+{
+    /*! Stems are disabled, the mixed output is generated */
+    OPNMIDI_StemMode_Off = 0,
+    /*! One stem per MIDI channel, the same channels of different MIDI ports share one stem */
+    OPNMIDI_StemMode_MidiChannel = 1,
+    /*! One stem per emulated chip */
+    OPNMIDI_StemMode_Chip = 2
+};
+
+/**
+ * @brief Set the separation of the output into stems which are rendered in one pass
+ *
+ * Unlike rendering of the song once per solo track, the song gets played once, so the
+ * voice allocation of stems is the same as of the mixed output and the stems sum up into it.
+ *
+ * Per chip, every chip writes its own output, the emulation costs nothing extra.
+ *
+ * Per MIDI channel, MIDI channels play copies of chips, which turn off the output of chip
+ * channels played by other MIDI channels. The release of the note is heard in the stem of
+ * the MIDI channel which has played the last note on the chip channel. Every chip is emulated
+ * once per MIDI channel which plays notes on it at the moment, plus one spare copy, but the
+ * mixed chips aren't emulated while stems are generated.
+ * Copies of chips are made from the state of the mixed chips by this call and at every reset
+ * of chips (e.g. when the song gets opened). When the emulator can't copy its state, copies
+ * made in the middle of the song run the LFO and envelopes in other phase than the mixed chips,
+ * so set the mode before the playback.
+ *
+ * The VGM file dumper can't render stems.
+ *
+ * Stems are generated by opn2_playStems() and opn2_generateStems(), other output functions
+ * keep generating the mixed output.
+ *
+ * @param device Instance of the library
+ * @param mode Stem mode (#OPNMIDI_StemMode)
+ * @return 0 on success, <0 when any error has occurred
+ */
+extern OPNMIDI_DECLSPEC int opn2_setStemMode(struct OPN2_MIDIPlayer *device, int mode);
+
+/**
+ * @brief Get the count of stems generated in the current stem mode
+ * @param device Instance of the library
+ * @return Count of stems: 16 per MIDI channel, count of chips per chip, 0 when stems are disabled
+ */
+extern OPNMIDI_DECLSPEC int opn2_getStemCount(struct OPN2_MIDIPlayer *device);
+
+/**
+ * @brief Generate PCM stereo audio output of every stem and iterate MIDI timers
+ *
+ * Works like opn2_playFormat(), but every stem is written into its own pair of buffers.
+ *
+ * Available when library is built with built-in MIDI Sequencer support.
+ *
+ * @param device Instance of the library
+ * @param sampleCount Count of samples (not frames!) of every stem
+ * @param left Array of left channel buffers, one per stem (see opn2_getStemCount())
+ * @param right Array of right channel buffers, one per stem
+ * @param format Destination PCM format format context
+ * @return Count of given samples of every stem, 0 at the end of song or on wrong format, -1 when stems are disabled or the render-ahead thread is running
+ */
+extern OPNMIDI_DECLSPEC int  opn2_playStems(struct OPN2_MIDIPlayer *device, int sampleCount, OPN2_UInt8 **left, OPN2_UInt8 **right, const struct OPNMIDI_AudioFormat *format);
+
+/**
+ * @brief Generate PCM stereo audio output of every stem without iteration of MIDI timers
+ *
+ * Works like opn2_generateFormat(), but every stem is written into its own pair of buffers.
+ *
+ * @param device Instance of the library
+ * @param sampleCount Count of samples (not frames!) of every stem
+ * @param left Array of left channel buffers, one per stem (see opn2_getStemCount())
+ * @param right Array of right channel buffers, one per stem
+ * @param format Destination PCM format format context
+ * @return Count of given samples of every stem, 0 on wrong format, -1 when stems are disabled
+ */
+extern OPNMIDI_DECLSPEC int  opn2_generateStems(struct OPN2_MIDIPlayer *device, int sampleCount, OPN2_UInt8 **left, OPN2_UInt8 **right, const struct OPNMIDI_AudioFormat *format);
+
 /**
  * @brief Periodic tick handler.
  * @param device
@@ -893,6 +1338,51 @@ extern OPNMIDI_DECLSPEC int  opn2_generateFormat(struct OPN2_MIDIPlayer *device,
  */
 extern OPNMIDI_DECLSPEC double opn2_tickEvents(struct OPN2_MIDIPlayer *device, double seconds, double granuality);
 
+/**
+ * @brief Start the render-ahead mode
+ *
+ * The library starts the worker thread which renders the song loaded by `opn2_openFile` or
+ * by `opn2_openData` ahead of time into the internal ring buffer. The audio callback of the
+ * host takes the rendered output by `opn2_readAsync()` which never blocks nor renders itself.
+ * Seek, rewind, tempo and loop changes, and opening of another song by `opn2_openFile`,
+ * `opn2_openData` or `opn2_openStream` are applied between the rendered chunks, and the
+ * output rendered before them is dropped. Real-time events (`opn2_rt_*` functions and
+ * `opn2_panic`) get queued without waiting for the worker, and are applied to the next
+ * rendered chunk, so they are heard after the output which is already buffered. Queued
+ * `opn2_rt_noteOn` and `opn2_rt_systemExclusive` calls return 1. Note that
+ * `opn2_positionTell()` and `opn2_atEnd()` report the position of the rendering which
+ * is ahead of the played output.
+ *
+ * While the render-ahead mode is active, don't call `opn2_play()` and don't change the setup
+ * of the player (bank, emulator, chips count, etc.), call `opn2_stopAsync()` first.
+ *
+ * Available when library is built with built-in MIDI Sequencer and threads support.
+ *
+ * @param device Instance of the library
+ * @param bufferFrames Capacity of the ring buffer in frames (at least 1024 frames are used)
+ * @return 0 on success, <0 when any error has occurred
+ */
+extern OPNMIDI_DECLSPEC int opn2_startAsync(struct OPN2_MIDIPlayer *device, int bufferFrames);
+
+/**
+ * @brief Take the PCM signed 16-bit stereo output rendered ahead by the worker thread
+ *
+ * Don't use count of frames, use instead count of samples. One frame is two samples.
+ * If there are not enough rendered samples, the rest of the buffer is filled by silence.
+ *
+ * @param device Instance of the library
+ * @param sampleCount Count of samples (not frames!)
+ * @param out Pointer to output with 16-bit stereo PCM output
+ * @return Count of given samples, 0 when nothing is rendered or render-ahead mode is not active
+ */
+extern OPNMIDI_DECLSPEC int opn2_readAsync(struct OPN2_MIDIPlayer *device, int sampleCount, short *out);
+
+/**
+ * @brief Stop the render-ahead mode and drop the rendered output
+ * @param device Instance of the library
+ */
+extern OPNMIDI_DECLSPEC void opn2_stopAsync(struct OPN2_MIDIPlayer *device);
+
 /**
  * @brief Track options
  */
@@ -1062,6 +1552,15 @@ typedef void (*OPN2_NoteHook)(void *userdata, int adlchn, int note, int ins, int
  */
 typedef void (*OPN2_DebugMessageHook)(void *userdata, const char *fmt, ...);
 
+/**
+ * @brief Emulator switch callback of the quality governor
+ * @param userdata Pointer to user data (usually, context of someting)
+ * @param fromEmulator Previously running emulator (#Opn2_Emulator)
+ * @param toEmulator New running emulator (#Opn2_Emulator)
+ * @param load Smoothed ratio of render time to played time which caused the switch
+ */
+typedef void (*OPN2_EmulatorSwitchHook)(void *userdata, int fromEmulator, int toEmulator, double load);
+
 /**
  * @brief Set raw MIDI event hook
  * @param device Instance of the library
@@ -1086,6 +1585,17 @@ extern OPNMIDI_DECLSPEC void opn2_setNoteHook(struct OPN2_MIDIPlayer *device, OP
  */
 extern OPNMIDI_DECLSPEC void opn2_setDebugMessageHook(struct OPN2_MIDIPlayer *device, OPN2_DebugMessageHook debugMessageHook, void *userData);
 
+/**
+ * @brief Set emulator switch hook of the quality governor
+ *
+ * The callback is called from the thread which renders the audio.
+ *
+ * @param device Instance of the library
+ * @param emulatorSwitchHook Pointer to the callback function which will be called on every switch made by the governor
+ * @param userData Pointer to user data which will be passed through the callback.
+ */
+extern OPNMIDI_DECLSPEC void opn2_setEmulatorSwitchHook(struct OPN2_MIDIPlayer *device, OPN2_EmulatorSwitchHook emulatorSwitchHook, void *userData);
+
 
 /**
  * @brief Get a textual description of the channel state. For display only.
@@ -1107,6 +1617,148 @@ extern OPNMIDI_DECLSPEC void opn2_setDebugMessageHook(struct OPN2_MIDIPlayer *de
  */
 extern OPNMIDI_DECLSPEC int opn2_describeChannels(struct OPN2_MIDIPlayer *device, char *text, char *attr, size_t size);
 
+/*! Count of chips which register writes are counted separately */
+#define OPNMIDI_STATS_MAX_CHIPS         16
+/*! Count of render load histogram buckets */
+#define OPNMIDI_STATS_HISTOGRAM_SIZE    16
+
+/**
+ * @brief Performance counters of the player
+ */
+typedef struct OPN2_Stats
+{
+    /*! Count of rendered stereo frames */
+    OPN2_UInt64 framesRendered;
+    /*! Wall time spent in the generation of chips output, in seconds */
+    double      chipTime;
+    /*! Wall time spent in the events processing, in seconds */
+    double      eventTime;
+    /*! Total count of register writes of all chips */
+    OPN2_UInt64 regWrites;
+    /*! Count of register writes of each of first OPNMIDI_STATS_MAX_CHIPS chips */
+    OPN2_UInt64 chipRegWrites[OPNMIDI_STATS_MAX_CHIPS];
+    /*! Count of played notes */
+    OPN2_UInt64 noteOns;
+    /*! Count of playing notes killed to free the chip channel for a new note */
+    OPN2_UInt64 voiceSteals;
+    /*! Count of notes which were ignored because no chip channel could be found */
+    OPN2_UInt64 unplaceableNotes;
+    /*! Count of notes which were put into the same chip channel to be played as automatic arpeggio */
+    OPN2_UInt64 arpeggioShares;
+    /*! Peak count of chip channels used at the same time */
+    unsigned    peakActiveChannels;
+    /*! Histogram of the render load: bucket N counts opn2_play() / opn2_generate() calls
+        which took from N/8 to (N+1)/8 of the duration of rendered audio, the last bucket
+        counts all calls which took longer */
+    OPN2_UInt64 renderLoadHistogram[OPNMIDI_STATS_HISTOGRAM_SIZE];
+} OPN2_Stats;
+
+/**
+ * @brief Get the snapshot of performance counters
+ *
+ * Counters are accumulated since creation of the player or the latest opn2_resetStats() call.
+ *
+ * @param device Instance of the library
+ * @param stats Destination structure
+ * @return 0 on success, <0 when any error has occurred (for example, when library was built without statistics)
+ */
+extern OPNMIDI_DECLSPEC int opn2_getStats(struct OPN2_MIDIPlayer *device, OPN2_Stats *stats);
+
+/**
+ * @brief Reset performance counters to zero
+ * @param device Instance of the library
+ */
+extern OPNMIDI_DECLSPEC void opn2_resetStats(struct OPN2_MIDIPlayer *device);
+
+
+
+/* ======== Trace capture and replay ======== */
+
+/**
+ * @brief Start logging of MIDI calls and chip register writes into the binary trace file
+ *
+ * Every real-time MIDI call (including events sent by the MIDI sequencer) and every
+ * register write of chips are logged with the number of rendered frame. The trace begins
+ * with a snapshot of the current chip registers, so it can be started at any moment
+ * (internal state of emulators isn't captured, so notes which are already sounding
+ * may be replayed slightly different).
+ * An already running trace gets closed before the new one gets started.
+ *
+ * @param device Instance of the library
+ * @param tracePath Path to the trace file to create
+ * @return 0 on success, <0 when any error has occurred (for example, when library was built without trace support)
+ */
+extern OPNMIDI_DECLSPEC int opn2_startTrace(struct OPN2_MIDIPlayer *device, const char *tracePath);
+
+/**
+ * @brief Flush and close the running trace file
+ * @param device Instance of the library
+ */
+extern OPNMIDI_DECLSPEC void opn2_stopTrace(struct OPN2_MIDIPlayer *device);
+
+/**
+ * @brief Receiver of audio rendered by the trace replay
+ * @param userdata Pointer to user data (usually, context of something)
+ * @param samples Interleaved 16-bit stereo PCM output
+ * @param frames Count of stereo frames in the output
+ */
+typedef void (*OPN2_TraceAudioHook)(void *userdata, const short *samples, size_t frames);
+
+/**
+ * @brief Feed the register writes from the trace file into the chip emulator
+ *
+ * No MIDI player is involved: register writes are passed straight into the freshly
+ * created chip emulators at the logged frames, so different emulators can be profiled
+ * and compared on identical input. Audio is rendered at the sample rate of the traced player.
+ *
+ * @param tracePath Path to the trace file made by opn2_startTrace()
+ * @param emulator Type of emulator (#OPNMIDI_Emulator)
+ * @param audioHook Receiver of the rendered audio, may be NULL to render without output
+ * @param userData Pointer to user data passed into the audio receiver
+ * @param sampleRate Receives the sample rate of rendered audio, may be NULL
+ * @return Count of rendered stereo frames, <0 when any error has occurred, use opn2_errorString() to get the reason
+ */
+extern OPNMIDI_DECLSPEC long opn2_replayTrace(const char *tracePath, int emulator,
+                                              OPN2_TraceAudioHook audioHook, void *userData,
+                                              unsigned long *sampleRate);
+
+
+/* ======== State save and restore ======== */
+
+/**
+ * @brief Save the complete state of the synthesizer into the memory block
+ *
+ * The state includes states of all chip emulators, register caches, MIDI channels,
+ * playing notes, chip channels allocation and the position of the MIDI sequencer.
+ * Restoring of it resumes the output bit-identically. The size of state depends on
+ * count of playing notes, the function writes nothing and returns the required size
+ * when the given buffer is too small.
+ *
+ * The state can be restored by the same build of library on the same machine into
+ * the player with the same sample rate, emulator, count of chips and loaded bank
+ * and music file.
+ *
+ * Emulators which can't save their state: `OPNMIDI_EMU_GX`, `OPNMIDI_EMU_NP2`,
+ * `OPNMIDI_EMU_MAME_2608` and `OPNMIDI_EMU_PMDWIN`. The function fails with the error
+ * naming the emulator when any of them runs, including the emulator of lead chips.
+ *
+ * @param device Instance of the library
+ * @param buffer Destination memory block, may be NULL to query the size
+ * @param bufferSize Size of the destination memory block in bytes
+ * @return Size of the state in bytes, <0 when any error has occurred
+ */
+extern OPNMIDI_DECLSPEC long opn2_saveState(struct OPN2_MIDIPlayer *device, void *buffer, unsigned long bufferSize);
+
+/**
+ * @brief Restore the state saved by opn2_saveState()
+ * @param device Instance of the library
+ * @param buffer Memory block with the saved state
+ * @param bufferSize Size of the memory block in bytes
+ * @return 0 on success, <0 when any error has occurred (for example, when state was saved with a different setup).
+ *         The player is not changed when the state can't be restored
+ */
+extern OPNMIDI_DECLSPEC int opn2_loadState(struct OPN2_MIDIPlayer *device, const void *buffer, unsigned long bufferSize);
+
 #ifdef __cplusplus
 }
 #endif
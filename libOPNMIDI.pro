@@ -38,6 +38,16 @@ HEADERS += \
     src/midi_sequencer_impl.hpp \
     src/fraction.hpp \
     src/opnbank.h \
+    src/opnmidi_async.hpp \
+    src/opnmidi_atomic.hpp \
+    src/opnmidi_events.hpp \
+    src/opnmidi_trace.hpp \
+    src/opnmidi_state.hpp \
+    src/opnmidi_parallel.hpp \
+    src/opnmidi_playlist.hpp \
+    src/opnmidi_stream.hpp \
+    src/opnmidi_stems.hpp \
+    src/opnmidi_loopcache.hpp \
     src/opnmidi_private.hpp \
     src/wopn/wopn_file.h
 
@@ -51,9 +61,18 @@ SOURCES += \
     src/chips/nuked_opn2.cpp \
     src/chips/nuked/ym3438.c \
     src/opnmidi.cpp \
+    src/opnmidi_async.cpp \
+    src/opnmidi_events.cpp \
+    src/opnmidi_trace.cpp \
     src/opnmidi_load.cpp \
     src/opnmidi_midiplay.cpp \
     src/opnmidi_opn2.cpp \
     src/opnmidi_private.cpp \
+    src/opnmidi_state.cpp \
+    src/opnmidi_parallel.cpp \
+    src/opnmidi_playlist.cpp \
+    src/opnmidi_stream.cpp \
+    src/opnmidi_stems.cpp \
+    src/opnmidi_loopcache.cpp \
     src/opnmidi_sequencer.cpp \
     src/wopn/wopn_file.c
@@ -1360,3 +1360,59 @@ void Ym2612_Impl::run( int pair_count, Ym2612_Emu::sample_t* out )
 }
 
 void Ym2612_Emu::run( int pair_count, sample_t* out ) { impl->run( pair_count, out ); }
+
+// The state holds pointers into the tables of the emulator, the address of
+// the saved emulator is kept to relocate them
+struct Ym2612_State
+{
+	const Ym2612_Impl* base;
+	state_t YM2612;
+	int mute_mask;
+	int LFOcnt;
+	int LFOinc;
+};
+
+unsigned long Ym2612_Emu::state_size() const { return sizeof (Ym2612_State); }
+
+void Ym2612_Emu::save_state( void* out ) const
+{
+	Ym2612_State st;
+	st.base = impl;
+	st.YM2612 = impl->YM2612;
+	st.mute_mask = impl->mute_mask;
+	st.LFOcnt = impl->g.LFOcnt;
+	st.LFOinc = impl->g.LFOinc;
+	memcpy( out, &st, sizeof st );
+}
+
+template<class T>
+static inline void relocate( T*& ptr, const Ym2612_Impl* from, Ym2612_Impl* to )
+{
+	const char* p = (const char*) ptr;
+	const char* begin = (const char*) from;
+	if ( p >= begin && p < begin + sizeof *from )
+		ptr = (T*) ((char*) to + (p - begin));
+}
+
+void Ym2612_Emu::load_state( const void* in )
+{
+	Ym2612_State st;
+	memcpy( &st, in, sizeof st );
+	impl->YM2612 = st.YM2612;
+	impl->mute_mask = st.mute_mask;
+	impl->g.LFOcnt = st.LFOcnt;
+	impl->g.LFOinc = st.LFOinc;
+	for ( int c = 0; c < channel_count; c++ )
+	{
+		for ( int s = 0; s < 4; s++ )
+		{
+			slot_t& sl = impl->YM2612.CHANNEL [c].SLOT [s];
+			relocate( sl.DT, st.base, impl );
+			relocate( sl.AR, st.base, impl );
+			relocate( sl.DR, st.base, impl );
+			relocate( sl.SR, st.base, impl );
+			relocate( sl.RR, st.base, impl );
+			relocate( sl.OUTp, st.base, impl );
+		}
+	}
+}
@@ -36,6 +36,15 @@ public:
 	typedef short sample_t;
 	enum { out_chan_count = 2 }; // stereo
 	void run( int pair_count, sample_t* out );
+
+	// Size of the serialized state in bytes
+	unsigned long state_size() const;
+
+	// Write the state into the buffer of state_size() bytes
+	void save_state( void* out ) const;
+
+	// Restore the state saved by the emulator running at the same rate
+	void load_state( const void* in );
 };
 
 #endif
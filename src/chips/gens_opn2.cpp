@@ -76,3 +76,18 @@ const char *GensOPN2::emulatorName()
 {
     return "GENS 2.10 OPN2";
 }
+
+size_t GensOPN2::nativeStateSize() const
+{
+    return static_cast<size_t>(chip->state_size());
+}
+
+void GensOPN2::nativeSaveState(uint8_t *dst) const
+{
+    chip->save_state(dst);
+}
+
+void GensOPN2::nativeLoadState(const uint8_t *src)
+{
+    chip->load_state(src);
+}
@@ -40,6 +40,9 @@ public:
     void nativePostGenerate() override {}
     void nativeGenerateN(int16_t *output, size_t frames) override;
     const char *emulatorName() override;
+    size_t nativeStateSize() const;
+    void nativeSaveState(uint8_t *dst) const;
+    void nativeLoadState(const uint8_t *src);
 };
 
 #endif // GENS_OPN2_H
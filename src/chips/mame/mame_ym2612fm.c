@@ -2839,6 +2839,59 @@ void ym2612_write_pan(void *chip, int c, unsigned char v)
 	F2612->CH[c].pan_volume_r = panlawtable[0x7F - (v & 0x7F)];
 }
 
+size_t ym2612_state_size(void)
+{
+	return sizeof(void *) + sizeof(YM2612);
+}
+
+void ym2612_state_save(void *chip, void *dst)
+{
+	/* Address of the chip is kept to relocate the internal pointers on load */
+	memcpy(dst, &chip, sizeof(void *));
+	memcpy((UINT8 *)dst + sizeof(void *), chip, sizeof(YM2612));
+}
+
+static void *ym2612_state_relocate(void *ptr, const UINT8 *oldBase, UINT8 *newBase)
+{
+	const UINT8 *p = (const UINT8 *)ptr;
+	if (p >= oldBase && p < oldBase + sizeof(YM2612))
+		return newBase + (p - oldBase);
+	return ptr;
+}
+
+void ym2612_state_load(void *chip, const void *src)
+{
+	YM2612 *F2612 = (YM2612 *)chip;
+	void *param = F2612->OPN.ST.param;
+	FM_TIMERHANDLER timer_handler = F2612->OPN.ST.timer_handler;
+	FM_IRQHANDLER IRQ_Handler = F2612->OPN.ST.IRQ_Handler;
+	const ssg_callbacks *SSG = F2612->OPN.ST.SSG;
+	const UINT8 *oldBase;
+	UINT8 *newBase = (UINT8 *)chip;
+	int c, s;
+
+	memcpy(&oldBase, src, sizeof(void *));
+	memcpy(chip, (const UINT8 *)src + sizeof(void *), sizeof(YM2612));
+
+	F2612->OPN.ST.param = param;
+	F2612->OPN.ST.timer_handler = timer_handler;
+	F2612->OPN.ST.IRQ_Handler = IRQ_Handler;
+	F2612->OPN.ST.SSG = SSG;
+	F2612->OPN.P_CH = F2612->CH;
+
+	for (c = 0; c < 6; c++)
+	{
+		FM_CH *CH = &F2612->CH[c];
+		for (s = 0; s < 4; s++)
+			CH->SLOT[s].DT = (INT32 *)ym2612_state_relocate(CH->SLOT[s].DT, oldBase, newBase);
+		CH->connect1 = (INT32 *)ym2612_state_relocate(CH->connect1, oldBase, newBase);
+		CH->connect2 = (INT32 *)ym2612_state_relocate(CH->connect2, oldBase, newBase);
+		CH->connect3 = (INT32 *)ym2612_state_relocate(CH->connect3, oldBase, newBase);
+		CH->connect4 = (INT32 *)ym2612_state_relocate(CH->connect4, oldBase, newBase);
+		CH->mem_connect = (INT32 *)ym2612_state_relocate(CH->mem_connect, oldBase, newBase);
+	}
+}
+
 UINT8 ym2612_read(void *chip,int a)
 {
 	YM2612 *F2612 = (YM2612 *)chip;
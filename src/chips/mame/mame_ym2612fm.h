@@ -7,6 +7,7 @@
 #define FM_HHHHH
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -154,6 +155,24 @@ unsigned char ym2612_read(void *chip, int a);
 int ym2612_timer_over(void *chip, int c );
 void ym2612_postload(void *chip);
 
+/**
+ * @brief Size of the serialized chip state
+ * @return Size in bytes
+ */
+size_t ym2612_state_size(void);
+/**
+ * @brief Write the chip state into the buffer of ym2612_state_size() bytes
+ * @param chip Chip instance
+ * @param dst Destination buffer
+ */
+void ym2612_state_save(void *chip, void *dst);
+/**
+ * @brief Restore the chip state saved by the chip running at the same rate
+ * @param chip Chip instance
+ * @param src Saved state
+ */
+void ym2612_state_load(void *chip, const void *src);
+
 void ym2612_set_mutemask(void *chip, UINT32 MuteMask);
 void ym2612_setoptions(UINT8 Flags);
 #endif /* (BUILD_YM2612||BUILD_YM3438) */
@@ -78,3 +78,18 @@ const char *MameOPN2::emulatorName()
 {
     return "MAME YM2612";
 }
+
+size_t MameOPN2::nativeStateSize() const
+{
+    return ym2612_state_size();
+}
+
+void MameOPN2::nativeSaveState(uint8_t *dst) const
+{
+    ym2612_state_save(chip, dst);
+}
+
+void MameOPN2::nativeLoadState(const uint8_t *src)
+{
+    ym2612_state_load(chip, src);
+}
@@ -39,6 +39,9 @@ public:
     void nativePostGenerate() override {}
     void nativeGenerate(int16_t *frame) override;
     const char *emulatorName() override;
+    size_t nativeStateSize() const;
+    void nativeSaveState(uint8_t *dst) const;
+    void nativeLoadState(const uint8_t *src);
 };
 
 #endif // MAME_OPN2_H
@@ -33,6 +33,8 @@ struct MameOPNA::Impl {
 
     Resampler *psgrsm;
     int32_t *psgbuffer;
+    // Has the SSG been programmed since the last reset
+    bool ssgUsed;
 
     static const ssg_callbacks cbssg;
 
@@ -64,6 +66,7 @@ MameOPNA::MameOPNA(OPNFamily f)
     impl->chip = NULL;
     impl->psgrsm = NULL;
     impl->psgbuffer = NULL;
+    impl->ssgUsed = false;
     setRate(m_rate, m_clock);
 }
 
@@ -96,16 +99,19 @@ void MameOPNA::setRate(uint32_t rate, uint32_t clock)
     PSG_init(psg, clock / 4, psgRate);  // TODO libOPNMIDI verify clocks
     PSG_setVolumeMode(psg, 1);  // YM2149 volume mode
 
+#ifndef OPNMIDI_DISABLE_OPNA_EXTRA_UNITS
     delete impl->psgrsm;
     Impl::Resampler *psgrsm = impl->psgrsm = new Impl::Resampler;
     psgrsm->init(psgRate, chipRate, 40);
 
     delete[] impl->psgbuffer;
     impl->psgbuffer = new int32_t[2 * psgrsm->calculateInternalSampleSize(buffer_size)];
+#endif
 
     ym2608_reset_chip(chip);
     ym2608_write(chip, 0, 0x29);
     ym2608_write(chip, 1, 0x9f);
+    impl->ssgUsed = false;
 }
 
 void MameOPNA::reset()
@@ -115,11 +121,16 @@ void MameOPNA::reset()
     ym2608_reset_chip(chip);
     ym2608_write(chip, 0, 0x29);
     ym2608_write(chip, 1, 0x9f);
+    impl->ssgUsed = false;
 }
 
 void MameOPNA::writeReg(uint32_t port, uint16_t addr, uint8_t data)
 {
     void *chip = impl->chip;
+#ifndef OPNMIDI_DISABLE_OPNA_EXTRA_UNITS
+    if(port == 0 && addr < 0x10)
+        impl->ssgUsed = true;
+#endif
     ym2608_write(chip, 0 + (int)(port) * 2, (uint8_t)addr);
     ym2608_write(chip, 1 + (int)(port) * 2, data);
 }
@@ -140,6 +151,24 @@ void MameOPNA::nativeGenerateN(int16_t *output, size_t frames)
 
     ym2608_update_one(chip, fmbufs, (int)frames);
 
+    // Never programmed SSG is silent, skip it and its resampler
+    if(!impl->ssgUsed)
+    {
+        for(size_t i = 0; i < frames; ++i)
+        {
+            int32_t l = fmLR[i];
+            l = (l > -32768) ? l : -32768;
+            l = (l < 32767) ? l : 32767;
+            int32_t r = fmR[i];
+            r = (r > -32768) ? r : -32768;
+            r = (r < 32767) ? r : 32767;
+            output[2 * i] = l;
+            output[2 * i + 1] = r;
+        }
+        return;
+    }
+
+#ifndef OPNMIDI_DISABLE_OPNA_EXTRA_UNITS
     PSG *psg = &impl->dev.m_psg;
     Impl::Resampler *psgrsm = impl->psgrsm;
     size_t psgframes = psgrsm->calculateInternalSampleSize(frames);
@@ -164,6 +193,7 @@ void MameOPNA::nativeGenerateN(int16_t *output, size_t frames)
         output[2 * i] = l;
         output[2 * i + 1] = r;
     }
+#endif
 }
 
 const char *MameOPNA::emulatorName()
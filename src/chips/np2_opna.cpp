@@ -27,7 +27,7 @@
 
 template <class ChipType>
 NP2OPNA<ChipType>::NP2OPNA(OPNFamily f)
-    : ChipBase(f)
+    : ChipBase(f), extraUnitsUsed(false)
 {
     ChipType *opn = (ChipType *)std::calloc(1, sizeof(ChipType));
     chip = new(opn) ChipType;
@@ -49,6 +49,7 @@ void NP2OPNA<ChipType>::setRate(uint32_t rate, uint32_t clock)
     uint32_t chipRate = ChipBase::isRunningAtPcmRate() ? rate : ChipBase::nativeRate();
     chip->SetRate(clock, chipRate, false);  // implies Reset()
     chip->SetReg(0x29, 0x9f);  // enable channels 4-6
+    extraUnitsUsed = false;
 }
 
 template <class ChipType>
@@ -57,11 +58,17 @@ void NP2OPNA<ChipType>::reset()
     ChipBase::reset();
     chip->Reset();
     chip->SetReg(0x29, 0x9f);  // enable channels 4-6
+    extraUnitsUsed = false;
 }
 
 template <class ChipType>
 void NP2OPNA<ChipType>::writeReg(uint32_t port, uint16_t addr, uint8_t data)
 {
+#ifndef OPNMIDI_DISABLE_OPNA_EXTRA_UNITS
+    // SSG and rhythm (ADPCM-B on OPNB) at 00-1F, ADPCM-B (ADPCM-A on OPNB) at 100-12F
+    if(addr < ((port == 0) ? 0x20 : 0x30))
+        extraUnitsUsed = true;
+#endif
     chip->SetReg((port << 8) | addr, data);
 }
 
@@ -75,7 +82,11 @@ template <class ChipType>
 void NP2OPNA<ChipType>::nativeGenerateN(int16_t *output, size_t frames)
 {
     std::memset(output, 0, 2 * frames * sizeof(output[0]));
-    chip->Mix(output, static_cast<int>(frames));
+    // Never programmed units are silent, skip them
+    if(extraUnitsUsed)
+        chip->Mix(output, static_cast<int>(frames));
+    else
+        chip->MixFM(output, static_cast<int>(frames));
 }
 
 template <>
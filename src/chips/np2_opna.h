@@ -29,6 +29,8 @@ class NP2OPNA final : public OPNChipBaseBufferedT<NP2OPNA<ChipType > >
 {
     typedef OPNChipBaseBufferedT<NP2OPNA<ChipType > > ChipBase;
     ChipType *chip;
+    //! Has the SSG, rhythm or ADPCM been programmed since the last reset
+    bool extraUnitsUsed;
 public:
     explicit NP2OPNA(OPNFamily f);
     ~NP2OPNA() override;
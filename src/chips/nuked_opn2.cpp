@@ -74,3 +74,18 @@ const char *NukedOPN2::emulatorName()
 {
     return "Nuked OPN2";
 }
+
+size_t NukedOPN2::nativeStateSize() const
+{
+    return sizeof(ym3438_t);
+}
+
+void NukedOPN2::nativeSaveState(uint8_t *dst) const
+{
+    std::memcpy(dst, chip, sizeof(ym3438_t));
+}
+
+void NukedOPN2::nativeLoadState(const uint8_t *src)
+{
+    std::memcpy(chip, src, sizeof(ym3438_t));
+}
@@ -82,6 +82,20 @@ public:
     virtual void generateAndMix32(int32_t *output, size_t frames) = 0;
 
     virtual const char* emulatorName() = 0;
+
+    /**
+     * @brief Size of the serialized chip state
+     * @return Size in bytes, or 0 when the emulator can't save its state
+     */
+    virtual size_t stateSize() const { return 0; }
+    /**
+     * @brief Write the chip state into the buffer of stateSize() bytes
+     */
+    virtual void saveState(uint8_t *dst) const { (void)dst; }
+    /**
+     * @brief Restore the state saved by the chip of the same emulator running at the same rate
+     */
+    virtual void loadState(const uint8_t *src) { (void)src; }
 private:
     OPNChipBase(const OPNChipBase &c);
     OPNChipBase &operator=(const OPNChipBase &c);
@@ -113,6 +127,15 @@ public:
     void generateAndMix(int16_t *output, size_t frames) override;
     void generate32(int32_t *output, size_t frames) override;
     void generateAndMix32(int32_t *output, size_t frames) override;
+    size_t stateSize() const override;
+    void saveState(uint8_t *dst) const override;
+    void loadState(const uint8_t *src) override;
+
+    // emulator state, values are OK to "redefine", the static polymorphism
+    // will accept it. Zero size means the emulator can't save its state.
+    size_t nativeStateSize() const { return 0; }
+    void nativeSaveState(uint8_t *dst) const { (void)dst; }
+    void nativeLoadState(const uint8_t *src) { (void)src; }
 private:
     bool m_runningAtPcmRate;
 #if defined(OPNMIDI_AUDIO_TICK_HANDLER)
@@ -151,6 +174,9 @@ public:
 public:
     void reset() override;
     void nativeGenerate(int16_t *frame) override;
+    size_t stateSize() const override;
+    void saveState(uint8_t *dst) const override;
+    void loadState(const uint8_t *src) override;
 protected:
     virtual void nativeGenerateN(int16_t *output, size_t frames) = 0;
 private:
@@ -1,6 +1,7 @@
 #include "opn_chip_base.h"
 #include <cmath>
 #include <cstdio>
+#include <cstring>
 
 #if defined(OPNMIDI_ENABLE_HQ_RESAMPLER)
 #include <zita-resampler/vresampler.h>
@@ -300,6 +301,51 @@ void OPNChipBaseT<T>::resampledGenerate(int32_t *output)
 }
 #endif
 
+template <class T>
+size_t OPNChipBaseT<T>::stateSize() const
+{
+#if defined(OPNMIDI_ENABLE_HQ_RESAMPLER)
+    return 0; // State of the resampler can't be saved
+#else
+    size_t size = static_cast<const T *>(this)->nativeStateSize();
+    if(size == 0)
+        return 0;
+    return size + sizeof(m_oldsamples) + sizeof(m_samples) + sizeof(m_samplecnt);
+#endif
+}
+
+template <class T>
+void OPNChipBaseT<T>::saveState(uint8_t *dst) const
+{
+#if !defined(OPNMIDI_ENABLE_HQ_RESAMPLER)
+    std::memcpy(dst, m_oldsamples, sizeof(m_oldsamples));
+    dst += sizeof(m_oldsamples);
+    std::memcpy(dst, m_samples, sizeof(m_samples));
+    dst += sizeof(m_samples);
+    std::memcpy(dst, &m_samplecnt, sizeof(m_samplecnt));
+    dst += sizeof(m_samplecnt);
+    static_cast<const T *>(this)->nativeSaveState(dst);
+#else
+    (void)dst;
+#endif
+}
+
+template <class T>
+void OPNChipBaseT<T>::loadState(const uint8_t *src)
+{
+#if !defined(OPNMIDI_ENABLE_HQ_RESAMPLER)
+    std::memcpy(m_oldsamples, src, sizeof(m_oldsamples));
+    src += sizeof(m_oldsamples);
+    std::memcpy(m_samples, src, sizeof(m_samples));
+    src += sizeof(m_samples);
+    std::memcpy(&m_samplecnt, src, sizeof(m_samplecnt));
+    src += sizeof(m_samplecnt);
+    static_cast<T *>(this)->nativeLoadState(src);
+#else
+    (void)src;
+#endif
+}
+
 /* OPNChipBaseBufferedT */
 
 template <class T, unsigned Buffer>
@@ -320,3 +366,32 @@ void OPNChipBaseBufferedT<T, Buffer>::nativeGenerate(int16_t *frame)
     bufferIndex = (bufferIndex + 1 < Buffer) ? (bufferIndex + 1) : 0;
     m_bufferIndex = bufferIndex;
 }
+
+template <class T, unsigned Buffer>
+size_t OPNChipBaseBufferedT<T, Buffer>::stateSize() const
+{
+    size_t size = OPNChipBaseT<T>::stateSize();
+    if(size == 0)
+        return 0;
+    return size + sizeof(m_bufferIndex) + sizeof(m_buffer);
+}
+
+template <class T, unsigned Buffer>
+void OPNChipBaseBufferedT<T, Buffer>::saveState(uint8_t *dst) const
+{
+    OPNChipBaseT<T>::saveState(dst);
+    dst += OPNChipBaseT<T>::stateSize();
+    std::memcpy(dst, &m_bufferIndex, sizeof(m_bufferIndex));
+    dst += sizeof(m_bufferIndex);
+    std::memcpy(dst, m_buffer, sizeof(m_buffer));
+}
+
+template <class T, unsigned Buffer>
+void OPNChipBaseBufferedT<T, Buffer>::loadState(const uint8_t *src)
+{
+    OPNChipBaseT<T>::loadState(src);
+    src += OPNChipBaseT<T>::stateSize();
+    std::memcpy(&m_bufferIndex, src, sizeof(m_bufferIndex));
+    src += sizeof(m_bufferIndex);
+    std::memcpy(m_buffer, src, sizeof(m_buffer));
+}
@@ -46,6 +46,7 @@ void PMDWinOPNA::setRate(uint32_t rate, uint32_t clock)
     std::memset(chip, 0, sizeof(*opn));
     OPNAInit(opn, m_clock, chipRate, 0);
     OPNASetReg(opn, 0x29, 0x9f);
+    opn->devmask = 1;  // SSG and rhythm get mixed since their first write
 }
 
 void PMDWinOPNA::reset()
@@ -54,11 +55,18 @@ void PMDWinOPNA::reset()
     OPNA *opn = reinterpret_cast<OPNA *>(chip);
     OPNAReset(opn);
     OPNASetReg(opn, 0x29, 0x9f);
+    opn->devmask = 1;
 }
 
 void PMDWinOPNA::writeReg(uint32_t port, uint16_t addr, uint8_t data)
 {
     OPNA *opn = reinterpret_cast<OPNA *>(chip);
+#ifndef OPNMIDI_DISABLE_OPNA_EXTRA_UNITS
+    if(port == 0 && addr < 0x10)
+        opn->devmask |= 2;  // SSG
+    else if(port == 0 && addr < 0x20)
+        opn->devmask |= 4;  // Rhythm
+#endif
     OPNASetReg(opn, (port << 8) | addr, data);
 }
 
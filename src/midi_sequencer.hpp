@@ -194,6 +194,23 @@ class BW_MidiSequencer
 
     typedef std::list<MidiTrackRow> MidiTrackQueue;
 
+    /**
+     * @brief Row of the merged event stream of all tracks
+     */
+    struct StreamRow
+    {
+        //! Row of the track data, NULL for the empty step made by the end of the truncated track
+        const MidiTrackRow *row;
+        //! Index of the track owning the row
+        size_t track;
+        //! Delay to next step in ticks, non-zero on the last row of the step only
+        uint64_t delay;
+        //! Is this row the last one handled by a single processEvents() call
+        bool stepEnd;
+        //! Reserved
+        char __padding[7];
+    };
+
     /**
      * @brief Song position context
      */
@@ -207,25 +224,14 @@ class BW_MidiSequencer
         double wait;
         //! Absolute time position on the track in seconds
         double absTimePosition;
-        //! Track information
-        struct TrackInfo
-        {
-            //! Delay to next event in a track
-            uint64_t delay;
-            //! Last handled event type
-            int32_t lastHandledEvent;
-            //! Reserved
-            char    __padding2[4];
-            //! MIDI Events queue position iterator
-            MidiTrackQueue::iterator pos;
-
-            TrackInfo() :
-                delay(0),
-                lastHandledEvent(0)
-            {}
-        };
-        std::vector<TrackInfo> track;
-        Position(): began(false), wait(0.0), absTimePosition(0.0), track()
+        //! Index of the next row in the merged event stream
+        size_t row;
+        //! Waiting time before next event in clock units, when the integer clock is used
+        int64_t clockWait;
+        //! Absolute time position on the track in clock units, when the integer clock is used
+        uint64_t clockTime;
+        Position(): began(false), wait(0.0), absTimePosition(0.0), row(0),
+            clockWait(0), clockTime(0)
         {}
     };
 
@@ -238,11 +244,26 @@ class BW_MidiSequencer
      */
     void buildSmfSetupReset(size_t trackCount);
 
+    struct SmfTrackParse;
+
     /**
      * @brief Build MIDI track data from the raw track data storage
+     *
+     * Tracks are decoded separately, by several threads when setParseThreads() asks so,
+     * then their loop points, tempo changes and meta-data are merged in order of tracks.
+     *
+     * @param trackData Raw data of tracks
+     * @param completeTracks Count of fully received tracks, the rest are cut at end of the received data
      * @return true if everything successfully processed, or false on any error
      */
-    bool buildSmfTrackData(const std::vector<std::vector<uint8_t> > &trackData);
+    bool buildSmfTrackData(const std::vector<std::vector<uint8_t> > &trackData,
+                           size_t completeTracks = ~static_cast<size_t>(0));
+
+#ifndef BWMIDI_DISABLE_PARALLEL_PARSING
+    struct SmfParseThread;
+    struct SmfParseJob;
+    static void parseSmfTracksProc(void *job);
+#endif
 
     /**
      * @brief Build the time line from off loaded events
@@ -254,14 +275,32 @@ class BW_MidiSequencer
                        uint64_t loopStartTicks = 0,
                        uint64_t loopEndTicks = 0);
 
+    /**
+     * @brief Merge rows of all tracks into the single time-ordered event stream
+     *
+     * Rows are ordered exactly as the track-by-track scheduling would handle them,
+     * so the playback just advances one cursor over the stream. The stream of the partial
+     * song stops before the first step that needs a row not yet received, so it's
+     * the exact beginning of the stream of the whole song.
+     */
+    void buildEventStream();
+
+    /**
+     * @brief Time of the row of the event stream
+     * @param row Index in the event stream
+     * @return Time in seconds, empty steps take the time of the previous row
+     */
+    double streamRowTime(size_t row) const;
+
     /**
      * @brief Parse one event from raw MIDI track stream
      * @param [_inout] ptr pointer to pointer to current position on the raw data track
      * @param [_in] end address to end of raw track data, needed to validate position and size
      * @param [_inout] status status of the track processing
+     * @param [_inout] track Decoding state of the track, receives errors and the loop points format
      * @return Parsed MIDI event entry
      */
-    MidiEvent parseEvent(const uint8_t **ptr, const uint8_t *end, int &status);
+    MidiEvent parseEvent(const uint8_t **ptr, const uint8_t *end, int &status, SmfTrackParse &track);
 
     /**
      * @brief Process MIDI events on the current tick moment
@@ -270,13 +309,39 @@ class BW_MidiSequencer
      */
     bool processEvents(bool isSeek = false);
 
+    /**
+     * @brief Append the delay in ticks to the waiting time with the current tempo
+     * @param ticks Delay in MIDI ticks
+     */
+    void addWaitTicks(uint64_t ticks);
+
+    /**
+     * @brief Append the delay in seconds to the waiting time
+     * @param seconds Delay in seconds
+     */
+    void addWaitSeconds(double seconds);
+
+    /**
+     * @brief Advance the integer clock and process all events that became due
+     * @param units Elapsed time in clock units
+     * @param isSeek is a seeking process
+     */
+    void clockAdvance(uint64_t units, bool isSeek);
+
+    /**
+     * @brief Move the time of the position between the clocks
+     * @param pos Position to convert
+     * @param fromRate Sample rate of the current clock, zero for seconds
+     * @param toRate Sample rate of the new clock, zero for seconds
+     */
+    static void convertClock(Position &pos, uint32_t fromRate, uint32_t toRate);
+
     /**
      * @brief Handle one event from the chain
      * @param tk MIDI track
      * @param evt MIDI event entry
-     * @param status Recent event type, -1 returned when end of track event was handled.
      */
-    void handleEvent(size_t tk, const MidiEvent &evt, int32_t &status);
+    void handleEvent(size_t tk, const MidiEvent &evt);
 
 public:
     /**
@@ -330,6 +395,64 @@ public:
     };
 
 private:
+    /**
+     * @brief Event of the track which affects the whole song: meta-data, tempo or loop point
+     */
+    struct SmfTrackNote
+    {
+        enum Origin
+        {
+            //! Event of the track
+            Origin_Track = 0,
+            //! Loop stack event made from the marker
+            Origin_Marker,
+            //! Loop stack event made from the XMI controller
+            Origin_XMI
+        };
+        //! The event, absolute position in ticks is set
+        MidiEvent event;
+        //! Index of the row in the track
+        size_t row;
+        //! Source of the event (#Origin)
+        int origin;
+    };
+
+    /**
+     * @brief Decoding result of the one track, merged into the song in order of tracks
+     */
+    struct SmfTrackParse
+    {
+        //! Events to apply to the song
+        std::vector<SmfTrackNote> notes;
+        //! Loop points format assumed at begin of the track
+        LoopFormat loopFormatIn;
+        //! Loop points format at end of the track
+        LoopFormat loopFormat;
+        //! Did the decoding depend on the loop points format
+        bool loopFormatUsed;
+        //! Was the track decoded without errors
+        bool ok;
+        //! Origin of the last parsed event (#SmfTrackNote::Origin)
+        int origin;
+        //! Length of the track in ticks
+        uint64_t length;
+        //! Has the track been stopped at end of the received data
+        bool cut;
+        //! Decoding errors
+        std::string errors;
+    };
+
+    /**
+     * @brief Decode one track into the rows of track data storage
+     * @param tk Index of the track
+     * @param trackData Raw data of the track
+     * @param loopFormat Loop points format at begin of the track
+     * @param cut Raw data is cut at end of the received data: the unfinished row is dropped
+     * @param [_out] track Decoding result of the track
+     */
+    void parseSmfTrack(size_t tk, const std::vector<uint8_t> &trackData,
+                       LoopFormat loopFormat, bool cut, SmfTrackParse &track);
+
     //! Music file format type. MIDI is default.
     FileFormat m_format;
     //! SMF format identifier.
@@ -343,11 +466,19 @@ private:
     Position m_trackBeginPosition;
     //! Loop start point
     Position m_loopBeginPosition;
+    //! Snapshot of the position at begin of the currently processed row
+    Position m_rowBeginPosition;
 
     //! Is looping enabled or not
     bool    m_loopEnabled;
     //! Don't process loop: trigger hooks only if they are set
     bool    m_loopHooksOnly;
+    //! Collect the timing and meta-data only, don't keep events for playback
+    bool    m_probeOnly;
+    //! Accept the SMF data cut at any point, see setPartialData()
+    bool    m_partialData;
+    //! Is the loaded song only a beginning of the whole one
+    bool    m_partial;
 
     //! Full song length in seconds
     double m_fullSongTimeLength;
@@ -361,6 +492,10 @@ private:
 
     //! Pre-processed track data storage
     std::vector<MidiTrackQueue > m_trackData;
+    //! Rows of all tracks merged into the single time-ordered stream
+    std::vector<StreamRow> m_eventStream;
+    //! Whether the nth track is cut at end of the received data
+    std::vector<bool> m_trackCut;
 
     //! CMF instruments
     std::vector<CmfInstrument> m_cmfInstruments;
@@ -373,6 +508,8 @@ private:
     std::vector<std::string> m_musTrackTitles;
     //! List of MIDI markers
     std::vector<MIDI_MarkerEntry> m_musMarkers;
+    //! Names of MIDI devices used by the device switch events
+    std::vector<std::string> m_musDeviceNames;
 
     //! Time of one tick
     fraction<uint64_t> m_invDeltaTicks;
@@ -381,6 +518,22 @@ private:
 
     //! Tempo multiplier factor
     double  m_tempoMultiplier;
+
+    //! Count of threads decoding the tracks of the loaded file
+    unsigned m_parseThreads;
+
+    //! Output sample rate of the integer clock, or zero when time is counted in seconds
+    uint32_t m_clockRate;
+    //! Tempo multiplier factor in 1/65536 units, used by the integer clock
+    uint64_t m_clockMultiplier;
+    //! Tempo of the current segment of the integer clock
+    fraction<uint64_t> m_clockTempo;
+    //! Ticks passed since begin of the current segment of the integer clock
+    uint64_t m_clockTicks;
+    //! Clock units already counted for the current segment of the integer clock
+    uint64_t m_clockDone;
+    //! Count of jumps to the start of the endless loop
+    size_t m_loopJumps;
     //! Is song at end
     bool    m_atEnd;
 
@@ -566,6 +719,27 @@ public:
      */
     FileFormat getFormat();
 
+    /**
+     * @brief Instruments referenced by the loaded song
+     */
+    struct InstrumentsUsage
+    {
+        //! Numbers of the program changes (program 0 is always marked)
+        bool programs[128];
+        //! Values of the bank select MSB (value 0 is always marked)
+        bool bankMsb[128];
+        //! Values of the bank select LSB (value 0 is always marked)
+        bool bankLsb[128];
+        //! Keys of the played notes
+        bool notes[128];
+    };
+
+    /**
+     * @brief Collect programs, banks and keys used by the loaded song
+     * @param usage Destination of the usage flags
+     */
+    void getInstrumentsUsage(InstrumentsUsage &usage) const;
+
     /**
      * @brief Returns the number of tracks
      * @return Track count
@@ -623,6 +797,62 @@ public:
      */
     void setLoopHooksOnly(bool enabled);
 
+    /**
+     * @brief Switch the probe mode on/off
+     *
+     * In the probe mode the loaded song is only scanned for the tempo map, loop points,
+     * markers and meta-strings, events are not kept, so the song can't be played.
+     * The real-time interface is not required in this mode.
+     *
+     * @param enabled Load only the timing and the meta-data of the next songs
+     */
+    void setProbeMode(bool enabled);
+
+    /**
+     * @brief Accept the Standard MIDI file which data is not yet fully received
+     *
+     * The loaded song keeps only the events known before the end of the data.
+     * Its playback waits at the end of them instead of finishing, see isPartial().
+     *
+     * @param enabled Load the beginning of the cut SMF data of the next songs
+     */
+    void setPartialData(bool enabled);
+
+    /**
+     * @brief Is the loaded song only a beginning of the whole one
+     *
+     * The song length, the loop points and the meta-data are provisional.
+     */
+    bool isPartial() const;
+
+    /**
+     * @brief Treat the loaded beginning of the song as the whole song, it ends at end of it
+     */
+    void finishPartial();
+
+    /**
+     * @brief Is the playback of the partial song waiting for the events not yet received
+     */
+    bool waitingData() const;
+
+    /**
+     * @brief Time of the loaded events after the current position
+     * @return Time in seconds, without of the tempo multiplier
+     */
+    double readyAheadTime() const;
+
+    /**
+     * @brief Continue the playback of the beginning of the same song loaded before
+     *
+     * The position, the loop state and the playback settings are taken from
+     * the previous sequencer, loaded from the smaller part of the same data.
+     *
+     * @param older Sequencer playing the beginning of this song
+     * @param buffer Temporary buffer for the state
+     * @return true if the state has been taken
+     */
+    bool continueFrom(BW_MidiSequencer &older, std::vector<uint8_t> &buffer);
+
     /**
      * @brief Get music title
      * @return music title string
@@ -647,6 +877,12 @@ public:
      */
     const std::vector<MIDI_MarkerEntry> &getMarkers();
 
+    /**
+     * @brief Get names of MIDI devices used by the device switch events
+     * @return Array of unique device names in order of appearance in tracks
+     */
+    const std::vector<std::string> &getDeviceNames();
+
     /**
      * @brief Is position of song at end
      * @return true if end of song was reached
@@ -683,6 +919,39 @@ public:
      */
     double Tick(double s, double granularity);
 
+    /**
+     * @brief Periodic tick handler of the integer clock, see setClockRate()
+     * @param frames Count of output frames since last call
+     * @return desired number of output frames until next call
+     */
+    uint64_t tickFrames(uint64_t frames);
+
+    /**
+     * @brief Count time by integer count of output frames instead of seconds
+     *
+     * Delays between events are converted from ticks into the 1/65536 fractions
+     * of the output frame exactly by the current tempo, so events are placed
+     * on the same frames on any platform.
+     *
+     * @param rate Output sample rate, or zero to count time in seconds
+     */
+    void setClockRate(uint32_t rate);
+
+    /**
+     * @brief Set count of threads to decode tracks of the next loaded file
+     *
+     * The loaded song is the same as with one thread. Ignored when the library
+     * was built without parallel parsing support.
+     *
+     * @param threads Count of threads, including the calling one, 1 is default
+     */
+    void setParseThreads(unsigned threads);
+
+    /**
+     * @brief Desired number of output frames until next call of tickFrames()
+     */
+    uint64_t clockWaitFrames() const;
+
     /**
      * @brief Change current position to specified time position in seconds
      * @param granularity don't expect intervals smaller than this, in seconds
@@ -732,7 +1001,50 @@ public:
      */
     void   setTempo(double tempo);
 
+    /**
+     * @brief Serialize the playback position, the loop state and the tempo
+     * @param out Destination buffer, the state is appended to its end
+     * @param fingerprint Write the phase of the integer clock instead of its counters
+     *        which grow while the tempo stays the same. Such state can be only compared
+     *        with another one, but not restored
+     */
+    void saveState(std::vector<uint8_t> &out, bool fingerprint = false);
+
+    /**
+     * @brief Restore the state written by saveState() while the same song was loaded
+     * @param data Pointer to the saved state
+     * @param size Size of available data
+     * @param apply Restore the state, otherwise only validate it
+     * @return Count of consumed bytes, or 0 if the state doesn't match the loaded song
+     */
+    size_t loadState(const uint8_t *data, size_t size, bool apply = true);
+
+    /**
+     * @brief Count of jumps to the start of the endless loop made since the song was opened
+     * @return Counter which changes on every repeat of the loop
+     */
+    size_t loopJumpsCount() const
+    {
+        return m_loopJumps;
+    }
+
 private:
+    /**
+     * @brief Serialize the song position, iterators are stored as row numbers
+     * @param out Destination buffer
+     * @param pos Position to store
+     */
+    void savePosition(std::vector<uint8_t> &out, const Position &pos);
+
+    /**
+     * @brief Restore the song position
+     * @param [_inout] ptr Pointer to the stored position, moved past it on success
+     * @param end End of available data
+     * @param pos Destination position
+     * @return false if data is truncated or doesn't match the loaded song
+     */
+    bool loadPosition(const uint8_t **ptr, const uint8_t *end, Position &pos);
+
     /**
      * @brief Load file as Id-software-Music-File (Wolfenstein)
      * @param fr Context with opened file
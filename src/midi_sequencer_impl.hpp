@@ -32,6 +32,17 @@
 #include <set>
 #include <assert.h>
 
+#ifndef BWMIDI_DISABLE_PARALLEL_PARSING
+#   ifdef _WIN32
+#       ifndef WIN32_LEAN_AND_MEAN
+#           define WIN32_LEAN_AND_MEAN
+#       endif
+#       include <windows.h>
+#   else
+#       include <pthread.h>
+#   endif
+#endif
+
 #if defined(_WIN32) && !defined(__WATCOMC__)
 #   ifdef _MSC_VER
 #       ifdef _WIN64
@@ -120,6 +131,50 @@ static inline uint64_t readLEint(const void *buffer, size_t nbytes)
     return result;
 }
 
+//! Bit shift to convert output frames into the integer clock units
+static const unsigned s_clockFrameShift = 16;
+//! Half of the output frame in the integer clock units
+static const int64_t s_clockHalfFrame = static_cast<int64_t>(1) << (s_clockFrameShift - 1);
+
+/**
+ * @brief Compute a * b / c rounded down without overflow of the intermediate product
+ * @param a First factor
+ * @param b Second factor
+ * @param c Divider, the result must fit 64 bits
+ * @return Result of division
+ */
+static uint64_t clockMulDiv(uint64_t a, uint64_t b, uint64_t c)
+{
+    const uint64_t mask = 0xFFFFFFFFu;
+    const uint64_t ll = (a & mask) * (b & mask);
+    const uint64_t lh = (a & mask) * (b >> 32);
+    const uint64_t hl = (a >> 32) * (b & mask);
+    const uint64_t hh = (a >> 32) * (b >> 32);
+    const uint64_t mid = (ll >> 32) + (lh & mask) + (hl & mask);
+    const uint64_t lo = (ll & mask) | (mid << 32);
+    uint64_t hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+
+    if(hi == 0)
+        return lo / c;
+
+    // Long division of 128-bit product
+    uint64_t q = 0;
+    hi %= c;
+    for(int i = 63; i >= 0; --i)
+    {
+        const bool carry = (hi >> 63) != 0;
+        hi = (hi << 1) | ((lo >> i) & 1);
+        q <<= 1;
+        if(carry || hi >= c)
+        {
+            hi -= c;
+            q |= 1;
+        }
+    }
+
+    return q;
+}
+
 /**
  * @brief Secure Standard MIDI Variable-Length numeric value parser with anti-out-of-range protection
  * @param [_inout] ptr Pointer to memory block that contains begin of variable-length value, will be iterated forward
@@ -304,11 +359,20 @@ BW_MidiSequencer::BW_MidiSequencer() :
     m_loopFormat(Loop_Default),
     m_loopEnabled(false),
     m_loopHooksOnly(false),
+    m_probeOnly(false),
+    m_partialData(false),
+    m_partial(false),
     m_fullSongTimeLength(0.0),
     m_postSongWaitDelay(1.0),
     m_loopStartTime(-1.0),
     m_loopEndTime(-1.0),
     m_tempoMultiplier(1.0),
+    m_parseThreads(1),
+    m_clockRate(0),
+    m_clockMultiplier(static_cast<uint64_t>(1) << s_clockFrameShift),
+    m_clockTicks(0),
+    m_clockDone(0),
+    m_loopJumps(0),
     m_atEnd(false),
     m_trackSolo(~static_cast<size_t>(0)),
     m_triggerHandler(NULL),
@@ -399,6 +463,48 @@ BW_MidiSequencer::FileFormat BW_MidiSequencer::getFormat()
     return m_format;
 }
 
+void BW_MidiSequencer::getInstrumentsUsage(InstrumentsUsage &usage) const
+{
+    std::memset(&usage, 0, sizeof(InstrumentsUsage));
+    usage.programs[0] = true;
+    usage.bankMsb[0] = true;
+    usage.bankLsb[0] = true;
+
+    for(size_t tk = 0; tk < m_trackData.size(); ++tk)
+    {
+        const MidiTrackQueue &track = m_trackData[tk];
+        for(MidiTrackQueue::const_iterator row = track.begin(); row != track.end(); ++row)
+        {
+            for(size_t i = 0; i < row->events.size(); ++i)
+            {
+                const MidiEvent &evt = row->events[i];
+                if(evt.data.empty())
+                    continue;
+
+                switch(evt.type)
+                {
+                case MidiEvent::T_NOTEON:
+                    usage.notes[evt.data[0] & 0x7F] = true;
+                    break;
+                case MidiEvent::T_PATCHCHANGE:
+                    usage.programs[evt.data[0] & 0x7F] = true;
+                    break;
+                case MidiEvent::T_CTRLCHANGE:
+                    if(evt.data.size() < 2)
+                        break;
+                    if(evt.data[0] == 0)
+                        usage.bankMsb[evt.data[1] & 0x7F] = true;
+                    else if(evt.data[0] == 32)
+                        usage.bankLsb[evt.data[1] & 0x7F] = true;
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+    }
+}
+
 size_t BW_MidiSequencer::getTrackCount() const
 {
     return m_trackData.size();
@@ -449,6 +555,92 @@ void BW_MidiSequencer::setLoopHooksOnly(bool enabled)
     m_loopHooksOnly = enabled;
 }
 
+void BW_MidiSequencer::setProbeMode(bool enabled)
+{
+    // The probe never calls real-time hooks, so, it's able to work without of the interface
+    static const BW_MidiRtInterface probeInterface = BW_MidiRtInterface();
+    m_probeOnly = enabled;
+    if(enabled && !m_interface)
+        m_interface = &probeInterface;
+}
+
+void BW_MidiSequencer::setPartialData(bool enabled)
+{
+    m_partialData = enabled;
+}
+
+bool BW_MidiSequencer::isPartial() const
+{
+    return m_partial;
+}
+
+void BW_MidiSequencer::finishPartial()
+{
+    m_partial = false;
+}
+
+bool BW_MidiSequencer::waitingData() const
+{
+    return m_partial && (m_currentPosition.row >= m_eventStream.size());
+}
+
+double BW_MidiSequencer::readyAheadTime() const
+{
+    if(m_eventStream.empty())
+        return 0.0;
+
+    const double readyTime = streamRowTime(m_eventStream.size() - 1);
+    const size_t row = m_currentPosition.row;
+    if(row >= m_eventStream.size())
+        return 0.0;
+
+    const double ahead = readyTime - streamRowTime(row);
+    return ahead > 0.0 ? ahead : 0.0;
+}
+
+double BW_MidiSequencer::streamRowTime(size_t row) const
+{
+    // Empty steps have no row, the time of the previous one is taken
+    while(row > 0 && !m_eventStream[row].row)
+        --row;
+    return m_eventStream[row].row ? m_eventStream[row].row->time : 0.0;
+}
+
+bool BW_MidiSequencer::continueFrom(BW_MidiSequencer &older, std::vector<uint8_t> &buffer)
+{
+    if((older.m_eventStream.size() > m_eventStream.size()) ||
+       (older.m_trackData.size() != m_trackData.size()))
+        return false; // Not a beginning of this song
+
+    setClockRate(older.m_clockRate);
+    setTempo(older.m_tempoMultiplier);
+    m_loopEnabled = older.m_loopEnabled;
+    m_loopHooksOnly = older.m_loopHooksOnly;
+    m_trackDisable = older.m_trackDisable;
+    m_trackSolo = older.m_trackSolo;
+    m_triggerHandler = older.m_triggerHandler;
+    m_triggerUserData = older.m_triggerUserData;
+
+    // The loop validity and the loop stack entries found in the received data since are kept
+    const bool invalidLoop = m_loop.invalidLoop;
+    std::vector<LoopStackEntry> parsedStack;
+    parsedStack.swap(m_loop.stack);
+
+    buffer.clear();
+    older.saveState(buffer);
+    if(buffer.empty() || loadState(&buffer[0], buffer.size()) == 0)
+    {
+        m_loop.stack.swap(parsedStack);
+        return false;
+    }
+
+    m_loop.invalidLoop = invalidLoop;
+    for(size_t i = m_loop.stack.size(); i < parsedStack.size(); ++i)
+        m_loop.stack.push_back(parsedStack[i]);
+
+    return true;
+}
+
 const std::string &BW_MidiSequencer::getMusicTitle()
 {
     return m_musTitle;
@@ -469,6 +661,11 @@ const std::vector<BW_MidiSequencer::MIDI_MarkerEntry> &BW_MidiSequencer::getMark
     return m_musMarkers;
 }
 
+const std::vector<std::string> &BW_MidiSequencer::getDeviceNames()
+{
+    return m_musDeviceNames;
+}
+
 bool BW_MidiSequencer::positionAtEnd()
 {
     return m_atEnd;
@@ -492,9 +689,13 @@ void BW_MidiSequencer::buildSmfSetupReset(size_t trackCount)
     m_musCopyright.clear();
     m_musTrackTitles.clear();
     m_musMarkers.clear();
+    m_musDeviceNames.clear();
     m_trackData.clear();
     m_trackData.resize(trackCount, MidiTrackQueue());
     m_trackDisable.resize(trackCount);
+    m_trackCut.clear();
+    m_trackCut.resize(trackCount, false);
+    m_partial = false;
 
     m_loop.reset();
     m_loop.invalidLoop = false;
@@ -503,11 +704,92 @@ void BW_MidiSequencer::buildSmfSetupReset(size_t trackCount)
     m_currentPosition.began = false;
     m_currentPosition.absTimePosition = 0.0;
     m_currentPosition.wait = 0.0;
-    m_currentPosition.track.clear();
-    m_currentPosition.track.resize(trackCount);
+    m_currentPosition.row = 0;
+    m_currentPosition.clockWait = 0;
+    m_currentPosition.clockTime = 0;
+    m_eventStream.clear();
+    m_clockTicks = 0;
+    m_clockDone = 0;
 }
 
-bool BW_MidiSequencer::buildSmfTrackData(const std::vector<std::vector<uint8_t> > &trackData)
+#ifndef BWMIDI_DISABLE_PARALLEL_PARSING
+struct BW_MidiSequencer::SmfParseThread
+{
+#ifdef _WIN32
+    HANDLE thread;
+    void (*proc)(void *);
+    void *arg;
+
+    static DWORD WINAPI entry(LPVOID self)
+    {
+        SmfParseThread *t = static_cast<SmfParseThread *>(self);
+        t->proc(t->arg);
+        return 0;
+    }
+
+    bool create(void (*threadProc)(void *), void *threadArg)
+    {
+        proc = threadProc;
+        arg = threadArg;
+        thread = CreateThread(NULL, 0, &entry, this, 0, NULL);
+        return thread != NULL;
+    }
+
+    void join()
+    {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+#else
+    pthread_t thread;
+    void (*proc)(void *);
+    void *arg;
+
+    static void *entry(void *self)
+    {
+        SmfParseThread *t = static_cast<SmfParseThread *>(self);
+        t->proc(t->arg);
+        return NULL;
+    }
+
+    bool create(void (*threadProc)(void *), void *threadArg)
+    {
+        proc = threadProc;
+        arg = threadArg;
+        return pthread_create(&thread, NULL, &entry, this) == 0;
+    }
+
+    void join()
+    {
+        pthread_join(thread, NULL);
+    }
+#endif
+};
+
+/**
+ * @brief Tracks decoded by one thread: every N-th track from the first one
+ */
+struct BW_MidiSequencer::SmfParseJob
+{
+    BW_MidiSequencer *self;
+    const std::vector<std::vector<uint8_t> > *trackData;
+    std::vector<SmfTrackParse> *tracks;
+    size_t completeTracks;
+    size_t first;
+    size_t step;
+};
+
+void BW_MidiSequencer::parseSmfTracksProc(void *job)
+{
+    SmfParseJob *j = static_cast<SmfParseJob *>(job);
+    const size_t trackCount = j->trackData->size();
+    for(size_t tk = j->first; tk < trackCount; tk += j->step)
+        j->self->parseSmfTrack(tk, (*j->trackData)[tk], Loop_Default, tk >= j->completeTracks, (*j->tracks)[tk]);
+}
+#endif
+
+bool BW_MidiSequencer::buildSmfTrackData(const std::vector<std::vector<uint8_t> > &trackData,
+                                         size_t completeTracks)
 {
     const size_t trackCount = trackData.size();
     buildSmfSetupReset(trackCount);
@@ -523,216 +805,267 @@ bool BW_MidiSequencer::buildSmfTrackData(const std::vector<std::vector<uint8_t>
     uint64_t loopEndTicks = 0;
     //! Full length of song in ticks
     uint64_t ticksSongLength = 0;
-    //! Cache for error message strign
-    char error[150];
-
-    //! Caches note on/off states.
-    bool noteStates[16 * 255];
-    /* This is required to carefully detect zero-length notes           *
-     * and avoid a move of "note-off" event over "note-on" while sort.  *
-     * Otherwise, after sort those notes will play infinite sound       */
 
     //! Tempo change events list
     std::vector<MidiEvent> temposList;
 
-    /*
-     * TODO: Make this be safer for memory in case of broken input data
-     * which may cause going away of available track data (and then give a crash!)
-     *
-     * POST: Check this more carefully for possible vulnuabilities are can crash this
-     */
+    //! Decoding results of tracks
+    std::vector<SmfTrackParse> tracks(trackCount);
+    //! Were tracks decoded before the merge
+    bool parsedAhead = false;
+
+#ifndef BWMIDI_DISABLE_PARALLEL_PARSING
+    const size_t threads = (m_parseThreads < trackCount) ? m_parseThreads : trackCount;
+    if(threads > 1)
+    {
+        /*
+         * The loop points format is known only after the merge of previous tracks,
+         * so the initial one is assumed. The merge decodes again the rare track
+         * which depends on the format that has been changed by previous tracks.
+         */
+        std::vector<SmfParseJob> jobs(threads);
+        std::vector<SmfParseThread> workers(threads);
+        std::vector<bool> started(threads, false);
+
+        for(size_t i = 0; i < threads; ++i)
+        {
+            jobs[i].self = this;
+            jobs[i].trackData = &trackData;
+            jobs[i].tracks = &tracks;
+            jobs[i].completeTracks = completeTracks;
+            jobs[i].first = i;
+            jobs[i].step = threads;
+        }
+
+        for(size_t i = 1; i < threads; ++i)
+            started[i] = workers[i].create(&parseSmfTracksProc, &jobs[i]);
+
+        parseSmfTracksProc(&jobs[0]);
+
+        for(size_t i = 1; i < threads; ++i)
+        {
+            if(started[i])
+                workers[i].join();
+            else
+                parseSmfTracksProc(&jobs[i]); // Thread can't be created
+        }
+
+        parsedAhead = true;
+    }
+#endif
+
     for(size_t tk = 0; tk < trackCount; ++tk)
     {
-        uint64_t abs_position = 0;
-        int status = 0;
-        MidiEvent event;
-        bool ok = false;
-        const uint8_t *end      = trackData[tk].data() + trackData[tk].size();
-        const uint8_t *trackPtr = trackData[tk].data();
-        std::memset(noteStates, 0, sizeof(noteStates));
-
-        // Time delay that follows the first event in the track
-        {
-            MidiTrackRow evtPos;
-            if(m_format == Format_RSXX)
-                ok = true;
-            else
-                evtPos.delay = readVarLenEx(&trackPtr, end, ok);
-            if(!ok)
-            {
-                int len = snprintf(error, 150, "buildTrackData: Can't read variable-length value at begin of track %d.\n", (int)tk);
-                if((len > 0) && (len < 150))
-                    m_parsingErrorsString += std::string(error, (size_t)len);
-                return false;
-            }
+        SmfTrackParse &track = tracks[tk];
 
-            // HACK: Begin every track with "Reset all controllers" event to avoid controllers state break came from end of song
-            if(tk == 0)
-            {
-                MidiEvent resetEvent;
-                resetEvent.type = MidiEvent::T_SPECIAL;
-                resetEvent.subtype = MidiEvent::ST_SONG_BEGIN_HOOK;
-                evtPos.events.push_back(resetEvent);
-            }
+        if(!parsedAhead || (track.loopFormatUsed && (track.loopFormatIn != m_loopFormat)))
+            parseSmfTrack(tk, trackData[tk], m_loopFormat, tk >= completeTracks, track);
+        else if(!track.loopFormatUsed)
+            track.loopFormat = m_loopFormat;
+        m_loopFormat = track.loopFormat;
 
-            evtPos.absPos = abs_position;
-            abs_position += evtPos.delay;
-            m_trackData[tk].push_back(evtPos);
-        }
+        size_t row = ~static_cast<size_t>(0);
 
-        MidiTrackRow evtPos;
-        do
+        for(size_t i = 0; i < track.notes.size(); ++i)
         {
-            event = parseEvent(&trackPtr, end, status);
-            if(!event.isValid)
+            const SmfTrackNote &note = track.notes[i];
+            const MidiEvent &event = note.event;
+            const uint64_t abs_position = event.absPosition;
+
+            if(note.row != row)
             {
-                int len = snprintf(error, 150, "buildTrackData: Fail to parse event in the track %d.\n", (int)tk);
-                if((len > 0) && (len < 150))
-                    m_parsingErrorsString += std::string(error, (size_t)len);
-                return false;
+                row = note.row;
+                gotLoopEventInThisRow = false;
             }
 
-            evtPos.events.push_back(event);
-            if(event.type == MidiEvent::T_SPECIAL)
+            if(event.subtype == MidiEvent::ST_COPYRIGHT)
             {
-                if(event.subtype == MidiEvent::ST_TEMPOCHANGE)
+                if(m_musCopyright.empty())
                 {
-                    event.absPosition = abs_position;
-                    temposList.push_back(event);
+                    m_musCopyright = std::string((const char *)event.data.data(), event.data.size());
+                    m_musCopyright.push_back('\0'); /* ending fix for UTF16 strings */
+                    if(m_interface->onDebugMessage)
+                        m_interface->onDebugMessage(m_interface->onDebugMessage_userData, "Music copyright: %s", m_musCopyright.c_str());
                 }
-                else if(!m_loop.invalidLoop && (event.subtype == MidiEvent::ST_LOOPSTART))
+                else if(m_interface->onDebugMessage)
                 {
-                    /*
-                     * loopStart is invalid when:
-                     * - starts together with loopEnd
-                     * - appears more than one time in same MIDI file
-                     */
-                    if(gotGlobalLoopStart || gotLoopEventInThisRow)
-                        m_loop.invalidLoop = true;
-                    else
-                    {
-                        gotGlobalLoopStart = true;
-                        loopStartTicks = abs_position;
-                    }
-                    // In this row we got loop event, register this!
-                    gotLoopEventInThisRow = true;
+                    std::string str((const char *)event.data.data(), event.data.size());
+                    str.push_back('\0'); /* ending fix for UTF16 strings */
+                    m_interface->onDebugMessage(m_interface->onDebugMessage_userData, "Extra copyright event: %s", str.c_str());
                 }
-                else if(!m_loop.invalidLoop && (event.subtype == MidiEvent::ST_LOOPEND))
+            }
+            else if(event.subtype == MidiEvent::ST_SQTRKTITLE)
+            {
+                if(m_musTitle.empty())
                 {
-                    /*
-                     * loopEnd is invalid when:
-                     * - starts before loopStart
-                     * - starts together with loopStart
-                     * - appars more than one time in same MIDI file
-                     */
-                    if(gotGlobalLoopEnd || gotLoopEventInThisRow)
-                    {
-                        m_loop.invalidLoop = true;
-                        if(m_interface->onDebugMessage)
-                        {
-                            m_interface->onDebugMessage(
-                                m_interface->onDebugMessage_userData,
-                                "== Invalid loop detected! %s %s ==",
-                                (gotGlobalLoopEnd ? "[Caught more than 1 loopEnd!]" : ""),
-                                (gotLoopEventInThisRow ? "[loopEnd in same row as loopStart!]" : "")
-                            );
-                        }
-                    }
-                    else
-                    {
-                        gotGlobalLoopEnd = true;
-                        loopEndTicks = abs_position;
-                    }
-                    // In this row we got loop event, register this!
-                    gotLoopEventInThisRow = true;
+                    m_musTitle = std::string((const char *)event.data.data(), event.data.size());
+                    m_musTitle.push_back('\0'); /* ending fix for UTF16 strings */
+                    if(m_interface->onDebugMessage)
+                        m_interface->onDebugMessage(m_interface->onDebugMessage_userData, "Music title: %s", m_musTitle.c_str());
                 }
-                else if(!m_loop.invalidLoop && (event.subtype == MidiEvent::ST_LOOPSTACK_BEGIN))
+                else
                 {
-                    if(!gotStackLoopStart)
-                    {
-                        if(!gotGlobalLoopStart)
-                            loopStartTicks = abs_position;
-                        gotStackLoopStart = true;
-                    }
-
-                    m_loop.stackUp();
-                    if(m_loop.stackLevel >= static_cast<int>(m_loop.stack.size()))
-                    {
-                        LoopStackEntry e;
-                        e.loops = event.data[0];
-                        e.infinity = (event.data[0] == 0);
-                        e.start = abs_position;
-                        e.end = abs_position;
-                        m_loop.stack.push_back(e);
-                    }
+                    std::string str((const char *)event.data.data(), event.data.size());
+                    str.push_back('\0'); /* ending fix for UTF16 strings */
+                    m_musTrackTitles.push_back(str);
+                    if(m_interface->onDebugMessage)
+                        m_interface->onDebugMessage(m_interface->onDebugMessage_userData, "Track title: %s", str.c_str());
                 }
-                else if(!m_loop.invalidLoop &&
-                    ((event.subtype == MidiEvent::ST_LOOPSTACK_END) ||
-                     (event.subtype == MidiEvent::ST_LOOPSTACK_BREAK))
-                )
+            }
+            else if(event.subtype == MidiEvent::ST_INSTRTITLE)
+            {
+                if(m_interface->onDebugMessage)
                 {
-                    if(m_loop.stackLevel <= -1)
-                    {
-                        m_loop.invalidLoop = true; // Caught loop end without of loop start!
-                        if(m_interface->onDebugMessage)
-                        {
-                            m_interface->onDebugMessage(
-                                m_interface->onDebugMessage_userData,
-                                "== Invalid loop detected! [Caught loop end without of loop start] =="
-                            );
-                        }
-                    }
-                    else
-                    {
-                        if(loopEndTicks < abs_position)
-                            loopEndTicks = abs_position;
-                        m_loop.getCurStack().end = abs_position;
-                        m_loop.stackDown();
-                    }
+                    std::string str((const char *)event.data.data(), event.data.size());
+                    str.push_back('\0'); /* ending fix for UTF16 strings */
+                    m_interface->onDebugMessage(m_interface->onDebugMessage_userData, "Instrument: %s", str.c_str());
                 }
             }
-
-            if(event.subtype != MidiEvent::ST_ENDTRACK) // Don't try to read delta after EndOfTrack event!
+            else if(event.subtype == MidiEvent::ST_DEVICESWITCH)
+            {
+                std::string data((const char *)event.data.data(), event.data.size());
+                if(std::find(m_musDeviceNames.begin(), m_musDeviceNames.end(), data) == m_musDeviceNames.end())
+                    m_musDeviceNames.push_back(data);
+            }
+            else if(event.subtype == MidiEvent::ST_TEMPOCHANGE)
             {
-                evtPos.delay = readVarLenEx(&trackPtr, end, ok);
-                if(!ok)
+                temposList.push_back(event);
+            }
+            else if(!m_loop.invalidLoop && (event.subtype == MidiEvent::ST_LOOPSTART))
+            {
+                /*
+                 * loopStart is invalid when:
+                 * - starts together with loopEnd
+                 * - appears more than one time in same MIDI file
+                 */
+                if(gotGlobalLoopStart || gotLoopEventInThisRow)
+                    m_loop.invalidLoop = true;
+                else
                 {
-                    /* End of track has been reached! However, there is no EOT event presented */
-                    event.type = MidiEvent::T_SPECIAL;
-                    event.subtype = MidiEvent::ST_ENDTRACK;
+                    gotGlobalLoopStart = true;
+                    loopStartTicks = abs_position;
                 }
+                // In this row we got loop event, register this!
+                gotLoopEventInThisRow = true;
             }
-
-#ifdef ENABLE_END_SILENCE_SKIPPING
-            //Have track end on its own row? Clear any delay on the row before
-            if(event.subtype == MidiEvent::ST_ENDTRACK && evtPos.events.size() == 1)
+            else if(!m_loop.invalidLoop && (event.subtype == MidiEvent::ST_LOOPEND))
             {
-                if (!m_trackData[tk].empty())
+                /*
+                 * loopEnd is invalid when:
+                 * - starts before loopStart
+                 * - starts together with loopStart
+                 * - appars more than one time in same MIDI file
+                 */
+                if(gotGlobalLoopEnd || gotLoopEventInThisRow)
                 {
-                    MidiTrackRow &previous = m_trackData[tk].back();
-                    previous.delay = 0;
-                    previous.timeDelay = 0;
+                    m_loop.invalidLoop = true;
+                    if(m_interface->onDebugMessage)
+                    {
+                        m_interface->onDebugMessage(
+                            m_interface->onDebugMessage_userData,
+                            "== Invalid loop detected! %s %s ==",
+                            (gotGlobalLoopEnd ? "[Caught more than 1 loopEnd!]" : ""),
+                            (gotLoopEventInThisRow ? "[loopEnd in same row as loopStart!]" : "")
+                        );
+                    }
                 }
+                else
+                {
+                    gotGlobalLoopEnd = true;
+                    loopEndTicks = abs_position;
+                }
+                // In this row we got loop event, register this!
+                gotLoopEventInThisRow = true;
             }
-#endif
+            else if(event.subtype == MidiEvent::ST_LOOPSTACK_BEGIN)
+            {
+                if(m_interface->onDebugMessage && (note.origin != SmfTrackNote::Origin_Track))
+                {
+                    m_interface->onDebugMessage(
+                        m_interface->onDebugMessage_userData,
+                        "Stack %s Loop Start at %d to %d level with %d loops",
+                        (note.origin == SmfTrackNote::Origin_XMI ? "XMI" : "Marker"),
+                        m_loop.stackLevel,
+                        m_loop.stackLevel + 1,
+                        event.data[0]
+                    );
+                }
+
+                if(m_loop.invalidLoop)
+                    continue;
+
+                if(!gotStackLoopStart)
+                {
+                    if(!gotGlobalLoopStart)
+                        loopStartTicks = abs_position;
+                    gotStackLoopStart = true;
+                }
 
-            if((evtPos.delay > 0) || (event.subtype == MidiEvent::ST_ENDTRACK))
+                m_loop.stackUp();
+                if(m_loop.stackLevel >= static_cast<int>(m_loop.stack.size()))
+                {
+                    LoopStackEntry e;
+                    e.loops = event.data[0];
+                    e.infinity = (event.data[0] == 0);
+                    e.start = abs_position;
+                    e.end = abs_position;
+                    m_loop.stack.push_back(e);
+                }
+            }
+            else if((event.subtype == MidiEvent::ST_LOOPSTACK_END) ||
+                    (event.subtype == MidiEvent::ST_LOOPSTACK_BREAK))
             {
-                evtPos.absPos = abs_position;
-                abs_position += evtPos.delay;
-                evtPos.sortEvents(noteStates);
-                m_trackData[tk].push_back(evtPos);
-                evtPos.clear();
-                gotLoopEventInThisRow = false;
+                if(m_interface->onDebugMessage && (note.origin != SmfTrackNote::Origin_Track))
+                {
+                    m_interface->onDebugMessage(
+                        m_interface->onDebugMessage_userData,
+                        "Stack %s Loop %s at %d to %d level",
+                        (note.origin == SmfTrackNote::Origin_XMI ? "XMI" : "Marker"),
+                        (event.subtype == MidiEvent::ST_LOOPSTACK_END ? "End" : "Break"),
+                        m_loop.stackLevel,
+                        m_loop.stackLevel - 1
+                    );
+                }
+
+                if(m_loop.invalidLoop)
+                    continue;
+
+                if(m_loop.stackLevel <= -1)
+                {
+                    m_loop.invalidLoop = true; // Caught loop end without of loop start!
+                    if(m_interface->onDebugMessage)
+                    {
+                        m_interface->onDebugMessage(
+                            m_interface->onDebugMessage_userData,
+                            "== Invalid loop detected! [Caught loop end without of loop start] =="
+                        );
+                    }
+                }
+                else
+                {
+                    if(loopEndTicks < abs_position)
+                        loopEndTicks = abs_position;
+                    m_loop.getCurStack().end = abs_position;
+                    m_loop.stackDown();
+                }
             }
         }
-        while((trackPtr <= end) && (event.subtype != MidiEvent::ST_ENDTRACK));
 
-        if(ticksSongLength < abs_position)
-            ticksSongLength = abs_position;
-        // Set the chain of events begin
-        if(m_trackData[tk].size() > 0)
-            m_currentPosition.track[tk].pos = m_trackData[tk].begin();
+        m_parsingErrorsString += track.errors;
+        if(!track.ok)
+        {
+            // Tracks after the broken one are not decoded by the single thread
+            for(size_t i = tk + 1; i < trackCount; ++i)
+                m_trackData[i].clear();
+            return false;
+        }
+
+        if(ticksSongLength < track.length)
+            ticksSongLength = track.length;
+
+        m_trackCut[tk] = track.cut;
+        if(track.cut)
+            m_partial = true;
     }
 
     if(gotGlobalLoopStart && !gotGlobalLoopEnd)
@@ -741,6 +1074,10 @@ bool BW_MidiSequencer::buildSmfTrackData(const std::vector<std::vector<uint8_t>
         loopEndTicks = ticksSongLength;
     }
 
+    // The stack loop end may be in the data not received yet
+    if(m_partial && gotStackLoopStart && (loopEndTicks <= loopStartTicks))
+        loopEndTicks = ticksSongLength;
+
     // loopStart must be located before loopEnd!
     if(loopStartTicks >= loopEndTicks)
     {
@@ -759,6 +1096,199 @@ bool BW_MidiSequencer::buildSmfTrackData(const std::vector<std::vector<uint8_t>
     return true;
 }
 
+void BW_MidiSequencer::parseSmfTrack(size_t tk, const std::vector<uint8_t> &trackData,
+                                     LoopFormat loopFormat, bool cut, SmfTrackParse &track)
+{
+    track.notes.clear();
+    track.loopFormatIn = loopFormat;
+    track.loopFormat = loopFormat;
+    track.loopFormatUsed = false;
+    track.ok = false;
+    track.origin = SmfTrackNote::Origin_Track;
+    track.length = 0;
+    track.cut = false;
+    track.errors.clear();
+
+    MidiTrackQueue &rows = m_trackData[tk];
+    rows.clear();
+
+    uint64_t abs_position = 0;
+    //! Index of the currently filled row
+    size_t rowIndex = 0;
+    int status = 0;
+    MidiEvent event;
+    bool ok = false;
+    const uint8_t *end      = trackData.data() + trackData.size();
+    const uint8_t *trackPtr = trackData.data();
+    //! Cache for error message strign
+    char error[150];
+
+    //! Caches note on/off states.
+    bool noteStates[16 * 255];
+    /* This is required to carefully detect zero-length notes           *
+     * and avoid a move of "note-off" event over "note-on" while sort.  *
+     * Otherwise, after sort those notes will play infinite sound       */
+    std::memset(noteStates, 0, sizeof(noteStates));
+
+    /*
+     * TODO: Make this be safer for memory in case of broken input data
+     * which may cause going away of available track data (and then give a crash!)
+     *
+     * POST: Check this more carefully for possible vulnuabilities are can crash this
+     */
+
+    // Time delay that follows the first event in the track
+    {
+        MidiTrackRow evtPos;
+        if(m_format == Format_RSXX)
+            ok = true;
+        else
+            evtPos.delay = readVarLenEx(&trackPtr, end, ok);
+        if(!ok && cut)
+        {
+            // Nothing of the track is received yet
+            track.ok = true;
+            track.cut = true;
+            return;
+        }
+        if(!ok)
+        {
+            int len = snprintf(error, 150, "buildTrackData: Can't read variable-length value at begin of track %d.\n", (int)tk);
+            if((len > 0) && (len < 150))
+                track.errors += std::string(error, (size_t)len);
+            return;
+        }
+
+        // HACK: Begin every track with "Reset all controllers" event to avoid controllers state break came from end of song
+        if(tk == 0 && !m_probeOnly)
+        {
+            MidiEvent resetEvent;
+            resetEvent.type = MidiEvent::T_SPECIAL;
+            resetEvent.subtype = MidiEvent::ST_SONG_BEGIN_HOOK;
+            evtPos.events.push_back(resetEvent);
+        }
+
+        evtPos.absPos = abs_position;
+        abs_position += evtPos.delay;
+        rows.push_back(evtPos);
+        rowIndex++;
+    }
+
+    MidiTrackRow evtPos;
+    //! Count of events in the current row, including ones not kept by the probe mode
+    size_t rowEventsCount = 0;
+    //! Size of errors before the currently parsed event
+    size_t errorsSize = 0;
+    do
+    {
+        if(cut && (trackPtr >= end))
+            break; // The next event is not received yet
+
+        errorsSize = track.errors.size();
+        event = parseEvent(&trackPtr, end, status, track);
+        if(!event.isValid && cut)
+        {
+            // The event is received partially
+            track.errors.resize(errorsSize);
+            track.cut = true;
+            break;
+        }
+        if(!event.isValid)
+        {
+            int len = snprintf(error, 150, "buildTrackData: Fail to parse event in the track %d.\n", (int)tk);
+            if((len > 0) && (len < 150))
+                track.errors += std::string(error, (size_t)len);
+            return;
+        }
+
+        // The probe keeps markers only: rows are still needed to calculate the time
+        if(!m_probeOnly || ((event.type == MidiEvent::T_SPECIAL) && (event.subtype == MidiEvent::ST_MARKER)))
+            evtPos.events.push_back(event);
+        rowEventsCount++;
+        if(event.type == MidiEvent::T_SPECIAL)
+        {
+            switch(event.subtype)
+            {
+            case MidiEvent::ST_COPYRIGHT:
+            case MidiEvent::ST_SQTRKTITLE:
+            case MidiEvent::ST_INSTRTITLE:
+            case MidiEvent::ST_DEVICESWITCH:
+            case MidiEvent::ST_TEMPOCHANGE:
+            case MidiEvent::ST_LOOPSTART:
+            case MidiEvent::ST_LOOPEND:
+            case MidiEvent::ST_LOOPSTACK_BEGIN:
+            case MidiEvent::ST_LOOPSTACK_END:
+            case MidiEvent::ST_LOOPSTACK_BREAK:
+            {
+                // Applied to the song by the merge of tracks
+                SmfTrackNote note;
+                note.event = event;
+                note.event.absPosition = abs_position;
+                note.row = rowIndex;
+                note.origin = track.origin;
+                track.notes.push_back(note);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+
+        if(event.subtype != MidiEvent::ST_ENDTRACK) // Don't try to read delta after EndOfTrack event!
+        {
+            evtPos.delay = readVarLenEx(&trackPtr, end, ok);
+            if(!ok && cut)
+            {
+                track.cut = true;
+                break; // The delay is received partially
+            }
+            if(!ok)
+            {
+                /* End of track has been reached! However, there is no EOT event presented */
+                event.type = MidiEvent::T_SPECIAL;
+                event.subtype = MidiEvent::ST_ENDTRACK;
+            }
+        }
+
+#ifdef ENABLE_END_SILENCE_SKIPPING
+        //Have track end on its own row? Clear any delay on the row before
+        if(event.subtype == MidiEvent::ST_ENDTRACK && rowEventsCount == 1)
+        {
+            if (!rows.empty())
+            {
+                MidiTrackRow &previous = rows.back();
+                previous.delay = 0;
+                previous.timeDelay = 0;
+            }
+        }
+#endif
+
+        if((evtPos.delay > 0) || (event.subtype == MidiEvent::ST_ENDTRACK))
+        {
+            evtPos.absPos = abs_position;
+            abs_position += evtPos.delay;
+            if(!m_probeOnly)
+                evtPos.sortEvents(noteStates);
+            rows.push_back(evtPos);
+            rowIndex++;
+            evtPos.clear();
+            rowEventsCount = 0;
+        }
+    }
+    while((trackPtr <= end) && (event.subtype != MidiEvent::ST_ENDTRACK));
+
+    if(cut && (event.subtype != MidiEvent::ST_ENDTRACK))
+    {
+        // The unfinished row is dropped: the track is known until its begin
+        while(!track.notes.empty() && (track.notes.back().row >= rowIndex))
+            track.notes.pop_back();
+        track.cut = true;
+    }
+
+    track.length = abs_position;
+    track.ok = true;
+}
+
 void BW_MidiSequencer::buildTimeLine(const std::vector<MidiEvent> &tempos,
                                           uint64_t loopStartTicks,
                                           uint64_t loopEndTicks)
@@ -892,10 +1422,14 @@ void BW_MidiSequencer::buildTimeLine(const std::vector<MidiEvent> &tempos,
     }
 
     m_fullSongTimeLength += m_postSongWaitDelay;
+    // Merge all tracks into the single stream of rows for the playback
+    if(!m_probeOnly)
+        buildEventStream();
     // Set begin of the music
     m_trackBeginPosition = m_currentPosition;
     // Initial loop position will begin at begin of track until passing of the loop point
     m_loopBeginPosition  = m_currentPosition;
+    m_rowBeginPosition = m_currentPosition;
     // Set lowest level of the loop stack
     m_loop.stackLevel = -1;
 
@@ -1014,109 +1548,224 @@ void BW_MidiSequencer::buildTimeLine(const std::vector<MidiEvent> &tempos,
                 }
             }
         }
-#undef DRUM_NOTE_MIN_TIME
-#undef DRUM_NOTE_MIN_TICKS
-    }
-#endif
+#undef DRUM_NOTE_MIN_TIME
+#undef DRUM_NOTE_MIN_TICKS
+    }
+#endif
+
+}
+
+void BW_MidiSequencer::buildEventStream()
+{
+    const size_t trackCount = m_trackData.size();
+    std::vector<MidiTrackQueue::iterator> pos(trackCount);
+    std::vector<uint64_t> delay(trackCount, 0);
+    std::vector<bool> playing(trackCount, true);
+    size_t rowsCount = 0;
+
+    for(size_t tk = 0; tk < trackCount; ++tk)
+    {
+        pos[tk] = m_trackData[tk].begin();
+        rowsCount += m_trackData[tk].size();
+    }
+
+    m_eventStream.clear();
+    m_eventStream.reserve(rowsCount);
+
+    /*
+     * Replay the track-by-track scheduling once: every step handles one row
+     * of every track which delay has been expired, and then waits for the
+     * shortest delay of all tracks still playing.
+     */
+    for(;;)
+    {
+        const size_t stepBegin = m_eventStream.size();
+
+        for(size_t tk = 0; tk < trackCount; ++tk)
+        {
+            if(!playing[tk] || (delay[tk] > 0))
+                continue;
+
+            // Check is an end of track has been reached
+            if(pos[tk] == m_trackData[tk].end())
+            {
+                if(m_trackCut[tk])
+                {
+                    // The next row of the track is not received yet, this step is unknown
+                    m_eventStream.resize(stepBegin);
+                    return;
+                }
+                playing[tk] = false;
+                break;
+            }
+
+            const MidiTrackRow &row = *pos[tk];
+            StreamRow entry;
+            entry.row = &row;
+            entry.track = tk;
+            entry.delay = 0;
+            entry.stepEnd = false;
+            m_eventStream.push_back(entry);
+
+            // End of track event stops the track, unless any channel event follows it
+            bool trackEnd = false;
+            for(size_t i = 0; i < row.events.size(); ++i)
+            {
+                const MidiEvent &evt = row.events[i];
+                if(evt.type == MidiEvent::T_SPECIAL)
+                    trackEnd |= (evt.subtype == MidiEvent::ST_ENDTRACK);
+                else if(evt.type != MidiEvent::T_SYSEX &&
+                        evt.type != MidiEvent::T_SYSEX2 &&
+                        evt.type != MidiEvent::T_SYSCOMSNGSEL &&
+                        evt.type != MidiEvent::T_SYSCOMSPOSPTR)
+                    trackEnd = false;
+            }
+
+            if(trackEnd)
+                playing[tk] = false;
+            else
+            {
+                delay[tk] += row.delay;
+                pos[tk]++;
+            }
+        }
+
+        // Find a shortest delay from all track
+        uint64_t shortestDelay = 0;
+        bool     shortestDelayNotFound = true;
+
+        for(size_t tk = 0; tk < trackCount; ++tk)
+        {
+            if(playing[tk] && (shortestDelayNotFound || delay[tk] < shortestDelay))
+            {
+                shortestDelay = delay[tk];
+                shortestDelayNotFound = false;
+            }
+        }
+
+        for(size_t tk = 0; tk < trackCount; ++tk)
+        {
+            if(playing[tk])
+                delay[tk] -= shortestDelay;
+        }
+
+        if(shortestDelayNotFound && m_eventStream.size() == stepBegin)
+            break;
+
+        if(m_eventStream.size() == stepBegin)
+        {
+            // Nothing handled, the step still waits by itself
+            StreamRow entry;
+            entry.row = NULL;
+            entry.track = 0;
+            m_eventStream.push_back(entry);
+        }
 
+        StreamRow &last = m_eventStream.back();
+        last.stepEnd = true;
+        last.delay = shortestDelay;
+
+        if(shortestDelayNotFound)
+            break;
+    }
 }
 
 bool BW_MidiSequencer::processEvents(bool isSeek)
 {
-    if(m_currentPosition.track.size() == 0)
+    if(waitingData())
+        return false;   // The next events are not received yet
+    if(m_eventStream.empty())
         m_atEnd = true; // No MIDI track data to play
     if(m_atEnd)
         return false;   // No more events in the queue
 
     m_loop.caughtEnd = false;
-    const size_t        trackCount = m_currentPosition.track.size();
-    const Position      rowBeginPosition(m_currentPosition);
+    const size_t        rowsCount = m_eventStream.size();
+    const Position      &rowBeginPosition = m_rowBeginPosition;
+    m_rowBeginPosition = m_currentPosition;
     bool     doLoopJump = false;
     unsigned caughLoopStart = 0;
     unsigned caughLoopStackStart = 0;
     unsigned caughLoopStackEnds = 0;
     double   caughLoopStackEndsTime = 0.0;
     unsigned caughLoopStackBreaks = 0;
+    uint64_t shortestDelay = 0;
 
 #ifdef DEBUG_TIME_CALCULATION
     double maxTime = 0.0;
 #endif
 
-    for(size_t tk = 0; tk < trackCount; ++tk)
+    // Handle all rows of the current step
+    while(m_currentPosition.row < rowsCount)
     {
-        Position::TrackInfo &track = m_currentPosition.track[tk];
-        if((track.lastHandledEvent >= 0) && (track.delay <= 0))
+        const StreamRow &entry = m_eventStream[m_currentPosition.row++];
+        if(!entry.row)
         {
-            // Check is an end of track has been reached
-            if(track.pos == m_trackData[tk].end())
-            {
-                track.lastHandledEvent = -1;
-                break;
-            }
+            // Empty step of the ended track, only waits
+            shortestDelay = entry.delay;
+            break;
+        }
 
-            // Handle event
-            for(size_t i = 0; i < track.pos->events.size(); i++)
-            {
-                const MidiEvent &evt = track.pos->events[i];
+        const MidiTrackRow &row = *entry.row;
+
+        for(size_t i = 0; i < row.events.size(); i++)
+        {
+            const MidiEvent &evt = row.events[i];
 #ifdef ENABLE_BEGIN_SILENCE_SKIPPING
-                if(!m_currentPosition.began && (evt.type == MidiEvent::T_NOTEON))
-                    m_currentPosition.began = true;
+            if(!m_currentPosition.began && (evt.type == MidiEvent::T_NOTEON))
+                m_currentPosition.began = true;
 #endif
-                if(isSeek && (evt.type == MidiEvent::T_NOTEON))
-                    continue;
-                handleEvent(tk, evt, track.lastHandledEvent);
+            if(isSeek && (evt.type == MidiEvent::T_NOTEON))
+                continue;
+            handleEvent(entry.track, evt);
 
-                if(m_loop.caughtStart)
-                {
-                    if(m_interface->onloopStart) // Loop Start hook
-                        m_interface->onloopStart(m_interface->onloopStart_userData);
+            if(m_loop.caughtStart)
+            {
+                if(m_interface->onloopStart) // Loop Start hook
+                    m_interface->onloopStart(m_interface->onloopStart_userData);
 
-                    caughLoopStart++;
-                    m_loop.caughtStart = false;
-                }
+                caughLoopStart++;
+                m_loop.caughtStart = false;
+            }
 
-                if(m_loop.caughtStackStart)
-                {
-                    if(m_interface->onloopStart && (m_loopStartTime >= track.pos->time)) // Loop Start hook
-                        m_interface->onloopStart(m_interface->onloopStart_userData);
+            if(m_loop.caughtStackStart)
+            {
+                if(m_interface->onloopStart && (m_loopStartTime >= row.time)) // Loop Start hook
+                    m_interface->onloopStart(m_interface->onloopStart_userData);
 
-                    caughLoopStackStart++;
-                    m_loop.caughtStackStart = false;
-                }
+                caughLoopStackStart++;
+                m_loop.caughtStackStart = false;
+            }
 
-                if(m_loop.caughtStackBreak)
-                {
-                    caughLoopStackBreaks++;
-                    m_loop.caughtStackBreak = false;
-                }
+            if(m_loop.caughtStackBreak)
+            {
+                caughLoopStackBreaks++;
+                m_loop.caughtStackBreak = false;
+            }
 
-                if(m_loop.caughtEnd || m_loop.isStackEnd())
+            if(m_loop.caughtEnd || m_loop.isStackEnd())
+            {
+                if(m_loop.caughtStackEnd)
                 {
-                    if(m_loop.caughtStackEnd)
-                    {
-                        m_loop.caughtStackEnd = false;
-                        caughLoopStackEnds++;
-                        caughLoopStackEndsTime = track.pos->time;
-                    }
-                    doLoopJump = true;
-                    break; // Stop event handling on catching loopEnd event!
+                    m_loop.caughtStackEnd = false;
+                    caughLoopStackEnds++;
+                    caughLoopStackEndsTime = row.time;
                 }
+                doLoopJump = true;
+                break; // Stop event handling on catching loopEnd event!
             }
+        }
 
 #ifdef DEBUG_TIME_CALCULATION
-            if(maxTime < track.pos->time)
-                maxTime = track.pos->time;
+        if(maxTime < row.time)
+            maxTime = row.time;
 #endif
-            // Read next event time (unless the track just ended)
-            if(track.lastHandledEvent >= 0)
-            {
-                track.delay += track.pos->delay;
-                track.pos++;
-            }
 
-            if(doLoopJump)
-                break;
-        }
+        if(entry.stepEnd)
+            shortestDelay = entry.delay;
+
+        if(entry.stepEnd || doLoopJump)
+            break;
     }
 
 #ifdef DEBUG_TIME_CALCULATION
@@ -1125,30 +1774,13 @@ bool BW_MidiSequencer::processEvents(bool isSeek)
     std::fflush(stdout);
 #endif
 
-    // Find a shortest delay from all track
-    uint64_t shortestDelay = 0;
-    bool     shortestDelayNotFound = true;
-
-    for(size_t tk = 0; tk < trackCount; ++tk)
-    {
-        Position::TrackInfo &track = m_currentPosition.track[tk];
-        if((track.lastHandledEvent >= 0) && (shortestDelayNotFound || track.delay < shortestDelay))
-        {
-            shortestDelay = track.delay;
-            shortestDelayNotFound = false;
-        }
-    }
-
-    // Schedule the next playevent to be processed after that delay
-    for(size_t tk = 0; tk < trackCount; ++tk)
-        m_currentPosition.track[tk].delay -= shortestDelay;
-
-    fraction<uint64_t> t = shortestDelay * m_tempo;
+    // All tracks has been ended when nothing left to wait for
+    const bool shortestDelayNotFound = !m_partial && (m_currentPosition.row >= rowsCount) && (shortestDelay == 0);
 
 #ifdef ENABLE_BEGIN_SILENCE_SKIPPING
     if(m_currentPosition.began)
 #endif
-        m_currentPosition.wait += t.value();
+        addWaitTicks(shortestDelay);
 
     if(caughLoopStart > 0)
         m_loopBeginPosition = rowBeginPosition;
@@ -1191,11 +1823,12 @@ bool BW_MidiSequencer::processEvents(bool isSeek)
                     if(m_loopHooksOnly) // Stop song on reaching loop end
                     {
                         m_atEnd = true; // Don't handle events anymore
-                        m_currentPosition.wait += m_postSongWaitDelay; // One second delay until stop playing
+                        addWaitSeconds(m_postSongWaitDelay); // One second delay until stop playing
                     }
                 }
                 m_currentPosition = s.startPosition;
                 m_loop.skipStackStart = true;
+                m_loopJumps++;
                 return true;
             }
             else
@@ -1237,19 +1870,56 @@ bool BW_MidiSequencer::processEvents(bool isSeek)
         if(!m_loopEnabled || m_loopHooksOnly)
         {
             m_atEnd = true; // Don't handle events anymore
-            m_currentPosition.wait += m_postSongWaitDelay; // One second delay until stop playing
+            addWaitSeconds(m_postSongWaitDelay); // One second delay until stop playing
             return true; // We have caugh end here!
         }
         m_currentPosition = m_loopBeginPosition;
+        m_loopJumps++;
     }
 
     return true; // Has events in queue
 }
 
-BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, const uint8_t *end, int &status)
+void BW_MidiSequencer::addWaitTicks(uint64_t ticks)
+{
+    if(m_clockRate == 0)
+    {
+        fraction<uint64_t> t = ticks * m_tempo;
+        m_currentPosition.wait += t.value();
+        return;
+    }
+
+    if(ticks == 0)
+        return;
+
+    // Count the whole segment of the same tempo to don't lose a remainder on every delay
+    if(m_clockTempo.nom() != m_tempo.nom() || m_clockTempo.denom() != m_tempo.denom())
+    {
+        m_clockTempo = m_tempo;
+        m_clockTicks = 0;
+        m_clockDone = 0;
+    }
+
+    m_clockTicks += ticks;
+    const uint64_t unitsPerSecond = static_cast<uint64_t>(m_clockRate) << s_clockFrameShift;
+    const uint64_t total = clockMulDiv(m_clockTicks, m_tempo.nom() * unitsPerSecond, m_tempo.denom());
+    m_currentPosition.clockWait += static_cast<int64_t>(total - m_clockDone);
+    m_clockDone = total;
+}
+
+void BW_MidiSequencer::addWaitSeconds(double seconds)
+{
+    if(m_clockRate == 0)
+        m_currentPosition.wait += seconds;
+    else
+        m_currentPosition.clockWait += static_cast<int64_t>(seconds * m_clockRate) << s_clockFrameShift;
+}
+
+BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, const uint8_t *end, int &status, SmfTrackParse &track)
 {
     const uint8_t *&ptr = *pptr;
     BW_MidiSequencer::MidiEvent evt;
+    track.origin = SmfTrackNote::Origin_Track;
 
     if(ptr + 1 > end)
     {
@@ -1267,7 +1937,7 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
         uint64_t length = readVarLenEx(pptr, end, ok);
         if(!ok || (ptr + length > end))
         {
-            m_parsingErrorsString += "parseEvent: Can't read SysEx event - Unexpected end of track data.\n";
+            track.errors += "parseEvent: Can't read SysEx event - Unexpected end of track data.\n";
             evt.isValid = 0;
             return evt;
         }
@@ -1282,11 +1952,17 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
     if(byte == MidiEvent::T_SPECIAL)
     {
         // Special event FF
+        if(ptr + 1 > end)
+        {
+            track.errors += "parseEvent: Can't read Special event type - Unexpected end of track data.\n";
+            evt.isValid = 0;
+            return evt;
+        }
         uint8_t  evtype = *(ptr++);
         uint64_t length = readVarLenEx(pptr, end, ok);
         if(!ok || (ptr + length > end))
         {
-            m_parsingErrorsString += "parseEvent: Can't read Special event - Unexpected end of track data.\n";
+            track.errors += "parseEvent: Can't read Special event - Unexpected end of track data.\n";
             evt.isValid = 0;
             return evt;
         }
@@ -1305,52 +1981,8 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
         }
 #endif
 
-        /* TODO: Store those meta-strings separately and give ability to read them
-         * by external functions (to display song title and copyright in the player) */
-        if(evt.subtype == MidiEvent::ST_COPYRIGHT)
-        {
-            if(m_musCopyright.empty())
-            {
-                m_musCopyright = std::string((const char *)evt.data.data(), evt.data.size());
-                m_musCopyright.push_back('\0'); /* ending fix for UTF16 strings */
-                if(m_interface->onDebugMessage)
-                    m_interface->onDebugMessage(m_interface->onDebugMessage_userData, "Music copyright: %s", m_musCopyright.c_str());
-            }
-            else if(m_interface->onDebugMessage)
-            {
-                std::string str((const char *)evt.data.data(), evt.data.size());
-                str.push_back('\0'); /* ending fix for UTF16 strings */
-                m_interface->onDebugMessage(m_interface->onDebugMessage_userData, "Extra copyright event: %s", str.c_str());
-            }
-        }
-        else if(evt.subtype == MidiEvent::ST_SQTRKTITLE)
-        {
-            if(m_musTitle.empty())
-            {
-                m_musTitle = std::string((const char *)evt.data.data(), evt.data.size());
-                m_musTitle.push_back('\0'); /* ending fix for UTF16 strings */
-                if(m_interface->onDebugMessage)
-                    m_interface->onDebugMessage(m_interface->onDebugMessage_userData, "Music title: %s", m_musTitle.c_str());
-            }
-            else
-            {
-                std::string str((const char *)evt.data.data(), evt.data.size());
-                str.push_back('\0'); /* ending fix for UTF16 strings */
-                m_musTrackTitles.push_back(str);
-                if(m_interface->onDebugMessage)
-                    m_interface->onDebugMessage(m_interface->onDebugMessage_userData, "Track title: %s", str.c_str());
-            }
-        }
-        else if(evt.subtype == MidiEvent::ST_INSTRTITLE)
-        {
-            if(m_interface->onDebugMessage)
-            {
-                std::string str((const char *)evt.data.data(), evt.data.size());
-                str.push_back('\0'); /* ending fix for UTF16 strings */
-                m_interface->onDebugMessage(m_interface->onDebugMessage_userData, "Instrument: %s", str.c_str());
-            }
-        }
-        else if(evt.subtype == MidiEvent::ST_MARKER)
+        /* Meta-strings are stored by the merge of tracks in buildSmfTrackData() */
+        if(evt.subtype == MidiEvent::ST_MARKER)
         {
             // To lower
             for(size_t i = 0; i < data.size(); i++)
@@ -1382,17 +2014,7 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
                 uint8_t loops = static_cast<uint8_t>(atoi(data.substr(10).c_str()));
                 evt.data.clear();
                 evt.data.push_back(loops);
-
-                if(m_interface->onDebugMessage)
-                {
-                    m_interface->onDebugMessage(
-                        m_interface->onDebugMessage_userData,
-                        "Stack Marker Loop Start at %d to %d level with %d loops",
-                        m_loop.stackLevel,
-                        m_loop.stackLevel + 1,
-                        loops
-                    );
-                }
+                track.origin = SmfTrackNote::Origin_Marker;
                 return evt;
             }
 
@@ -1401,17 +2023,7 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
                 evt.type = MidiEvent::T_SPECIAL;
                 evt.subtype = MidiEvent::ST_LOOPSTACK_END;
                 evt.data.clear();
-
-                if(m_interface->onDebugMessage)
-                {
-                    m_interface->onDebugMessage(
-                        m_interface->onDebugMessage_userData,
-                        "Stack Marker Loop %s at %d to %d level",
-                        (evt.subtype == MidiEvent::ST_LOOPSTACK_END ? "End" : "Break"),
-                        m_loop.stackLevel,
-                        m_loop.stackLevel - 1
-                    );
-                }
+                track.origin = SmfTrackNote::Origin_Marker;
                 return evt;
             }
         }
@@ -1434,7 +2046,7 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
     {
         if(ptr + 1 > end)
         {
-            m_parsingErrorsString += "parseEvent: Can't read System Command Song Select event - Unexpected end of track data.\n";
+            track.errors += "parseEvent: Can't read System Command Song Select event - Unexpected end of track data.\n";
             evt.isValid = 0;
             return evt;
         }
@@ -1448,7 +2060,7 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
     {
         if(ptr + 2 > end)
         {
-            m_parsingErrorsString += "parseEvent: Can't read System Command Position Pointer event - Unexpected end of track data.\n";
+            track.errors += "parseEvent: Can't read System Command Position Pointer event - Unexpected end of track data.\n";
             evt.isValid = 0;
             return evt;
         }
@@ -1472,11 +2084,18 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
     case MidiEvent::T_WHEEL:
         if(ptr + 2 > end)
         {
-            m_parsingErrorsString += "parseEvent: Can't read regular 2-byte event - Unexpected end of track data.\n";
+            track.errors += "parseEvent: Can't read regular 2-byte event - Unexpected end of track data.\n";
             evt.isValid = 0;
             return evt;
         }
 
+        // The probe doesn't need notes data, only controllers may mark loop points
+        if(m_probeOnly && (evType != MidiEvent::T_CTRLCHANGE))
+        {
+            ptr += 2;
+            return evt;
+        }
+
         evt.data.push_back(*(ptr++));
         evt.data.push_back(*(ptr++));
 
@@ -1493,30 +2112,32 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
                 switch(evt.data[0])
                 {
                 case 110:
-                    if(m_loopFormat == Loop_Default)
+                    track.loopFormatUsed = true;
+                    if(track.loopFormat == Loop_Default)
                     {
                         // Change event type to custom Loop Start event and clear data
                         evt.type = MidiEvent::T_SPECIAL;
                         evt.subtype = MidiEvent::ST_LOOPSTART;
                         evt.data.clear();
-                        m_loopFormat = Loop_HMI;
+                        track.loopFormat = Loop_HMI;
                     }
-                    else if(m_loopFormat == Loop_HMI)
+                    else if(track.loopFormat == Loop_HMI)
                     {
                         // Repeating of 110'th point is BAD practice, treat as EMIDI
-                        m_loopFormat = Loop_EMIDI;
+                        track.loopFormat = Loop_EMIDI;
                     }
                     break;
 
                 case 111:
-                    if(m_loopFormat == Loop_HMI)
+                    track.loopFormatUsed = true;
+                    if(track.loopFormat == Loop_HMI)
                     {
                         // Change event type to custom Loop End event and clear data
                         evt.type = MidiEvent::T_SPECIAL;
                         evt.subtype = MidiEvent::ST_LOOPEND;
                         evt.data.clear();
                     }
-                    else if(m_loopFormat != Loop_EMIDI)
+                    else if(track.loopFormat != Loop_EMIDI)
                     {
                         // Change event type to custom Loop Start event and clear data
                         evt.type = MidiEvent::T_SPECIAL;
@@ -1526,7 +2147,8 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
                     break;
 
                 case 113:
-                    if(m_loopFormat == Loop_EMIDI)
+                    track.loopFormatUsed = true;
+                    if(track.loopFormat == Loop_EMIDI)
                     {
                         // EMIDI does using of CC113 with same purpose as CC7
                         evt.data[0] = 7;
@@ -1534,7 +2156,7 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
                     break;
 #if 0 //WIP
                 case 116:
-                    if(m_loopFormat == Loop_EMIDI)
+                    if(track.loopFormat == Loop_EMIDI)
                     {
                         evt.type = MidiEvent::T_SPECIAL;
                         evt.subtype = MidiEvent::ST_LOOPSTACK_BEGIN;
@@ -1555,7 +2177,7 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
                     break;
 
                 case 117:  // Next/Break Loop Controller
-                    if(m_loopFormat == Loop_EMIDI)
+                    if(track.loopFormat == Loop_EMIDI)
                     {
                         evt.type = MidiEvent::T_SPECIAL;
                         evt.subtype = MidiEvent::ST_LOOPSTACK_END;
@@ -1585,17 +2207,7 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
                     evt.subtype = MidiEvent::ST_LOOPSTACK_BEGIN;
                     evt.data[0] = evt.data[1];
                     evt.data.pop_back();
-
-                    if(m_interface->onDebugMessage)
-                    {
-                        m_interface->onDebugMessage(
-                            m_interface->onDebugMessage_userData,
-                            "Stack XMI Loop Start at %d to %d level with %d loops",
-                            m_loop.stackLevel,
-                            m_loop.stackLevel + 1,
-                            evt.data[0]
-                        );
-                    }
+                    track.origin = SmfTrackNote::Origin_XMI;
                     break;
 
                 case 117:  // Next/Break Loop Controller
@@ -1604,17 +2216,7 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
                                 MidiEvent::ST_LOOPSTACK_BREAK :
                                 MidiEvent::ST_LOOPSTACK_END;
                     evt.data.clear();
-
-                    if(m_interface->onDebugMessage)
-                    {
-                        m_interface->onDebugMessage(
-                            m_interface->onDebugMessage_userData,
-                            "Stack XMI Loop %s at %d to %d level",
-                            (evt.subtype == MidiEvent::ST_LOOPSTACK_END ? "End" : "Break"),
-                            m_loop.stackLevel,
-                            m_loop.stackLevel - 1
-                        );
-                    }
+                    track.origin = SmfTrackNote::Origin_XMI;
                     break;
 
                 case 119:  // Callback Trigger
@@ -1631,10 +2233,15 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
     case MidiEvent::T_CHANAFTTOUCH:
         if(ptr + 1 > end)
         {
-            m_parsingErrorsString += "parseEvent: Can't read regular 1-byte event - Unexpected end of track data.\n";
+            track.errors += "parseEvent: Can't read regular 1-byte event - Unexpected end of track data.\n";
             evt.isValid = 0;
             return evt;
         }
+        if(m_probeOnly)
+        {
+            ptr++;
+            return evt;
+        }
         evt.data.push_back(*(ptr++));
         return evt;
     default:
@@ -1644,7 +2251,7 @@ BW_MidiSequencer::MidiEvent BW_MidiSequencer::parseEvent(const uint8_t **pptr, c
     return evt;
 }
 
-void BW_MidiSequencer::handleEvent(size_t track, const BW_MidiSequencer::MidiEvent &evt, int32_t &status)
+void BW_MidiSequencer::handleEvent(size_t track, const BW_MidiSequencer::MidiEvent &evt)
 {
     if(track == 0 && m_smfFormat < 2 && evt.type == MidiEvent::T_SPECIAL &&
        (evt.subtype == MidiEvent::ST_TEMPOCHANGE || evt.subtype == MidiEvent::ST_TIMESIGNATURE))
@@ -1684,10 +2291,7 @@ void BW_MidiSequencer::handleEvent(size_t track, const BW_MidiSequencer::MidiEve
             m_interface->rt_metaEvent(m_interface->rtUserData, evtype, reinterpret_cast<const uint8_t*>(data), size_t(length));
 
         if(evtype == MidiEvent::ST_ENDTRACK) // End Of Track
-        {
-            status = -1;
             return;
-        }
 
         if(evtype == MidiEvent::ST_TEMPOCHANGE) // Tempo change
         {
@@ -1787,7 +2391,6 @@ void BW_MidiSequencer::handleEvent(size_t track, const BW_MidiSequencer::MidiEve
     size_t midCh = evt.channel;
     if(m_interface->rt_currentDevice)
         midCh += m_interface->rt_currentDevice(m_interface->rtUserData, track);
-    status = evt.type;
 
     switch(evt.type)
     {
@@ -1883,6 +2486,87 @@ double BW_MidiSequencer::Tick(double s, double granularity)
 }
 
 
+void BW_MidiSequencer::clockAdvance(uint64_t units, bool isSeek)
+{
+    m_currentPosition.clockWait -= static_cast<int64_t>(units);
+    m_currentPosition.clockTime += units;
+
+    int antiFreezeCounter = 10000; // Limit 10000 loops to avoid freezing
+    while((m_currentPosition.clockWait < s_clockHalfFrame) && (antiFreezeCounter > 0))
+    {
+        if(!processEvents(isSeek))
+            break;
+        if(m_currentPosition.clockWait <= 0)
+            antiFreezeCounter--;
+    }
+
+    if(antiFreezeCounter <= 0)
+        addWaitSeconds(1.0); /* Add extra 1 second when over 10000 events
+                                with zero delay are been detected */
+}
+
+uint64_t BW_MidiSequencer::tickFrames(uint64_t frames)
+{
+    assert(m_interface); // MIDI output interface must be defined!
+    assert(m_clockRate > 0);
+
+    clockAdvance(frames * m_clockMultiplier, false);
+
+    return clockWaitFrames();
+}
+
+uint64_t BW_MidiSequencer::clockWaitFrames() const
+{
+    if(m_currentPosition.clockWait < s_clockHalfFrame)
+        return 0;
+    // The next event is handled at the nearest output frame
+    return static_cast<uint64_t>(m_currentPosition.clockWait - s_clockHalfFrame) / m_clockMultiplier + 1;
+}
+
+void BW_MidiSequencer::convertClock(Position &pos, uint32_t fromRate, uint32_t toRate)
+{
+    double wait = pos.wait, time = pos.absTimePosition;
+    if(fromRate > 0)
+    {
+        const double unitsPerSecond = static_cast<double>(static_cast<uint64_t>(fromRate) << s_clockFrameShift);
+        wait = static_cast<double>(pos.clockWait) / unitsPerSecond;
+        time = static_cast<double>(pos.clockTime) / unitsPerSecond;
+    }
+
+    if(toRate > 0)
+    {
+        const double unitsPerSecond = static_cast<double>(static_cast<uint64_t>(toRate) << s_clockFrameShift);
+        pos.clockWait = static_cast<int64_t>(wait * unitsPerSecond);
+        pos.clockTime = static_cast<uint64_t>(time * unitsPerSecond);
+    }
+    else
+    {
+        pos.wait = wait;
+        pos.absTimePosition = time;
+    }
+}
+
+void BW_MidiSequencer::setParseThreads(unsigned threads)
+{
+    m_parseThreads = (threads > 1) ? threads : 1;
+}
+
+void BW_MidiSequencer::setClockRate(uint32_t rate)
+{
+    if(rate == m_clockRate)
+        return;
+
+    convertClock(m_currentPosition, m_clockRate, rate);
+    convertClock(m_trackBeginPosition, m_clockRate, rate);
+    convertClock(m_loopBeginPosition, m_clockRate, rate);
+    for(size_t i = 0; i < m_loop.stack.size(); ++i)
+        convertClock(m_loop.stack[i].startPosition, m_clockRate, rate);
+
+    m_clockRate = rate;
+    m_clockTicks = 0;
+    m_clockDone = 0;
+}
+
 double BW_MidiSequencer::seek(double seconds, const double granularity)
 {
     if(seconds < 0.0)
@@ -1918,6 +2602,33 @@ double BW_MidiSequencer::seek(double seconds, const double granularity)
      */
     m_loop.caughtStart   = false;
 
+    if(m_clockRate > 0)
+    {
+        const double unitsPerSecond = static_cast<double>(static_cast<uint64_t>(m_clockRate) << s_clockFrameShift);
+        const double endTime = seconds < m_fullSongTimeLength ? seconds : m_fullSongTimeLength;
+        const uint64_t end = static_cast<uint64_t>(endTime * unitsPerSecond);
+
+        // Jump from event to event, the song time doesn't depend on the tempo multiplier here
+        clockAdvance(0, true);
+        while(m_currentPosition.clockTime < end)
+        {
+            const uint64_t left = end - m_currentPosition.clockTime;
+            uint64_t units = left;
+            if(m_currentPosition.clockWait >= s_clockHalfFrame)
+                units = static_cast<uint64_t>(m_currentPosition.clockWait - s_clockHalfFrame) + 1;
+            clockAdvance(units < left ? units : left, true);
+        }
+
+        if(m_currentPosition.clockWait < 0)
+            m_currentPosition.clockWait = 0;
+
+        m_time.reset();
+        m_time.delay = static_cast<double>(m_currentPosition.clockWait) / unitsPerSecond;
+
+        m_loopEnabled = loopFlagState;
+        return m_time.delay;
+    }
+
     while((m_currentPosition.absTimePosition < seconds) &&
           (m_currentPosition.absTimePosition < m_fullSongTimeLength))
     {
@@ -1954,8 +2665,180 @@ double BW_MidiSequencer::seek(double seconds, const double granularity)
     return m_currentPosition.wait;
 }
 
+template<class T>
+static inline void statePut(std::vector<uint8_t> &out, const T &value)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&value);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+template<class T>
+static inline bool stateGet(const uint8_t **ptr, const uint8_t *end, T &value)
+{
+    if(static_cast<size_t>(end - *ptr) < sizeof(T))
+        return false;
+    std::memcpy(&value, *ptr, sizeof(T));
+    *ptr += sizeof(T);
+    return true;
+}
+
+void BW_MidiSequencer::savePosition(std::vector<uint8_t> &out, const Position &pos)
+{
+    statePut(out, static_cast<uint8_t>(pos.began ? 1 : 0));
+    statePut(out, pos.wait);
+    statePut(out, pos.absTimePosition);
+    statePut(out, static_cast<uint64_t>(pos.row));
+    statePut(out, pos.clockWait);
+    statePut(out, pos.clockTime);
+}
+
+bool BW_MidiSequencer::loadPosition(const uint8_t **ptr, const uint8_t *end, Position &pos)
+{
+    uint8_t began;
+    uint64_t row;
+
+    if(!stateGet(ptr, end, began) ||
+       !stateGet(ptr, end, pos.wait) ||
+       !stateGet(ptr, end, pos.absTimePosition) ||
+       !stateGet(ptr, end, row) ||
+       !stateGet(ptr, end, pos.clockWait) ||
+       !stateGet(ptr, end, pos.clockTime))
+        return false;
+
+    if(row > m_eventStream.size())
+        return false;
+
+    pos.began = (began != 0);
+    pos.row = static_cast<size_t>(row);
+
+    return true;
+}
+
+void BW_MidiSequencer::saveState(std::vector<uint8_t> &out, bool fingerprint)
+{
+    savePosition(out, m_currentPosition);
+    savePosition(out, m_loopBeginPosition);
+
+    statePut(out, m_tempo.nom());
+    statePut(out, m_tempo.denom());
+    statePut(out, static_cast<uint8_t>(m_atEnd ? 1 : 0));
+    statePut(out, m_time.timeRest);
+    statePut(out, m_time.delay);
+    statePut(out, m_clockTempo.nom());
+    statePut(out, m_clockTempo.denom());
+    if(fingerprint)
+    {
+        // Only the remainder of the last division affects delays of next ticks
+        const uint64_t unitsPerSecond = static_cast<uint64_t>(m_clockRate) << s_clockFrameShift;
+        const uint64_t rest = m_clockTicks * (m_clockTempo.nom() * unitsPerSecond) -
+                              m_clockDone * m_clockTempo.denom();
+        statePut(out, rest);
+    }
+    else
+    {
+        statePut(out, m_clockTicks);
+        statePut(out, m_clockDone);
+    }
+
+    const uint8_t loopFlags = static_cast<uint8_t>((m_loop.caughtStart ? 0x01 : 0) |
+                                                   (m_loop.caughtEnd ? 0x02 : 0) |
+                                                   (m_loop.caughtStackStart ? 0x04 : 0) |
+                                                   (m_loop.caughtStackEnd ? 0x08 : 0) |
+                                                   (m_loop.caughtStackBreak ? 0x10 : 0) |
+                                                   (m_loop.skipStackStart ? 0x20 : 0) |
+                                                   (m_loop.invalidLoop ? 0x40 : 0));
+    statePut(out, loopFlags);
+    statePut(out, static_cast<int32_t>(m_loop.stackLevel));
+    statePut(out, static_cast<uint32_t>(m_loop.stack.size()));
+    for(size_t i = 0; i < m_loop.stack.size(); ++i)
+    {
+        const LoopStackEntry &e = m_loop.stack[i];
+        statePut(out, static_cast<uint8_t>(e.infinity ? 1 : 0));
+        statePut(out, static_cast<int32_t>(e.loops));
+        statePut(out, e.start);
+        statePut(out, e.end);
+        savePosition(out, e.startPosition);
+    }
+}
+
+size_t BW_MidiSequencer::loadState(const uint8_t *data, size_t size, bool apply)
+{
+    const uint8_t *ptr = data;
+    const uint8_t *end = data + size;
+    Position current, loopBegin;
+    uint64_t tempoNom, tempoDenom;
+    uint8_t atEnd, loopFlags;
+    double timeRest, timeDelay;
+    uint64_t clockTempoNom, clockTempoDenom, clockTicks, clockDone;
+    int32_t stackLevel;
+    uint32_t stackSize;
+
+    if(!loadPosition(&ptr, end, current) ||
+       !loadPosition(&ptr, end, loopBegin) ||
+       !stateGet(&ptr, end, tempoNom) ||
+       !stateGet(&ptr, end, tempoDenom) ||
+       !stateGet(&ptr, end, atEnd) ||
+       !stateGet(&ptr, end, timeRest) ||
+       !stateGet(&ptr, end, timeDelay) ||
+       !stateGet(&ptr, end, clockTempoNom) ||
+       !stateGet(&ptr, end, clockTempoDenom) ||
+       !stateGet(&ptr, end, clockTicks) ||
+       !stateGet(&ptr, end, clockDone) ||
+       !stateGet(&ptr, end, loopFlags) ||
+       !stateGet(&ptr, end, stackLevel) ||
+       !stateGet(&ptr, end, stackSize))
+        return 0;
+
+    if(tempoDenom == 0 || clockTempoDenom == 0 || stackSize > static_cast<size_t>(end - ptr))
+        return 0;
+
+    std::vector<LoopStackEntry> stack(stackSize);
+    for(size_t i = 0; i < stackSize; ++i)
+    {
+        LoopStackEntry &e = stack[i];
+        uint8_t infinity;
+        int32_t loops;
+        if(!stateGet(&ptr, end, infinity) ||
+           !stateGet(&ptr, end, loops) ||
+           !stateGet(&ptr, end, e.start) ||
+           !stateGet(&ptr, end, e.end) ||
+           !loadPosition(&ptr, end, e.startPosition))
+            return 0;
+        e.infinity = (infinity != 0);
+        e.loops = loops;
+    }
+
+    if(!apply)
+        return static_cast<size_t>(ptr - data);
+
+    m_currentPosition = current;
+    m_loopBeginPosition = loopBegin;
+    m_tempo = fraction<uint64_t>(tempoNom, tempoDenom);
+    m_atEnd = (atEnd != 0);
+    m_time.timeRest = timeRest;
+    m_time.delay = timeDelay;
+    m_clockTempo = fraction<uint64_t>(clockTempoNom, clockTempoDenom);
+    m_clockTicks = clockTicks;
+    m_clockDone = clockDone;
+
+    m_loop.caughtStart = (loopFlags & 0x01) != 0;
+    m_loop.caughtEnd = (loopFlags & 0x02) != 0;
+    m_loop.caughtStackStart = (loopFlags & 0x04) != 0;
+    m_loop.caughtStackEnd = (loopFlags & 0x08) != 0;
+    m_loop.caughtStackBreak = (loopFlags & 0x10) != 0;
+    m_loop.skipStackStart = (loopFlags & 0x20) != 0;
+    m_loop.invalidLoop = (loopFlags & 0x40) != 0;
+    m_loop.stackLevel = stackLevel;
+    m_loop.stack.swap(stack);
+
+    return static_cast<size_t>(ptr - data);
+}
+
 double BW_MidiSequencer::tell()
 {
+    if(m_clockRate > 0)
+        return static_cast<double>(m_currentPosition.clockTime) /
+               static_cast<double>(static_cast<uint64_t>(m_clockRate) << s_clockFrameShift);
     return m_currentPosition.absTimePosition;
 }
 
@@ -1982,11 +2865,18 @@ void BW_MidiSequencer::rewind()
     m_loop.reset();
     m_loop.caughtStart  = true;
     m_time.reset();
+
+    // The integer clock counts the tempo segment from the begin again
+    m_clockTicks        = 0;
+    m_clockDone         = 0;
 }
 
 void BW_MidiSequencer::setTempo(double tempo)
 {
     m_tempoMultiplier = tempo;
+    m_clockMultiplier = static_cast<uint64_t>(tempo * (1 << s_clockFrameShift) + 0.5);
+    if(m_clockMultiplier == 0)
+        m_clockMultiplier = 1;
 }
 
 bool BW_MidiSequencer::loadMIDI(const std::string &filename)
@@ -2242,7 +3132,8 @@ bool BW_MidiSequencer::parseIMF(FileAndMemReader &fr)
         event.absPosition = abs_position;
         event.isValid = 1;
 
-        evtPos.events.push_back(event);
+        if(!m_probeOnly)
+            evtPos.events.push_back(event);
         evtPos.delay = static_cast<uint64_t>(imfRaw[2]) + 256 * static_cast<uint64_t>(imfRaw[3]);
 
         if(evtPos.delay > 0)
@@ -2259,9 +3150,6 @@ bool BW_MidiSequencer::parseIMF(FileAndMemReader &fr)
     abs_position += evtPos.delay;
     m_trackData[0].push_back(evtPos);
 
-    if(!m_trackData[0].empty())
-        m_currentPosition.track[0].pos = m_trackData[0].begin();
-
     buildTimeLine(temposList);
 
     return true;
@@ -2574,6 +3462,8 @@ bool BW_MidiSequencer::parseSMF(FileAndMemReader &fr)
     m_tempo         = fraction<uint64_t>(1,            static_cast<uint64_t>(deltaTicks) * 2);
 
     size_t totalGotten = 0;
+    //! Count of tracks received fully, the partial data may end at any point
+    size_t completeTracks = TrackCount;
 
     for(size_t tk = 0; tk < TrackCount; ++tk)
     {
@@ -2581,6 +3471,11 @@ bool BW_MidiSequencer::parseSMF(FileAndMemReader &fr)
         size_t trackLength;
 
         fsize = fr.read(headerBuf, 1, 8);
+        if(m_partialData && (fsize < 8))
+        {
+            completeTracks = tk;
+            break;
+        }
         if((fsize < 8) || (std::memcmp(headerBuf, "MTrk", 4) != 0))
         {
             m_errorString = fr.fileName() + ": Invalid format, MTrk signature is not found!\n";
@@ -2591,6 +3486,12 @@ bool BW_MidiSequencer::parseSMF(FileAndMemReader &fr)
         // Read track data
         rawTrackData[tk].resize(trackLength);
         fsize = fr.read(&rawTrackData[tk][0], 1, trackLength);
+        if(m_partialData && (fsize < trackLength))
+        {
+            rawTrackData[tk].resize(fsize);
+            completeTracks = tk;
+            break;
+        }
         if(fsize < trackLength)
         {
             m_errorString = fr.fileName() + ": Unexpected file ending while getting raw track data!\n";
@@ -2610,7 +3511,7 @@ bool BW_MidiSequencer::parseSMF(FileAndMemReader &fr)
     }
 
     // Build new MIDI events table
-    if(!buildSmfTrackData(rawTrackData))
+    if(!buildSmfTrackData(rawTrackData, completeTracks))
     {
         m_errorString = fr.fileName() + ": MIDI data parsing error has occouped!\n" + m_parsingErrorsString;
         return false;
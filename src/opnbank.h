@@ -97,7 +97,9 @@ struct OpnInstMeta
     enum
     {
         Flag_Pseudo8op = 0x01,
-        Flag_NoSound = 0x02
+        Flag_NoSound = 0x02,
+        //! Instrument is not decoded yet from the lazily loaded bank (always together with Flag_NoSound)
+        Flag_Unloaded = 0x80
     };
 
     //! Operator data
@@ -27,12 +27,82 @@
 #include "chips/opn_chip_base.h"
 #ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
 #include "midi_sequencer.hpp"
+#include "file_reader.hpp"
 #endif
 
 /* Unify MIDI player casting and interface between ADLMIDI and OPNMIDI */
 #define GET_MIDI_PLAYER(device) reinterpret_cast<OPNMIDIplay *>((device)->opn2_midiPlayer)
 typedef OPNMIDIplay MidiPlayer;
 
+#ifndef OPNMIDI_DISABLE_ASYNC_RENDER
+/* Suspend the render-ahead worker while changing the playback state, and drop the rendered output */
+#define ASYNC_RENDER_SUSPEND(play) OPNMIDIAsyncRender::Suspend asyncSuspend((play)->m_asyncRender.get(), true)
+/* Suspend the render-ahead worker while reading the playback state */
+#define ASYNC_RENDER_LOCK(play) OPNMIDIAsyncRender::Suspend asyncSuspend((play)->m_asyncRender.get(), false)
+#else
+#define ASYNC_RENDER_SUSPEND(play)
+#define ASYNC_RENDER_LOCK(play)
+#endif
+
+#if !defined(OPNMIDI_DISABLE_LOOP_CACHE) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+static void LeaveLoopCache(MidiPlayer *player);
+static void DropLoopCache(MidiPlayer *player);
+/* Continue by the live rendering from the replayed position before changing the playback state */
+#define LOOP_CACHE_LEAVE(play) LeaveLoopCache(play)
+/* Forget the recorded loop when the playback position gets replaced */
+#define LOOP_CACHE_DROP(play) DropLoopCache(play)
+#else
+#define LOOP_CACHE_LEAVE(play)
+#define LOOP_CACHE_DROP(play)
+#endif
+
+/**
+ * @brief Pass the real-time event to the render path without waiting for it
+ *
+ * Events are queued while the render-ahead worker runs, and while the loop cache
+ * is replayed, so the replay gets left at the next saved state.
+ *
+ * @return true when the event is queued, false when the caller must apply it by itself
+ */
+static bool QueueEvent(MidiPlayer *play, const OPNMIDIEventQueue::Event &event)
+{
+    if(!play->m_eventQueue.get())
+        return false;
+#if !defined(OPNMIDI_DISABLE_ASYNC_RENDER) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    OPNMIDIAsyncRender *render = play->m_asyncRender.get();
+    if(render && render->isRunning())
+        return play->m_eventQueue->push(event);
+#endif
+#if !defined(OPNMIDI_DISABLE_LOOP_CACHE) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    if(play->m_loopCache.get() && play->m_loopCache->replaying())
+        return play->m_eventQueue->push(event);
+#endif
+    ADL_UNUSED(event);
+    return false;
+}
+
+static bool QueueEvent(MidiPlayer *play, uint8_t type, uint8_t channel = 0,
+                       uint8_t a = 0, uint8_t b = 0, uint16_t value = 0)
+{
+    OPNMIDIEventQueue::Event event;
+    event.type = type;
+    event.channel = channel;
+    event.a = a;
+    event.b = b;
+    event.value = value;
+    event.size = 0;
+    return QueueEvent(play, event);
+}
+
+static void ApplyQueuedEvents(MidiPlayer *play)
+{
+    if(play->m_eventQueue.get() && !play->m_eventQueue->empty())
+        play->m_eventQueue->apply(*play);
+}
+
+/* Apply the real-time event right now, after events queued before it */
+#define RT_EVENT_DIRECT(play) ASYNC_RENDER_LOCK(play); LOOP_CACHE_LEAVE(play); ApplyQueuedEvents(play)
+
 static OPN2_Version opn2_version = {
     OPNMIDI_VERSION_MAJOR,
     OPNMIDI_VERSION_MINOR,
@@ -75,6 +145,7 @@ OPNMIDI_EXPORT int opn2_setDeviceIdentifier(OPN2_MIDIPlayer *device, unsigned id
         return -1;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     play->setDeviceId(static_cast<uint8_t>(id));
     return 0;
 }
@@ -86,6 +157,7 @@ OPNMIDI_EXPORT int opn2_setNumChips(OPN2_MIDIPlayer *device, int numCards)
 
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     play->m_setup.numChips = static_cast<unsigned int>(numCards);
     if(play->m_setup.numChips < 1 || play->m_setup.numChips > OPN_MAX_CHIPS)
     {
@@ -122,6 +194,29 @@ OPNMIDI_EXPORT int opn2_getNumChipsObtained(struct OPN2_MIDIPlayer *device)
 }
 
 
+OPNMIDI_EXPORT int opn2_setDynamicChips(struct OPN2_MIDIPlayer *device, int enabled)
+{
+    if(device == NULL)
+        return -2;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    ASYNC_RENDER_LOCK(play);
+    LOOP_CACHE_LEAVE(play);
+    play->m_setup.dynamicChips = (enabled != 0);
+    if(!play->m_setup.dynamicChips)
+        play->m_synth->m_numActiveChips = play->m_synth->m_numChips;
+    return 0;
+}
+
+OPNMIDI_EXPORT int opn2_getNumChipsActive(struct OPN2_MIDIPlayer *device)
+{
+    if(device == NULL)
+        return -2;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    return (int)play->m_synth->m_numActiveChips;
+}
+
 OPNMIDI_EXPORT int opn2_reserveBanks(OPN2_MIDIPlayer *device, unsigned banks)
 {
     if(!device)
@@ -145,6 +240,8 @@ OPNMIDI_EXPORT int opn2_getBank(OPN2_MIDIPlayer *device, const OPN2_BankId *idp,
 
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    // Banks become editable, so have all of them loaded
+    play->m_synth->loadLazyBanks();
     Synth::BankMap &map = play->m_synth->m_insBanks;
 
     Synth::BankMap::iterator it;
@@ -172,6 +269,7 @@ OPNMIDI_EXPORT int opn2_getBank(OPN2_MIDIPlayer *device, const OPN2_BankId *idp,
         else
             ir = map.insert(value);
         it = ir.first;
+        ++play->m_synth->m_insBanksRevision;
     }
 
     it.to_ptrs(bank->pointer);
@@ -198,10 +296,12 @@ OPNMIDI_EXPORT int opn2_removeBank(OPN2_MIDIPlayer *device, OPN2_Bank *bank)
 
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     Synth::BankMap &map = play->m_synth->m_insBanks;
     Synth::BankMap::iterator it = Synth::BankMap::iterator::from_ptrs(bank->pointer);
     size_t size = map.size();
     map.erase(it);
+    ++play->m_synth->m_insBanksRevision;
     return (map.size() != size) ? 0 : -1;
 }
 
@@ -212,6 +312,7 @@ OPNMIDI_EXPORT int opn2_getFirstBank(OPN2_MIDIPlayer *device, OPN2_Bank *bank)
 
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    play->m_synth->loadLazyBanks();
     Synth::BankMap &map = play->m_synth->m_insBanks;
 
     Synth::BankMap::iterator it = map.begin();
@@ -258,8 +359,12 @@ OPNMIDI_EXPORT int opn2_setInstrument(OPN2_MIDIPlayer *device, OPN2_Bank *bank,
     if(ins->version != 0)
         return -1;
 
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    LOOP_CACHE_LEAVE(play);
     Synth::BankMap::iterator it = Synth::BankMap::iterator::from_ptrs(bank->pointer);
     cvt_OPNI_to_FMIns(it->second.ins[index], *ins);
+    ++play->m_synth->m_insBanksRevision;
     return 0;
 }
 
@@ -269,6 +374,7 @@ OPNMIDI_EXPORT int opn2_openBankFile(OPN2_MIDIPlayer *device, const char *filePa
     {
         MidiPlayer *play = GET_MIDI_PLAYER(device);
         assert(play);
+        LOOP_CACHE_LEAVE(play);
         play->m_setup.tick_skip_samples_delay = 0;
         if(!play->LoadBank(filePath))
         {
@@ -290,6 +396,7 @@ OPNMIDI_EXPORT int opn2_openBankData(OPN2_MIDIPlayer *device, const void *mem, l
     {
         MidiPlayer *play = GET_MIDI_PLAYER(device);
         assert(play);
+        LOOP_CACHE_LEAVE(play);
         play->m_setup.tick_skip_samples_delay = 0;
         if(!play->LoadBank(mem, static_cast<size_t>(size)))
         {
@@ -305,11 +412,56 @@ OPNMIDI_EXPORT int opn2_openBankData(OPN2_MIDIPlayer *device, const void *mem, l
     return -1;
 }
 
+OPNMIDI_EXPORT void opn2_setLazyBankLoading(OPN2_MIDIPlayer *device, int enabled)
+{
+    if(!device)
+        return;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    play->m_setup.lazyBanks = (enabled != 0);
+}
+
+OPNMIDI_EXPORT int opn2_saveBankImage(OPN2_MIDIPlayer *device, const char *filePath)
+{
+    if(!device)
+    {
+        OPN2MIDI_ErrorString = "Can't save bank image: OPN2 MIDI is not initialized";
+        return -1;
+    }
+
+    if(!filePath)
+        return -1;
+
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+
+    std::vector<uint8_t> image;
+    if(!play->SaveBankImage(image))
+        return -1;
+
+    std::FILE *file = std::fopen(filePath, "wb");
+    if(!file)
+    {
+        play->setErrorString("OPN2 MIDI: Can't open bank image file for writing");
+        return -1;
+    }
+
+    size_t written = std::fwrite(&image[0], 1, image.size(), file);
+    if(std::fclose(file) != 0 || written != image.size())
+    {
+        play->setErrorString("OPN2 MIDI: Can't write bank image file");
+        return -1;
+    }
+
+    return 0;
+}
+
 OPNMIDI_EXPORT void opn2_setLfoEnabled(struct OPN2_MIDIPlayer *device, int lfoEnable)
 {
     if(!device) return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     Synth &synth = *play->m_synth;
     play->m_setup.lfoEnable = lfoEnable;
     synth.m_lfoEnable = (lfoEnable < 0 ?
@@ -331,6 +483,7 @@ OPNMIDI_EXPORT void opn2_setLfoFrequency(struct OPN2_MIDIPlayer *device, int lfo
     if(!device) return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     Synth &synth = *play->m_synth;
     play->m_setup.lfoFrequency = lfoFrequency;
     synth.m_lfoFrequency = lfoFrequency < 0 ?
@@ -353,6 +506,7 @@ OPNMIDI_EXPORT void opn2_setChipType(struct OPN2_MIDIPlayer *device, int chipTyp
     if(!device) return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     play->m_setup.chipType = chipType;
     play->applySetup();
 }
@@ -372,6 +526,7 @@ OPNMIDI_EXPORT void opn2_setScaleModulators(OPN2_MIDIPlayer *device, int smod)
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     play->m_setup.ScaleModulators = smod;
     play->m_synth->m_scaleModulators = (play->m_setup.ScaleModulators != 0);
 }
@@ -382,6 +537,7 @@ OPNMIDI_EXPORT void opn2_setFullRangeBrightness(struct OPN2_MIDIPlayer *device,
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     play->m_setup.fullRangeBrightnessCC74 = (fr_brightness != 0);
 }
 
@@ -391,6 +547,7 @@ OPNMIDI_EXPORT void opn2_setAutoArpeggio(OPN2_MIDIPlayer *device, int aaEn)
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     play->m_setup.enableAutoArpeggio = (aaEn != 0);
 }
 
@@ -401,6 +558,8 @@ OPNMIDI_EXPORT void opn2_setLoopEnabled(OPN2_MIDIPlayer *device, int loopEn)
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    ASYNC_RENDER_SUSPEND(play);
+    LOOP_CACHE_LEAVE(play);
     play->m_sequencer->setLoopEnabled(loopEn != 0);
 #else
     ADL_UNUSED(device);
@@ -408,12 +567,41 @@ OPNMIDI_EXPORT void opn2_setLoopEnabled(OPN2_MIDIPlayer *device, int loopEn)
 #endif
 }
 
+OPNMIDI_EXPORT int opn2_setLoopCache(struct OPN2_MIDIPlayer *device, double maxSeconds)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+#if !defined(OPNMIDI_DISABLE_LOOP_CACHE) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    if(maxSeconds < 0.0)
+    {
+        play->setErrorString("OPN2 MIDI: Negative length of the loop cache!");
+        return -1;
+    }
+    ASYNC_RENDER_LOCK(play);
+    LOOP_CACHE_LEAVE(play);
+    if(!play->m_loopCache.get())
+        play->m_loopCache.reset(new OPNMIDILoopCache);
+    if(!play->m_eventQueue.get())
+        play->m_eventQueue.reset(new OPNMIDIEventQueue);
+    const double rate = static_cast<double>(play->m_setup.PCM_RATE);
+    play->m_loopCache->setLimit(static_cast<size_t>(maxSeconds * rate), play->m_setup.PCM_RATE);
+    return 0;
+#else
+    ADL_UNUSED(maxSeconds);
+    play->setErrorString("OPN2 MIDI: Loop cache is not supported in this build of library!");
+    return -1;
+#endif
+}
+
 OPNMIDI_EXPORT void opn2_setSoftPanEnabled(OPN2_MIDIPlayer *device, int softPanEn)
 {
     if(!device)
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     play->m_synth->m_softPanning = (softPanEn != 0);
 }
 
@@ -424,6 +612,7 @@ OPNMIDI_EXPORT void opn2_setLogarithmicVolumes(struct OPN2_MIDIPlayer *device, i
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     Synth &synth = *play->m_synth;
     play->m_setup.LogarithmicVolumes = static_cast<unsigned int>(logvol);
     if(!synth.setupLocked())
@@ -441,6 +630,7 @@ OPNMIDI_EXPORT void opn2_setVolumeRangeModel(OPN2_MIDIPlayer *device, int volume
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     Synth &synth = *play->m_synth;
     play->m_setup.VolumeModel = volumeModel;
     if(!synth.setupLocked())
@@ -467,6 +657,8 @@ OPNMIDI_EXPORT int opn2_openFile(OPN2_MIDIPlayer *device, const char *filePath)
     {
         MidiPlayer *play = GET_MIDI_PLAYER(device);
         assert(play);
+        ASYNC_RENDER_SUSPEND(play);
+        LOOP_CACHE_DROP(play);
 #ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
         play->m_setup.tick_skip_samples_delay = 0;
         if(!play->LoadMIDI(filePath))
@@ -494,6 +686,8 @@ OPNMIDI_EXPORT int opn2_openData(OPN2_MIDIPlayer *device, const void *mem, unsig
     {
         MidiPlayer *play = GET_MIDI_PLAYER(device);
         assert(play);
+        ASYNC_RENDER_SUSPEND(play);
+        LOOP_CACHE_DROP(play);
 #ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
         play->m_setup.tick_skip_samples_delay = 0;
         if(!play->LoadMIDI(mem, static_cast<size_t>(size)))
@@ -516,6 +710,145 @@ OPNMIDI_EXPORT int opn2_openData(OPN2_MIDIPlayer *device, const void *mem, unsig
     return -1;
 }
 
+OPNMIDI_EXPORT int opn2_openStream(struct OPN2_MIDIPlayer *device, OPN2_StreamReadFunc read, void *userData, double prebuffer)
+{
+    if(device)
+    {
+        MidiPlayer *play = GET_MIDI_PLAYER(device);
+        assert(play);
+        ASYNC_RENDER_SUSPEND(play);
+        LOOP_CACHE_DROP(play);
+#if !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER) && !defined(OPNMIDI_DISABLE_STREAM_LOADER)
+        if(!read)
+        {
+            play->setErrorString("Invalid read callback");
+            return -1;
+        }
+        play->m_setup.tick_skip_samples_delay = 0;
+        if(!play->LoadMIDIStream(read, userData, prebuffer > 0.0 ? prebuffer : 0.0))
+        {
+            std::string err = play->getErrorString();
+            if(err.empty())
+                play->setErrorString("OPN2 MIDI: Can't load data from the stream");
+            return -1;
+        }
+        else return 0;
+#else
+        ADL_UNUSED(read);
+        ADL_UNUSED(userData);
+        ADL_UNUSED(prebuffer);
+        play->setErrorString("OPNMIDI: Stream loading is not supported in this build of library!");
+        return -1;
+#endif
+    }
+
+    OPN2MIDI_ErrorString = "Can't load file: OPN2 MIDI is not initialized";
+    return -1;
+}
+
+OPNMIDI_EXPORT int opn2_streamState(struct OPN2_MIDIPlayer *device)
+{
+    if(!device)
+        return -1;
+#if !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER) && !defined(OPNMIDI_DISABLE_STREAM_LOADER)
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    int state = play->m_streamLoader->state();
+    if(state == OPNMIDIStreamLoader::State_Failed)
+        play->setErrorString(play->m_streamLoader->errorString());
+    return state;
+#else
+    return 0;
+#endif
+}
+
+OPNMIDI_EXPORT int opn2_queueNextFile(struct OPN2_MIDIPlayer *device, const char *filePath)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+#if !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER) && !defined(OPNMIDI_DISABLE_GAPLESS_PLAYLIST)
+    if(!filePath)
+    {
+        play->setErrorString("Invalid file path");
+        return -1;
+    }
+    if(!play->m_playlist->queueFile(filePath, play->m_setup.parseThreads))
+    {
+        play->setErrorString(play->m_playlist->errorString());
+        return -1;
+    }
+    return 0;
+#else
+    ADL_UNUSED(filePath);
+    play->setErrorString("OPNMIDI: Gapless playlist is not supported in this build of library!");
+    return -1;
+#endif
+}
+
+OPNMIDI_EXPORT int opn2_queueNextData(struct OPN2_MIDIPlayer *device, const void *mem, unsigned long size)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+#if !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER) && !defined(OPNMIDI_DISABLE_GAPLESS_PLAYLIST)
+    if(!mem || size == 0)
+    {
+        play->setErrorString("Invalid music data");
+        return -1;
+    }
+    if(!play->m_playlist->queueData(mem, static_cast<size_t>(size), play->m_setup.parseThreads))
+    {
+        play->setErrorString(play->m_playlist->errorString());
+        return -1;
+    }
+    return 0;
+#else
+    ADL_UNUSED(mem);
+    ADL_UNUSED(size);
+    play->setErrorString("OPNMIDI: Gapless playlist is not supported in this build of library!");
+    return -1;
+#endif
+}
+
+OPNMIDI_EXPORT void opn2_clearNextSong(struct OPN2_MIDIPlayer *device)
+{
+    if(!device)
+        return;
+#if !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER) && !defined(OPNMIDI_DISABLE_GAPLESS_PLAYLIST)
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    play->m_playlist->clear();
+#endif
+}
+
+OPNMIDI_EXPORT int opn2_nextSongState(struct OPN2_MIDIPlayer *device)
+{
+    if(!device)
+        return -1;
+#if !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER) && !defined(OPNMIDI_DISABLE_GAPLESS_PLAYLIST)
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    int state = play->m_playlist->state();
+    if(state == OPNMIDIPlaylist::State_Failed)
+        play->setErrorString(play->m_playlist->errorString());
+    return state;
+#else
+    return 0;
+#endif
+}
+
+OPNMIDI_EXPORT void opn2_setGaplessTails(struct OPN2_MIDIPlayer *device, int enabled)
+{
+    if(!device)
+        return;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    play->m_setup.gaplessTails = (enabled != 0);
+}
+
 OPNMIDI_EXPORT const char *opn2_emulatorName()
 {
     return "<opn2_emulatorName() is deprecated! Use opn2_chipEmulatorName() instead!>";
@@ -540,6 +873,21 @@ OPNMIDI_EXPORT int opn2_switchEmulator(struct OPN2_MIDIPlayer *device, int emula
     {
         MidiPlayer *play = GET_MIDI_PLAYER(device);
         assert(play);
+        LOOP_CACHE_LEAVE(play);
+#if defined(OPNMIDI_MIDI2VGM) && !defined(OPNMIDI_DISABLE_STEMS)
+        if(emulator == OPNMIDI_VGM_DUMPER && play->m_stems.get())
+        {
+            play->setErrorString("OPN2 MIDI: Stems can't be rendered by the VGM dumper!");
+            return -1;
+        }
+#endif
+#ifdef OPNMIDI_MIDI2VGM
+        if(emulator == OPNMIDI_VGM_DUMPER && play->m_setup.leadEmulator >= 0)
+        {
+            play->setErrorString("OPN2 MIDI: The VGM dumper can't be mixed with other emulators!");
+            return -1;
+        }
+#endif
         if(opn2_isEmulatorAvailable(emulator))
         {
             play->m_setup.emulator = emulator;
@@ -551,6 +899,52 @@ OPNMIDI_EXPORT int opn2_switchEmulator(struct OPN2_MIDIPlayer *device, int emula
     return -1;
 }
 
+OPNMIDI_EXPORT int opn2_setLeadChipsEmulator(struct OPN2_MIDIPlayer *device, int emulator, int chips)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+
+    if(emulator >= 0 && !opn2_isEmulatorAvailable(emulator))
+    {
+        play->setErrorString("OPN2 MIDI: Unknown emulation core!");
+        return -1;
+    }
+#ifdef OPNMIDI_MIDI2VGM
+    if(emulator >= 0 && (emulator == OPNMIDI_VGM_DUMPER || play->m_setup.emulator == OPNMIDI_VGM_DUMPER))
+    {
+        play->setErrorString("OPN2 MIDI: The VGM dumper can't be mixed with other emulators!");
+        return -1;
+    }
+#endif
+    if(chips < 0)
+    {
+        play->setErrorString("OPN2 MIDI: Negative count of lead chips!");
+        return -1;
+    }
+
+    LOOP_CACHE_LEAVE(play);
+    play->m_setup.leadEmulator = (chips > 0) ? emulator : -1;
+    play->m_setup.leadChips = (emulator >= 0) ? static_cast<unsigned int>(chips) : 0;
+    play->partialReset();
+    return 0;
+}
+
+OPNMIDI_EXPORT int opn2_setQualityGovernor(struct OPN2_MIDIPlayer *device, int enabled)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    ASYNC_RENDER_LOCK(play);
+    if(play->m_governor.level != 0) // Return to the selected emulator
+        play->m_synth->switchEmulator(play->m_setup.emulator, play->m_setup.PCM_RATE, play);
+    play->m_governor.enabled = (enabled != 0);
+    play->resetQualityGovernor();
+    return 0;
+}
+
 
 OPNMIDI_EXPORT int opn2_setRunAtPcmRate(OPN2_MIDIPlayer *device, int enabled)
 {
@@ -558,6 +952,7 @@ OPNMIDI_EXPORT int opn2_setRunAtPcmRate(OPN2_MIDIPlayer *device, int enabled)
     {
         MidiPlayer *play = GET_MIDI_PLAYER(device);
         assert(play);
+        LOOP_CACHE_LEAVE(play);
         Synth &synth = *play->m_synth;
         play->m_setup.runAtPcmRate = (enabled != 0);
         if(!synth.setupLocked())
@@ -603,6 +998,9 @@ OPNMIDI_EXPORT void opn2_close(OPN2_MIDIPlayer *device)
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+#ifndef OPNMIDI_DISABLE_ASYNC_RENDER
+    play->m_asyncRender.reset();
+#endif
     delete play;
     device->opn2_midiPlayer = NULL;
     free(device);
@@ -615,6 +1013,7 @@ OPNMIDI_EXPORT void opn2_reset(OPN2_MIDIPlayer *device)
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_DROP(play);
     play->partialReset();
     play->resetMIDI();
 }
@@ -668,6 +1067,11 @@ OPNMIDI_EXPORT double opn2_positionTell(struct OPN2_MIDIPlayer *device)
         return -1.0;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    ASYNC_RENDER_LOCK(play);
+#   ifndef OPNMIDI_DISABLE_LOOP_CACHE
+    if(play->m_loopCache.get() && play->m_loopCache->replaying())
+        return play->m_loopCache->replayTime();
+#   endif
     return play->m_sequencer->tell();
 #else
     ADL_UNUSED(device);
@@ -684,9 +1088,14 @@ OPNMIDI_EXPORT void opn2_positionSeek(struct OPN2_MIDIPlayer *device, double sec
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    ASYNC_RENDER_SUSPEND(play);
+    LOOP_CACHE_DROP(play);
     play->realTime_panic();
     play->m_setup.delay = play->m_sequencer->seek(seconds, play->m_setup.mindelay);
     play->m_setup.carry = 0.0;
+    uint64_t frames = play->m_sequencer->clockWaitFrames();
+    play->m_setup.clockDelay = static_cast<uint32_t>(frames > 512 ? 512 : frames);
+    play->m_setup.clockElapsed = 0;
 #else
     ADL_UNUSED(device);
     ADL_UNUSED(seconds);
@@ -700,10 +1109,53 @@ OPNMIDI_EXPORT void opn2_positionRewind(struct OPN2_MIDIPlayer *device)
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    ASYNC_RENDER_SUSPEND(play);
+    LOOP_CACHE_DROP(play);
     play->realTime_panic();
     play->m_sequencer->rewind();
+    play->m_setup.clockDelay = 0;
+    play->m_setup.clockElapsed = 0;
+#else
+    ADL_UNUSED(device);
+#endif
+}
+
+OPNMIDI_EXPORT void opn2_setIntegerClock(struct OPN2_MIDIPlayer *device, int enabled)
+{
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+    if(!device)
+        return;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    ASYNC_RENDER_SUSPEND(play);
+    LOOP_CACHE_LEAVE(play);
+    LOOP_CACHE_DROP(play);
+    play->m_setup.integerClock = (enabled != 0);
+    play->m_setup.delay = 0.0;
+    play->m_setup.carry = 0.0;
+    play->m_setup.tick_skip_samples_delay = 0;
+    play->m_sequencer->setClockRate(play->m_setup.integerClock ? static_cast<uint32_t>(play->m_setup.PCM_RATE) : 0);
+    uint64_t frames = play->m_sequencer->clockWaitFrames();
+    play->m_setup.clockDelay = static_cast<uint32_t>(frames > 512 ? 512 : frames);
+    play->m_setup.clockElapsed = 0;
+#else
+    ADL_UNUSED(device);
+    ADL_UNUSED(enabled);
+#endif
+}
+
+OPNMIDI_EXPORT void opn2_setParseThreads(struct OPN2_MIDIPlayer *device, int threads)
+{
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+    if(!device)
+        return;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    play->m_setup.parseThreads = (threads > 1) ? static_cast<unsigned>(threads) : 1;
+    play->m_sequencer->setParseThreads(play->m_setup.parseThreads);
 #else
     ADL_UNUSED(device);
+    ADL_UNUSED(threads);
 #endif
 }
 
@@ -714,6 +1166,8 @@ OPNMIDI_EXPORT void opn2_setTempo(struct OPN2_MIDIPlayer *device, double tempo)
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    ASYNC_RENDER_SUSPEND(play);
+    LOOP_CACHE_LEAVE(play);
     play->m_sequencer->setTempo(tempo);
 #else
     ADL_UNUSED(device);
@@ -732,30 +1186,190 @@ OPNMIDI_EXPORT int opn2_describeChannels(struct OPN2_MIDIPlayer *device, char *s
     return 0;
 }
 
-
-OPNMIDI_EXPORT const char *opn2_metaMusicTitle(struct OPN2_MIDIPlayer *device)
+OPNMIDI_EXPORT int opn2_getStats(struct OPN2_MIDIPlayer *device, OPN2_Stats *stats)
 {
-#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
-    if(!device)
-        return "";
+    if(!device || !stats)
+        return -1;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
-    return play->m_sequencer->getMusicTitle().c_str();
+#ifndef OPNMIDI_DISABLE_STATS
+    ASYNC_RENDER_LOCK(play);
+    const MidiPlayer::Stats &s = play->m_stats;
+    const Synth &synth = *play->m_synth;
+
+    std::memset(stats, 0, sizeof(OPN2_Stats));
+    stats->framesRendered = s.framesRendered;
+    stats->chipTime = s.chipTime;
+    stats->eventTime = s.eventTime;
+    for(size_t i = 0; i < synth.m_statRegWrites.size(); ++i)
+    {
+        stats->regWrites += synth.m_statRegWrites[i];
+        if(i < OPNMIDI_STATS_MAX_CHIPS)
+            stats->chipRegWrites[i] = synth.m_statRegWrites[i];
+    }
+    stats->noteOns = s.noteOns;
+    stats->voiceSteals = s.voiceSteals;
+    stats->unplaceableNotes = s.unplaceableNotes;
+    stats->arpeggioShares = s.arpeggioShares;
+    stats->peakActiveChannels = s.peakActiveChannels;
+    for(size_t i = 0; i < OPNMIDI_STATS_HISTOGRAM_SIZE; ++i)
+        stats->renderLoadHistogram[i] = s.loadHistogram[i];
+    return 0;
 #else
-    ADL_UNUSED(device);
-    return "";
+    play->setErrorString("OPN2 MIDI: Library was built without statistics support!");
+    return -1;
 #endif
 }
 
-
-OPNMIDI_EXPORT const char *opn2_metaMusicCopyright(struct OPN2_MIDIPlayer *device)
+OPNMIDI_EXPORT void opn2_resetStats(struct OPN2_MIDIPlayer *device)
 {
-#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+#ifndef OPNMIDI_DISABLE_STATS
     if(!device)
-        return "";
+        return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
-    return play->m_sequencer->getMusicCopyright().c_str();
+    ASYNC_RENDER_LOCK(play);
+    play->resetStats();
+#else
+    ADL_UNUSED(device);
+#endif
+}
+
+
+OPNMIDI_EXPORT int opn2_startTrace(struct OPN2_MIDIPlayer *device, const char *tracePath)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+#ifndef OPNMIDI_DISABLE_TRACE
+    ASYNC_RENDER_LOCK(play);
+    LOOP_CACHE_LEAVE(play);
+    Synth &synth = *play->m_synth;
+    synth.m_trace = NULL;
+    play->m_trace.reset();
+
+    play->m_trace.reset(new OPNMIDITrace);
+    if(!tracePath || !play->m_trace->open(tracePath, play->m_setup.PCM_RATE))
+    {
+        play->m_trace.reset();
+        play->setErrorString("OPN2 MIDI: Can't create the trace file!");
+        return -1;
+    }
+
+    synth.m_trace = play->m_trace.get();
+    synth.traceSnapshot();
+    return 0;
+#else
+    ADL_UNUSED(tracePath);
+    play->setErrorString("OPN2 MIDI: Trace is not supported in this build of library!");
+    return -1;
+#endif
+}
+
+OPNMIDI_EXPORT void opn2_stopTrace(struct OPN2_MIDIPlayer *device)
+{
+#ifndef OPNMIDI_DISABLE_TRACE
+    if(!device)
+        return;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    ASYNC_RENDER_LOCK(play);
+    play->m_synth->m_trace = NULL;
+    play->m_trace.reset();
+#else
+    ADL_UNUSED(device);
+#endif
+}
+
+OPNMIDI_EXPORT long opn2_replayTrace(const char *tracePath, int emulator,
+                                     OPN2_TraceAudioHook audioHook, void *userData,
+                                     unsigned long *sampleRate)
+{
+#ifndef OPNMIDI_DISABLE_TRACE
+    if(!tracePath)
+    {
+        OPN2MIDI_ErrorString = "OPN2 MIDI: Can't open the trace file!";
+        return -1;
+    }
+    const char *error = NULL;
+    long frames = OPNMIDITrace::replay(tracePath, emulator, audioHook, userData, sampleRate, &error);
+    if(frames < 0)
+        OPN2MIDI_ErrorString = error;
+    return frames;
+#else
+    ADL_UNUSED(tracePath);
+    ADL_UNUSED(emulator);
+    ADL_UNUSED(audioHook);
+    ADL_UNUSED(userData);
+    ADL_UNUSED(sampleRate);
+    OPN2MIDI_ErrorString = "OPN2 MIDI: Trace is not supported in this build of library!";
+    return -1;
+#endif
+}
+
+OPNMIDI_EXPORT long opn2_saveState(struct OPN2_MIDIPlayer *device, void *buffer, unsigned long bufferSize)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    ASYNC_RENDER_LOCK(play);
+    LOOP_CACHE_LEAVE(play);
+    if(!play->saveState(play->m_stateBuffer))
+        return -1;
+
+    const size_t size = play->m_stateBuffer.size();
+    if(buffer && size <= bufferSize)
+        std::memcpy(buffer, &play->m_stateBuffer[0], size);
+    return static_cast<long>(size);
+}
+
+OPNMIDI_EXPORT int opn2_loadState(struct OPN2_MIDIPlayer *device, const void *buffer, unsigned long bufferSize)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    if(!buffer)
+    {
+        play->setErrorString("OPN2 MIDI: Invalid state data");
+        return -1;
+    }
+    ASYNC_RENDER_SUSPEND(play);
+    LOOP_CACHE_DROP(play);
+    if(!play->loadState(reinterpret_cast<const uint8_t *>(buffer), bufferSize))
+        return -1;
+#ifndef OPNMIDI_DISABLE_TRACE
+    if(play->m_synth->m_trace)
+        play->m_synth->traceSnapshot();
+#endif
+    return 0;
+}
+
+OPNMIDI_EXPORT const char *opn2_metaMusicTitle(struct OPN2_MIDIPlayer *device)
+{
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+    if(!device)
+        return "";
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    return play->m_sequencer->getMusicTitle().c_str();
+#else
+    ADL_UNUSED(device);
+    return "";
+#endif
+}
+
+
+OPNMIDI_EXPORT const char *opn2_metaMusicCopyright(struct OPN2_MIDIPlayer *device)
+{
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+    if(!device)
+        return "";
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    return play->m_sequencer->getMusicCopyright().c_str();
 #else
     ADL_UNUSED(device);
     return 0;
@@ -847,6 +1461,60 @@ OPNMIDI_EXPORT Opn2_MarkerEntry opn2_metaMarker(struct OPN2_MIDIPlayer *device,
     return marker;
 }
 
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+static int ProbeMIDI(FileAndMemReader &fr, struct Opn2_ProbeInfo *info)
+{
+    std::string error;
+    if(!MidiPlayer::ProbeMIDI(fr, info, error))
+    {
+        OPN2MIDI_ErrorString = error.empty() ? std::string("Can't probe the music file") : error;
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+OPNMIDI_EXPORT int opn2_probeFile(const char *filePath, struct Opn2_ProbeInfo *info)
+{
+    if(!info)
+        return -1;
+    std::memset(info, 0, sizeof(Opn2_ProbeInfo));
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+    FileAndMemReader file;
+    file.openFile(filePath);
+    return ProbeMIDI(file, info);
+#else
+    ADL_UNUSED(filePath);
+    OPN2MIDI_ErrorString = "OPNMIDI: MIDI Sequencer is not supported in this build of library!";
+    return -1;
+#endif
+}
+
+OPNMIDI_EXPORT int opn2_probeData(const void *mem, unsigned long size, struct Opn2_ProbeInfo *info)
+{
+    if(!info)
+        return -1;
+    std::memset(info, 0, sizeof(Opn2_ProbeInfo));
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+    FileAndMemReader file;
+    file.openData(mem, static_cast<size_t>(size));
+    return ProbeMIDI(file, info);
+#else
+    ADL_UNUSED(mem);
+    ADL_UNUSED(size);
+    OPN2MIDI_ErrorString = "OPNMIDI: MIDI Sequencer is not supported in this build of library!";
+    return -1;
+#endif
+}
+
+OPNMIDI_EXPORT void opn2_probeFree(struct Opn2_ProbeInfo *info)
+{
+    if(!info)
+        return;
+    std::free(info->storage);
+    std::memset(info, 0, sizeof(Opn2_ProbeInfo));
+}
+
 OPNMIDI_EXPORT void opn2_setRawEventHook(struct OPN2_MIDIPlayer *device, OPN2_RawEventHook rawEventHook, void *userData)
 {
 #ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
@@ -889,6 +1557,17 @@ OPNMIDI_EXPORT void opn2_setDebugMessageHook(struct OPN2_MIDIPlayer *device, OPN
 #endif
 }
 
+OPNMIDI_EXPORT void opn2_setEmulatorSwitchHook(struct OPN2_MIDIPlayer *device, OPN2_EmulatorSwitchHook emulatorSwitchHook, void *userData)
+{
+    if(!device)
+        return;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    ASYNC_RENDER_LOCK(play);
+    play->hooks.onEmulatorSwitch = emulatorSwitchHook;
+    play->hooks.onEmulatorSwitch_userData = userData;
+}
+
 
 template <class Dst>
 static void CopySamplesRaw(OPN2_UInt8 *dstLeft, OPN2_UInt8 *dstRight, const int32_t *src,
@@ -1014,34 +1693,66 @@ static int SendStereoAudio(int         samples_requested,
     return 0;
 }
 
+#ifndef OPNMIDI_DISABLE_STEMS
+/**
+ * @brief Send the rendered chunk of every stem into the own output of the stem
+ * @param stems Renderer of stems
+ * @param silence When set, this buffer is sent into every stem instead of the stem outputs
+ * @return 0 on success, -1 on wrong output format
+ */
+static int SendStemsAudio(OPNMIDIStems &stems,
+                          int          samples_requested,
+                          ssize_t      in_size,
+                          int32_t     *silence,
+                          ssize_t      out_pos,
+                          OPN2_UInt8 *const *left,
+                          OPN2_UInt8 *const *right,
+                          const OPNMIDI_AudioFormat *format)
+{
+    for(size_t i = 0, n = stems.count(); i < n; ++i)
+    {
+        int32_t *in = silence ? silence : stems.output(i);
+        if(SendStereoAudio(samples_requested, in_size, in, out_pos, left[i], right[i], format) == -1)
+            return -1;
+    }
+    return 0;
+}
+#endif
+
 
 OPNMIDI_EXPORT int opn2_play(struct OPN2_MIDIPlayer *device, int sampleCount, short *out)
 {
     return opn2_playFormat(device, sampleCount, (OPN2_UInt8 *)out, (OPN2_UInt8 *)(out + 1), &opn2_DefaultAudioFormat);
 }
 
-OPNMIDI_EXPORT int opn2_playFormat(OPN2_MIDIPlayer *device, int sampleCount,
-                                   OPN2_UInt8 *out_left, OPN2_UInt8 *out_right,
-                                   const OPNMIDI_AudioFormat *format)
-{
-#if defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
-    ADL_UNUSED(device);
-    ADL_UNUSED(sampleCount);
-    ADL_UNUSED(out_left);
-    ADL_UNUSED(out_right);
-    ADL_UNUSED(format);
-    return 0;
-#endif
-
 #ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
-    sampleCount -= sampleCount % 2; //Avoid even sample requests
-    if(sampleCount < 0)
-        return 0;
-    if(!device)
-        return 0;
-
-    MidiPlayer *player = GET_MIDI_PLAYER(device);
-    assert(player);
+/**
+ * @brief Play the song by the sequencer and render the audio output
+ * @param player Instance of the MIDI player
+ * @param sampleCount Count of samples (not frames!), must be even
+ * @param out_left Left channel buffer output
+ * @param out_right Right channel buffer output
+ * @param format Destination PCM format format context
+ * @param dryRun When set, chips aren't emulated and the output isn't written: rendered chunks
+ *        are recorded into it, and playback stops once it gets full
+ * @param stemLeft When set, stems are rendered into these left channel buffers instead of the mix
+ * @param stemRight Right channel buffers of stems
+ * @return Count of given samples, or -1 on wrong output format
+ */
+static int PlaySong(MidiPlayer *player, int sampleCount,
+                    OPN2_UInt8 *out_left, OPN2_UInt8 *out_right,
+                    const OPNMIDI_AudioFormat *format,
+                    OPNMIDIParallelRender *dryRun,
+                    OPN2_UInt8 *const *stemLeft = NULL,
+                    OPN2_UInt8 *const *stemRight = NULL)
+{
+#ifdef OPNMIDI_DISABLE_PARALLEL_RENDER
+    ADL_UNUSED(dryRun);
+#endif
+#ifdef OPNMIDI_DISABLE_STEMS
+    ADL_UNUSED(stemLeft);
+    ADL_UNUSED(stemRight);
+#endif
     MidiPlayer::Setup &setup = player->m_setup;
 
     ssize_t gotten_len = 0;
@@ -1049,11 +1760,86 @@ OPNMIDI_EXPORT int opn2_playFormat(OPN2_MIDIPlayer *device, int sampleCount,
     //ssize_t n_periodCountPhys = n_periodCountStereo * 2;
     int left = sampleCount;
     bool hasSkipped = setup.tick_skip_samples_delay > 0;
+    OPNMIDIEventQueue *events = player->m_eventQueue.get();
+#ifndef OPNMIDI_DISABLE_LOOP_CACHE
+    // Only the mixed output of the live playback gets cached
+    OPNMIDILoopCache *loopCache = (dryRun || stemLeft) ? NULL : player->m_loopCache.get();
+#   ifndef OPNMIDI_DISABLE_TRACE
+    if(player->m_trace.get())
+        loopCache = NULL; // Every register write must be logged
+#   endif
+    // The floating point clock doesn't repeat by whole frames
+    if(loopCache && (!loopCache->enabled() || !setup.integerClock))
+        loopCache = NULL;
+#endif
 
     while(left > 0)
     {
+#ifndef OPNMIDI_DISABLE_GAPLESS_PLAYLIST
+        // Continue by the queued song right at the end of the current one
+        if(!hasSkipped && player->m_sequencer->positionAtEnd() && player->startNextSong())
+        {
+            setup.delay = 0.0;
+            setup.clockDelay = 0;
+            setup.clockElapsed = 0;
+        }
+#endif
+#ifndef OPNMIDI_DISABLE_STREAM_LOADER
+        // Pause by the silence until enough of the song data is received
+        if(player->streamWaiting())
+        {
+#   ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+            if(dryRun)
+                break;
+#   endif
+            int32_t *out_buf = player->m_outBuf;
+            while(left > 0)
+            {
+                ssize_t silentStereo = (left / 2 > 512) ? 512 : (left / 2);
+                std::memset(out_buf, 0, static_cast<size_t>(silentStereo * 2) * sizeof(out_buf[0]));
+#   ifndef OPNMIDI_DISABLE_STEMS
+                if(stemLeft)
+                {
+                    if(SendStemsAudio(*player->m_stems, sampleCount, silentStereo, out_buf, gotten_len, stemLeft, stemRight, format) == -1)
+                        return -1;
+                }
+                else
+#   endif
+                if(SendStereoAudio(sampleCount, silentStereo, out_buf, gotten_len, out_left, out_right, format) == -1)
+                    return -1;
+                left -= (int)(silentStereo * 2);
+                gotten_len += silentStereo * 2;
+            }
+            break;
+        }
+#endif
+#ifndef OPNMIDI_DISABLE_LOOP_CACHE
+        // Real-time events wait until the replay reaches the next saved state
+        if(loopCache && events && loopCache->replaying() && !events->empty())
+            loopCache->requestLeave();
+        // The loop repeats the recorded one: give its output, the player stays at the loop start
+        if(loopCache && loopCache->update(*player))
+        {
+            const int32_t *cached = NULL;
+            ssize_t frames = static_cast<ssize_t>(loopCache->take(static_cast<size_t>(left / 2), cached));
+            if(SendStereoAudio(sampleCount, frames, const_cast<int32_t *>(cached), gotten_len, out_left, out_right, format) == -1)
+                return -1;
+            left -= (int)(frames * 2);
+            gotten_len += frames * 2;
+            continue;
+        }
+#endif
+        // Real-time events given while the render-ahead worker was busy or while the loop was replayed
+        if(events && !events->empty())
+        {
+            LOOP_CACHE_LEAVE(player);
+            events->apply(*player);
+        }
+
         const double eat_delay = setup.delay < setup.maxdelay ? setup.delay : setup.maxdelay;
-        if(hasSkipped)
+        if(setup.integerClock)
+            n_periodCountStereo = static_cast<ssize_t>(setup.clockDelay);
+        else if(hasSkipped)
         {
             size_t samples = setup.tick_skip_samples_delay > sampleCount ? sampleCount : setup.tick_skip_samples_delay;
             n_periodCountStereo = samples / 2;
@@ -1070,63 +1856,228 @@ OPNMIDI_EXPORT int opn2_playFormat(OPN2_MIDIPlayer *device, int sampleCount,
         //    setup.SkipForward -= 1;
         //else
         {
-            if((player->m_sequencer->positionAtEnd()) && (setup.delay <= 0.0))
+            const bool waitDone = setup.integerClock ? (setup.clockDelay == 0) : (setup.delay <= 0.0);
+            if((player->m_sequencer->positionAtEnd()) && waitDone)
                 break;//Stop to fetch samples at reaching the song end with disabled loop
 
             ssize_t leftSamples = left / 2;
             if(n_periodCountStereo > leftSamples)
             {
-                setup.tick_skip_samples_delay = (n_periodCountStereo - leftSamples) * 2;
+                // The integer clock just keeps the rest of the delay for the next call
+                if(!setup.integerClock)
+                    setup.tick_skip_samples_delay = (n_periodCountStereo - leftSamples) * 2;
                 n_periodCountStereo = leftSamples;
             }
+#ifndef OPNMIDI_DISABLE_LOOP_CACHE
+            // States of the recorded loop get saved at the fixed steps
+            if(loopCache && loopCache->recording())
+            {
+                const ssize_t toCheckpoint = static_cast<ssize_t>(loopCache->framesToCheckpoint());
+                if(n_periodCountStereo > toCheckpoint)
+                    n_periodCountStereo = toCheckpoint;
+            }
+#endif
             //! Count of stereo samples
             ssize_t in_generatedStereo = (n_periodCountStereo > 512) ? 512 : n_periodCountStereo;
             //! Total count of samples
             ssize_t in_generatedPhys = in_generatedStereo * 2;
             //! Unsigned total sample count
-            //fill buffer with zeros
-            int32_t *out_buf = player->m_outBuf;
-            std::memset(out_buf, 0, static_cast<size_t>(in_generatedPhys) * sizeof(out_buf[0]));
             Synth &synth = *player->m_synth;
-            unsigned int chips = synth.m_numChips;
-            if(chips == 1)
-                synth.m_chips[0]->generate32(out_buf, (size_t)in_generatedStereo);
-            else/* if(n_periodCountStereo > 0)*/
+            unsigned int chips = synth.m_numActiveChips;
+#ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+            if(dryRun)
+                dryRun->advance(static_cast<size_t>(in_generatedStereo), chips);
+            else
+#endif
+#ifndef OPNMIDI_DISABLE_STEMS
+            if(stemLeft)
             {
-                /* Generate data from every chip and mix result */
-                for(size_t card = 0; card < chips; ++card)
-                    synth.m_chips[card]->generateAndMix32(out_buf, (size_t)in_generatedStereo);
+                OPNMIDIStems &stems = *player->m_stems;
+#   ifndef OPNMIDI_DISABLE_STATS
+                const double chipBegin = opn2_monotonicTime();
+#   endif
+                stems.generate(synth, (size_t)in_generatedStereo);
+#   ifndef OPNMIDI_DISABLE_STATS
+                player->m_stats.chipTime += opn2_monotonicTime() - chipBegin;
+#   endif
+                if(SendStemsAudio(stems, sampleCount, in_generatedStereo, NULL, gotten_len, stemLeft, stemRight, format) == -1)
+                    return -1;
             }
-            /* Process it */
-            if(SendStereoAudio(sampleCount, in_generatedStereo, out_buf, gotten_len, out_left, out_right, format) == -1)
-                return 0;
+            else
+#endif
+            {
+                //fill buffer with zeros
+                int32_t *out_buf = player->m_outBuf;
+                std::memset(out_buf, 0, static_cast<size_t>(in_generatedPhys) * sizeof(out_buf[0]));
+#ifndef OPNMIDI_DISABLE_STATS
+                const double chipBegin = opn2_monotonicTime();
+#endif
+                if(chips == 1)
+                    synth.m_chips[0]->generate32(out_buf, (size_t)in_generatedStereo);
+                else/* if(n_periodCountStereo > 0)*/
+                {
+                    /* Generate data from every chip and mix result */
+                    for(size_t card = 0; card < chips; ++card)
+                        synth.m_chips[card]->generateAndMix32(out_buf, (size_t)in_generatedStereo);
+                }
+#ifndef OPNMIDI_DISABLE_STATS
+                player->m_stats.chipTime += opn2_monotonicTime() - chipBegin;
+#endif
+#ifndef OPNMIDI_DISABLE_LOOP_CACHE
+                if(loopCache)
+                    loopCache->record(out_buf, static_cast<size_t>(in_generatedStereo));
+#endif
+                /* Process it */
+                if(SendStereoAudio(sampleCount, in_generatedStereo, out_buf, gotten_len, out_left, out_right, format) == -1)
+                    return -1;
+            }
+#ifndef OPNMIDI_DISABLE_TRACE
+            if(player->m_trace.get())
+                player->m_trace->advance(static_cast<size_t>(in_generatedStereo), chips);
+#endif
 
             left -= (int)in_generatedPhys;
             gotten_len += (in_generatedPhys) /* - setup.stored_samples*/;
+
+            if(setup.integerClock)
+            {
+                setup.clockDelay -= static_cast<uint32_t>(in_generatedStereo);
+                setup.clockElapsed += static_cast<uint32_t>(in_generatedStereo);
+            }
+        }
+        if(setup.integerClock)
+        {
+            if(setup.clockDelay == 0)
+            {
+#ifndef OPNMIDI_DISABLE_STATS
+                const double eventBegin = opn2_monotonicTime();
+#endif
+                const uint64_t frames = player->TickFrames(setup.clockElapsed);
+                setup.clockElapsed = 0;
+                setup.clockDelay = static_cast<uint32_t>(frames > 512 ? 512 : frames);
+#ifndef OPNMIDI_DISABLE_STATS
+                player->m_stats.eventTime += opn2_monotonicTime() - eventBegin;
+#endif
+            }
         }
-        if(hasSkipped)
+        else if(hasSkipped)
         {
             setup.tick_skip_samples_delay -= n_periodCountStereo * 2;
             hasSkipped = setup.tick_skip_samples_delay > 0;
         }
         else
+        {
+#ifndef OPNMIDI_DISABLE_STATS
+            const double eventBegin = opn2_monotonicTime();
+#endif
             setup.delay = player->Tick(eat_delay, setup.mindelay);
+#ifndef OPNMIDI_DISABLE_STATS
+            player->m_stats.eventTime += opn2_monotonicTime() - eventBegin;
+#endif
+        }
+
+#ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+        if(dryRun && dryRun->full())
+            break;
+#endif
     }
 
     return static_cast<int>(gotten_len);
-#endif //OPNMIDI_DISABLE_MIDI_SEQUENCER
 }
 
+/**
+ * @brief Play the song and account the render time, the common part of opn2_playFormat() and opn2_playStems()
+ * @return Count of given samples, 0 at the end of song or on wrong output format
+ */
+static int PlayFormat(MidiPlayer *player, int sampleCount,
+                      OPN2_UInt8 *out_left, OPN2_UInt8 *out_right,
+                      OPN2_UInt8 *const *stemLeft, OPN2_UInt8 *const *stemRight,
+                      const OPNMIDI_AudioFormat *format)
+{
+    MidiPlayer::Setup &setup = player->m_setup;
+
+#ifndef OPNMIDI_DISABLE_STATS
+    const bool timeRender = true;
+#else
+    const bool timeRender = player->m_governor.enabled;
+#endif
+    const double renderBegin = timeRender ? opn2_monotonicTime() : 0.0;
 
-OPNMIDI_EXPORT int opn2_generate(struct OPN2_MIDIPlayer *device, int sampleCount, short *out)
+    int gotten_len = PlaySong(player, sampleCount, out_left, out_right, format, NULL, stemLeft, stemRight);
+    if(gotten_len < 0)
+        return 0;
+
+    if(timeRender)
+    {
+        const double renderTime = opn2_monotonicTime() - renderBegin;
+        const double playTime = double(gotten_len / 2) / double(setup.PCM_RATE);
+#ifndef OPNMIDI_DISABLE_STATS
+        player->m_stats.framesRendered += static_cast<uint64_t>(gotten_len / 2);
+        player->accountRenderTime(renderTime, playTime);
+#endif
+        bool govern = true;
+#ifndef OPNMIDI_DISABLE_LOOP_CACHE
+        // The replayed output says nothing about the speed of the emulator
+        govern = !player->m_loopCache.get() || !player->m_loopCache->replaying();
+#endif
+        if(govern)
+            player->governQuality(renderTime, playTime);
+    }
+
+    return static_cast<int>(gotten_len);
+}
+
+#ifndef OPNMIDI_DISABLE_LOOP_CACHE
+/**
+ * @brief Stop the recording or the replay of the loop cache before the state gets changed
+ *
+ * The replay is left at once: the song gets rendered from the previous saved state up to
+ * the replayed position. The render is silent, the output of these frames was already
+ * given from the cache.
+ */
+static void LeaveLoopCache(MidiPlayer *player)
 {
-    return opn2_generateFormat(device, sampleCount, (OPN2_UInt8 *)out, (OPN2_UInt8 *)(out + 1), &opn2_DefaultAudioFormat);
+    OPNMIDILoopCache *loopCache = player->m_loopCache.get();
+    if(!loopCache)
+        return;
+
+    size_t frames = loopCache->leave(*player);
+    int16_t scratch[2 * 512];
+    while(frames > 0)
+    {
+        const size_t chunk = frames > 512 ? 512 : frames;
+        const int got = PlaySong(player, static_cast<int>(chunk * 2),
+                                 reinterpret_cast<OPN2_UInt8 *>(scratch),
+                                 reinterpret_cast<OPN2_UInt8 *>(scratch + 1),
+                                 &opn2_DefaultAudioFormat, NULL);
+        if(got <= 0)
+            break;
+        frames -= static_cast<size_t>(got / 2);
+    }
 }
 
-OPNMIDI_EXPORT int opn2_generateFormat(struct OPN2_MIDIPlayer *device, int sampleCount,
-                                       OPN2_UInt8 *out_left, OPN2_UInt8 *out_right,
-                                       const OPNMIDI_AudioFormat *format)
+static void DropLoopCache(MidiPlayer *player)
 {
+    if(player->m_loopCache.get())
+        player->m_loopCache->drop();
+}
+#endif
+#endif //OPNMIDI_DISABLE_MIDI_SEQUENCER
+
+OPNMIDI_EXPORT int opn2_playFormat(OPN2_MIDIPlayer *device, int sampleCount,
+                                   OPN2_UInt8 *out_left, OPN2_UInt8 *out_right,
+                                   const OPNMIDI_AudioFormat *format)
+{
+#if defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    ADL_UNUSED(device);
+    ADL_UNUSED(sampleCount);
+    ADL_UNUSED(out_left);
+    ADL_UNUSED(out_right);
+    ADL_UNUSED(format);
+    return 0;
+#endif
+
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
     sampleCount -= sampleCount % 2; //Avoid even sample requests
     if(sampleCount < 0)
         return 0;
@@ -1135,13 +2086,251 @@ OPNMIDI_EXPORT int opn2_generateFormat(struct OPN2_MIDIPlayer *device, int sampl
 
     MidiPlayer *player = GET_MIDI_PLAYER(device);
     assert(player);
+    return PlayFormat(player, sampleCount, out_left, out_right, NULL, NULL, format);
+#endif //OPNMIDI_DISABLE_MIDI_SEQUENCER
+}
+
+#ifndef OPNMIDI_DISABLE_STEMS
+/**
+ * @brief Check that stems can be generated now
+ * @return true when stems are enabled and the render-ahead thread isn't running
+ */
+static bool StemsReady(MidiPlayer *player)
+{
+    if(!player->m_stems.get() || player->m_stems->count() == 0)
+    {
+        player->setErrorString("OPN2 MIDI: Stems are disabled, call opn2_setStemMode() first!");
+        return false;
+    }
+#   ifndef OPNMIDI_DISABLE_ASYNC_RENDER
+    if(player->m_asyncRender.get() && player->m_asyncRender->isRunning())
+    {
+        player->setErrorString("OPNMIDI: Can't render stems while the render-ahead thread is running!");
+        return false;
+    }
+#   endif
+    return true;
+}
+#endif
+
+OPNMIDI_EXPORT int opn2_setStemMode(struct OPN2_MIDIPlayer *device, int mode)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+#ifndef OPNMIDI_DISABLE_STEMS
+    if(mode < OPNMIDI_StemMode_Off || mode > OPNMIDI_StemMode_Chip)
+    {
+        play->setErrorString("OPN2 MIDI: Unknown stem mode!");
+        return -1;
+    }
+#   ifdef OPNMIDI_MIDI2VGM
+    if(mode != OPNMIDI_StemMode_Off && play->m_setup.emulator == OPNMIDI_VGM_DUMPER)
+    {
+        play->setErrorString("OPN2 MIDI: Stems can't be rendered by the VGM dumper!");
+        return -1;
+    }
+#   endif
+
+    ASYNC_RENDER_LOCK(play);
+    LOOP_CACHE_LEAVE(play);
+    Synth &synth = *play->m_synth;
+    if(mode == OPNMIDI_StemMode_Off)
+    {
+        synth.m_stems = NULL;
+        play->m_stems.reset();
+        return 0;
+    }
+
+    if(!play->m_stems.get())
+        play->m_stems.reset(new OPNMIDIStems);
+    play->m_stems->setMode(synth, mode, play->m_setup.emulator, play->m_setup.PCM_RATE);
+    synth.m_stems = play->m_stems.get();
+    return 0;
+#else
+    if(mode == OPNMIDI_StemMode_Off)
+        return 0;
+    play->setErrorString("OPN2 MIDI: Stems are not supported in this build of library!");
+    return -1;
+#endif
+}
+
+OPNMIDI_EXPORT int opn2_getStemCount(struct OPN2_MIDIPlayer *device)
+{
+    if(!device)
+        return 0;
+#ifndef OPNMIDI_DISABLE_STEMS
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    return play->m_stems.get() ? static_cast<int>(play->m_stems->count()) : 0;
+#else
+    return 0;
+#endif
+}
+
+OPNMIDI_EXPORT int opn2_playStems(struct OPN2_MIDIPlayer *device, int sampleCount,
+                                  OPN2_UInt8 **left, OPN2_UInt8 **right,
+                                  const OPNMIDI_AudioFormat *format)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *player = GET_MIDI_PLAYER(device);
+    assert(player);
+#if !defined(OPNMIDI_DISABLE_STEMS) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    sampleCount -= sampleCount % 2; //Avoid odd sample requests
+    if(sampleCount < 0 || !left || !right)
+        return 0;
+    if(!StemsReady(player))
+        return -1;
+    return PlayFormat(player, sampleCount, NULL, NULL, left, right, format);
+#else
+    ADL_UNUSED(sampleCount);
+    ADL_UNUSED(left);
+    ADL_UNUSED(right);
+    ADL_UNUSED(format);
+#   ifdef OPNMIDI_DISABLE_STEMS
+    player->setErrorString("OPN2 MIDI: Stems are not supported in this build of library!");
+#   else
+    player->setErrorString("OPNMIDI: MIDI Sequencer is not supported in this build of library!");
+#   endif
+    return -1;
+#endif
+}
+
+
+OPNMIDI_EXPORT int opn2_renderSongParallel(struct OPN2_MIDIPlayer *device, int threads, int sampleCount,
+                                           OPN2_UInt8 *out_left, OPN2_UInt8 *out_right,
+                                           const OPNMIDI_AudioFormat *format)
+{
+#if !defined(OPNMIDI_DISABLE_PARALLEL_RENDER) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    sampleCount -= sampleCount % 2; //Avoid odd sample requests
+    if(sampleCount < 0)
+        return 0;
+    if(!device)
+        return 0;
+
+    MidiPlayer *player = GET_MIDI_PLAYER(device);
+    assert(player);
+    Synth &synth = *player->m_synth;
+
+#ifndef OPNMIDI_DISABLE_ASYNC_RENDER
+    if(player->m_asyncRender.get() && player->m_asyncRender->isRunning())
+    {
+        player->setErrorString("OPNMIDI: Can't render the song while the render-ahead thread is running!");
+        return -1;
+    }
+#endif
+
+    if(threads <= 0)
+        threads = static_cast<int>(synth.m_numChips);
+
+    // Chips which call the player back while generating can't be emulated concurrently
+    bool serial = (threads == 1) || (synth.m_numChips < 2);
+#if defined(ADLMIDI_AUDIO_TICK_HANDLER)
+    serial = true;
+#endif
+#ifdef OPNMIDI_MIDI2VGM
+    if(player->m_setup.emulator == OPNMIDI_VGM_DUMPER)
+        serial = true;
+#endif
+    if(serial)
+        return opn2_playFormat(device, sampleCount, out_left, out_right, format);
+
+    LOOP_CACHE_LEAVE(player);
+    if(!player->m_parallelRender.get())
+        player->m_parallelRender.reset(new OPNMIDIParallelRender);
+    OPNMIDIParallelRender &render = *player->m_parallelRender;
+
+    std::vector<OPNChipBase *> chips(synth.m_chips.size());
+    for(size_t i = 0; i < chips.size(); ++i)
+        chips[i] = synth.m_chips[i].get();
+
+    const double renderBegin = opn2_monotonicTime();
+    int gotten_len = 0;
+    bool error = false;
+
+    while(gotten_len < sampleCount)
+    {
+        render.begin(chips.size());
+
+        // Play the block without chips, register writes get recorded
+        synth.m_parallelRender = &render;
+        int got = PlaySong(player, sampleCount - gotten_len, NULL, NULL, format, &render);
+        synth.m_parallelRender = NULL;
+
+#ifndef OPNMIDI_DISABLE_STATS
+        const double chipBegin = opn2_monotonicTime();
+#endif
+        int32_t *mix = render.render(chips, static_cast<size_t>(threads));
+#ifndef OPNMIDI_DISABLE_STATS
+        player->m_stats.chipTime += opn2_monotonicTime() - chipBegin;
+#endif
+
+        if(SendStereoAudio(sampleCount, static_cast<ssize_t>(render.frames()), mix,
+                           gotten_len, out_left, out_right, format) == -1)
+        {
+            error = true;
+            break;
+        }
+
+        gotten_len += got;
+        if(!render.full())
+            break; // Song has reached the end, or the output is filled
+    }
+
+    const double renderTime = opn2_monotonicTime() - renderBegin;
+    const double playTime = double(gotten_len / 2) / double(player->m_setup.PCM_RATE);
+#ifndef OPNMIDI_DISABLE_STATS
+    player->m_stats.framesRendered += static_cast<uint64_t>(gotten_len / 2);
+    player->accountRenderTime(renderTime, playTime);
+#else
+    ADL_UNUSED(renderTime);
+    ADL_UNUSED(playTime);
+#endif
+
+    return error ? 0 : gotten_len;
+#else
+    ADL_UNUSED(threads);
+    return opn2_playFormat(device, sampleCount, out_left, out_right, format);
+#endif
+}
+
+
+OPNMIDI_EXPORT int opn2_generate(struct OPN2_MIDIPlayer *device, int sampleCount, short *out)
+{
+    return opn2_generateFormat(device, sampleCount, (OPN2_UInt8 *)out, (OPN2_UInt8 *)(out + 1), &opn2_DefaultAudioFormat);
+}
+
+/**
+ * @brief Render the audio output without the sequencer, the common part of opn2_generateFormat() and opn2_generateStems()
+ * @param stemLeft When set, stems are rendered into these left channel buffers instead of the mix
+ * @param stemRight Right channel buffers of stems
+ * @return Count of given samples, 0 on wrong output format
+ */
+static int GenerateFormat(MidiPlayer *player, int sampleCount,
+                          OPN2_UInt8 *out_left, OPN2_UInt8 *out_right,
+                          OPN2_UInt8 *const *stemLeft, OPN2_UInt8 *const *stemRight,
+                          const OPNMIDI_AudioFormat *format)
+{
+#ifdef OPNMIDI_DISABLE_STEMS
+    ADL_UNUSED(stemLeft);
+    ADL_UNUSED(stemRight);
+#endif
     MidiPlayer::Setup &setup = player->m_setup;
+    LOOP_CACHE_LEAVE(player);
 
     ssize_t gotten_len = 0;
     ssize_t n_periodCountStereo = 512;
 
     int     left = sampleCount;
     double  delay = double(sampleCount / 2) / double(setup.PCM_RATE);
+#ifndef OPNMIDI_DISABLE_STATS
+    const bool timeRender = true;
+#else
+    const bool timeRender = player->m_governor.enabled;
+#endif
+    const double renderBegin = timeRender ? opn2_monotonicTime() : 0.0;
 
     while(left > 0)
     {
@@ -1162,20 +2351,45 @@ OPNMIDI_EXPORT int opn2_generateFormat(struct OPN2_MIDIPlayer *device, int sampl
             //! Total count of samples
             ssize_t in_generatedPhys = in_generatedStereo * 2;
             //! Unsigned total sample count
-            //fill buffer with zeros
             int32_t *out_buf = player->m_outBuf;
-            std::memset(out_buf, 0, static_cast<size_t>(in_generatedPhys) * sizeof(out_buf[0]));
             Synth &synth = *player->m_synth;
-            unsigned int chips = synth.m_numChips;
-            if(chips == 1)
-                synth.m_chips[0]->generate32(out_buf, (size_t)in_generatedStereo);
-            else/* if(n_periodCountStereo > 0)*/
+            unsigned int chips = synth.m_numActiveChips;
+#ifndef OPNMIDI_DISABLE_STATS
+            const double chipBegin = opn2_monotonicTime();
+#endif
+#ifndef OPNMIDI_DISABLE_STEMS
+            if(stemLeft)
+                player->m_stems->generate(synth, (size_t)in_generatedStereo);
+            else
+#endif
             {
-                /* Generate data from every chip and mix result */
-                for(size_t card = 0; card < chips; ++card)
-                    synth.m_chips[card]->generateAndMix32(out_buf, (size_t)in_generatedStereo);
+                //fill buffer with zeros
+                std::memset(out_buf, 0, static_cast<size_t>(in_generatedPhys) * sizeof(out_buf[0]));
+                if(chips == 1)
+                    synth.m_chips[0]->generate32(out_buf, (size_t)in_generatedStereo);
+                else/* if(n_periodCountStereo > 0)*/
+                {
+                    /* Generate data from every chip and mix result */
+                    for(size_t card = 0; card < chips; ++card)
+                        synth.m_chips[card]->generateAndMix32(out_buf, (size_t)in_generatedStereo);
+                }
             }
+#ifndef OPNMIDI_DISABLE_STATS
+            player->m_stats.chipTime += opn2_monotonicTime() - chipBegin;
+#endif
+#ifndef OPNMIDI_DISABLE_TRACE
+            if(player->m_trace.get())
+                player->m_trace->advance(static_cast<size_t>(in_generatedStereo), chips);
+#endif
             /* Process it */
+#ifndef OPNMIDI_DISABLE_STEMS
+            if(stemLeft)
+            {
+                if(SendStemsAudio(*player->m_stems, sampleCount, in_generatedStereo, NULL, gotten_len, stemLeft, stemRight, format) == -1)
+                    return 0;
+            }
+            else
+#endif
             if(SendStereoAudio(sampleCount, in_generatedStereo, out_buf, gotten_len, out_left, out_right, format) == -1)
                 return 0;
 
@@ -1183,12 +2397,69 @@ OPNMIDI_EXPORT int opn2_generateFormat(struct OPN2_MIDIPlayer *device, int sampl
             gotten_len += (in_generatedPhys) /* - setup.stored_samples*/;
         }
 
+#ifndef OPNMIDI_DISABLE_STATS
+        const double eventBegin = opn2_monotonicTime();
+#endif
         player->TickIterators(eat_delay);
+#ifndef OPNMIDI_DISABLE_STATS
+        player->m_stats.eventTime += opn2_monotonicTime() - eventBegin;
+#endif
+    }
+
+    if(timeRender)
+    {
+        const double renderTime = opn2_monotonicTime() - renderBegin;
+        const double playTime = double(gotten_len / 2) / double(setup.PCM_RATE);
+#ifndef OPNMIDI_DISABLE_STATS
+        player->m_stats.framesRendered += static_cast<uint64_t>(gotten_len / 2);
+        player->accountRenderTime(renderTime, playTime);
+#endif
+        player->governQuality(renderTime, playTime);
     }
 
     return static_cast<int>(gotten_len);
 }
 
+OPNMIDI_EXPORT int opn2_generateFormat(struct OPN2_MIDIPlayer *device, int sampleCount,
+                                       OPN2_UInt8 *out_left, OPN2_UInt8 *out_right,
+                                       const OPNMIDI_AudioFormat *format)
+{
+    sampleCount -= sampleCount % 2; //Avoid even sample requests
+    if(sampleCount < 0)
+        return 0;
+    if(!device)
+        return 0;
+
+    MidiPlayer *player = GET_MIDI_PLAYER(device);
+    assert(player);
+    return GenerateFormat(player, sampleCount, out_left, out_right, NULL, NULL, format);
+}
+
+OPNMIDI_EXPORT int opn2_generateStems(struct OPN2_MIDIPlayer *device, int sampleCount,
+                                      OPN2_UInt8 **left, OPN2_UInt8 **right,
+                                      const OPNMIDI_AudioFormat *format)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *player = GET_MIDI_PLAYER(device);
+    assert(player);
+#ifndef OPNMIDI_DISABLE_STEMS
+    sampleCount -= sampleCount % 2; //Avoid odd sample requests
+    if(sampleCount < 0 || !left || !right)
+        return 0;
+    if(!StemsReady(player))
+        return -1;
+    return GenerateFormat(player, sampleCount, NULL, NULL, left, right, format);
+#else
+    ADL_UNUSED(sampleCount);
+    ADL_UNUSED(left);
+    ADL_UNUSED(right);
+    ADL_UNUSED(format);
+    player->setErrorString("OPN2 MIDI: Stems are not supported in this build of library!");
+    return -1;
+#endif
+}
+
 OPNMIDI_EXPORT double opn2_tickEvents(struct OPN2_MIDIPlayer *device, double seconds, double granuality)
 {
 #ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
@@ -1196,6 +2467,7 @@ OPNMIDI_EXPORT double opn2_tickEvents(struct OPN2_MIDIPlayer *device, double sec
         return -1.0;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     return play->Tick(seconds, granuality);
 #else
     ADL_UNUSED(device);
@@ -1205,6 +2477,72 @@ OPNMIDI_EXPORT double opn2_tickEvents(struct OPN2_MIDIPlayer *device, double sec
 #endif
 }
 
+OPNMIDI_EXPORT int opn2_startAsync(struct OPN2_MIDIPlayer *device, int bufferFrames)
+{
+    if(!device)
+        return -1;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+#if !defined(OPNMIDI_DISABLE_ASYNC_RENDER) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    if(bufferFrames < 0)
+    {
+        play->setErrorString("OPNMIDI: Negative size of render-ahead buffer!");
+        return -1;
+    }
+    if(!play->m_asyncRender.get())
+        play->m_asyncRender.reset(new OPNMIDIAsyncRender(device));
+    if(!play->m_eventQueue.get())
+        play->m_eventQueue.reset(new OPNMIDIEventQueue);
+    if(!play->m_asyncRender->start(static_cast<size_t>(bufferFrames), play->m_setup.PCM_RATE))
+    {
+        play->setErrorString("OPNMIDI: Can't start the render-ahead thread!");
+        return -1;
+    }
+    return 0;
+#else
+    ADL_UNUSED(bufferFrames);
+    play->setErrorString("OPNMIDI: Render-ahead mode is not supported in this build of library!");
+    return -1;
+#endif
+}
+
+OPNMIDI_EXPORT int opn2_readAsync(struct OPN2_MIDIPlayer *device, int sampleCount, short *out)
+{
+#if !defined(OPNMIDI_DISABLE_ASYNC_RENDER) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    sampleCount -= sampleCount % 2; //Avoid odd sample requests
+    if(!device || sampleCount <= 0)
+        return 0;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    OPNMIDIAsyncRender *render = play->m_asyncRender.get();
+    if(!render || !render->isRunning())
+    {
+        std::memset(out, 0, static_cast<size_t>(sampleCount) * sizeof(short));
+        return 0;
+    }
+    return static_cast<int>(render->read(out, static_cast<size_t>(sampleCount)));
+#else
+    ADL_UNUSED(device);
+    if(sampleCount > 0)
+        std::memset(out, 0, static_cast<size_t>(sampleCount) * sizeof(short));
+    return 0;
+#endif
+}
+
+OPNMIDI_EXPORT void opn2_stopAsync(struct OPN2_MIDIPlayer *device)
+{
+#ifndef OPNMIDI_DISABLE_ASYNC_RENDER
+    if(!device)
+        return;
+    MidiPlayer *play = GET_MIDI_PLAYER(device);
+    assert(play);
+    if(play->m_asyncRender.get())
+        play->m_asyncRender->stop();
+#else
+    ADL_UNUSED(device);
+#endif
+}
+
 OPNMIDI_EXPORT int opn2_atEnd(struct OPN2_MIDIPlayer *device)
 {
 #ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
@@ -1212,6 +2550,7 @@ OPNMIDI_EXPORT int opn2_atEnd(struct OPN2_MIDIPlayer *device)
         return 1;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    ASYNC_RENDER_LOCK(play);
     return (int)play->m_sequencer->positionAtEnd();
 #else
     ADL_UNUSED(device);
@@ -1240,6 +2579,7 @@ OPNMIDI_EXPORT int opn2_setTrackOptions(struct OPN2_MIDIPlayer *device, size_t t
         return -1;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    LOOP_CACHE_LEAVE(play);
     MidiSequencer &seq = *play->m_sequencer;
 
     unsigned enableFlag = trackOptions & 3;
@@ -1280,6 +2620,9 @@ OPNMIDI_EXPORT void opn2_panic(struct OPN2_MIDIPlayer *device)
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::Panic))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_panic();
 }
 
@@ -1289,6 +2632,9 @@ OPNMIDI_EXPORT void opn2_rt_resetState(struct OPN2_MIDIPlayer *device)
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::ResetState))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_ResetState();
 }
 
@@ -1298,6 +2644,9 @@ OPNMIDI_EXPORT int opn2_rt_noteOn(struct OPN2_MIDIPlayer *device, OPN2_UInt8 cha
         return 0;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::NoteOn, channel, note, velocity))
+        return 1;
+    RT_EVENT_DIRECT(play);
     return (int)play->realTime_NoteOn(channel, note, velocity);
 }
 
@@ -1307,6 +2656,9 @@ OPNMIDI_EXPORT void opn2_rt_noteOff(struct OPN2_MIDIPlayer *device, OPN2_UInt8 c
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::NoteOff, channel, note))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_NoteOff(channel, note);
 }
 
@@ -1316,6 +2668,9 @@ OPNMIDI_EXPORT void opn2_rt_noteAfterTouch(struct OPN2_MIDIPlayer *device, OPN2_
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::NoteAfterTouch, channel, note, atVal))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_NoteAfterTouch(channel, note, atVal);
 }
 
@@ -1325,6 +2680,9 @@ OPNMIDI_EXPORT void opn2_rt_channelAfterTouch(struct OPN2_MIDIPlayer *device, OP
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::ChannelAfterTouch, channel, atVal))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_ChannelAfterTouch(channel, atVal);
 }
 
@@ -1334,6 +2692,9 @@ OPNMIDI_EXPORT void opn2_rt_controllerChange(struct OPN2_MIDIPlayer *device, OPN
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::Controller, channel, type, value))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_Controller(channel, type, value);
 }
 
@@ -1343,6 +2704,9 @@ OPNMIDI_EXPORT void opn2_rt_patchChange(struct OPN2_MIDIPlayer *device, OPN2_UIn
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::PatchChange, channel, patch))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_PatchChange(channel, patch);
 }
 
@@ -1352,6 +2716,9 @@ OPNMIDI_EXPORT void opn2_rt_pitchBend(struct OPN2_MIDIPlayer *device, OPN2_UInt8
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::PitchBend, channel, 0, 0, pitch))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_PitchBend(channel, pitch);
 }
 
@@ -1361,6 +2728,9 @@ OPNMIDI_EXPORT void opn2_rt_pitchBendML(struct OPN2_MIDIPlayer *device, OPN2_UIn
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::PitchBendML, channel, msb, lsb))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_PitchBend(channel, msb, lsb);
 }
 
@@ -1370,6 +2740,9 @@ OPNMIDI_EXPORT void opn2_rt_bankChangeLSB(struct OPN2_MIDIPlayer *device, OPN2_U
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::BankChangeLSB, channel, lsb))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_BankChangeLSB(channel, lsb);
 }
 
@@ -1379,6 +2752,9 @@ OPNMIDI_EXPORT void opn2_rt_bankChangeMSB(struct OPN2_MIDIPlayer *device, OPN2_U
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::BankChangeMSB, channel, msb))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_BankChangeMSB(channel, msb);
 }
 
@@ -1388,6 +2764,9 @@ OPNMIDI_EXPORT void opn2_rt_bankChange(struct OPN2_MIDIPlayer *device, OPN2_UInt
         return;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(QueueEvent(play, OPNMIDIEventQueue::BankChange, channel, 0, 0, static_cast<uint16_t>(bank)))
+        return;
+    RT_EVENT_DIRECT(play);
     play->realTime_BankChange(channel, (uint16_t)bank);
 }
 
@@ -1397,5 +2776,15 @@ OPNMIDI_EXPORT int opn2_rt_systemExclusive(struct OPN2_MIDIPlayer *device, const
         return -1;
     MidiPlayer *play = GET_MIDI_PLAYER(device);
     assert(play);
+    if(msg && size <= OPNMIDIEventQueue::MaxSysExSize)
+    {
+        OPNMIDIEventQueue::Event event;
+        event.type = OPNMIDIEventQueue::SysEx;
+        event.size = static_cast<uint16_t>(size);
+        std::memcpy(event.data, msg, size);
+        if(QueueEvent(play, event))
+            return 1;
+    }
+    RT_EVENT_DIRECT(play);
     return play->realTime_SysEx(msg, size);
 }
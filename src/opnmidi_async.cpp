@@ -0,0 +1,309 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_DISABLE_ASYNC_RENDER
+
+#include "opnmidi_async.hpp"
+#include "opnmidi_private.hpp"
+#include "opnmidi_midiplay.hpp"
+#include "opnmidi_atomic.hpp"
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#   include <time.h>
+#endif
+
+
+/***************************************************************
+ *                    Thread and mutex                         *
+ ***************************************************************/
+
+struct OPNMIDIAsyncRender::Impl
+{
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION mutex;
+
+    Impl() : thread(NULL) { InitializeCriticalSection(&mutex); }
+    ~Impl() { DeleteCriticalSection(&mutex); }
+
+    void lock() { EnterCriticalSection(&mutex); }
+    void unlock() { LeaveCriticalSection(&mutex); }
+
+    static DWORD WINAPI entry(LPVOID arg)
+    {
+        OPNMIDIAsyncRender::threadProc(arg);
+        return 0;
+    }
+
+    bool create(OPNMIDIAsyncRender *self)
+    {
+        thread = CreateThread(NULL, 0, &entry, self, 0, NULL);
+        return thread != NULL;
+    }
+
+    void join()
+    {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        thread = NULL;
+    }
+
+    static void sleepMs(unsigned ms)
+    {
+        Sleep(ms);
+    }
+#else
+    pthread_t thread;
+    pthread_mutex_t mutex;
+
+    Impl() { pthread_mutex_init(&mutex, NULL); }
+    ~Impl() { pthread_mutex_destroy(&mutex); }
+
+    void lock() { pthread_mutex_lock(&mutex); }
+    void unlock() { pthread_mutex_unlock(&mutex); }
+
+    static void *entry(void *arg)
+    {
+        OPNMIDIAsyncRender::threadProc(arg);
+        return NULL;
+    }
+
+    bool create(OPNMIDIAsyncRender *self)
+    {
+        return pthread_create(&thread, NULL, &entry, self) == 0;
+    }
+
+    void join()
+    {
+        pthread_join(thread, NULL);
+    }
+
+    static void sleepMs(unsigned ms)
+    {
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(ms / 1000);
+        ts.tv_nsec = static_cast<long>(ms % 1000) * 1000000L;
+        nanosleep(&ts, NULL);
+    }
+#endif
+};
+
+
+/***************************************************************
+ *                  Render-ahead worker                        *
+ ***************************************************************/
+
+enum
+{
+    //! Maximal count of frames rendered at once
+    AsyncChunkFrames = 512,
+    //! Minimal capacity of the ring buffer in frames
+    AsyncMinBufferFrames = 1024
+};
+
+OPNMIDIAsyncRender::OPNMIDIAsyncRender(OPN2_MIDIPlayer *device) :
+    m_impl(new Impl),
+    m_device(device),
+    m_running(false),
+    m_quit(0),
+    m_ringMask(0),
+    m_writePos(0),
+    m_readPos(0),
+    m_flushSerial(0),
+    m_flushPos(0),
+    m_readerFlushSerial(0),
+    m_ended(false),
+    m_idleMs(1)
+{}
+
+OPNMIDIAsyncRender::~OPNMIDIAsyncRender()
+{
+    stop();
+    delete m_impl;
+}
+
+bool OPNMIDIAsyncRender::start(size_t bufferFrames, unsigned long sampleRate)
+{
+    stop();
+
+    if(bufferFrames < AsyncMinBufferFrames)
+        bufferFrames = AsyncMinBufferFrames;
+
+    size_t capacity = 1;
+    while(capacity < bufferFrames * 2)
+        capacity <<= 1;
+
+    m_ring.assign(capacity, 0);
+    m_ringMask = capacity - 1;
+    m_chunk.resize(AsyncChunkFrames * 2);
+    m_writePos = 0;
+    m_readPos = 0;
+    m_flushSerial = 0;
+    m_flushPos = 0;
+    m_readerFlushSerial = 0;
+    m_ended = false;
+    m_quit = 0;
+
+    // Poll the free space few times per chunk duration
+    unsigned long chunkMs = sampleRate ? (AsyncChunkFrames * 1000ul / sampleRate) : 10;
+    m_idleMs = static_cast<unsigned>(std::max(1ul, std::min(20ul, chunkMs / 4)));
+
+    m_running = m_impl->create(this);
+    return m_running;
+}
+
+void OPNMIDIAsyncRender::stop()
+{
+    if(!m_running)
+        return;
+    s_storeFlag(&m_quit, 1);
+    m_impl->join();
+    m_running = false;
+    m_writePos = 0;
+    m_readPos = 0;
+}
+
+size_t OPNMIDIAsyncRender::read(int16_t *out, size_t samples)
+{
+    size_t flushSerial = s_loadAcquire(&m_flushSerial);
+    size_t readPos = m_readPos;
+    size_t writePos = s_loadAcquire(&m_writePos);
+
+    if(flushSerial != m_readerFlushSerial)
+    {
+        // Drop everything rendered before the seek, tempo or loop change
+        size_t flushPos = s_loadAcquire(&m_flushPos);
+        m_readerFlushSerial = flushSerial;
+        if(flushPos - readPos <= writePos - readPos)
+            readPos = flushPos;
+    }
+
+    size_t available = writePos - readPos;
+    size_t toCopy = std::min(samples, available);
+    toCopy -= toCopy % 2;
+
+    size_t capacity = m_ringMask + 1;
+    size_t offset = readPos & m_ringMask;
+    size_t first = std::min(toCopy, capacity - offset);
+    std::memcpy(out, &m_ring[offset], first * sizeof(int16_t));
+    if(toCopy > first)
+        std::memcpy(out + first, &m_ring[0], (toCopy - first) * sizeof(int16_t));
+
+    if(samples > toCopy)
+        std::memset(out + toCopy, 0, (samples - toCopy) * sizeof(int16_t));
+
+    s_storeRelease(&m_readPos, readPos + toCopy);
+    return toCopy;
+}
+
+void OPNMIDIAsyncRender::lock()
+{
+    m_impl->lock();
+}
+
+void OPNMIDIAsyncRender::unlock(bool flush)
+{
+    if(flush)
+    {
+        // Nothing is being rendered while locked, so everything before
+        // the current write position is outdated
+        m_ended = false;
+        s_storeRelease(&m_flushPos, m_writePos);
+        s_storeRelease(&m_flushSerial, m_flushSerial + 1);
+    }
+    m_impl->unlock();
+}
+
+void OPNMIDIAsyncRender::threadProc(void *self)
+{
+    reinterpret_cast<OPNMIDIAsyncRender *>(self)->run();
+}
+
+void OPNMIDIAsyncRender::run()
+{
+    while(!s_loadFlag(&m_quit))
+    {
+        if(!renderChunk())
+            Impl::sleepMs(m_idleMs);
+    }
+}
+
+bool OPNMIDIAsyncRender::renderChunk()
+{
+    size_t capacity = m_ringMask + 1;
+    size_t chunkSamples = m_chunk.size();
+    size_t writePos = m_writePos;
+    size_t readPos = s_loadAcquire(&m_readPos);
+
+    if(capacity - (writePos - readPos) < chunkSamples)
+        return false; // Buffer is full
+
+    bool rendered = false;
+
+    // Samples are published under the lock, so the flush on unlock()
+    // never misses a chunk rendered before the change
+    m_impl->lock();
+    if(!m_ended)
+    {
+        int got = opn2_play(m_device, static_cast<int>(chunkSamples), &m_chunk[0]);
+        if(got <= 0)
+        {
+#ifndef OPNMIDI_DISABLE_GAPLESS_PLAYLIST
+            // Keep polling while the queued song is being parsed
+            OPNMIDIplay *play = reinterpret_cast<OPNMIDIplay *>(m_device->opn2_midiPlayer);
+            m_ended = !play->isNextSongPending();
+#else
+            m_ended = true;
+#endif
+        }
+        else
+        {
+            size_t count = static_cast<size_t>(got);
+            size_t offset = writePos & m_ringMask;
+            size_t first = std::min(count, capacity - offset);
+            std::memcpy(&m_ring[offset], &m_chunk[0], first * sizeof(int16_t));
+            if(count > first)
+                std::memcpy(&m_ring[0], &m_chunk[0] + first, (count - first) * sizeof(int16_t));
+            s_storeRelease(&m_writePos, writePos + count);
+            rendered = true;
+        }
+    }
+    else
+    {
+        // Keep taking real-time events after the end of the song
+        OPNMIDIplay *play = reinterpret_cast<OPNMIDIplay *>(m_device->opn2_midiPlayer);
+        if(play->m_eventQueue.get())
+            play->m_eventQueue->apply(*play);
+    }
+    m_impl->unlock();
+
+    return rendered;
+}
+
+#endif // OPNMIDI_DISABLE_ASYNC_RENDER
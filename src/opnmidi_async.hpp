@@ -0,0 +1,157 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_ASYNC_HPP
+#define OPNMIDI_ASYNC_HPP
+
+#ifndef OPNMIDI_DISABLE_ASYNC_RENDER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct OPN2_MIDIPlayer;
+
+/**
+ * @brief Render-ahead worker which keeps a PCM ring buffer filled
+ *
+ * The worker thread renders the song by opn2_play() into the single-producer,
+ * single-consumer ring, and the audio callback takes the samples by read()
+ * without locking. Any change of the player state while the worker is running
+ * must be done between lock() and unlock() calls.
+ */
+class OPNMIDIAsyncRender
+{
+public:
+    explicit OPNMIDIAsyncRender(OPN2_MIDIPlayer *device);
+    ~OPNMIDIAsyncRender();
+
+    /**
+     * @brief Start the worker thread
+     * @param bufferFrames Capacity of the ring buffer in frames
+     * @param sampleRate Output sample rate
+     * @return true on success
+     */
+    bool start(size_t bufferFrames, unsigned long sampleRate);
+
+    /**
+     * @brief Stop the worker thread and drop the buffered samples
+     */
+    void stop();
+
+    /**
+     * @brief Is worker thread running
+     */
+    bool isRunning() const
+    {
+        return m_running;
+    }
+
+    /**
+     * @brief Take rendered samples from the ring buffer, never blocks
+     * @param out Destination of 16-bit stereo PCM output
+     * @param samples Count of samples (not frames!)
+     * @return Count of given samples, the rest of output gets filled by silence
+     */
+    size_t read(int16_t *out, size_t samples);
+
+    /**
+     * @brief Suspend rendering to change the player state
+     */
+    void lock();
+
+    /**
+     * @brief Resume rendering
+     * @param flush Drop all samples rendered before the change
+     */
+    void unlock(bool flush);
+
+    /**
+     * @brief Scoped suspension of rendering, does nothing if worker isn't running
+     */
+    class Suspend
+    {
+        OPNMIDIAsyncRender *m_render;
+        bool m_flush;
+    public:
+        Suspend(OPNMIDIAsyncRender *render, bool flush) :
+            m_render((render && render->isRunning()) ? render : NULL),
+            m_flush(flush)
+        {
+            if(m_render)
+                m_render->lock();
+        }
+        ~Suspend()
+        {
+            if(m_render)
+                m_render->unlock(m_flush);
+        }
+    private:
+        Suspend(const Suspend &);
+        Suspend &operator=(const Suspend &);
+    };
+
+private:
+    struct Impl;
+    Impl *m_impl;
+
+    //! Instance of the library
+    OPN2_MIDIPlayer *m_device;
+    //! Is worker thread running
+    bool m_running;
+    //! Worker is requested to quit
+    volatile int m_quit;
+
+    //! Ring buffer of interleaved stereo samples
+    std::vector<int16_t> m_ring;
+    //! Mask of ring buffer position, capacity is power of two
+    size_t m_ringMask;
+    //! Total count of samples written by worker
+    volatile size_t m_writePos;
+    //! Total count of samples taken by reader
+    volatile size_t m_readPos;
+    //! Serial number of the flush request
+    volatile size_t m_flushSerial;
+    //! Write position at the latest flush request
+    volatile size_t m_flushPos;
+    //! Last flush request handled by reader
+    size_t m_readerFlushSerial;
+
+    //! Temporary buffer of one rendered chunk
+    std::vector<int16_t> m_chunk;
+    //! Song has reached end, wait for the flush
+    bool m_ended;
+    //! Sleep between the polls of the free space, in milliseconds
+    unsigned m_idleMs;
+
+    static void threadProc(void *self);
+    void run();
+    bool renderChunk();
+
+    OPNMIDIAsyncRender(const OPNMIDIAsyncRender &);
+    OPNMIDIAsyncRender &operator=(const OPNMIDIAsyncRender &);
+};
+
+#endif // OPNMIDI_DISABLE_ASYNC_RENDER
+
+#endif // OPNMIDI_ASYNC_HPP
@@ -0,0 +1,96 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_ATOMIC_HPP
+#define OPNMIDI_ATOMIC_HPP
+
+#include <stddef.h>
+
+#if defined(_MSC_VER) && !defined(__GNUC__)
+#   include <intrin.h>
+#endif
+
+/*
+ * Atomic access of positions and flags shared between threads
+ */
+
+static inline size_t s_loadAcquire(const volatile size_t *p)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#elif defined(_MSC_VER)
+    size_t v = *p;
+    _ReadWriteBarrier();
+    return v;
+#else
+    return *p;
+#endif
+}
+
+static inline void s_storeRelease(volatile size_t *p, size_t v)
+{
+#if defined(__GNUC__)
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#elif defined(_MSC_VER)
+    _ReadWriteBarrier();
+    *p = v;
+#else
+    *p = v;
+#endif
+}
+
+static inline int s_loadFlag(const volatile int *p)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#else
+    return *p;
+#endif
+}
+
+static inline void s_storeFlag(volatile int *p, int v)
+{
+#if defined(__GNUC__)
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#else
+    *p = v;
+#endif
+}
+
+/**
+ * @brief Set the flag and return its previous value
+ */
+static inline int s_exchangeFlag(volatile int *p, int v)
+{
+#if defined(__GNUC__)
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQUIRE);
+#elif defined(_MSC_VER)
+    return static_cast<int>(_InterlockedExchange(reinterpret_cast<volatile long *>(p), v));
+#else
+    int old = *p;
+    *p = v;
+    return old;
+#endif
+}
+
+#endif // OPNMIDI_ATOMIC_HPP
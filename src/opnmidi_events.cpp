@@ -0,0 +1,114 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "opnmidi_events.hpp"
+#include "opnmidi_midiplay.hpp"
+#include "opnmidi_atomic.hpp"
+
+OPNMIDIEventQueue::OPNMIDIEventQueue() :
+    m_ring(Capacity),
+    m_head(0),
+    m_tail(0),
+    m_pushLock(0)
+{}
+
+bool OPNMIDIEventQueue::push(const Event &event)
+{
+    // Producers only wait for each other while one event gets copied
+    while(s_exchangeFlag(&m_pushLock, 1))
+        {}
+
+    size_t tail = m_tail;
+    bool pushed = (tail - s_loadAcquire(&m_head)) < Capacity;
+    if(pushed)
+    {
+        m_ring[tail & (Capacity - 1)] = event;
+        s_storeRelease(&m_tail, tail + 1);
+    }
+
+    s_storeFlag(&m_pushLock, 0);
+    return pushed;
+}
+
+bool OPNMIDIEventQueue::empty() const
+{
+    return s_loadAcquire(&m_tail) == m_head;
+}
+
+void OPNMIDIEventQueue::apply(OPNMIDIplay &player)
+{
+    size_t head = m_head;
+    while(head != s_loadAcquire(&m_tail))
+    {
+        const Event &e = m_ring[head & (Capacity - 1)];
+        switch(e.type)
+        {
+        case NoteOn:
+            player.realTime_NoteOn(e.channel, e.a, e.b);
+            break;
+        case NoteOff:
+            player.realTime_NoteOff(e.channel, e.a);
+            break;
+        case NoteAfterTouch:
+            player.realTime_NoteAfterTouch(e.channel, e.a, e.b);
+            break;
+        case ChannelAfterTouch:
+            player.realTime_ChannelAfterTouch(e.channel, e.a);
+            break;
+        case Controller:
+            player.realTime_Controller(e.channel, e.a, e.b);
+            break;
+        case PatchChange:
+            player.realTime_PatchChange(e.channel, e.a);
+            break;
+        case PitchBend:
+            player.realTime_PitchBend(e.channel, e.value);
+            break;
+        case PitchBendML:
+            player.realTime_PitchBend(e.channel, e.a, e.b);
+            break;
+        case BankChangeLSB:
+            player.realTime_BankChangeLSB(e.channel, e.a);
+            break;
+        case BankChangeMSB:
+            player.realTime_BankChangeMSB(e.channel, e.a);
+            break;
+        case BankChange:
+            player.realTime_BankChange(e.channel, e.value);
+            break;
+        case SysEx:
+            player.realTime_SysEx(e.data, e.size);
+            break;
+        case Panic:
+            player.realTime_panic();
+            break;
+        case ResetState:
+            player.realTime_ResetState();
+            break;
+        default:
+            break;
+        }
+        // Free the slot only after the event was taken
+        s_storeRelease(&m_head, ++head);
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_EVENTS_HPP
+#define OPNMIDI_EVENTS_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class OPNMIDIplay;
+
+/**
+ * @brief Queue of real-time MIDI events which are applied by the rendering thread
+ *
+ * The host pushes events from any thread without waiting for the rendering, the
+ * render path applies them between chunks. Space for all events is allocated at
+ * once, so neither side allocates memory.
+ */
+class OPNMIDIEventQueue
+{
+public:
+    enum
+    {
+        //! Maximal count of queued events, power of two
+        Capacity = 256,
+        //! Maximal size of the queued SysEx message
+        MaxSysExSize = 64
+    };
+
+    //! Type of the queued event
+    enum Type
+    {
+        NoteOn = 0,
+        NoteOff,
+        NoteAfterTouch,
+        ChannelAfterTouch,
+        Controller,
+        PatchChange,
+        PitchBend,
+        PitchBendML,
+        BankChangeLSB,
+        BankChangeMSB,
+        BankChange,
+        SysEx,
+        Panic,
+        ResetState
+    };
+
+    //! Queued event
+    struct Event
+    {
+        //! Type of the event (#Type)
+        uint8_t type;
+        //! MIDI channel
+        uint8_t channel;
+        //! First data byte
+        uint8_t a;
+        //! Second data byte
+        uint8_t b;
+        //! 14-bit pitch or the 16-bit bank
+        uint16_t value;
+        //! Size of the SysEx message
+        uint16_t size;
+        //! SysEx message
+        uint8_t data[MaxSysExSize];
+    };
+
+    OPNMIDIEventQueue();
+
+    /**
+     * @brief Append the event, can be called by several threads
+     * @return false when the queue is full
+     */
+    bool push(const Event &event);
+
+    /**
+     * @brief Is there no queued events
+     */
+    bool empty() const;
+
+    /**
+     * @brief Apply all queued events to the player, must be called by one thread at time
+     * @param player MIDI player which receives events
+     */
+    void apply(OPNMIDIplay &player);
+
+private:
+    //! Ring of queued events
+    std::vector<Event> m_ring;
+    //! Total count of applied events
+    volatile size_t m_head;
+    //! Total count of pushed events
+    volatile size_t m_tail;
+    //! Pushing is in progress
+    volatile int m_pushLock;
+
+    OPNMIDIEventQueue(const OPNMIDIEventQueue &);
+    OPNMIDIEventQueue &operator=(const OPNMIDIEventQueue &);
+};
+
+#endif // OPNMIDI_EVENTS_HPP
@@ -31,6 +31,9 @@
 #endif
 #include "wopn/wopn_file.h"
 
+#include <algorithm>
+#include <cstddef>
+
 bool OPNMIDIplay::LoadBank(const std::string &filename)
 {
     FileAndMemReader file;
@@ -40,6 +43,10 @@ bool OPNMIDIplay::LoadBank(const std::string &filename)
 
 bool OPNMIDIplay::LoadBank(const void *data, size_t size)
 {
+    // Bank images are used in place, without of the extra copy
+    if(IsBankImage(data, size))
+        return LoadBankImage(data, size);
+
     FileAndMemReader file;
     file.openData(data, (size_t)size);
     return LoadBank(file);
@@ -55,6 +62,25 @@ void cvt_FMIns_to_OPNI(OPN2_Instrument &ins, const OpnInstMeta &in)
     cvt_FMIns_to_generic(ins, in);
 }
 
+static const char *wopnErrorString(int err)
+{
+    switch(err)
+    {
+    case WOPN_ERR_BAD_MAGIC:
+        return "Custom bank: Invalid magic!";
+    case WOPN_ERR_UNEXPECTED_ENDING:
+        return "Custom bank: Unexpected ending!";
+    case WOPN_ERR_INVALID_BANKS_COUNT:
+        return "Custom bank: Invalid banks count!";
+    case WOPN_ERR_NEWER_VERSION:
+        return "Custom bank: Version is newer than supported by this library!";
+    case WOPN_ERR_OUT_OF_MEMORY:
+        return "Custom bank: Out of memory!";
+    default:
+        return "Custom bank: Unknown error!";
+    }
+}
+
 bool OPNMIDIplay::LoadBank(FileAndMemReader &fr)
 {
     int err = 0;
@@ -79,6 +105,20 @@ bool OPNMIDIplay::LoadBank(FileAndMemReader &fr)
     }
     fr.read(raw_file_data, 1, fsize);
 
+    if(IsBankImage(raw_file_data, fsize))
+    {
+        bool ret = LoadBankImage(raw_file_data, fsize);
+        free(raw_file_data);
+        return ret;
+    }
+
+    if(m_setup.lazyBanks)
+    {
+        bool ret = LoadBankLazy(reinterpret_cast<const uint8_t *>(raw_file_data), fsize);
+        free(raw_file_data);
+        return ret;
+    }
+
     // Parse bank file from the memory
     wopn = WOPN_LoadBankFromMem((void*)raw_file_data, fsize, &err);
     //Free the buffer no more needed
@@ -87,27 +127,8 @@ bool OPNMIDIplay::LoadBank(FileAndMemReader &fr)
     // Check for any erros
     if(!wopn)
     {
-        switch(err)
-        {
-        case WOPN_ERR_BAD_MAGIC:
-            errorStringOut = "Custom bank: Invalid magic!";
-            return false;
-        case WOPN_ERR_UNEXPECTED_ENDING:
-            errorStringOut = "Custom bank: Unexpected ending!";
-            return false;
-        case WOPN_ERR_INVALID_BANKS_COUNT:
-            errorStringOut = "Custom bank: Invalid banks count!";
-            return false;
-        case WOPN_ERR_NEWER_VERSION:
-            errorStringOut = "Custom bank: Version is newer than supported by this library!";
-            return false;
-        case WOPN_ERR_OUT_OF_MEMORY:
-            errorStringOut = "Custom bank: Out of memory!";
-            return false;
-        default:
-            errorStringOut = "Custom bank: Unknown error!";
-            return false;
-        }
+        errorStringOut = wopnErrorString(err);
+        return false;
     }
 
     Synth &synth = *m_synth;
@@ -121,6 +142,8 @@ bool OPNMIDIplay::LoadBank(FileAndMemReader &fr)
     m_setup.chipType = -1;
 
     synth.m_insBanks.clear();
+    synth.clearLazyBanks();
+    ++synth.m_insBanksRevision;
 
     uint16_t slots_counts[2] = {wopn->banks_count_melodic, wopn->banks_count_percussion};
     WOPNBank *slots_src_ins[2] = { wopn->banks_melodic, wopn->banks_percussive };
@@ -150,6 +173,334 @@ bool OPNMIDIplay::LoadBank(FileAndMemReader &fr)
     return true;
 }
 
+
+/***************************************************************
+ *                   Lazy bank loading                         *
+ ***************************************************************/
+
+bool OPNMIDIplay::LoadBankLazy(const uint8_t *data, size_t size)
+{
+    WOPNFile header;
+    size_t insSize = 0;
+    std::vector<WOPNBankLocation> locations;
+
+    int err = WOPN_LocateBanksInMem((void*)data, size, &header, NULL, NULL);
+    if(err == WOPN_ERR_OK)
+    {
+        locations.resize(static_cast<size_t>(header.banks_count_melodic) + header.banks_count_percussion);
+        err = WOPN_LocateBanksInMem((void*)data, size, &header, &locations[0], &insSize);
+    }
+
+    if(err != WOPN_ERR_OK)
+    {
+        errorStringOut = wopnErrorString(err);
+        return false;
+    }
+
+    Synth &synth = *m_synth;
+    synth.m_insBankSetup.volumeModel = header.volume_model;
+    synth.m_insBankSetup.lfoEnable = (header.lfo_freq & 8) != 0;
+    synth.m_insBankSetup.lfoFrequency = header.lfo_freq & 7;
+    synth.m_insBankSetup.chipType = header.chip_type;
+    m_setup.VolumeModel = OPNMIDI_VolumeModel_AUTO;
+    m_setup.lfoEnable = -1;
+    m_setup.lfoFrequency = -1;
+    m_setup.chipType = -1;
+
+    synth.m_insBanks.clear();
+    synth.clearLazyBanks();
+    ++synth.m_insBanksRevision;
+
+    Synth::LazyBank &lazy = synth.m_insLazy;
+    lazy.data.assign(data, data + size);
+    lazy.version = header.version;
+    lazy.insSize = insSize;
+    for(size_t i = 0; i < locations.size(); ++i)
+    {
+        const WOPNBankLocation &loc = locations[i];
+        size_t bankno = (loc.bank_midi_msb * 256) +
+                        (loc.bank_midi_lsb) +
+                        (loc.is_percussion ? size_t(Synth::PercussionTag) : 0);
+        lazy.tables[bankno] = loc.offset;
+    }
+
+    // Keep the first bank ready: the bank map must never look empty
+    synth.findBank(lazy.tables.begin()->first);
+
+    applySetup();
+
+    return true;
+}
+
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+void OPNMIDIplay::preloadLazyBanks()
+{
+    Synth &synth = *m_synth;
+    if(synth.m_insLazy.tables.empty())
+        return;
+
+    MidiSequencer::InstrumentsUsage usage;
+    m_sequencer->getInstrumentsUsage(usage);
+
+    const std::map<size_t, size_t> &tables = synth.m_insLazy.tables;
+    for(std::map<size_t, size_t>::const_iterator t = tables.begin(); t != tables.end(); ++t)
+    {
+        const size_t bankno = t->first;
+        const bool isPercussion = (bankno & Synth::PercussionTag) != 0;
+        const size_t msb = (bankno >> 8) & 0x7F;
+        const size_t lsb = bankno & 0xFF;
+
+        // Percussion banks are selected by the program, melodic ones by the bank select
+        if(isPercussion ? !usage.programs[lsb & 0x7F] : (!usage.bankMsb[msb] || !usage.bankLsb[lsb & 0x7F]))
+            continue;
+
+        Synth::BankMap::iterator b = synth.findBank(bankno);
+        const bool *used = isPercussion ? usage.notes : usage.programs;
+        for(size_t i = 0; i < 128; ++i)
+        {
+            if(used[i])
+                synth.bankInstrument(b->second, i);
+        }
+    }
+}
+#endif
+
+
+/***************************************************************
+ *                  Pre-baked bank image                       *
+ ***************************************************************/
+
+/*
+ * Bank image layout, all values are little-endian:
+ *
+ *  0   char[12]    Magic "OPN2-BNKIMG\0"
+ * 12   uint16      Format version, starts from 1
+ * 14   uint16      Size of one instrument entry (sizeof(OpnInstMeta))
+ * 16   uint16      Count of banks
+ * 18   uint16      Reserved, must be zero
+ * 20   int32[4]    Bank setup: volume model, LFO enable, LFO frequency, chip type
+ * 36   {uint32 id, uint32 offset}[banks]   Bank map index, sorted by id
+ * ...  OpnInstMeta[128][banks]             Instrument tables, aligned by 8 bytes
+ */
+static const char s_bankImageMagic[12] = {'O','P','N','2','-','B','N','K','I','M','G','\0'};
+
+static const uint16_t BankImageVersion = 1;
+static const size_t BankImageHeaderSize = 36;
+static const size_t BankImageIndexEntry = 8;
+static const size_t BankImageTableSize = 128 * sizeof(OpnInstMeta);
+
+static inline bool hostIsLittleEndian()
+{
+    const uint16_t v = 1;
+    return *reinterpret_cast<const uint8_t *>(&v) == 1;
+}
+
+static inline uint16_t readLE16(const uint8_t *p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t readLE32(const uint8_t *p)
+{
+    return static_cast<uint32_t>(p[0]) |
+           (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) |
+           (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline void writeLE16(uint8_t *p, uint16_t v)
+{
+    p[0] = static_cast<uint8_t>(v & 0xFF);
+    p[1] = static_cast<uint8_t>((v >> 8) & 0xFF);
+}
+
+static inline void writeLE32(uint8_t *p, uint32_t v)
+{
+    p[0] = static_cast<uint8_t>(v & 0xFF);
+    p[1] = static_cast<uint8_t>((v >> 8) & 0xFF);
+    p[2] = static_cast<uint8_t>((v >> 16) & 0xFF);
+    p[3] = static_cast<uint8_t>((v >> 24) & 0xFF);
+}
+
+static void swapBytes(uint8_t *p, size_t size)
+{
+    for(size_t i = 0; i < size / 2; ++i)
+    {
+        uint8_t t = p[i];
+        p[i] = p[size - 1 - i];
+        p[size - 1 - i] = t;
+    }
+}
+
+/**
+ * @brief Convert multi-byte fields of the instrument between host and little-endian orders
+ */
+static void swapInstrumentBytes(OpnInstMeta &ins)
+{
+    uint8_t *p = reinterpret_cast<uint8_t *>(&ins);
+    swapBytes(p + offsetof(OpnInstMeta, op) + offsetof(OpnTimbre, noteOffset), 2);
+    swapBytes(p + offsetof(OpnInstMeta, op) + sizeof(OpnTimbre) + offsetof(OpnTimbre, noteOffset), 2);
+    swapBytes(p + offsetof(OpnInstMeta, soundKeyOnMs), 2);
+    swapBytes(p + offsetof(OpnInstMeta, soundKeyOffMs), 2);
+    swapBytes(p + offsetof(OpnInstMeta, voice2_fine_tune), sizeof(double));
+}
+
+bool OPNMIDIplay::IsBankImage(const void *data, size_t size)
+{
+    return data && size >= sizeof(s_bankImageMagic) &&
+           std::memcmp(data, s_bankImageMagic, sizeof(s_bankImageMagic)) == 0;
+}
+
+bool OPNMIDIplay::LoadBankImage(const void *data, size_t size)
+{
+    const uint8_t *in = static_cast<const uint8_t *>(data);
+
+    if(!IsBankImage(data, size) || size < BankImageHeaderSize)
+    {
+        errorStringOut = "Bank image: Invalid magic!";
+        return false;
+    }
+
+    const uint16_t version = readLE16(in + 12);
+    if(version == 0)
+    {
+        errorStringOut = "Bank image: Invalid version!";
+        return false;
+    }
+
+    if(version > BankImageVersion)
+    {
+        errorStringOut = "Bank image: Version is newer than supported by this library!";
+        return false;
+    }
+
+    if(readLE16(in + 14) != sizeof(OpnInstMeta))
+    {
+        errorStringOut = "Bank image: Instrument layout doesn't match this library!";
+        return false;
+    }
+
+    size_t banksCount = readLE16(in + 16);
+    if(banksCount == 0)
+    {
+        errorStringOut = "Bank image: Invalid banks count!";
+        return false;
+    }
+
+    const uint8_t *index = in + BankImageHeaderSize;
+    if(size - BankImageHeaderSize < banksCount * BankImageIndexEntry)
+    {
+        errorStringOut = "Bank image: Unexpected ending!";
+        return false;
+    }
+
+    // Validate the whole index before of the touching of current banks
+    for(size_t i = 0; i < banksCount; ++i)
+    {
+        uint32_t offset = readLE32(index + i * BankImageIndexEntry + 4);
+        if(offset > size || size - offset < BankImageTableSize)
+        {
+            errorStringOut = "Bank image: Unexpected ending!";
+            return false;
+        }
+    }
+
+    Synth &synth = *m_synth;
+    synth.m_insBankSetup.volumeModel = static_cast<int32_t>(readLE32(in + 20));
+    synth.m_insBankSetup.lfoEnable = static_cast<int32_t>(readLE32(in + 24));
+    synth.m_insBankSetup.lfoFrequency = static_cast<int32_t>(readLE32(in + 28));
+    synth.m_insBankSetup.chipType = static_cast<int32_t>(readLE32(in + 32));
+    m_setup.VolumeModel = OPNMIDI_VolumeModel_AUTO;
+    m_setup.lfoEnable = -1;
+    m_setup.lfoFrequency = -1;
+    m_setup.chipType = -1;
+
+    synth.m_insBanks.clear();
+    synth.clearLazyBanks();
+    ++synth.m_insBanksRevision;
+    synth.m_insBanks.reserve(banksCount);
+
+    const bool swap = !hostIsLittleEndian();
+    for(size_t i = 0; i < banksCount; ++i)
+    {
+        const uint8_t *entry = index + i * BankImageIndexEntry;
+        size_t bankno = readLE32(entry);
+        Synth::Bank &bank = synth.m_insBanks[bankno];
+        // Tables are already in the final layout: the whole bank is one copy
+        std::memcpy(bank.ins, in + readLE32(entry + 4), BankImageTableSize);
+        if(swap)
+        {
+            for(size_t j = 0; j < 128; ++j)
+                swapInstrumentBytes(bank.ins[j]);
+        }
+    }
+
+    applySetup();
+
+    return true;
+}
+
+bool OPNMIDIplay::SaveBankImage(std::vector<uint8_t> &out)
+{
+    Synth &synth = *m_synth;
+    synth.loadLazyBanks();
+
+    if(synth.m_insBanks.empty())
+    {
+        errorStringOut = "Bank is not set!";
+        return false;
+    }
+
+    if(synth.m_insBanks.size() > 0xFFFF)
+    {
+        errorStringOut = "Bank image: Too many banks!";
+        return false;
+    }
+
+    // Sort banks by identifier to keep the output reproducible
+    std::vector<size_t> ids;
+    ids.reserve(synth.m_insBanks.size());
+    for(Synth::BankMap::iterator it = synth.m_insBanks.begin(); it != synth.m_insBanks.end(); ++it)
+        ids.push_back(it->first);
+    std::sort(ids.begin(), ids.end());
+
+    const size_t banksCount = ids.size();
+    size_t tablesBegin = BankImageHeaderSize + banksCount * BankImageIndexEntry;
+    tablesBegin = (tablesBegin + 7) & ~static_cast<size_t>(7);
+
+    out.clear();
+    out.resize(tablesBegin + banksCount * BankImageTableSize, 0);
+    uint8_t *o = &out[0];
+
+    std::memcpy(o, s_bankImageMagic, sizeof(s_bankImageMagic));
+    writeLE16(o + 12, BankImageVersion);
+    writeLE16(o + 14, sizeof(OpnInstMeta));
+    writeLE16(o + 16, static_cast<uint16_t>(banksCount));
+    writeLE16(o + 18, 0);
+    writeLE32(o + 20, static_cast<uint32_t>(synth.m_insBankSetup.volumeModel));
+    writeLE32(o + 24, static_cast<uint32_t>(synth.m_insBankSetup.lfoEnable));
+    writeLE32(o + 28, static_cast<uint32_t>(synth.m_insBankSetup.lfoFrequency));
+    writeLE32(o + 32, static_cast<uint32_t>(synth.m_insBankSetup.chipType));
+
+    const bool swap = !hostIsLittleEndian();
+    for(size_t i = 0; i < banksCount; ++i)
+    {
+        size_t offset = tablesBegin + i * BankImageTableSize;
+        writeLE32(o + BankImageHeaderSize + i * BankImageIndexEntry, static_cast<uint32_t>(ids[i]));
+        writeLE32(o + BankImageHeaderSize + i * BankImageIndexEntry + 4, static_cast<uint32_t>(offset));
+
+        OpnInstMeta *table = reinterpret_cast<OpnInstMeta *>(o + offset);
+        std::memcpy(table, synth.m_insBanks[ids[i]].ins, BankImageTableSize);
+        if(swap)
+        {
+            for(size_t j = 0; j < 128; ++j)
+                swapInstrumentBytes(table[j]);
+        }
+    }
+
+    return true;
+}
+
 #ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
 
 bool OPNMIDIplay::LoadMIDI_pre()
@@ -161,6 +512,12 @@ bool OPNMIDIplay::LoadMIDI_pre()
         return false;
     }
 
+#ifndef OPNMIDI_DISABLE_STREAM_LOADER
+    // The song received by the read callback is replaced
+    m_streamLoader->clear();
+    m_streamStalled = false;
+#endif
+
     /**** Set all properties BEFORE starting of actial file reading! ****/
     resetMIDI();
     applySetup();
@@ -195,10 +552,21 @@ bool OPNMIDIplay::LoadMIDI_post()
         synth.m_musicMode = Synth::MODE_XMIDI;
 
     m_setup.tick_skip_samples_delay = 0;
+    m_setup.clockDelay = 0;
+    m_setup.clockElapsed = 0;
+    preloadLazyBanks();
     synth.reset(m_setup.emulator, m_setup.PCM_RATE, synth.chipFamily(), this); // Reset OPN2 chip
     m_chipChannels.clear();
     m_chipChannels.resize(synth.m_numChannels);
+    m_insIndex.reset(m_chipChannels.size());
     resetMIDIDefaults();
+    resetChipPool();
+
+    // Register all MIDI devices before playback, so device switches never allocate memory
+    const std::vector<std::string> &devices = seq.getDeviceNames();
+    for(size_t i = 0; i < devices.size(); ++i)
+        chooseDevice(devices[i].data(), devices[i].size());
+    m_currentMidiDevice.assign(seq.getTrackCount(), 0);
 #ifdef OPNMIDI_MIDI2VGM
     m_sequencerInterface->onloopStart = synth.m_loopStartHook;
     m_sequencerInterface->onloopStart_userData = synth.m_loopStartHookData;
@@ -245,4 +613,96 @@ bool OPNMIDIplay::LoadMIDI(const void *data, size_t size)
     return true;
 }
 
+#ifndef OPNMIDI_DISABLE_STREAM_LOADER
+bool OPNMIDIplay::LoadMIDIStream(OPNMIDIStreamLoader::ReadFunc read, void *userData, double prebuffer)
+{
+    if(!LoadMIDI_pre())
+        return false;
+
+    // Playback settings are kept by the new sequencer
+    const bool loopEnabled = m_sequencer->getLoopEnabled();
+    const double tempo = m_sequencer->getTempoMultiplier();
+    if(!m_streamLoader->open(read, userData, prebuffer, m_setup.parseThreads, m_sequencer))
+    {
+        errorStringOut = m_streamLoader->errorString();
+        return false;
+    }
+
+    MidiSequencer &seq = *m_sequencer;
+    seq.setLoopEnabled(loopEnabled);
+    seq.setTempo(tempo);
+    seq.setClockRate(m_setup.integerClock ? static_cast<uint32_t>(m_setup.PCM_RATE) : 0);
+    seq.setParseThreads(m_setup.parseThreads);
+    if(!LoadMIDI_post())
+        return false;
+    return true;
+}
+#endif
+
+static char *probeStoreString(char *&dst, const std::string &str)
+{
+    char *ret = dst;
+    std::memcpy(dst, str.c_str(), str.size() + 1);
+    dst += str.size() + 1;
+    return ret;
+}
+
+bool OPNMIDIplay::ProbeMIDI(FileAndMemReader &fr, Opn2_ProbeInfo *info, std::string &error)
+{
+    MidiSequencer seq;
+    seq.setProbeMode(true);
+    if(!seq.loadMIDI(fr))
+    {
+        error = seq.getErrorString();
+        return false;
+    }
+
+    const std::vector<std::string> &titles = seq.getTrackTitles();
+    const std::vector<MidiSequencer::MIDI_MarkerEntry> &markers = seq.getMarkers();
+
+    // Keep everything in one memory block: markers, title pointers, then strings
+    size_t markersSize = markers.size() * sizeof(Opn2_MarkerEntry);
+    size_t titlesSize = titles.size() * sizeof(const char *);
+    size_t stringsSize = seq.getMusicTitle().size() + seq.getMusicCopyright().size() + 2;
+    for(size_t i = 0; i < titles.size(); ++i)
+        stringsSize += titles[i].size() + 1;
+    for(size_t i = 0; i < markers.size(); ++i)
+        stringsSize += markers[i].label.size() + 1;
+
+    uint8_t *storage = static_cast<uint8_t *>(std::malloc(markersSize + titlesSize + stringsSize));
+    if(!storage)
+    {
+        error = "Out of memory";
+        return false;
+    }
+
+    Opn2_MarkerEntry *outMarkers = reinterpret_cast<Opn2_MarkerEntry *>(storage);
+    const char **outTitles = reinterpret_cast<const char **>(storage + markersSize);
+    char *dst = reinterpret_cast<char *>(storage + markersSize + titlesSize);
+
+    info->totalTimeLength = seq.timeLength();
+    info->loopStartTime = seq.getLoopStart();
+    info->loopEndTime = seq.getLoopEnd();
+    info->trackCount = seq.getTrackCount();
+    info->musicTitle = probeStoreString(dst, seq.getMusicTitle());
+    info->musicCopyright = probeStoreString(dst, seq.getMusicCopyright());
+
+    for(size_t i = 0; i < titles.size(); ++i)
+        outTitles[i] = probeStoreString(dst, titles[i]);
+    info->trackTitleCount = titles.size();
+    info->trackTitles = titles.empty() ? NULL : outTitles;
+
+    for(size_t i = 0; i < markers.size(); ++i)
+    {
+        outMarkers[i].label = probeStoreString(dst, markers[i].label);
+        outMarkers[i].pos_time = markers[i].pos_time;
+        outMarkers[i].pos_ticks = static_cast<unsigned long>(markers[i].pos_ticks);
+    }
+    info->markerCount = markers.size();
+    info->markers = markers.empty() ? NULL : outMarkers;
+
+    info->storage = storage;
+    return true;
+}
+
 #endif //OPNMIDI_DISABLE_MIDI_SEQUENCER
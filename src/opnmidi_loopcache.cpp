@@ -0,0 +1,225 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(OPNMIDI_DISABLE_LOOP_CACHE) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+
+#include "opnmidi_loopcache.hpp"
+#include "opnmidi_midiplay.hpp"
+#include "midi_sequencer.hpp"
+
+OPNMIDILoopCache::OPNMIDILoopCache() :
+    m_limit(0),
+    m_rate(44100),
+    m_interval(4410),
+    m_state(State_Idle),
+    m_loopJumps(0),
+    m_loopJumpsKnown(false),
+    m_position(0),
+    m_leaveRequested(false),
+    m_tooLong(false),
+    m_startTime(0.0),
+    m_timeScale(1.0)
+{}
+
+OPNMIDILoopCache::~OPNMIDILoopCache()
+{}
+
+void OPNMIDILoopCache::setLimit(size_t frames, unsigned long rate)
+{
+    m_limit = frames;
+    m_rate = rate;
+    // Real-time events wait for the saved state up to 1/10 of second
+    m_interval = rate >= 10 ? static_cast<size_t>(rate / 10) : 1;
+    drop();
+}
+
+void OPNMIDILoopCache::drop()
+{
+    stopRecording();
+    m_loopJumpsKnown = false;
+    m_tooLong = false;
+}
+
+size_t OPNMIDILoopCache::framesToCheckpoint() const
+{
+    return m_checkpoints.back().frame + m_interval - m_pcm.size() / 2;
+}
+
+bool OPNMIDILoopCache::update(OPNMIDIplay &player)
+{
+    if(m_state == State_Replaying)
+    {
+        if(!m_leaveRequested || m_position % m_interval != 0)
+            return true;
+
+        // The replay has reached the saved state, the live rendering continues right from it
+        const size_t i = m_position / m_interval;
+        if(i >= m_checkpoints.size() || m_checkpoints[i].frame != m_position)
+            return true;
+        const Checkpoint &c = m_checkpoints[i];
+        if(!player.loadState(&c.state[0], c.state.size()))
+            return true; // Keep the replay, it's still valid
+        drop();
+        return false;
+    }
+
+    const size_t jumps = player.m_sequencer->loopJumpsCount();
+    if(!m_loopJumpsKnown || jumps == m_loopJumps)
+    {
+        m_loopJumps = jumps;
+        m_loopJumpsKnown = true;
+        // Keep the state to recover at fixed steps, the replay gets left at any moment
+        if(m_state == State_Recording &&
+           m_pcm.size() / 2 >= m_checkpoints.back().frame + m_interval &&
+           !saveCheckpoint(player))
+            stopRecording();
+        return false;
+    }
+
+    m_loopJumps = jumps;
+    player.saveLoopFingerprint(m_nextFingerprint);
+    const bool repeated = !m_fingerprint.empty() && m_nextFingerprint == m_fingerprint;
+
+    if(repeated && m_state == State_Recording && !m_pcm.empty())
+    {
+        m_state = State_Replaying;
+        m_position = 0;
+        m_leaveRequested = false;
+        return true;
+    }
+
+    if(repeated && !m_tooLong)
+    {
+        // The loop has repeated the previous one, so the next one repeats too
+        startRecording(player);
+        return false;
+    }
+
+    if(!repeated)
+        m_tooLong = false;
+    stopRecording();
+    m_fingerprint.swap(m_nextFingerprint);
+    return false;
+}
+
+void OPNMIDILoopCache::record(const int32_t *frames, size_t count)
+{
+    if(m_state != State_Recording)
+        return;
+
+    if(m_pcm.size() / 2 + count > m_limit)
+    {
+        // Too long loop, it repeats with the same length
+        stopRecording();
+        m_tooLong = true;
+        return;
+    }
+
+    m_pcm.insert(m_pcm.end(), frames, frames + count * 2);
+}
+
+size_t OPNMIDILoopCache::take(size_t count, const int32_t *&out)
+{
+    const size_t frames = m_pcm.size() / 2;
+    size_t left = frames - m_position;
+    if(m_leaveRequested)
+    {
+        // Stop at the next saved state
+        const size_t next = (m_position / m_interval + 1) * m_interval;
+        if(next < frames)
+            left = next - m_position;
+    }
+    if(count > left)
+        count = left;
+
+    out = &m_pcm[m_position * 2];
+    m_position += count;
+    if(m_position >= frames)
+        m_position = 0;
+
+    return count;
+}
+
+double OPNMIDILoopCache::replayTime() const
+{
+    return m_startTime + m_timeScale * static_cast<double>(m_position) / static_cast<double>(m_rate);
+}
+
+size_t OPNMIDILoopCache::leave(OPNMIDIplay &player)
+{
+    if(m_state != State_Replaying)
+    {
+        // The recorded output doesn't match the changed state
+        if(m_state == State_Recording)
+            stopRecording();
+        return 0;
+    }
+
+    size_t i = m_checkpoints.size() - 1;
+    while(i > 0 && m_checkpoints[i].frame > m_position)
+        --i;
+
+    const Checkpoint &c = m_checkpoints[i];
+    const size_t catchUp = m_position - c.frame;
+    const bool restored = player.loadState(&c.state[0], c.state.size());
+    drop();
+
+    // The player stays at the loop start when the state can't be restored
+    return restored ? catchUp : 0;
+}
+
+void OPNMIDILoopCache::startRecording(OPNMIDIplay &player)
+{
+    m_pcm.clear();
+    m_checkpoints.clear();
+    m_fingerprint.swap(m_nextFingerprint);
+    m_startTime = player.m_sequencer->tell();
+    m_timeScale = player.m_sequencer->getTempoMultiplier();
+    m_state = State_Recording;
+
+    if(!saveCheckpoint(player))
+    {
+        // The emulator can't save its state, the replay couldn't be left
+        stopRecording();
+    }
+}
+
+void OPNMIDILoopCache::stopRecording()
+{
+    m_state = State_Idle;
+    m_position = 0;
+    m_leaveRequested = false;
+    // Release the memory, the loop may be long
+    std::vector<int32_t>().swap(m_pcm);
+    std::vector<Checkpoint>().swap(m_checkpoints);
+}
+
+bool OPNMIDILoopCache::saveCheckpoint(OPNMIDIplay &player)
+{
+    m_checkpoints.push_back(Checkpoint());
+    Checkpoint &c = m_checkpoints.back();
+    c.frame = m_pcm.size() / 2;
+    return player.saveState(c.state);
+}
+
+#endif // OPNMIDI_DISABLE_LOOP_CACHE
@@ -0,0 +1,206 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_LOOPCACHE_HPP
+#define OPNMIDI_LOOPCACHE_HPP
+
+class OPNMIDILoopCache;
+
+#if !defined(OPNMIDI_DISABLE_LOOP_CACHE) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class OPNMIDIplay;
+
+/**
+ * @brief Replay of the output of the song loop which repeats the previous one
+ *
+ * The fingerprint of the player state (registers, state of chips, voices, MIDI
+ * channels, sequencer position and the phase of the clock) is taken at every jump
+ * to the loop start. Once two loops start with the same fingerprint, every next loop
+ * will play exactly the same, so the output gets recorded from one jump to the next
+ * one, and then the recorded output is given instead, and the player stays at the
+ * loop start meanwhile. Emulators which state never repeats cost one fingerprint
+ * per loop, nothing gets recorded for them.
+ *
+ * States of the player are saved at fixed steps of the recorded loop. Real-time
+ * events leave the replay when it reaches the next saved state, so the live
+ * rendering continues from it exactly. Any other change of the state from outside
+ * must leave the replay at once: the player restores the previous saved state and
+ * renders the rest of frames up to the replayed position.
+ */
+class OPNMIDILoopCache
+{
+public:
+    OPNMIDILoopCache();
+    ~OPNMIDILoopCache();
+
+    /**
+     * @brief Set the maximal length of the cached loop
+     * @param frames Count of frames, 0 disables the cache
+     * @param rate Output sample rate
+     */
+    void setLimit(size_t frames, unsigned long rate);
+
+    /**
+     * @brief Is the cache enabled
+     */
+    bool enabled() const
+    {
+        return m_limit != 0;
+    }
+
+    /**
+     * @brief Is the recorded output being given instead of the rendering
+     */
+    bool replaying() const
+    {
+        return m_state == State_Replaying;
+    }
+
+    /**
+     * @brief Is the output being recorded
+     */
+    bool recording() const
+    {
+        return m_state == State_Recording;
+    }
+
+    /**
+     * @brief Forget the recorded loop, the next one gets recorded again
+     */
+    void drop();
+
+    /**
+     * @brief Leave the replay once it reaches the next saved state
+     */
+    void requestLeave()
+    {
+        m_leaveRequested = true;
+    }
+
+    /**
+     * @brief Count of frames to render while recording before the state gets saved again
+     */
+    size_t framesToCheckpoint() const;
+
+    /**
+     * @brief Check the loop start and keep states to recover, must be called between chunks
+     * @param player MIDI player which renders the song
+     * @return true while the recorded output is given, false when the player must render
+     */
+    bool update(OPNMIDIplay &player);
+
+    /**
+     * @brief Append the rendered chunk of interleaved stereo frames to the recorded loop
+     */
+    void record(const int32_t *frames, size_t count);
+
+    /**
+     * @brief Take the next part of the recorded loop
+     * @param count Wanted count of frames
+     * @param out Pointer to the interleaved stereo frames
+     * @return Count of given frames, less than wanted at the loop end or at the saved
+     *         state where the requested leave happens
+     */
+    size_t take(size_t count, const int32_t *&out);
+
+    /**
+     * @brief Position of the song in the replay, in seconds
+     */
+    double replayTime() const;
+
+    /**
+     * @brief Stop the replay and restore the latest state of the player saved before its position
+     *
+     * The recording gets stopped as well, the state of the player is going to be changed from outside.
+     *
+     * @param player MIDI player which renders the song
+     * @return Count of frames which the player must render to reach the replayed position
+     */
+    size_t leave(OPNMIDIplay &player);
+
+private:
+    enum State
+    {
+        //! Waiting for the loop start
+        State_Idle = 0,
+        //! The loop output is being recorded
+        State_Recording,
+        //! The recorded loop is being given
+        State_Replaying
+    };
+
+    //! State of the player saved while recording
+    struct Checkpoint
+    {
+        //! Position in the loop, in frames
+        size_t frame;
+        //! State of the player
+        std::vector<uint8_t> state;
+    };
+
+    //! Maximal length of the loop, in frames
+    size_t m_limit;
+    //! Output sample rate
+    unsigned long m_rate;
+    //! Distance between saved states, in frames
+    size_t m_interval;
+    //! Current state (#State)
+    int m_state;
+    //! Count of loop jumps of the sequencer known by the cache
+    size_t m_loopJumps;
+    //! Is m_loopJumps known
+    bool m_loopJumpsKnown;
+    //! Fingerprint of the player at the previous loop start
+    std::vector<uint8_t> m_fingerprint;
+    //! Fingerprint at the current loop start, compared with the recorded one
+    std::vector<uint8_t> m_nextFingerprint;
+    //! Recorded interleaved stereo frames of the loop
+    std::vector<int32_t> m_pcm;
+    //! States saved while recording, sorted by position
+    std::vector<Checkpoint> m_checkpoints;
+    //! Position of the replay, in frames
+    size_t m_position;
+    //! Leave the replay at the next saved state
+    bool m_leaveRequested;
+    //! The repeated loop is longer than the limit
+    bool m_tooLong;
+    //! Position of the song at the loop start, in seconds
+    double m_startTime;
+    //! Speed of the song time against the output time
+    double m_timeScale;
+
+    void startRecording(OPNMIDIplay &player);
+    void stopRecording();
+    bool saveCheckpoint(OPNMIDIplay &player);
+
+    OPNMIDILoopCache(const OPNMIDILoopCache &);
+    OPNMIDILoopCache &operator=(const OPNMIDILoopCache &);
+};
+
+#endif // OPNMIDI_DISABLE_LOOP_CACHE
+
+#endif // OPNMIDI_LOOPCACHE_HPP
@@ -32,6 +32,9 @@
 // Minimum life time of percussion notes
 static const double drum_note_min_time = 0.03;
 
+// The new note is exposed while the MIDI channel holds less notes than this
+static const size_t s_exposedNotesMax = 2;
+
 enum { MasterVolumeDefault = 127 };
 
 inline bool isXgPercChannel(uint8_t msb, uint8_t lsb)
@@ -62,10 +65,24 @@ void OPNMIDIplay::OpnChannel::addAge(int64_t us)
     }
 }
 
+#if !defined(OPNMIDI_DISABLE_GAPLESS_PLAYLIST) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+static void playlistPrepare(void *userData, MidiSequencer &seq)
+{
+    reinterpret_cast<OPNMIDIplay *>(userData)->prepareNextSong(seq);
+}
+
+static void playlistAdopt(void *userData)
+{
+    reinterpret_cast<OPNMIDIplay *>(userData)->adoptNextSong();
+}
+#endif
+
 OPNMIDIplay::OPNMIDIplay(unsigned long sampleRate) :
     m_sysExDeviceId(0),
     m_synthMode(Mode_XG),
-    m_arpeggioCounter(0)
+    m_arpeggioCounter(0),
+    m_arpeggioSteps(0),
+    m_chipIdleTime(0.0)
 #if defined(ADLMIDI_AUDIO_TICK_HANDLER)
     , m_audioTickCounter(0)
 #endif
@@ -74,6 +91,8 @@ OPNMIDIplay::OPNMIDIplay(unsigned long sampleRate) :
 
     m_setup.emulator = opn2_getLowestEmulator();
     m_setup.runAtPcmRate = false;
+    m_setup.leadEmulator = -1;
+    m_setup.leadChips = 0;
 
     m_setup.PCM_RATE = sampleRate;
     m_setup.mindelay = 1.0 / static_cast<double>(m_setup.PCM_RATE);
@@ -90,15 +109,38 @@ OPNMIDIplay::OPNMIDIplay(unsigned long sampleRate) :
     m_setup.ScaleModulators     = 0;
     m_setup.fullRangeBrightnessCC74 = false;
     m_setup.enableAutoArpeggio = true;
+    m_setup.dynamicChips = false;
+    m_setup.gaplessTails = true;
+    m_setup.lazyBanks = false;
+    m_setup.integerClock = false;
+    m_setup.parseThreads = 1;
     m_setup.delay = 0.0;
     m_setup.carry = 0.0;
+    m_setup.clockDelay = 0;
+    m_setup.clockElapsed = 0;
     m_setup.tick_skip_samples_delay = 0;
 
+    m_governor.enabled = false;
+
     m_synth.reset(new Synth);
+#ifndef OPNMIDI_DISABLE_STATS
+    resetStats();
+#endif
 
 #ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
     m_sequencer.reset(new MidiSequencer);
     initSequencerInterface();
+#   ifndef OPNMIDI_DISABLE_GAPLESS_PLAYLIST
+    OPNMIDIPlaylist::Hooks hooks;
+    hooks.prepare = &playlistPrepare;
+    hooks.adopt = &playlistAdopt;
+    hooks.userData = this;
+    m_playlist.reset(new OPNMIDIPlaylist(m_sequencerInterface.get(), hooks));
+#   endif
+#   ifndef OPNMIDI_DISABLE_STREAM_LOADER
+    m_streamLoader.reset(new OPNMIDIStreamLoader(m_sequencerInterface.get()));
+    m_streamStalled = false;
+#   endif
 #endif
     resetMIDI();
     applySetup();
@@ -118,6 +160,8 @@ void OPNMIDIplay::applySetup()
     m_setup.tick_skip_samples_delay = 0;
 
     synth.m_runAtPcmRate            = m_setup.runAtPcmRate;
+    synth.m_leadEmulator            = m_setup.leadEmulator;
+    synth.m_leadChips               = m_setup.leadChips;
 
     synth.m_scaleModulators         = (m_setup.ScaleModulators != 0);
 
@@ -150,7 +194,10 @@ void OPNMIDIplay::applySetup()
     synth.reset(m_setup.emulator, m_setup.PCM_RATE, static_cast<OPNFamily>(chipType), this);
     m_chipChannels.clear();
     m_chipChannels.resize(synth.m_numChannels, OpnChannel());
+    m_insIndex.reset(m_chipChannels.size());
     resetMIDIDefaults();
+    resetChipPool();
+    resetQualityGovernor();
 #if defined(OPNMIDI_MIDI2VGM) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
     m_sequencerInterface->onloopStart = synth.m_loopStartHook;
     m_sequencerInterface->onloopStart_userData = synth.m_loopStartHookData;
@@ -168,10 +215,15 @@ void OPNMIDIplay::partialReset()
     realTime_panic();
     m_setup.tick_skip_samples_delay = 0;
     synth.m_runAtPcmRate = m_setup.runAtPcmRate;
+    synth.m_leadEmulator = m_setup.leadEmulator;
+    synth.m_leadChips = m_setup.leadChips;
     synth.reset(m_setup.emulator, m_setup.PCM_RATE, synth.chipFamily(), this);
     m_chipChannels.clear();
     m_chipChannels.resize(synth.m_numChannels);
+    m_insIndex.reset(m_chipChannels.size());
     resetMIDIDefaults();
+    resetChipPool();
+    resetQualityGovernor();
 #if defined(OPNMIDI_MIDI2VGM) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
     m_sequencerInterface->onloopStart = synth.m_loopStartHook;
     m_sequencerInterface->onloopStart_userData = synth.m_loopStartHookData;
@@ -181,6 +233,163 @@ void OPNMIDIplay::partialReset()
 #endif
 }
 
+/**
+ * @brief Emulators ordered from the most expensive to the cheapest one.
+ * The quality governor moves along the row which contains the selected emulator.
+ */
+static const int s_governorLadders[][3] =
+{
+    {OPNMIDI_EMU_NUKED, OPNMIDI_EMU_MAME, OPNMIDI_EMU_GENS},
+    {OPNMIDI_EMU_GX, OPNMIDI_EMU_GENS, -1},
+    {OPNMIDI_EMU_MAME_2608, OPNMIDI_EMU_NP2, -1}
+};
+
+enum
+{
+    //! Count of quality governor ladders
+    GovernorLaddersCount = sizeof(s_governorLadders) / sizeof(s_governorLadders[0]),
+    //! Max length of quality governor ladder
+    GovernorLadderLength = sizeof(s_governorLadders[0]) / sizeof(s_governorLadders[0][0])
+};
+
+//! Load above which the render is considered as over budget
+static const double s_governorLoadHigh = 0.85;
+//! Load below which there is enough headroom to switch back
+static const double s_governorLoadLow = 0.35;
+//! Time constant of the load smoothing, in seconds
+static const double s_governorSmoothTime = 0.25;
+//! Time to let the load settle after the switch, in seconds
+static const double s_governorSettleTime = 0.5;
+//! Time of the overload before switching to the cheaper emulator, in seconds
+static const double s_governorOverTime = 0.1;
+//! Initial and maximal time of the headroom before switching back, in seconds
+static const double s_governorUpgradeDelay = 5.0;
+static const double s_governorUpgradeDelayMax = 320.0;
+
+void OPNMIDIplay::resetQualityGovernor()
+{
+    QualityGovernor &g = m_governor;
+    g.levels[0] = m_setup.emulator;
+    g.levelsCount = 1;
+    g.level = 0;
+    g.load = 0.0;
+    g.overTime = 0.0;
+    g.underTime = 0.0;
+    g.upgradeDelay = s_governorUpgradeDelay;
+    g.sinceSwitch = 0.0;
+    g.lastUpgrade = false;
+
+    for(size_t l = 0; l < GovernorLaddersCount; ++l)
+    {
+        const int *ladder = s_governorLadders[l];
+        if(ladder[0] != m_setup.emulator)
+            continue;
+        for(size_t i = 1; i < GovernorLadderLength; ++i)
+        {
+            if(ladder[i] >= 0 && opn2_isEmulatorAvailable(ladder[i]))
+                g.levels[g.levelsCount++] = ladder[i];
+        }
+        break;
+    }
+
+    // Chips of cheaper emulators are created now, the switch is made on the audio thread
+    if(g.enabled)
+        m_synth->prepareEmulators(g.levels, g.levelsCount, m_setup.PCM_RATE, this);
+    else
+        m_synth->prepareEmulators(NULL, 0, m_setup.PCM_RATE, this);
+}
+
+void OPNMIDIplay::governQuality(double renderTime, double playTime)
+{
+    QualityGovernor &g = m_governor;
+    if(!g.enabled || g.levelsCount < 2 || playTime <= 0.0)
+        return;
+#ifndef OPNMIDI_DISABLE_STEMS
+    // Copies of chips made for stems would be created on the audio thread
+    if(m_synth->m_stems && m_synth->m_stems->count() > 0)
+        return;
+#endif
+
+    double k = playTime / s_governorSmoothTime;
+    if(k > 1.0)
+        k = 1.0;
+    g.load += (renderTime / playTime - g.load) * k;
+    g.sinceSwitch += playTime;
+
+    if(g.sinceSwitch < s_governorSettleTime)
+        return;
+
+    if(g.load > s_governorLoadHigh)
+    {
+        g.overTime += playTime;
+        g.underTime = 0.0;
+    }
+    else if(g.load < s_governorLoadLow)
+    {
+        g.underTime += playTime;
+        g.overTime = 0.0;
+    }
+    else
+    {
+        g.overTime = 0.0;
+        g.underTime = 0.0;
+    }
+
+    size_t level = g.level;
+    if(g.overTime >= s_governorOverTime && level + 1 < g.levelsCount)
+    {
+        // Switching back has failed, wait for longer headroom next time
+        if(g.lastUpgrade && g.sinceSwitch < g.upgradeDelay * 2.0)
+            g.upgradeDelay = std::min(g.upgradeDelay * 2.0, s_governorUpgradeDelayMax);
+        g.lastUpgrade = false;
+        ++level;
+    }
+    else if(g.underTime >= g.upgradeDelay && level > 0)
+    {
+        g.lastUpgrade = true;
+        --level;
+    }
+    else
+        return;
+
+    int from = g.levels[g.level];
+    double load = g.load;
+    g.level = level;
+    g.overTime = 0.0;
+    g.underTime = 0.0;
+    g.sinceSwitch = 0.0;
+
+#if !defined(OPNMIDI_DISABLE_LOOP_CACHE) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    // States saved by the loop cache belong to the previous emulator
+    if(m_loopCache.get())
+        m_loopCache->drop();
+#endif
+
+    m_synth->switchEmulator(g.levels[level], m_setup.PCM_RATE, this);
+
+    if(hooks.onEmulatorSwitch)
+        hooks.onEmulatorSwitch(hooks.onEmulatorSwitch_userData, from, g.levels[level], load);
+}
+
+#ifndef OPNMIDI_DISABLE_STATS
+void OPNMIDIplay::resetStats()
+{
+    std::memset(&m_stats, 0, sizeof(m_stats));
+    Synth &synth = *m_synth;
+    std::fill(synth.m_statRegWrites.begin(), synth.m_statRegWrites.end(), 0);
+}
+
+void OPNMIDIplay::accountRenderTime(double renderTime, double playTime)
+{
+    if(playTime <= 0.0)
+        return;
+    double bucket = (renderTime / playTime) * 8.0;
+    size_t i = (bucket < double(OPNMIDI_STATS_HISTOGRAM_SIZE - 1)) ?
+                static_cast<size_t>(bucket) : (OPNMIDI_STATS_HISTOGRAM_SIZE - 1);
+    ++m_stats.loadHistogram[i];
+}
+#endif
+
 void OPNMIDIplay::resetMIDI()
 {
     Synth &synth = *m_synth;
@@ -191,6 +400,8 @@ void OPNMIDIplay::resetMIDI()
 
     m_midiChannels.clear();
     m_midiChannels.resize(16, MIDIchannel());
+    m_midiDevices.clear();
+    m_currentMidiDevice.clear();
 
     resetMIDIDefaults();
 
@@ -218,14 +429,144 @@ void OPNMIDIplay::resetMIDIDefaults(int offset)
     }
 }
 
+#if !defined(OPNMIDI_DISABLE_GAPLESS_PLAYLIST) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+bool OPNMIDIplay::startNextSong()
+{
+    if(!m_playlist.get())
+        return false;
+
+    // Playback settings are kept from the previous song
+    const bool loopEnabled = m_sequencer->getLoopEnabled();
+    const double tempo = m_sequencer->getTempoMultiplier();
+    if(!m_playlist->take(m_sequencer))
+        return false;
+
+    Synth &synth = *m_synth;
+    MidiSequencer &seq = *m_sequencer;
+    seq.setLoopEnabled(loopEnabled);
+    seq.setTempo(tempo);
+    seq.setClockRate(m_setup.integerClock ? static_cast<uint32_t>(m_setup.PCM_RATE) : 0);
+    seq.setParseThreads(m_setup.parseThreads);
+#ifdef OPNMIDI_MIDI2VGM
+    seq.setLoopHooksOnly(m_sequencerInterface->onloopStart != NULL);
+#endif
+
+    // Release notes of the previous song, chips are not reset
+    realTime_panic();
+    if(!m_setup.gaplessTails)
+        synth.silenceAll();
+
+    MidiSequencer::FileFormat format = seq.getFormat();
+    if(format == MidiSequencer::Format_RSXX)
+    {
+        synth.m_musicMode     = Synth::MODE_RSXX;
+        synth.m_volumeScale   = Synth::VOLUME_Generic;
+    }
+    else if(format == MidiSequencer::Format_XMIDI)
+        synth.m_musicMode = Synth::MODE_XMIDI;
+    else
+        synth.m_musicMode = Synth::MODE_MIDI;
+
+    synth.m_masterVolume = MasterVolumeDefault;
+    m_sysExDeviceId = 0;
+    m_synthMode = Mode_XG;
+    for(size_t c = 0, n = m_midiChannels.size(); c < n; ++c)
+    {
+        MIDIchannel &ch = m_midiChannels[c];
+        ch.def_volume = 100;
+        ch.def_bendsense_lsb = 0;
+        ch.def_bendsense_msb = 2;
+    }
+    resetMIDIDefaults();
+    for(size_t c = 0, n = m_midiChannels.size(); c < n; ++c)
+        m_midiChannels[c].reset();
+
+    return true;
+}
+
+void OPNMIDIplay::prepareNextSong(MidiSequencer &seq)
+{
+    // Same devices as chooseDevice() registers for the song opened from the begin
+    m_nextMidiDevices.clear();
+    const std::vector<std::string> &devices = seq.getDeviceNames();
+    for(size_t i = 0; i < devices.size(); ++i)
+    {
+        if(std::find(m_nextMidiDevices.begin(), m_nextMidiDevices.end(), devices[i]) == m_nextMidiDevices.end())
+            m_nextMidiDevices.push_back(devices[i]);
+    }
+
+    m_nextCurrentMidiDevice.assign(seq.getTrackCount(), 0);
+
+    const size_t channels = m_nextMidiDevices.size() > 1 ? m_nextMidiDevices.size() * 16 : 16;
+    m_nextMidiChannels.clear();
+    m_nextMidiChannels.resize(channels, MIDIchannel());
+}
+
+void OPNMIDIplay::adoptNextSong()
+{
+    m_midiDevices.swap(m_nextMidiDevices);
+    m_currentMidiDevice.swap(m_nextCurrentMidiDevice);
+    // Channels are never shrunk, same as by chooseDevice()
+    if(m_nextMidiChannels.size() > m_midiChannels.size())
+        m_midiChannels.swap(m_nextMidiChannels);
+}
+#endif
+
+#if !defined(OPNMIDI_DISABLE_STREAM_LOADER) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+bool OPNMIDIplay::streamWaiting()
+{
+    if(!m_sequencer->isPartial())
+        return false;
+
+    if(m_streamLoader->take(m_sequencer))
+    {
+        // Devices of the newer part are registered, devices of tracks are kept
+        const std::vector<std::string> &devices = m_sequencer->getDeviceNames();
+        for(size_t i = 0; i < devices.size(); ++i)
+            chooseDevice(devices[i].data(), devices[i].size());
+    }
+
+    MidiSequencer &seq = *m_sequencer;
+    if(!seq.isPartial())
+    {
+        m_streamStalled = false;
+        return false;
+    }
+
+    if(m_streamStalled)
+    {
+        // Resume once the prebuffer is received again
+        if(seq.readyAheadTime() < m_streamLoader->prebuffer())
+            return true;
+        m_streamStalled = false;
+        return false;
+    }
+
+    // Pause before the delay after the last received events, so the next ones come in time
+    m_streamStalled = seq.waitingData();
+    return m_streamStalled;
+}
+#endif
+
 void OPNMIDIplay::TickIterators(double s)
 {
     Synth &synth = *m_synth;
+#ifndef OPNMIDI_DISABLE_STATS
+    uint32_t activeChannels = 0;
+#endif
     for(uint32_t c = 0, n = synth.m_numChannels; c < n; ++c)
     {
         OpnChannel &ch = m_chipChannels[c];
         ch.addAge(static_cast<int64_t>(s * 1e6));
+#ifndef OPNMIDI_DISABLE_STATS
+        if(!ch.users.empty())
+            ++activeChannels;
+#endif
     }
+#ifndef OPNMIDI_DISABLE_STATS
+    if(activeChannels > m_stats.peakActiveChannels)
+        m_stats.peakActiveChannels = activeChannels;
+#endif
 
     // Resolve "hell of all times" of too short drum notes
     for(size_t c = 0, n = m_midiChannels.size(); c < n; ++c)
@@ -258,6 +599,7 @@ void OPNMIDIplay::TickIterators(double s)
 
     updateVibrato(s);
     updateArpeggio(s);
+    updateChipPool(s);
 #if !defined(ADLMIDI_AUDIO_TICK_HANDLER)
     updateGlide(s);
 #endif
@@ -265,6 +607,7 @@ void OPNMIDIplay::TickIterators(double s)
 
 void OPNMIDIplay::realTime_ResetState()
 {
+    traceMidi(TraceMidi_ResetState, 0);
     Synth &synth = *m_synth;
     for(size_t ch = 0; ch < m_midiChannels.size(); ch++)
     {
@@ -282,8 +625,21 @@ void OPNMIDIplay::realTime_ResetState()
     synth.m_masterVolume = MasterVolumeDefault;
 }
 
+Synth::Bank *OPNMIDIplay::findCachedBank(MIDIchannel::BankCache &cache, unsigned slot, size_t bank)
+{
+    if((cache.lookedUp & (1u << slot)) == 0)
+    {
+        Synth &synth = *m_synth;
+        Synth::BankMap::iterator b = synth.findBank(bank);
+        cache.banks[slot] = (b != synth.m_insBanks.end()) ? &b->second : NULL;
+        cache.lookedUp |= 1u << slot;
+    }
+    return cache.banks[slot];
+}
+
 bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
 {
+    traceMidi(TraceMidi_NoteOn, 3, channel, note, velocity);
     Synth &synth = *m_synth;
 
     if(note >= 127)
@@ -356,16 +712,22 @@ bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocit
 
     const OpnInstMeta *ains = &Synth::m_emptyInstrument;
 
+    MIDIchannel::BankCache &cache = midiChan.bankCache;
+    if(cache.revision != synth.m_insBanksRevision || cache.bank != bank)
+    {
+        cache.revision = synth.m_insBanksRevision;
+        cache.lookedUp = 0;
+        cache.bank = bank;
+    }
+
     //Set bank bank
-    const Synth::Bank *bnk = NULL;
+    Synth::Bank *bnk = NULL;
     bool caughtMissingBank = false;
     if((bank & ~static_cast<uint16_t>(Synth::PercussionTag)) > 0)
     {
-        Synth::BankMap::iterator b = synth.m_insBanks.find(bank);
-        if(b != synth.m_insBanks.end())
-            bnk = &b->second;
+        bnk = findCachedBank(cache, MIDIchannel::BankCache::Slot_Exact, bank);
         if(bnk)
-            ains = &bnk->ins[midiins];
+            ains = synth.bankInstrument(*bnk, midiins);
         else
             caughtMissingBank = true;
     }
@@ -376,12 +738,12 @@ bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocit
         size_t fallback = bank & ~(size_t)0x7F;
         if(fallback != bank)
         {
-            Synth::BankMap::iterator b = synth.m_insBanks.find(fallback);
+            Synth::Bank *b = findCachedBank(cache, MIDIchannel::BankCache::Slot_NoLsb, fallback);
             caughtMissingBank = false;
-            if(b != synth.m_insBanks.end())
-                bnk = &b->second;
+            if(b)
+                bnk = b;
             if(bnk)
-                ains = &bnk->ins[midiins];
+                ains = synth.bankInstrument(*bnk, midiins);
             else
                 caughtMissingBank = true;
         }
@@ -389,11 +751,11 @@ bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocit
 
     if(caughtMissingBank && hooks.onDebugMessage)
     {
-        std::set<size_t> &missing = (isPercussion) ?
-                                    caugh_missing_banks_percussion : caugh_missing_banks_melodic;
+        FlagSet<65536> &missing = (isPercussion) ?
+                                  caugh_missing_banks_percussion : caugh_missing_banks_melodic;
         const char *text = (isPercussion) ?
                            "percussion" : "melodic";
-        if(missing.insert(bank).second)
+        if(missing.insert(bank))
         {
             hooks.onDebugMessage(hooks.onDebugMessage_userData,
                                  "[%i] Playing missing %s MIDI bank %i (patch %i)",
@@ -404,11 +766,11 @@ bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocit
     //Or fall back to first bank
     if((ains->flags & OpnInstMeta::Flag_NoSound) != 0)
     {
-        Synth::BankMap::iterator b = synth.m_insBanks.find(bank & Synth::PercussionTag);
-        if(b != synth.m_insBanks.end())
-            bnk = &b->second;
+        Synth::Bank *b = findCachedBank(cache, MIDIchannel::BankCache::Slot_First, bank & Synth::PercussionTag);
+        if(b)
+            bnk = b;
         if(bnk)
-            ains = &bnk->ins[midiins];
+            ains = synth.bankInstrument(*bnk, midiins);
     }
 
     const int veloffset = ains->midiVelocityOffset;
@@ -475,6 +837,8 @@ bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocit
 
     // Allocate OPN2 channel (the physical sound channel for the note)
     int32_t adlchannel[MIDIchannel::NoteInfo::MaxNumPhysChans] = { -1, -1 };
+    // The melody line is exposed, chords and drums are hidden by the rest of the song
+    const bool exposed = !isPercussion && midiChan.activenotes.size() < s_exposedNotesMax;
 
     for(uint32_t ccount = 0; ccount < MIDIchannel::NoteInfo::MaxNumPhysChans; ++ccount)
     {
@@ -488,8 +852,9 @@ bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocit
 
         int32_t c = -1;
         int32_t bs = -0x7FFFFFFFl;
+        size_t numChannels = static_cast<size_t>(synth.m_numActiveChips) * 6;
 
-        for(size_t a = 0; a < static_cast<size_t>(synth.m_numChannels); ++a)
+        for(size_t a = 0; a < numChannels; ++a)
         {
             if(ccount == 1 && static_cast<int32_t>(a) == adlchannel[0]) continue;
             // ^ Don't use the same channel for primary&secondary
@@ -508,7 +873,7 @@ bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocit
             //    if(opn.four_op_category[a] != expected_mode)
             //        continue;
             //}
-            int64_t s = calculateChipChannelGoodness(a, voices[ccount]);
+            int64_t s = calculateChipChannelGoodness(a, voices[ccount], exposed);
             if(s > bs)
             {
                 bs = static_cast<int32_t>(s);    // Best candidate wins
@@ -516,8 +881,13 @@ bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocit
             }
         }
 
+        // Take a channel of the new chip rather than steal the playing voice
+        if((c < 0 || !m_chipChannels[static_cast<size_t>(c)].users.empty()) && growChipPool())
+            c = static_cast<int32_t>(numChannels);
+
         if(c < 0)
         {
+            OPN_STATS_INC(m_stats.unplaceableNotes);
             if(hooks.onDebugMessage)
                 hooks.onDebugMessage(hooks.onDebugMessage_userData,
                                      "ignored unplaceable note [bank %i, inst %i, note %i, MIDI channel %i]",
@@ -535,6 +905,8 @@ bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocit
         return false;
     }
 
+    OPN_STATS_INC(m_stats.noteOns);
+
     //if(hooks.onDebugMessage)
     //    hooks.onDebugMessage(hooks.onDebugMessage_userData, "i1=%d:%d, i2=%d:%d", i[0],adlchannel[0], i[1],adlchannel[1]);
 
@@ -605,6 +977,7 @@ bool OPNMIDIplay::realTime_NoteOn(uint8_t channel, uint8_t note, uint8_t velocit
 
 void OPNMIDIplay::realTime_NoteOff(uint8_t channel, uint8_t note)
 {
+    traceMidi(TraceMidi_NoteOff, 2, channel, note);
     if(static_cast<size_t>(channel) > m_midiChannels.size())
         channel = channel % 16;
     noteOff(channel, note);
@@ -612,6 +985,7 @@ void OPNMIDIplay::realTime_NoteOff(uint8_t channel, uint8_t note)
 
 void OPNMIDIplay::realTime_NoteAfterTouch(uint8_t channel, uint8_t note, uint8_t atVal)
 {
+    traceMidi(TraceMidi_NoteAfterTouch, 3, channel, note, atVal);
     if(static_cast<size_t>(channel) > m_midiChannels.size())
         channel = channel % 16;
     MIDIchannel &chan = m_midiChannels[channel];
@@ -634,6 +1008,7 @@ void OPNMIDIplay::realTime_NoteAfterTouch(uint8_t channel, uint8_t note, uint8_t
 
 void OPNMIDIplay::realTime_ChannelAfterTouch(uint8_t channel, uint8_t atVal)
 {
+    traceMidi(TraceMidi_ChannelAfterTouch, 2, channel, atVal);
     if(static_cast<size_t>(channel) > m_midiChannels.size())
         channel = channel % 16;
     m_midiChannels[channel].aftertouch = atVal;
@@ -641,6 +1016,7 @@ void OPNMIDIplay::realTime_ChannelAfterTouch(uint8_t channel, uint8_t atVal)
 
 void OPNMIDIplay::realTime_Controller(uint8_t channel, uint8_t type, uint8_t value)
 {
+    traceMidi(TraceMidi_Controller, 3, channel, type, value);
     if(static_cast<size_t>(channel) > m_midiChannels.size())
         channel = channel % 16;
     switch(type)
@@ -787,6 +1163,7 @@ void OPNMIDIplay::realTime_Controller(uint8_t channel, uint8_t type, uint8_t val
 
 void OPNMIDIplay::realTime_PatchChange(uint8_t channel, uint8_t patch)
 {
+    traceMidi(TraceMidi_PatchChange, 2, channel, patch);
     if(static_cast<size_t>(channel) > m_midiChannels.size())
         channel = channel % 16;
     m_midiChannels[channel].patch = patch;
@@ -794,6 +1171,7 @@ void OPNMIDIplay::realTime_PatchChange(uint8_t channel, uint8_t patch)
 
 void OPNMIDIplay::realTime_PitchBend(uint8_t channel, uint16_t pitch)
 {
+    traceMidi(TraceMidi_PitchBend, 3, channel, uint8_t((pitch >> 7) & 0x7F), uint8_t(pitch & 0x7F));
     if(static_cast<size_t>(channel) > m_midiChannels.size())
         channel = channel % 16;
     m_midiChannels[channel].bend = int(pitch) - 8192;
@@ -802,6 +1180,7 @@ void OPNMIDIplay::realTime_PitchBend(uint8_t channel, uint16_t pitch)
 
 void OPNMIDIplay::realTime_PitchBend(uint8_t channel, uint8_t msb, uint8_t lsb)
 {
+    traceMidi(TraceMidi_PitchBend, 3, channel, msb, lsb);
     if(static_cast<size_t>(channel) > m_midiChannels.size())
         channel = channel % 16;
     m_midiChannels[channel].bend = int(lsb) + int(msb) * 128 - 8192;
@@ -810,6 +1189,7 @@ void OPNMIDIplay::realTime_PitchBend(uint8_t channel, uint8_t msb, uint8_t lsb)
 
 void OPNMIDIplay::realTime_BankChangeLSB(uint8_t channel, uint8_t lsb)
 {
+    traceMidi(TraceMidi_BankChangeLSB, 2, channel, lsb);
     if(static_cast<size_t>(channel) > m_midiChannels.size())
         channel = channel % 16;
     m_midiChannels[channel].bank_lsb = lsb;
@@ -817,6 +1197,7 @@ void OPNMIDIplay::realTime_BankChangeLSB(uint8_t channel, uint8_t lsb)
 
 void OPNMIDIplay::realTime_BankChangeMSB(uint8_t channel, uint8_t msb)
 {
+    traceMidi(TraceMidi_BankChangeMSB, 2, channel, msb);
     if(static_cast<size_t>(channel) > m_midiChannels.size())
         channel = channel % 16;
     m_midiChannels[channel].bank_msb = msb;
@@ -824,6 +1205,7 @@ void OPNMIDIplay::realTime_BankChangeMSB(uint8_t channel, uint8_t msb)
 
 void OPNMIDIplay::realTime_BankChange(uint8_t channel, uint16_t bank)
 {
+    traceMidi(TraceMidi_BankChange, 3, channel, uint8_t((bank >> 8) & 0xFF), uint8_t(bank & 0xFF));
     if(static_cast<size_t>(channel) > m_midiChannels.size())
         channel = channel % 16;
     m_midiChannels[channel].bank_lsb = uint8_t(bank & 0xFF);
@@ -837,6 +1219,11 @@ void OPNMIDIplay::setDeviceId(uint8_t id)
 
 bool OPNMIDIplay::realTime_SysEx(const uint8_t *msg, size_t size)
 {
+#ifndef OPNMIDI_DISABLE_TRACE
+    if(m_trace.get())
+        m_trace->midiData(TraceMidi_SysEx, 0, msg, size);
+#endif
+
     if(size < 4 || msg[0] != 0xF0 || msg[size - 1] != 0xF7)
         return false;
 
@@ -1053,19 +1440,25 @@ bool OPNMIDIplay::doYamahaSysEx(unsigned dev, const uint8_t *data, size_t size)
 
 void OPNMIDIplay::realTime_panic()
 {
+    traceMidi(TraceMidi_Panic, 0);
     panic();
     killSustainingNotes(-1, -1, OpnChannel::LocationData::Sustain_ANY);
 }
 
 void OPNMIDIplay::realTime_deviceSwitch(size_t track, const char *data, size_t length)
 {
-    const std::string indata(data, length);
-    m_currentMidiDevice[track] = chooseDevice(indata);
+#ifndef OPNMIDI_DISABLE_TRACE
+    if(m_trace.get())
+        m_trace->midiData(TraceMidi_DeviceSwitch, track, reinterpret_cast<const uint8_t *>(data), length);
+#endif
+    if(track >= m_currentMidiDevice.size())
+        m_currentMidiDevice.resize(track + 1, 0);
+    m_currentMidiDevice[track] = chooseDevice(data, length);
 }
 
 size_t OPNMIDIplay::realTime_currentDevice(size_t track)
 {
-    if(m_currentMidiDevice.empty())
+    if(track >= m_currentMidiDevice.size())
         return 0;
     return m_currentMidiDevice[track];
 }
@@ -1108,7 +1501,7 @@ void OPNMIDIplay::noteUpdate(size_t midCh,
     if(info.isBlank)
     {
         if(props_mask & Upd_Off)
-            m_midiChannels[midCh].activenotes.erase(i);
+            m_midiChannels[midCh].erase_activenote(i);
         return;
     }
 
@@ -1121,6 +1514,11 @@ void OPNMIDIplay::noteUpdate(size_t midCh,
 
         if(props_mask & Upd_Patch)
         {
+#ifndef OPNMIDI_DISABLE_STEMS
+            // The patch writes the panning register, which turns the stem output on
+            if(synth.m_stems)
+                synth.m_stems->setChannelOwner(synth, c, midCh, false);
+#endif
             synth.setPatch(c, ins.ains);
             OpnChannel::users_iterator ci = m_chipChannels[c].find_or_create_user(my_loc);
             if(!ci.is_end())    // inserts if necessary
@@ -1131,6 +1529,7 @@ void OPNMIDIplay::noteUpdate(size_t midCh,
                 d.fixed_sustain = (ains.soundKeyOnMs == static_cast<uint16_t>(opnNoteOnMaxTime));
                 d.kon_time_until_neglible_us = 1000 * ains.soundKeyOnMs;
                 d.ins       = ins;
+                reindexChipChannel(c);
             }
         }
     }
@@ -1150,7 +1549,10 @@ void OPNMIDIplay::noteUpdate(size_t midCh,
                 OpnChannel::users_iterator k = m_chipChannels[c].find_user(my_loc);
                 bool do_erase_user = (!k.is_end() && ((k->value.sustained & OpnChannel::LocationData::Sustain_Sostenuto) == 0));
                 if(do_erase_user)
+                {
                     m_chipChannels[c].users.erase(k);
+                    reindexChipChannel(c);
+                }
 
                 if(hooks.onNote)
                     hooks.onNote(hooks.onNote_userData, c, noteTone, static_cast<int>(midiins), 0, 0.0);
@@ -1176,6 +1578,7 @@ void OPNMIDIplay::noteUpdate(size_t midCh,
                 OpnChannel::users_iterator d = m_chipChannels[c].find_or_create_user(my_loc);
                 if(!d.is_end())
                     d->value.sustained |= OpnChannel::LocationData::Sustain_Pedal; // note: not erased!
+                reindexChipChannel(c);
                 if(hooks.onNote)
                     hooks.onNote(hooks.onNote_userData, c, noteTone, static_cast<int>(midiins), -1, 0.0);
             }
@@ -1233,6 +1636,10 @@ void OPNMIDIplay::noteUpdate(size_t midCh,
                 if(vibrato && (d.is_end() || d->value.vibdelay_us >= chan.vibdelay_us))
                     bend += static_cast<double>(vibrato) * chan.vibdepth * std::sin(chan.vibpos);
 
+#ifndef OPNMIDI_DISABLE_STEMS
+                if(synth.m_stems)
+                    synth.m_stems->setChannelOwner(synth, c, midCh, true);
+#endif
                 synth.noteOn(c, currentTone + bend + phase);
 
                 if(hooks.onNote)
@@ -1244,7 +1651,7 @@ void OPNMIDIplay::noteUpdate(size_t midCh,
     if(info.chip_channels_count == 0)
     {
         m_midiChannels[midCh].cleanupNote(i);
-        m_midiChannels[midCh].activenotes.erase(i);
+        m_midiChannels[midCh].erase_activenote(i);
     }
 }
 
@@ -1268,7 +1675,7 @@ void OPNMIDIplay::setErrorString(const std::string &err)
     errorStringOut = err;
 }
 
-int64_t OPNMIDIplay::calculateChipChannelGoodness(size_t c, const MIDIchannel::NoteInfo::Phys &ins) const
+int64_t OPNMIDIplay::calculateChipChannelGoodness(size_t c, const MIDIchannel::NoteInfo::Phys &ins, bool exposed) const
 {
     Synth &synth = *m_synth;
     const OpnChannel &chan = m_chipChannels[c];
@@ -1285,6 +1692,10 @@ int64_t OPNMIDIplay::calculateChipChannelGoodness(size_t c, const MIDIchannel::N
         return s;
     }
 
+    // Free channel: exposed notes prefer lead chips, dense parts leave them free
+    if(chan.users.empty())
+        return synth.isLeadChip(c / 6) ? (exposed ? 1 : -1) : 0;
+
     // Same midi-instrument = some stability
     for(OpnChannel::const_users_iterator j = chan.users.begin(); !j.is_end(); ++j)
     {
@@ -1371,6 +1782,7 @@ void OPNMIDIplay::prepareChipChannelForNewNote(size_t c, const MIDIchannel::Note
             {
                 // Do arpeggio together with this note.
                 //doing_arpeggio = true;
+                OPN_STATS_INC(m_stats.arpeggioShares);
                 continue;
             }
 
@@ -1394,7 +1806,6 @@ void OPNMIDIplay::killOrEvacuate(size_t from_channel,
                                  OpnChannel::users_iterator j,
                                  OPNMIDIplay::MIDIchannel::notes_iterator i)
 {
-    Synth &synth = *m_synth;
     uint32_t maxChannels = OPN_MAX_CHIPS * 6;
     OpnChannel::LocationData &jd = j->value;
     MIDIchannel::NoteInfo &info = i->value;
@@ -1403,56 +1814,78 @@ void OPNMIDIplay::killOrEvacuate(size_t from_channel,
     // evacuated to another channel as an arpeggio
     // instrument. This helps if e.g. all channels
     // are full of strings and we want to do percussion.
+    // Only channels playing the same instrument are visited,
+    // and the lowest suitable one is taken.
     // FIXME: This does not care about four-op entanglements.
-    for(uint32_t c = 0; c < synth.m_numChannels; ++c)
+    int32_t found = InstrumentIndex::NoChannel;
+    const int32_t buckets[2] =
     {
-        uint16_t cs = static_cast<uint16_t>(c);
-
-        if(!m_setup.enableAutoArpeggio)
-            break; // Arpeggio disabled completely
+        InstrumentIndex::bucketOf(jd.ins.ains),
+        InstrumentIndex::MixedBucket
+    };
 
-        if(c >= maxChannels)
-            break;
-        if(c == from_channel)
-            continue;
-        //if(opn.four_op_category[c] != opn.four_op_category[from_channel])
-        //    continue;
+    for(size_t b = 0; b < 2 && m_setup.enableAutoArpeggio; ++b)
+    {
+        for(int32_t c = m_insIndex.heads[buckets[b]]; c != InstrumentIndex::NoChannel; c = m_insIndex.nodes[c].next)
+        {
+            size_t cu = static_cast<size_t>(c);
 
-        OpnChannel &adlch = m_chipChannels[c];
-        if(adlch.users.size() == adlch.users.capacity())
-            continue;  // no room for more arpeggio on channel
+            if(found != InstrumentIndex::NoChannel && c > found)
+                continue;
+            if(cu >= maxChannels)
+                continue;
+            if(cu == from_channel)
+                continue;
+            //if(opn.four_op_category[c] != opn.four_op_category[from_channel])
+            //    continue;
 
-        if(!m_chipChannels[cs].find_user(jd.loc).is_end())
-            continue;  // channel already has this note playing (sustained)
-                       // avoid introducing a duplicate location.
+            OpnChannel &adlch = m_chipChannels[cu];
+            if(adlch.users.size() == adlch.users.capacity())
+                continue;  // no room for more arpeggio on channel
 
-        for(OpnChannel::users_iterator m = adlch.users.begin(); !m.is_end(); ++m)
-        {
-            OpnChannel::LocationData &mv = m->value;
+            if(!adlch.find_user(jd.loc).is_end())
+                continue;  // channel already has this note playing (sustained)
+                           // avoid introducing a duplicate location.
 
-            if(mv.vibdelay_us >= 200000
-               && mv.kon_time_until_neglible_us < 10000000) continue;
-            if(mv.ins != jd.ins)
-                continue;
-            if(hooks.onNote)
+            for(OpnChannel::users_iterator m = adlch.users.begin(); !m.is_end(); ++m)
             {
-                hooks.onNote(hooks.onNote_userData,
-                             static_cast<int>(from_channel),
-                             info.noteTone,
-                             static_cast<int>(info.midiins), 0, 0.0);
-                hooks.onNote(hooks.onNote_userData,
-                             static_cast<int>(c),
-                             info.noteTone,
-                             static_cast<int>(info.midiins),
-                             info.vol, 0.0);
+                OpnChannel::LocationData &mv = m->value;
+
+                if(mv.vibdelay_us >= 200000
+                   && mv.kon_time_until_neglible_us < 10000000) continue;
+                if(mv.ins != jd.ins)
+                    continue;
+                found = c;
+                break;
             }
+        }
+    }
 
-            info.phys_erase(static_cast<uint16_t>(from_channel));
-            info.phys_ensure_find_or_create(cs)->assign(jd.ins);
-            m_chipChannels[cs].users.push_back(jd);
-            m_chipChannels[from_channel].users.erase(j);
-            return;
+    if(found != InstrumentIndex::NoChannel)
+    {
+        uint16_t cs = static_cast<uint16_t>(found);
+
+        if(hooks.onNote)
+        {
+            hooks.onNote(hooks.onNote_userData,
+                         static_cast<int>(from_channel),
+                         info.noteTone,
+                         static_cast<int>(info.midiins), 0, 0.0);
+            hooks.onNote(hooks.onNote_userData,
+                         static_cast<int>(cs),
+                         info.noteTone,
+                         static_cast<int>(info.midiins),
+                         info.vol, 0.0);
         }
+
+        info.phys_erase(static_cast<uint16_t>(from_channel));
+        info.phys_ensure_find_or_create(cs)->assign(jd.ins);
+        m_chipChannels[cs].users.push_back(jd);
+        m_chipChannels[from_channel].users.erase(j);
+        reindexChipChannel(cs);
+        reindexChipChannel(from_channel);
+        OPN_STATS_INC(m_stats.arpeggioShares);
+        return;
     }
 
     /*UI.PrintLn(
@@ -1463,6 +1896,7 @@ void OPNMIDIplay::killOrEvacuate(size_t from_channel,
                 ins
                 );*/
     // Kill it
+    OPN_STATS_INC(m_stats.voiceSteals);
     noteUpdate(jd.loc.MidCh,
                i,
                Upd_Off,
@@ -1474,7 +1908,7 @@ void OPNMIDIplay::panic()
     for(uint8_t chan = 0; chan < m_midiChannels.size(); chan++)
     {
         for(uint8_t note = 0; note < 128; note++)
-            realTime_NoteOff(chan, note);
+            noteOff(chan, note);
     }
 }
 
@@ -1512,6 +1946,8 @@ void OPNMIDIplay::killSustainingNotes(int32_t midCh, int32_t this_adlchn, uint32
             }
         }
 
+        reindexChipChannel(c);
+
         // Keyoff the channel, if there are no users left.
         if(m_chipChannels[c].users.empty())
             synth.noteOff(c);
@@ -1622,15 +2058,18 @@ void OPNMIDIplay::updateVibrato(double amount)
 
 
 
-size_t OPNMIDIplay::chooseDevice(const std::string &name)
+size_t OPNMIDIplay::chooseDevice(const char *name, size_t length)
 {
-    std::map<std::string, size_t>::iterator i = m_midiDevices.find(name);
-
-    if(i != m_midiDevices.end())
-        return i->second;
+    // Compare without making a string, the lookup happens while playing
+    for(size_t i = 0, n = m_midiDevices.size(); i < n; ++i)
+    {
+        const std::string &dev = m_midiDevices[i];
+        if(dev.size() == length && (length == 0 || std::memcmp(dev.data(), name, length) == 0))
+            return i * 16;
+    }
 
     size_t n = m_midiDevices.size() * 16;
-    m_midiDevices.insert(std::make_pair(name, n));
+    m_midiDevices.push_back(std::string(name, length));
     m_midiChannels.resize(n + 16);
     resetMIDIDefaults(static_cast<int>(n));
     return n;
@@ -1682,6 +2121,7 @@ retry_arpeggio:
 
         if(n_users > 1)
         {
+            ++m_arpeggioSteps;
             OpnChannel::users_iterator i = m_chipChannels[c].users.begin();
             size_t rate_reduction = 3;
 
@@ -1718,6 +2158,131 @@ retry_arpeggio:
     }
 }
 
+void OPNMIDIplay::InstrumentIndex::reset(size_t numChannels)
+{
+    for(size_t b = 0; b <= BucketsCount; ++b)
+        heads[b] = NoChannel;
+    Node n = {NoChannel, NoChannel, NoBucket};
+    nodes.assign(numChannels, n);
+}
+
+void OPNMIDIplay::InstrumentIndex::link(size_t c, int32_t bucket)
+{
+    Node &n = nodes[c];
+    if(n.bucket == bucket)
+        return;
+
+    if(n.bucket != NoBucket)
+    {
+        if(n.prev != NoChannel)
+            nodes[static_cast<size_t>(n.prev)].next = n.next;
+        else
+            heads[n.bucket] = n.next;
+        if(n.next != NoChannel)
+            nodes[static_cast<size_t>(n.next)].prev = n.prev;
+    }
+
+    n.bucket = bucket;
+    n.prev = NoChannel;
+    n.next = NoChannel;
+
+    if(bucket != NoBucket)
+    {
+        n.next = heads[bucket];
+        if(n.next != NoChannel)
+            nodes[static_cast<size_t>(n.next)].prev = static_cast<int32_t>(c);
+        heads[bucket] = static_cast<int32_t>(c);
+    }
+}
+
+int32_t OPNMIDIplay::InstrumentIndex::bucketOf(const OpnTimbre &ins)
+{
+    // FNV-1a of the instrument bytes, the same bytes which are compared for equality
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&ins);
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < sizeof(OpnTimbre); ++i)
+        h = (h ^ p[i]) * 16777619u;
+    return static_cast<int32_t>((h ^ (h >> 16)) & (BucketsCount - 1));
+}
+
+void OPNMIDIplay::reindexChipChannel(size_t c)
+{
+    const OpnChannel &chan = m_chipChannels[c];
+    int32_t bucket = InstrumentIndex::NoBucket;
+
+    OpnChannel::const_users_iterator j = chan.users.begin();
+    if(!j.is_end())
+    {
+        const MIDIchannel::NoteInfo::Phys &ins = j->value.ins;
+        bucket = InstrumentIndex::bucketOf(ins.ains);
+        for(++j; !j.is_end(); ++j)
+        {
+            if(j->value.ins != ins)
+            {
+                bucket = InstrumentIndex::MixedBucket;
+                break;
+            }
+        }
+    }
+
+    m_insIndex.link(c, bucket);
+}
+
+void OPNMIDIplay::reindexChipChannels()
+{
+    m_insIndex.reset(m_chipChannels.size());
+    for(size_t c = 0; c < m_chipChannels.size(); ++c)
+        reindexChipChannel(c);
+}
+
+//! Time of silence before the last active chip gets retired, in seconds
+static const double s_chipRetireTime = 2.0;
+
+void OPNMIDIplay::resetChipPool()
+{
+    Synth &synth = *m_synth;
+    m_chipIdleTime = 0.0;
+    if(m_setup.dynamicChips && !synth.setupLocked())
+        synth.m_numActiveChips = 1;
+    else
+        synth.m_numActiveChips = synth.m_numChips;
+}
+
+bool OPNMIDIplay::growChipPool()
+{
+    Synth &synth = *m_synth;
+    if(synth.m_numActiveChips >= synth.m_numChips)
+        return false;
+    ++synth.m_numActiveChips;
+    m_chipIdleTime = 0.0;
+    return true;
+}
+
+void OPNMIDIplay::updateChipPool(double amount)
+{
+    Synth &synth = *m_synth;
+    if(!m_setup.dynamicChips || synth.m_numActiveChips <= 1)
+        return;
+
+    size_t first = static_cast<size_t>(synth.m_numActiveChips - 1) * 6;
+    for(size_t c = first; c < first + 6; ++c)
+    {
+        const OpnChannel &ch = m_chipChannels[c];
+        if(!ch.users.empty() || ch.koff_time_until_neglible_us > 0)
+        {
+            m_chipIdleTime = 0.0;
+            return;
+        }
+    }
+
+    m_chipIdleTime += amount;
+    if(m_chipIdleTime >= s_chipRetireTime)
+    {
+        --synth.m_numActiveChips;
+        m_chipIdleTime = 0.0;
+    }
+}
+
 void OPNMIDIplay::updateGlide(double amount)
 {
     size_t num_channels = m_midiChannels.size();
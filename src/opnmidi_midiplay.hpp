@@ -27,6 +27,14 @@
 #include "opnbank.h"
 #include "opnmidi_private.hpp"
 #include "opnmidi_ptr.hpp"
+#include "opnmidi_opn2.hpp"
+#include "opnmidi_async.hpp"
+#include "opnmidi_events.hpp"
+#include "opnmidi_trace.hpp"
+#include "opnmidi_parallel.hpp"
+#include "opnmidi_playlist.hpp"
+#include "opnmidi_stream.hpp"
+#include "opnmidi_loopcache.hpp"
 #include "structures/pl_list.hpp"
 
 /**
@@ -38,7 +46,9 @@ struct MIDIEventHooks
         onNote(NULL),
         onNote_userData(NULL),
         onDebugMessage(NULL),
-        onDebugMessage_userData(NULL)
+        onDebugMessage_userData(NULL),
+        onEmulatorSwitch(NULL),
+        onEmulatorSwitch_userData(NULL)
     {}
 
     //! Note on/off hooks
@@ -50,6 +60,11 @@ struct MIDIEventHooks
     typedef void (*DebugMessageHook)(void *userdata, const char *fmt, ...);
     DebugMessageHook onDebugMessage;
     void *onDebugMessage_userData;
+
+    //! Emulator switches made by quality governor
+    typedef void (*EmulatorSwitchHook)(void *userdata, int fromEmulator, int toEmulator, double load);
+    EmulatorSwitchHook onEmulatorSwitch;
+    void *onEmulatorSwitch_userData;
 };
 
 class OPNMIDIplay
@@ -64,6 +79,18 @@ public:
     void partialReset();
     void resetMIDI();
 
+    /**
+     * @brief Build emulator levels of the quality governor for the selected emulator
+     */
+    void resetQualityGovernor();
+
+    /**
+     * @brief Account the render time and switch emulator when needed
+     * @param renderTime Time spent to render the audio, in seconds
+     * @param playTime Duration of the rendered audio, in seconds
+     */
+    void governQuality(double renderTime, double playTime);
+
 private:
     void resetMIDIDefaults(int offset = 0);
 
@@ -144,6 +171,35 @@ public:
         //! Is melodic channel turned into percussion
         bool is_xg_percussion;
 
+        /**
+         * @brief Banks found by the note-on for the current bank number
+         *
+         * Bank select, program change (of the XG percussion) and synth mode
+         * change the bank number, changes of the bank map change its revision,
+         * both invalidate the cache.
+         */
+        struct BankCache
+        {
+            enum
+            {
+                //! Bank of the exact number
+                Slot_Exact = 0,
+                //! Bank of the number ignoring LSB
+                Slot_NoLsb,
+                //! First melodic or percussion bank
+                Slot_First,
+                Slot_Count
+            };
+            //! Revision of the bank map, zero when nothing is cached
+            uint32_t revision;
+            //! Flags of the slots which were looked up
+            uint32_t lookedUp;
+            //! Bank number (with the percussion tag)
+            size_t bank;
+            //! Found banks, NULL when missing
+            Synth::Bank *banks[Slot_Count];
+        } bankCache;
+
         /**
          * @brief Per-Note information
          */
@@ -270,9 +326,57 @@ public:
         typedef pl_list<NoteInfo>::iterator notes_iterator;
         typedef pl_list<NoteInfo>::const_iterator const_notes_iterator;
 
+        /**
+         * @brief Direct note number to list cell map of active notes
+         *
+         * The cells are owned by the activenotes list, a copy of the channel
+         * gets its own cells, so the copied index is marked stale and gets
+         * rebuilt on the next lookup.
+         */
+        struct NoteIndex
+        {
+            //! Cell of the active note for every note number, or NULL
+            pl_cell<NoteInfo> *cells[128];
+            //! Index matches the cells of the owning list
+            bool valid;
+
+            NoteIndex() : valid(true)
+            {
+                std::memset(cells, 0, sizeof(cells));
+            }
+            NoteIndex(const NoteIndex &) : valid(false)
+            {
+                std::memset(cells, 0, sizeof(cells));
+            }
+            NoteIndex &operator=(const NoteIndex &)
+            {
+                std::memset(cells, 0, sizeof(cells));
+                valid = false;
+                return *this;
+            }
+        };
+        //! Index of active notes by note number
+        NoteIndex activenotes_index;
+
+        /**
+         * @brief Rebuild the index of active notes from the list
+         */
+        void reindex_activenotes()
+        {
+            std::memset(activenotes_index.cells, 0, sizeof(activenotes_index.cells));
+            for(notes_iterator i = activenotes.begin(); !i.is_end(); ++i)
+                activenotes_index.cells[i->value.note & 127] = &*i;
+            activenotes_index.valid = true;
+        }
+
         notes_iterator find_activenote(unsigned note)
         {
-            return activenotes.find_if(NoteInfo::FindPredicate(note));
+            if(note >= 128)
+                return activenotes.end();
+            if(!activenotes_index.valid)
+                reindex_activenotes();
+            pl_cell<NoteInfo> *cell = activenotes_index.cells[note];
+            return cell ? notes_iterator(cell) : activenotes.end();
         }
 
         notes_iterator ensure_find_activenote(unsigned note)
@@ -287,15 +391,30 @@ public:
             notes_iterator it = find_activenote(note);
             if(!it.is_end())
                 cleanupNote(it);
-            else
+            else if(note < 128)
             {
                 NoteInfo ni;
                 ni.note = note;
                 it = activenotes.insert(activenotes.end(), ni);
+                if(!it.is_end())
+                    activenotes_index.cells[note] = &*it;
             }
             return it;
         }
 
+        /**
+         * @brief Remove the active note from the list and from the index
+         * @param i Iterator of the active note
+         * @return Iterator of the next note
+         */
+        notes_iterator erase_activenote(notes_iterator i)
+        {
+            if(!activenotes_index.valid)
+                reindex_activenotes();
+            activenotes_index.cells[i->value.note & 127] = NULL;
+            return activenotes.erase(i);
+        }
+
         notes_iterator ensure_find_or_create_activenote(unsigned note)
         {
             notes_iterator it = find_or_create_activenote(note);
@@ -317,6 +436,7 @@ public:
             lastmrpn = 0;
             nrpn = false;
             is_xg_percussion = false;
+            bankCache.revision = 0;
         }
 
 
@@ -511,6 +631,10 @@ public:
     {
         int     emulator;
         bool    runAtPcmRate;
+        //! Emulator of the lead chips which take exposed voices, or -1
+        int     leadEmulator;
+        //! Number of first chips which run leadEmulator
+        unsigned int leadChips;
         unsigned int OpnBank;
         unsigned int numChips;
         unsigned int LogarithmicVolumes;
@@ -522,10 +646,24 @@ public:
         int     ScaleModulators;
         bool    fullRangeBrightnessCC74;
         bool    enableAutoArpeggio;
+        bool    dynamicChips;
+        //! Let the release of notes ring when the queued song starts
+        bool    gaplessTails;
+        //! Keep the bank file raw and decode instruments on the first use
+        bool    lazyBanks;
+        //! Count the song time by integer count of output frames
+        bool    integerClock;
+        //! Count of threads to decode tracks of loaded files
+        unsigned int parseThreads;
 
         double delay;
         double carry;
 
+        //! Output frames until next tick of the integer clock
+        uint32_t clockDelay;
+        //! Output frames rendered since last tick of the integer clock
+        uint32_t clockElapsed;
+
         /* The lag between visual content and audio content equals */
         /* the sum of these two buffers. */
         double mindelay;
@@ -573,16 +711,214 @@ public:
     //! Installed function hooks
     MIDIEventHooks hooks;
 
+#ifndef OPNMIDI_DISABLE_STATS
+    /**
+     * @brief Performance counters
+     */
+    struct Stats
+    {
+        //! Count of rendered stereo frames
+        uint64_t framesRendered;
+        //! Time spent in the generation of chips output, in seconds
+        double   chipTime;
+        //! Time spent in the events processing, in seconds
+        double   eventTime;
+        //! Count of played notes
+        uint64_t noteOns;
+        //! Count of killed notes to free the chip channel
+        uint64_t voiceSteals;
+        //! Count of notes which had no chip channel
+        uint64_t unplaceableNotes;
+        //! Count of notes which were put into arpeggio
+        uint64_t arpeggioShares;
+        //! Peak count of used chip channels
+        uint32_t peakActiveChannels;
+        //! Histogram of render time to played time ratio
+        uint64_t loadHistogram[OPNMIDI_STATS_HISTOGRAM_SIZE];
+    } m_stats;
+
+    /**
+     * @brief Reset all performance counters
+     */
+    void resetStats();
+
+    /**
+     * @brief Account the render time in the histogram
+     * @param renderTime Time spent to render the audio, in seconds
+     * @param playTime Duration of the rendered audio, in seconds
+     */
+    void accountRenderTime(double renderTime, double playTime);
+#endif
+
+#ifndef OPNMIDI_DISABLE_ASYNC_RENDER
+    //! Render-ahead worker, created by opn2_startAsync()
+    AdlMIDI_UPtr<OPNMIDIAsyncRender> m_asyncRender;
+#endif
+
+    //! Real-time events applied by the render path, created by opn2_startAsync()
+    AdlMIDI_UPtr<OPNMIDIEventQueue> m_eventQueue;
+
+#ifndef OPNMIDI_DISABLE_TRACE
+    //! Trace log of MIDI calls and register writes, created by opn2_startTrace()
+    AdlMIDI_UPtr<OPNMIDITrace> m_trace;
+#endif
+
+#ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+    //! Recorder of the song blocks, created by opn2_renderSongParallel()
+    AdlMIDI_UPtr<OPNMIDIParallelRender> m_parallelRender;
+#endif
+
+#ifndef OPNMIDI_DISABLE_STEMS
+    //! Renderer of separate outputs, created by opn2_setStemMode()
+    AdlMIDI_UPtr<OPNMIDIStems> m_stems;
+#endif
+
+#if !defined(OPNMIDI_DISABLE_LOOP_CACHE) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    //! Recorder and player of repeated song loops, created by opn2_setLoopCache()
+    AdlMIDI_UPtr<OPNMIDILoopCache> m_loopCache;
+#endif
+
+#if !defined(OPNMIDI_DISABLE_GAPLESS_PLAYLIST) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    //! Loader of the next song, created by opn2_queueNextFile() or by opn2_queueNextData()
+    AdlMIDI_UPtr<OPNMIDIPlaylist> m_playlist;
+
+    /**
+     * @brief Switch to the queued song if it's ready, keeps the state of chips
+     * @return true if the next song has been started
+     */
+    bool startNextSong();
+
+    /**
+     * @brief Build MIDI devices and channels of the parsed next song, called by the playlist on its thread
+     * @param seq Sequencer of the next song
+     */
+    void prepareNextSong(MidiSequencer &seq);
+
+    /**
+     * @brief Exchange MIDI devices and channels with ones prepared for the next song without allocations
+     */
+    void adoptNextSong();
+
+    /**
+     * @brief Is there a queued song which didn't start yet
+     */
+    bool isNextSongPending() const
+    {
+        return m_playlist.get() && m_playlist->pending();
+    }
+#endif
+
+#if !defined(OPNMIDI_DISABLE_STREAM_LOADER) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    //! Loader of the song received by the read callback, started by opn2_openStream()
+    AdlMIDI_UPtr<OPNMIDIStreamLoader> m_streamLoader;
+    //! Is the playback paused until enough of the song data is received
+    bool m_streamStalled;
+
+    /**
+     * @brief Load the music file which data is received by the read callback
+     * @param read Read callback of the song data
+     * @param userData Pointer to user data given to the read callback
+     * @param prebuffer Time of the song to receive before the playback, in seconds
+     * @return true on success, false on failure
+     */
+    bool LoadMIDIStream(OPNMIDIStreamLoader::ReadFunc read, void *userData, double prebuffer);
+
+    /**
+     * @brief Continue by the newer received part of the song, and check is the output paused
+     * @return true if the playback waits for the song data, the output must be silent
+     */
+    bool streamWaiting();
+#endif
+
+    //! Buffer of the last saved state, reused by opn2_saveState()
+    std::vector<uint8_t> m_stateBuffer;
+
 private:
-    //! Per-track MIDI devices map
-    std::map<std::string, size_t> m_midiDevices;
-    //! Current MIDI device per track
-    std::map<size_t /*track*/, size_t /*channel begin index*/> m_currentMidiDevice;
+    //! Names of known MIDI devices, the device N takes MIDI channels from N*16 to N*16+15
+    std::vector<std::string> m_midiDevices;
+    //! Channel begin index of the current MIDI device per track
+    std::vector<size_t> m_currentMidiDevice;
+#if !defined(OPNMIDI_DISABLE_GAPLESS_PLAYLIST) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+    //! Names of MIDI devices of the queued song, or of the previous song once it started
+    std::vector<std::string> m_nextMidiDevices;
+    //! Channel begin index of the MIDI device per track of the queued song
+    std::vector<size_t> m_nextCurrentMidiDevice;
+    //! MIDI channels of all devices of the queued song
+    std::vector<MIDIchannel> m_nextMidiChannels;
+#endif
 
     //! Chip channels map
     std::vector<OpnChannel> m_chipChannels;
+
+    /**
+     * @brief Index of busy chip channels by the instrument of their users
+     *
+     * Every chip channel with users is linked into the bucket of the hash of
+     * their instrument, or into the mixed bucket when its users are playing
+     * different instruments, so the search of channels that are playing
+     * the given instrument visits only the matching ones. Never allocates
+     * memory after reset().
+     */
+    struct InstrumentIndex
+    {
+        enum
+        {
+            //! Count of buckets of instrument hashes, power of two
+            BucketsCount = 64,
+            //! Bucket of channels whose users are playing different instruments
+            MixedBucket = BucketsCount,
+            //! Channel is not linked
+            NoBucket = -1,
+            //! End of the bucket
+            NoChannel = -1
+        };
+
+        struct Node
+        {
+            int32_t prev;
+            int32_t next;
+            int32_t bucket;
+        };
+
+        //! First channel of every bucket
+        int32_t heads[BucketsCount + 1];
+        //! Links of every chip channel
+        std::vector<Node> nodes;
+
+        InstrumentIndex()
+        {
+            reset(0);
+        }
+
+        /**
+         * @brief Unlink all channels and set the count of chip channels
+         * @param numChannels Count of chip channels
+         */
+        void reset(size_t numChannels);
+
+        /**
+         * @brief Move the channel into another bucket
+         * @param c Chip channel
+         * @param bucket Bucket, or NoBucket to unlink the channel
+         */
+        void link(size_t c, int32_t bucket);
+
+        /**
+         * @brief Bucket of channels which are playing this instrument
+         * @param ins Instrument
+         * @return Bucket index
+         */
+        static int32_t bucketOf(const OpnTimbre &ins);
+    };
+
+    //! Index of busy chip channels by instruments
+    InstrumentIndex m_insIndex;
     //! Counter of arpeggio processing
     size_t m_arpeggioCounter;
+    //! Count of arpeggio steps made on chip channels with several users
+    size_t m_arpeggioSteps;
+    //! Time while the last active chip stays silent, in seconds
+    double m_chipIdleTime;
 
 #if defined(ADLMIDI_AUDIO_TICK_HANDLER)
     //! Audio tick counter
@@ -592,12 +928,46 @@ private:
     //! Local error string
     std::string errorStringOut;
 
+    /**
+     * @brief Fixed-size set of small numbers, never allocates memory
+     */
+    template<size_t Count>
+    struct FlagSet
+    {
+        uint8_t bits[(Count + 7) / 8];
+
+        FlagSet()
+        {
+            clear();
+        }
+
+        void clear()
+        {
+            std::memset(bits, 0, sizeof(bits));
+        }
+
+        bool count(size_t i) const
+        {
+            return (bits[(i % Count) / 8] & (1u << (i % 8))) != 0;
+        }
+
+        //! Returns true when the value wasn't in the set yet
+        bool insert(size_t i)
+        {
+            uint8_t &b = bits[(i % Count) / 8];
+            uint8_t mask = static_cast<uint8_t>(1u << (i % 8));
+            bool added = (b & mask) == 0;
+            b |= mask;
+            return added;
+        }
+    };
+
     //! Missing instruments catches
-    std::set<size_t> caugh_missing_instruments;
+    FlagSet<256> caugh_missing_instruments;
     //! Missing melodic banks catches
-    std::set<size_t> caugh_missing_banks_melodic;
+    FlagSet<65536> caugh_missing_banks_melodic;
     //! Missing percussion banks catches
-    std::set<size_t> caugh_missing_banks_percussion;
+    FlagSet<65536> caugh_missing_banks_percussion;
 
 public:
 
@@ -610,9 +980,69 @@ public:
     //! Generator output buffer
     int32_t m_outBuf[1024];
 
+    /**
+     * @brief State of the adaptive quality governor
+     */
+    struct QualityGovernor
+    {
+        //! Is governor enabled
+        bool    enabled;
+        //! Emulators from the selected one to the cheapest one
+        int     levels[4];
+        //! Count of usable levels
+        size_t  levelsCount;
+        //! Level of the currently running emulator
+        size_t  level;
+        //! Smoothed ratio of the render time to the played time
+        double  load;
+        //! Played time while load stays over the budget, in seconds
+        double  overTime;
+        //! Played time while load has enough headroom, in seconds
+        double  underTime;
+        //! Played time with headroom needed to switch back, in seconds
+        double  upgradeDelay;
+        //! Played time since last switch, in seconds
+        double  sinceSwitch;
+        //! Last switch was made to the more expensive emulator
+        bool    lastUpgrade;
+    } m_governor;
+
     //! Synthesizer setup
     Setup m_setup;
 
+    /**
+     * @brief Serialize the complete state of the synthesizer and of the sequencer
+     * @param out Destination buffer, its content gets replaced
+     * @return true on success, false when the running emulator can't save its state
+     */
+    bool saveState(std::vector<uint8_t> &out);
+
+    /**
+     * @brief Restore the state written by saveState()
+     * @param data Pointer to the saved state
+     * @param size Size of the saved state
+     * @return true on success, false if state is invalid or doesn't match the current setup
+     */
+    bool loadState(const uint8_t *data, size_t size);
+
+    /**
+     * @brief Parse the state written by saveState()
+     * @param data Pointer to the saved state
+     * @param size Size of the saved state
+     * @param apply Restore the parsed state, otherwise only validate it without changes of the player
+     * @return true on success, false if state is invalid or doesn't match the current setup
+     */
+    bool readState(const uint8_t *data, size_t size, bool apply);
+
+    /**
+     * @brief Serialize the state which defines the further output, to compare it with another one
+     *
+     * Unlike saveState(), internals of emulators and the floating point clock
+     * aren't written, the result can't be restored.
+     * @param out Destination buffer, its content gets replaced
+     */
+    void saveLoopFingerprint(std::vector<uint8_t> &out);
+
     /**
      * @brief Load bank from file
      * @param filename Path to bank file
@@ -635,6 +1065,47 @@ public:
      */
     bool LoadBank(FileAndMemReader &fr);
 
+    /**
+     * @brief Load WOPN bank lazily: keep the raw data, decode banks and instruments on the first use
+     * @param data Pointer to the raw WOPN bank file data, gets copied
+     * @param size Size of given memory block
+     * @return true on success
+     */
+    bool LoadBankLazy(const uint8_t *data, size_t size);
+
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+    /**
+     * @brief Decode instruments of the lazily loaded bank referenced by the loaded song
+     */
+    void preloadLazyBanks();
+#endif
+
+    /**
+     * @brief Does the memory block begin with the bank image signature
+     * @param data Pointer to memory block
+     * @param size Size of given memory block
+     * @return true if data is a pre-baked bank image
+     */
+    static bool IsBankImage(const void *data, size_t size);
+
+    /**
+     * @brief Load the pre-baked bank image, made by SaveBankImage()
+     *
+     * Instrument tables are stored in the final layout, so every bank
+     * is taken by a single copy. Data may point to the memory-mapped file.
+     * @param data Pointer to the bank image
+     * @param size Size of the bank image
+     * @return true on success
+     */
+    bool LoadBankImage(const void *data, size_t size);
+
+    /**
+     * @brief Write the currently loaded banks as the pre-baked bank image
+     * @param out Output buffer, gets replaced with the image data
+     * @return true on success
+     */
+    bool SaveBankImage(std::vector<uint8_t> &out);
+
 #ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
     /**
      * @brief MIDI file loading pre-process
@@ -664,6 +1135,15 @@ public:
      */
     bool LoadMIDI(const void *data, size_t size);
 
+    /**
+     * @brief Scan the music file for timing and meta-data only, without of loading it
+     * @param fr Context with opened file data
+     * @param info Receives the timing and meta-data, all strings are kept in one memory block
+     * @param error Receives the error message on failure
+     * @return true on success, false on failure
+     */
+    static bool ProbeMIDI(FileAndMemReader &fr, Opn2_ProbeInfo *info, std::string &error);
+
     /**
      * @brief Periodic tick handler.
      * @param s seconds since last call
@@ -671,6 +1151,13 @@ public:
      * @return desired number of seconds until next call
      */
     double Tick(double s, double granularity);
+
+    /**
+     * @brief Periodic tick handler of the integer clock
+     * @param frames Count of output frames since last call
+     * @return desired number of output frames until next call
+     */
+    uint64_t TickFrames(uint64_t frames);
 #endif //OPNMIDI_DISABLE_MIDI_SEQUENCER
 
     /**
@@ -896,13 +1383,42 @@ private:
 
     void noteUpdateAll(size_t midCh, unsigned props_mask);
 
+    /**
+     * @brief Log the real-time MIDI call into the trace when it's running
+     * @param kind Kind of the call
+     * @param argc Count of used arguments
+     */
+    void traceMidi(OPNMIDITraceMidi kind, size_t argc, uint8_t a = 0, uint8_t b = 0, uint8_t c = 0)
+    {
+#ifndef OPNMIDI_DISABLE_TRACE
+        if(m_trace.get())
+            m_trace->midiEvent(kind, argc, a, b, c);
+#else
+        ADL_UNUSED(kind);
+        ADL_UNUSED(argc);
+        ADL_UNUSED(a);
+        ADL_UNUSED(b);
+        ADL_UNUSED(c);
+#endif
+    }
+
+    /**
+     * @brief Find the bank for the note-on, looking it up only once per cache slot
+     * @param cache Bank cache of the MIDI channel
+     * @param slot Cache slot (MIDIchannel::BankCache::Slot_*)
+     * @param bank Bank number to look up
+     * @return Bank or NULL if it's missing
+     */
+    Synth::Bank *findCachedBank(MIDIchannel::BankCache &cache, unsigned slot, size_t bank);
+
     /**
      * @brief Determine how good a candidate this adlchannel would be for playing a note from this instrument.
      * @param c Wanted chip channel
      * @param ins Instrument wanted to be used in this channel
+     * @param exposed The note is heard alone, like a melody, rather than in a dense part
      * @return Calculated coodness points
      */
-    int64_t calculateChipChannelGoodness(size_t c, const MIDIchannel::NoteInfo::Phys &ins) const;
+    int64_t calculateChipChannelGoodness(size_t c, const MIDIchannel::NoteInfo::Phys &ins, bool exposed) const;
 
     /**
      * @brief A new note will be played on this channel using this instrument.
@@ -923,6 +1439,17 @@ private:
         OpnChannel::users_iterator j,
         MIDIchannel::notes_iterator i);
 
+    /**
+     * @brief Update the instrument index entry of the chip channel after change of its users
+     * @param c Chip channel
+     */
+    void reindexChipChannel(size_t c);
+
+    /**
+     * @brief Rebuild the instrument index from scratch
+     */
+    void reindexChipChannels();
+
     /**
      * @brief Off all notes and silence sound
      */
@@ -977,6 +1504,23 @@ private:
      */
     void updateArpeggio(double /*amount*/);
 
+    /**
+     * @brief Set initial count of active chips after reset of chips
+     */
+    void resetChipPool();
+
+    /**
+     * @brief Activate one more chip when all active chip channels are busy
+     * @return true if new chip has been activated
+     */
+    bool growChipPool();
+
+    /**
+     * @brief Retire the last active chip when it stays silent long enough
+     * @param amount Amount value in seconds
+     */
+    void updateChipPool(double amount);
+
     /**
      * @brief Update Portamento gliding to amount of seconds
      * @param amount Amount value in seconds
@@ -985,11 +1529,12 @@ private:
 
 public:
     /**
-     * @brief Checks was device name used or not
+     * @brief Checks was device name used or not, and registers the new device
      * @param name Name of MIDI device
+     * @param length Length of the name
      * @return Offset of the MIDI Channels, multiple to 16
      */
-    size_t chooseDevice(const std::string &name);
+    size_t chooseDevice(const char *name, size_t length);
 
     /**
      * @brief Gets a textual description of the state of chip channels
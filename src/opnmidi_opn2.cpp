@@ -23,6 +23,8 @@
 
 #include "opnmidi_opn2.hpp"
 #include "opnmidi_private.hpp"
+#include "opnmidi_cvt.hpp"
+#include "wopn/wopn_file.h"
 
 #if defined(OPNMIDI_DISABLE_NUKED_EMULATOR) && defined(OPNMIDI_DISABLE_MAME_EMULATOR) && \
     defined(OPNMIDI_DISABLE_GENS_EMULATOR) && defined(OPNMIDI_DISABLE_GX_EMULATOR) && \
@@ -185,6 +187,253 @@ static inline double s_commonFreq(double tone)
     return std::exp(0.057762265 * tone);
 }
 
+static inline double s_familyFreqCoef(OPNFamily family)
+{
+    switch(family)
+    {
+    case OPNChip_OPN2: default:
+        return 321.88557;
+    case OPNChip_OPNA:
+        return 309.12412;
+    }
+}
+
+/**
+ * @brief Convert the tone into block, F-number and frequency multiplication increment
+ * @param tone Tone in semitones
+ * @param coef Frequency coefficient of the chip family
+ * @param ftone [out] Block and F-number value
+ * @param mul_offset [out] Increment of frequency multiplication
+ * @return false if the tone can't be played
+ */
+static bool s_toneToFreq(double tone, double coef, uint32_t &ftone, uint32_t &mul_offset)
+{
+    // Hertz range: 0..131071
+    double hertz = s_commonFreq(tone);
+
+    if(hertz < 0) // Avoid infinite loop
+        return false;
+
+    hertz *= coef;
+
+    uint32_t octave = 0;
+    mul_offset = 0;
+
+    //Basic range until max of octaves reaching
+    while((hertz >= 1023.75) && (octave < 0x3800))
+    {
+        hertz /= 2.0;    // Calculate octave
+        octave += 0x800;
+    }
+    //Extended range, rely on frequency multiplication increment
+    while(hertz >= 2036.75)
+    {
+        hertz /= 2.0;    // Calculate octave
+        mul_offset++;
+    }
+    ftone = octave + static_cast<uint32_t>(hertz + 0.5);
+    return true;
+}
+
+/**
+ * @brief Tone to frequency lookup table of the chip family
+ *
+ * Tone range is split into cells of 1/64 of semitone. Every cell keeps the
+ * frequency value at its beginning, and the lowest tone where the value of
+ * the next cell begins, found by bisection over the formula above. As the
+ * formula is a monotonic step function, the lookup gives exactly the same
+ * values as the formula. Rare cells crossing more than one step of the
+ * frequency are marked to be computed by the formula.
+ */
+class OpnFreqTable
+{
+public:
+    enum
+    {
+        MaxTone = 128,
+        CellsPerTone = 64,
+        CellsCount = MaxTone * CellsPerTone
+    };
+
+    explicit OpnFreqTable(double coef)
+    {
+        for(size_t i = 0; i <= CellsCount; ++i)
+            m_freq[i] = compute(coef, cellTone(i));
+
+        for(size_t i = 0; i < CellsCount; ++i)
+        {
+            uint32_t lo = m_freq[i];
+            uint32_t hi = m_freq[i + 1];
+            double from = cellTone(i), to = cellTone(i + 1);
+
+            if(lo == hi)
+            {
+                m_next[i] = HUGE_VAL;
+                continue;
+            }
+
+            for(;;)
+            {
+                double mid = from + (to - from) * 0.5;
+                if(mid <= from || mid >= to)
+                    break;
+                uint32_t value = compute(coef, mid);
+                if(value == lo)
+                    from = mid;
+                else if(value == hi)
+                    to = mid;
+                else
+                {
+                    m_freq[i] |= Flag_Mixed;
+                    break;
+                }
+            }
+            m_next[i] = to;
+        }
+    }
+
+    /**
+     * @brief Find the block/F-number and frequency multiplication increment
+     * @return false if the tone is out of the table, or its cell isn't resolved
+     */
+    bool lookup(double tone, uint32_t &ftone, uint32_t &mul_offset) const
+    {
+        if(!(tone >= 0.0 && tone < MaxTone))
+            return false;
+
+        size_t cell = static_cast<size_t>(tone * CellsPerTone);
+        uint32_t value = m_freq[cell];
+        if(value & Flag_Mixed)
+            return false;
+        if(tone >= m_next[cell])
+            value = m_freq[cell + 1] & ~Flag_Mixed;
+
+        ftone = value & 0xFFFF;
+        mul_offset = value >> 16;
+        return true;
+    }
+
+private:
+    enum
+    {
+        Flag_Mixed = 0x80000000u
+    };
+
+    static double cellTone(size_t cell)
+    {
+        return static_cast<double>(cell) / CellsPerTone;
+    }
+
+    static uint32_t compute(double coef, double tone)
+    {
+        uint32_t ftone = 0, mul_offset = 0;
+        s_toneToFreq(tone, coef, ftone, mul_offset);
+        return (ftone & 0xFFFF) | (mul_offset << 16);
+    }
+
+    //! Packed frequency of the cell beginning: F-number and block | multiplication increment << 16
+    uint32_t m_freq[CellsCount + 1];
+    //! The lowest tone of the cell having frequency of the next cell
+    double m_next[CellsCount];
+};
+
+static const OpnFreqTable &s_freqTable(OPNFamily family)
+{
+    static const OpnFreqTable opn2(s_familyFreqCoef(OPNChip_OPN2));
+    static const OpnFreqTable opna(s_familyFreqCoef(OPNChip_OPNA));
+    return (family == OPNChip_OPNA) ? opna : opn2;
+}
+
+
+/***************************************************************
+ *               Volume and brightness curves                  *
+ * *************************************************************/
+
+/**
+ * @brief Lookup tables of the Generic volume model and of the brightness curve
+ *
+ * Generic model keeps the lowest volume of every resulting level, found by
+ * bisection over the logarithmic formula, so the level is found by a binary
+ * search without calling a log.
+ */
+class OpnVolumeTables
+{
+public:
+    enum
+    {
+        MinVolume = 1108075, // 8725 * 127
+        MaxVolume = 127 * 127 * 127 * 127,
+        LevelsCount = 64
+    };
+
+    OpnVolumeTables()
+    {
+        for(uint32_t level = 0; level < LevelsCount; ++level)
+        {
+            uint_fast32_t from = MinVolume, to = MaxVolume + 1;
+            while(to - from > 1)
+            {
+                uint_fast32_t mid = from + (to - from) / 2;
+                if(genericFormula(mid) > level * 2)
+                    to = mid;
+                else
+                    from = mid;
+            }
+            m_genericLevel[level] = to;
+        }
+
+        for(uint32_t b = 0; b < 256; ++b)
+            m_brightness[b] = static_cast<uint8_t>(::round(127.0 * ::sqrt((static_cast<double>(b)) * (1.0 / 127.0))));
+    }
+
+    /**
+     * @brief Volume of the Generic model
+     * @param volume Product of velocity, master, channel volume and expression
+     * @return Volume level in 0...127 range
+     */
+    uint_fast32_t generic(uint_fast32_t volume) const
+    {
+        if(volume > MaxVolume)
+            return genericFormula(volume);
+        const uint_fast32_t *end = m_genericLevel + LevelsCount;
+        return static_cast<uint_fast32_t>(std::upper_bound(m_genericLevel, end, volume) - m_genericLevel) * 2;
+    }
+
+    /**
+     * @brief Next step of the brightness curve
+     */
+    uint8_t brightness(uint8_t b) const
+    {
+        return m_brightness[b];
+    }
+
+    static uint_fast32_t genericFormula(uint_fast32_t volume)
+    {
+        const double c1 = 11.541560327111707;
+        const double c2 = 1.601379199767093e+02;
+
+        // The formula below: SOLVE(V=127^4 * 2^( (A-63.49999) / 8), A)
+        if(volume > MinVolume)
+        {
+            double lv = std::log(static_cast<double>(volume));
+            return static_cast<uint_fast32_t>(lv * c1 - c2) * 2;
+        }
+        return 0;
+    }
+
+private:
+    //! Lowest volume giving a level above the index
+    uint_fast32_t m_genericLevel[LevelsCount];
+    //! Brightness curve
+    uint8_t m_brightness[256];
+};
+
+static const OpnVolumeTables &s_volumeTables()
+{
+    static const OpnVolumeTables tables;
+    return tables;
+}
+
 
 
 enum
@@ -210,8 +459,21 @@ static OpnInstMeta makeEmptyInstrument()
 const OpnInstMeta OPN2::m_emptyInstrument = makeEmptyInstrument();
 
 OPN2::OPN2() :
+    m_emulator(-1),
     m_regLFOSetup(0),
     m_numChips(1),
+    m_numActiveChips(1),
+    m_leadEmulator(-1),
+    m_leadChips(0),
+#ifndef OPNMIDI_DISABLE_TRACE
+    m_trace(NULL),
+#endif
+#ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+    m_parallelRender(NULL),
+#endif
+#ifndef OPNMIDI_DISABLE_STEMS
+    m_stems(NULL),
+#endif
     m_scaleModulators(false),
     m_runAtPcmRate(false),
     m_softPanning(false),
@@ -229,6 +491,9 @@ OPN2::OPN2() :
 
     // Initialize blank instruments banks
     m_insBanks.clear();
+    m_insBanksRevision = 1;
+    m_insLazy.version = 0;
+    m_insLazy.insSize = 0;
 }
 
 OPN2::~OPN2()
@@ -236,6 +501,55 @@ OPN2::~OPN2()
     clearChips();
 }
 
+OPN2::BankMap::iterator OPN2::findBank(size_t bank)
+{
+    BankMap::iterator it = m_insBanks.find(bank);
+    if(it != m_insBanks.end() || m_insLazy.tables.empty())
+        return it;
+
+    std::map<size_t, size_t>::const_iterator t = m_insLazy.tables.find(bank);
+    if(t == m_insLazy.tables.end())
+        return it;
+
+    Bank &b = m_insBanks[bank];
+    std::memset(&b, 0, sizeof(Bank));
+    for(size_t i = 0; i < 128; ++i)
+        b.ins[i].flags = OpnInstMeta::Flag_NoSound | OpnInstMeta::Flag_Unloaded;
+    b.lazyOffset = t->second;
+
+    return m_insBanks.find(bank);
+}
+
+void OPN2::loadLazyInstrument(Bank &bank, size_t index)
+{
+    OpnInstMeta &ins = bank.ins[index];
+    WOPNInstrument inIns;
+    std::memset(&inIns, 0, sizeof(WOPNInstrument));
+    WOPN_LoadBankInstFromMem(&inIns, &m_insLazy.data[bank.lazyOffset + index * m_insLazy.insSize], m_insLazy.version);
+    std::memset(&ins, 0, sizeof(OpnInstMeta));
+    cvt_generic_to_FMIns(ins, inIns);
+}
+
+void OPN2::loadLazyBanks()
+{
+    for(std::map<size_t, size_t>::const_iterator t = m_insLazy.tables.begin(); t != m_insLazy.tables.end(); ++t)
+    {
+        BankMap::iterator it = findBank(t->first);
+        for(size_t i = 0; i < 128; ++i)
+            bankInstrument(it->second, i);
+        it->second.lazyOffset = 0;
+    }
+    clearLazyBanks();
+}
+
+void OPN2::clearLazyBanks()
+{
+    std::vector<uint8_t>().swap(m_insLazy.data);
+    m_insLazy.tables.clear();
+    m_insLazy.version = 0;
+    m_insLazy.insSize = 0;
+}
+
 bool OPN2::setupLocked()
 {
     return (m_musicMode == MODE_CMF ||
@@ -243,19 +557,77 @@ bool OPN2::setupLocked()
             m_musicMode == MODE_RSXX);
 }
 
+static inline void s_shadowWrite(OPN2::RegShadow &sh, uint8_t port, uint8_t index, uint8_t value)
+{
+    port &= 1;
+    sh.regs[port][index] = value;
+    sh.written[port][index >> 3] |= static_cast<uint8_t>(1u << (index & 7));
+    if(port == 0 && index == 0x28)
+        sh.keyOn[value & 7] = value;
+}
+
 void OPN2::writeReg(size_t chip, uint8_t port, uint8_t index, uint8_t value)
 {
+#ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+    if(m_parallelRender)
+        m_parallelRender->regWrite(chip, port, index, value);
+    else
+#endif
     m_chips[chip]->writeReg(port, index, value);
+#ifndef OPNMIDI_DISABLE_STEMS
+    if(m_stems)
+        m_stems->regWrite(chip, port, index, value);
+#endif
+    s_shadowWrite(m_regShadow[chip], port, index, value);
+    OPN_STATS_INC(m_statRegWrites[chip]);
+#ifndef OPNMIDI_DISABLE_TRACE
+    if(m_trace)
+        m_trace->regWrite(chip, port, index, value);
+#endif
 }
 
 void OPN2::writeRegI(size_t chip, uint8_t port, uint32_t index, uint32_t value)
 {
+#ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+    if(m_parallelRender)
+        m_parallelRender->regWrite(chip, port, static_cast<uint8_t>(index), static_cast<uint8_t>(value));
+    else
+#endif
     m_chips[chip]->writeReg(port, static_cast<uint8_t>(index), static_cast<uint8_t>(value));
+#ifndef OPNMIDI_DISABLE_STEMS
+    if(m_stems)
+        m_stems->regWrite(chip, port, static_cast<uint8_t>(index), static_cast<uint8_t>(value));
+#endif
+    s_shadowWrite(m_regShadow[chip], port, static_cast<uint8_t>(index), static_cast<uint8_t>(value));
+    OPN_STATS_INC(m_statRegWrites[chip]);
+#ifndef OPNMIDI_DISABLE_TRACE
+    if(m_trace)
+        m_trace->regWrite(chip, port, static_cast<uint8_t>(index), static_cast<uint8_t>(value));
+#endif
 }
 
 void OPN2::writePan(size_t chip, uint32_t index, uint32_t value)
 {
+#ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+    if(m_parallelRender)
+        m_parallelRender->panWrite(chip, static_cast<uint8_t>(index), static_cast<uint8_t>(value));
+    else
+#endif
     m_chips[chip]->writePan(static_cast<uint16_t>(index), static_cast<uint8_t>(value));
+#ifndef OPNMIDI_DISABLE_STEMS
+    if(m_stems)
+        m_stems->panWrite(chip, static_cast<uint16_t>(index), static_cast<uint8_t>(value));
+#endif
+    if(index < 6)
+    {
+        RegShadow &sh = m_regShadow[chip];
+        sh.pan[index] = static_cast<uint8_t>(value);
+        sh.panWritten |= static_cast<uint8_t>(1u << index);
+    }
+#ifndef OPNMIDI_DISABLE_TRACE
+    if(m_trace)
+        m_trace->panWrite(chip, static_cast<uint8_t>(index), static_cast<uint8_t>(value));
+#endif
 }
 
 void OPN2::noteOff(size_t c)
@@ -270,45 +642,20 @@ void OPN2::noteOff(size_t c)
 
 void OPN2::noteOn(size_t c, double tone)
 {
-    // Hertz range: 0..131071
-    double hertz = s_commonFreq(tone);
+    uint32_t ftone = 0, mul_offset = 0;
 
-    if(hertz < 0) // Avoid infinite loop
+    if(!s_freqTable(m_chipFamily).lookup(tone, ftone, mul_offset) &&
+       !s_toneToFreq(tone, s_familyFreqCoef(m_chipFamily), ftone, mul_offset))
         return;
 
-    double coef;
-    switch(m_chipFamily)
-    {
-    case OPNChip_OPN2: default:
-        coef = 321.88557; break;
-    case OPNChip_OPNA:
-        coef = 309.12412; break;
-    }
-    hertz *= coef;
-
     size_t      chip;
     uint8_t     port;
     uint32_t    cc;
     size_t      ch4 = c % 6;
     getOpnChannel(c, chip, port, cc);
 
-    uint32_t octave = 0, ftone = 0, mul_offset = 0;
     const OpnTimbre &adli = m_insCache[c];
 
-    //Basic range until max of octaves reaching
-    while((hertz >= 1023.75) && (octave < 0x3800))
-    {
-        hertz /= 2.0;    // Calculate octave
-        octave += 0x800;
-    }
-    //Extended range, rely on frequency multiplication increment
-    while(hertz >= 2036.75)
-    {
-        hertz /= 2.0;    // Calculate octave
-        mul_offset++;
-    }
-    ftone = octave + static_cast<uint32_t>(hertz + 0.5);
-
     for(size_t op = 0; op < 4; op++)
     {
         uint32_t reg = adli.OPS[op].data[0];
@@ -392,18 +739,7 @@ void OPN2::touchNote(size_t c,
              * increment sounds wrong. Therefore, using the square root.
              */
         //volume = (int)(volume * std::sqrt( (double) ch[c].users.size() ));
-        const double c1 = 11.541560327111707;
-        const double c2 = 1.601379199767093e+02;
-        const uint_fast32_t minVolume = 1108075; // 8725 * 127
-
-        // The formula below: SOLVE(V=127^4 * 2^( (A-63.49999) / 8), A)
-        if(volume > minVolume)
-        {
-            double lv = std::log(static_cast<double>(volume));
-            volume = static_cast<uint_fast32_t>(lv * c1 - c2) * 2;
-        }
-        else
-            volume = 0;
+        volume = s_volumeTables().generic(volume);
     }
     break;
 
@@ -459,7 +795,7 @@ void OPN2::touchNote(size_t c,
         uint32_t vol_res = do_op ? (127 - (static_cast<uint32_t>(volume) * (127 - (x & 127))) / 127) : x;
         if(brightness != 127)
         {
-            brightness = static_cast<uint32_t>(::round(127.0 * ::sqrt((static_cast<double>(brightness)) * (1.0 / 127.0))));
+            brightness = s_volumeTables().brightness(brightness);
             if(!do_op)
                 vol_res = (127 - (brightness * (127 - (static_cast<uint32_t>(vol_res) & 127))) / 127);
         }
@@ -586,13 +922,12 @@ void OPN2::clearChips()
     for(size_t i = 0; i < m_chips.size(); i++)
         m_chips[i].reset(NULL);
     m_chips.clear();
+    m_spareChips.clear();
+    m_spareEmulators.clear();
 }
 
 void OPN2::reset(int emulator, unsigned long PCM_RATE, OPNFamily family, void *audioTickHandler)
 {
-#if !defined(ADLMIDI_AUDIO_TICK_HANDLER)
-    ADL_UNUSED(audioTickHandler);
-#endif
     clearChips();
     m_insCache.clear();
     m_regLFOSens.clear();
@@ -601,6 +936,7 @@ void OPN2::reset(int emulator, unsigned long PCM_RATE, OPNFamily family, void *a
         m_numChips = 2;// VGM Dumper can't work in multichip mode
 #endif
     m_chips.resize(m_numChips, AdlMIDI_SPtr<OPNChipBase>());
+    m_emulator = emulator;
 
 #ifdef OPNMIDI_MIDI2VGM
     m_loopStartHook = NULL;
@@ -611,73 +947,32 @@ void OPN2::reset(int emulator, unsigned long PCM_RATE, OPNFamily family, void *a
 
     for(size_t i = 0; i < m_chips.size(); i++)
     {
-        OPNChipBase *chip;
-
-        switch(emulator)
-        {
-        default:
-            assert(false);
-            abort();
-#ifndef OPNMIDI_DISABLE_MAME_EMULATOR
-        case OPNMIDI_EMU_MAME:
-            chip = new MameOPN2(family);
-            break;
-#endif
-#ifndef OPNMIDI_DISABLE_NUKED_EMULATOR
-        case OPNMIDI_EMU_NUKED:
-            chip = new NukedOPN2(family);
-            break;
-#endif
-#ifndef OPNMIDI_DISABLE_GENS_EMULATOR
-        case OPNMIDI_EMU_GENS:
-            chip = new GensOPN2(family);
-            break;
-#endif
-#ifndef OPNMIDI_DISABLE_GX_EMULATOR
-        case OPNMIDI_EMU_GX:
-            chip = new GXOPN2(family);
-            break;
-#endif
-#ifndef OPNMIDI_DISABLE_NP2_EMULATOR
-        case OPNMIDI_EMU_NP2:
-            chip = new NP2OPNA<>(family);
-            break;
-#endif
-#ifndef OPNMIDI_DISABLE_MAME_2608_EMULATOR
-        case OPNMIDI_EMU_MAME_2608:
-            chip = new MameOPNA(family);
-            break;
-#endif
-#ifndef OPNMIDI_DISABLE_PMDWIN_EMULATOR
-        case OPNMIDI_EMU_PMDWIN:
-            chip = new PMDWinOPNA(family);
-            break;
-#endif
-#ifdef OPNMIDI_MIDI2VGM
-        case OPNMIDI_VGM_DUMPER:
-            chip = new VGMFileDumper(family);
-            if(i == 0)//Set hooks for first chip only
-            {
-                m_loopStartHook = &VGMFileDumper::loopStartHook;
-                m_loopStartHookData = chip;
-                m_loopEndHook  = &VGMFileDumper::loopEndHook;
-                m_loopEndHookData = chip;
-            }
-            break;
-#endif
-        }
+        OPNChipBase *chip = createChip(chipEmulator(emulator, i), i, family, PCM_RATE, audioTickHandler);
         m_chips[i].reset(chip);
-        chip->setChipId(static_cast<uint32_t>(i));
-        chip->setRate(static_cast<uint32_t>(PCM_RATE), chip->nativeClockRate());
-        if(m_runAtPcmRate)
-            chip->setRunningAtPcmRate(true);
-#if defined(ADLMIDI_AUDIO_TICK_HANDLER)
-        chip->setAudioTickHandlerInstance(audioTickHandler);
-#endif
         family = chip->family();
     }
 
+    m_regShadow.clear();
+    m_regShadow.resize(m_numChips);
+    std::memset(&m_regShadow[0], 0, m_regShadow.size() * sizeof(RegShadow));
+#ifndef OPNMIDI_DISABLE_STATS
+    if(m_statRegWrites.size() < m_numChips)
+        m_statRegWrites.resize(m_numChips, 0);
+#endif
+
+    m_numActiveChips = m_numChips;
     m_chipFamily = family;
+#ifndef OPNMIDI_DISABLE_TRACE
+    if(m_trace)
+        m_trace->chipReset(m_numChips, family);
+#endif
+#ifndef OPNMIDI_DISABLE_STEMS
+    if(m_stems)
+        m_stems->chipReset(*this, emulator, PCM_RATE);
+#endif
+    // Build the lookup tables before the playback starts
+    s_freqTable(family);
+    s_volumeTables();
     m_numChannels = m_numChips * 6;
     m_insCache.resize(m_numChannels,   m_emptyInstrument.op[0]);
     m_regLFOSens.resize(m_numChannels,    0);
@@ -710,3 +1005,234 @@ OPNFamily OPN2::chipFamily() const
 {
     return m_chipFamily;
 }
+
+OPNChipBase *OPN2::createChip(int emulator, size_t index, OPNFamily family,
+                              unsigned long PCM_RATE, void *audioTickHandler)
+{
+#if !defined(ADLMIDI_AUDIO_TICK_HANDLER)
+    ADL_UNUSED(audioTickHandler);
+#endif
+    OPNChipBase *chip;
+
+    switch(emulator)
+    {
+    default:
+        assert(false);
+        abort();
+#ifndef OPNMIDI_DISABLE_MAME_EMULATOR
+    case OPNMIDI_EMU_MAME:
+        chip = new MameOPN2(family);
+        break;
+#endif
+#ifndef OPNMIDI_DISABLE_NUKED_EMULATOR
+    case OPNMIDI_EMU_NUKED:
+        chip = new NukedOPN2(family);
+        break;
+#endif
+#ifndef OPNMIDI_DISABLE_GENS_EMULATOR
+    case OPNMIDI_EMU_GENS:
+        chip = new GensOPN2(family);
+        break;
+#endif
+#ifndef OPNMIDI_DISABLE_GX_EMULATOR
+    case OPNMIDI_EMU_GX:
+        chip = new GXOPN2(family);
+        break;
+#endif
+#ifndef OPNMIDI_DISABLE_NP2_EMULATOR
+    case OPNMIDI_EMU_NP2:
+        chip = new NP2OPNA<>(family);
+        break;
+#endif
+#ifndef OPNMIDI_DISABLE_MAME_2608_EMULATOR
+    case OPNMIDI_EMU_MAME_2608:
+        chip = new MameOPNA(family);
+        break;
+#endif
+#ifndef OPNMIDI_DISABLE_PMDWIN_EMULATOR
+    case OPNMIDI_EMU_PMDWIN:
+        chip = new PMDWinOPNA(family);
+        break;
+#endif
+#ifdef OPNMIDI_MIDI2VGM
+    case OPNMIDI_VGM_DUMPER:
+        chip = new VGMFileDumper(family);
+        if(index == 0)//Set hooks for first chip only
+        {
+            m_loopStartHook = &VGMFileDumper::loopStartHook;
+            m_loopStartHookData = chip;
+            m_loopEndHook  = &VGMFileDumper::loopEndHook;
+            m_loopEndHookData = chip;
+        }
+        break;
+#endif
+    }
+    chip->setChipId(static_cast<uint32_t>(index));
+    chip->setRate(static_cast<uint32_t>(PCM_RATE), chip->nativeClockRate());
+    if(m_runAtPcmRate)
+        chip->setRunningAtPcmRate(true);
+#if defined(ADLMIDI_AUDIO_TICK_HANDLER)
+    chip->setAudioTickHandlerInstance(audioTickHandler);
+#endif
+    return chip;
+}
+
+/**
+ * @brief Write the saved registers state into the sink
+ * @param sink Receiver of writeReg(port, index, value) and writePan(channel, value) calls
+ * @param regs Saved registers state
+ */
+template<class Sink>
+static void s_replayShadow(Sink &sink, const OPN2::RegShadow &regs)
+{
+    for(uint8_t port = 0; port < 2; ++port)
+    {
+        for(unsigned index = 0; index < 256; ++index)
+        {
+            if((regs.written[port][index >> 3] & (1u << (index & 7))) == 0)
+                continue;
+            if(port == 0 && index == 0x28)
+                continue; // Key state is restored at end
+            if(index >= 0xA0 && index <= 0xAF)
+                continue; // Frequency registers are restored by pairs
+            sink.writeReg(port, static_cast<uint8_t>(index), regs.regs[port][index]);
+        }
+
+        // The high byte of frequency gets latched until the low byte is written
+        for(unsigned i = 0; i < 6; ++i)
+        {
+            unsigned high = (i < 3) ? (0xA4 + i) : (0xAC + i - 3);
+            unsigned low = high - 4;
+            if((regs.written[port][high >> 3] & (1u << (high & 7))) != 0)
+                sink.writeReg(port, static_cast<uint8_t>(high), regs.regs[port][high]);
+            if((regs.written[port][low >> 3] & (1u << (low & 7))) != 0)
+                sink.writeReg(port, static_cast<uint8_t>(low), regs.regs[port][low]);
+        }
+    }
+
+    for(uint16_t ch = 0; ch < 6; ++ch)
+    {
+        if(regs.panWritten & (1u << ch))
+            sink.writePan(ch, regs.pan[ch]);
+    }
+
+    for(unsigned slot = 0; slot < 8; ++slot)
+    {
+        if((slot & 3) == 3)
+            continue;
+        if(regs.keyOn[slot] & 0xF0)
+            sink.writeReg(0, 0x28, regs.keyOn[slot]);
+    }
+}
+
+namespace
+{
+
+struct ChipShadowSink
+{
+    OPNChipBase *chip;
+    void writeReg(uint8_t port, uint8_t index, uint8_t value)
+    {
+        chip->writeReg(port, index, value);
+    }
+    void writePan(uint16_t channel, uint8_t value)
+    {
+        chip->writePan(channel, value);
+    }
+};
+
+#ifndef OPNMIDI_DISABLE_TRACE
+struct TraceShadowSink
+{
+    OPNMIDITrace *trace;
+    size_t chip;
+    void writeReg(uint8_t port, uint8_t index, uint8_t value)
+    {
+        trace->regWrite(chip, port, index, value);
+    }
+    void writePan(uint16_t channel, uint8_t value)
+    {
+        trace->panWrite(chip, static_cast<uint8_t>(channel), value);
+    }
+};
+#endif
+
+} // anonymous namespace
+
+void OPN2::restoreRegisters(OPNChipBase *chip, const RegShadow &regs)
+{
+    ChipShadowSink sink = {chip};
+    s_replayShadow(sink, regs);
+}
+
+#ifndef OPNMIDI_DISABLE_TRACE
+void OPN2::traceSnapshot()
+{
+    if(!m_trace)
+        return;
+    m_trace->chipReset(m_numChips, m_chipFamily);
+    for(size_t i = 0; i < m_numChips; ++i)
+    {
+        TraceShadowSink sink = {m_trace, i};
+        s_replayShadow(sink, m_regShadow[i]);
+    }
+}
+#endif
+
+void OPN2::switchEmulator(int emulator, unsigned long PCM_RATE, void *audioTickHandler)
+{
+    size_t set = 0;
+    while(set < m_spareEmulators.size() && m_spareEmulators[set] != emulator)
+        ++set;
+
+    if(set < m_spareEmulators.size())
+    {
+        // Chips created ahead are swapped with running ones, which are kept for the switch back
+        for(size_t i = 0; i < m_chips.size(); i++)
+        {
+            if(isLeadChip(i))
+                continue;
+            AdlMIDI_SPtr<OPNChipBase> &spare = m_spareChips[set * m_chips.size() + i];
+            spare->reset();
+            restoreRegisters(spare.get(), m_regShadow[i]);
+            m_chips[i].swap(spare);
+        }
+        m_spareEmulators[set] = m_emulator;
+    }
+    else
+    {
+        for(size_t i = 0; i < m_chips.size(); i++)
+        {
+            if(isLeadChip(i))
+                continue;
+            OPNChipBase *chip = createChip(emulator, i, m_chipFamily, PCM_RATE, audioTickHandler);
+            restoreRegisters(chip, m_regShadow[i]);
+            m_chips[i].reset(chip);
+        }
+    }
+    m_emulator = emulator;
+#ifndef OPNMIDI_DISABLE_STEMS
+    if(m_stems)
+        m_stems->switchEmulator(*this, emulator, PCM_RATE);
+#endif
+}
+
+void OPN2::prepareEmulators(const int *emulators, size_t count, unsigned long PCM_RATE, void *audioTickHandler)
+{
+    m_spareChips.clear();
+    m_spareEmulators.clear();
+
+    for(size_t e = 0; e < count; ++e)
+    {
+        if(emulators[e] == m_emulator)
+            continue;
+        m_spareEmulators.push_back(emulators[e]);
+        for(size_t i = 0; i < m_chips.size(); i++)
+        {
+            OPNChipBase *chip = NULL;
+            if(!isLeadChip(i))
+                chip = createChip(emulators[e], i, m_chipFamily, PCM_RATE, audioTickHandler);
+            m_spareChips.push_back(AdlMIDI_SPtr<OPNChipBase>(chip));
+        }
+    }
+}
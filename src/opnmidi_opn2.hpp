@@ -28,17 +28,46 @@
 #include "opnmidi_ptr.hpp"
 #include "opnmidi_private.hpp"
 #include "opnmidi_bankmap.h"
+#include "opnmidi_trace.hpp"
+#include "opnmidi_parallel.hpp"
+#include "opnmidi_stems.hpp"
 #include "chips/opn_chip_family.h"
 
+class OPNMIDIStateWriter;
+class OPNMIDIStateReader;
+
 /**
  * @brief OPN2 Chip management class
  */
 class OPN2
 {
     friend class OPNMIDIplay;
+#ifndef OPNMIDI_DISABLE_TRACE
+    friend class OPNMIDITrace;
+#endif
+#ifndef OPNMIDI_DISABLE_STEMS
+    friend class OPNMIDIStems;
+#endif
 public:
     enum { PercussionTag = 1 << 15 };
 
+    /**
+     * @brief Copy of the chip registers, needed to move the state into another emulator
+     */
+    struct RegShadow
+    {
+        //! Last written values of both ports
+        uint8_t regs[2][256];
+        //! Bit mask of registers which were written since reset
+        uint8_t written[2][256 / 8];
+        //! Soft panning values of chip channels
+        uint8_t pan[6];
+        //! Bit mask of channels which soft panning was written
+        uint8_t panWritten;
+        //! Last key on/off command of every channel slot
+        uint8_t keyOn[8];
+    };
+
     //! Total number of chip channels between all running emulators
     uint32_t m_numChannels;
     //! Just a padding. Reserved.
@@ -56,6 +85,13 @@ public:
     void *m_loopEndHookData;
 #endif
 private:
+    //! Emulator of chips which aren't lead chips
+    int m_emulator;
+    //! Chips of other emulators created ahead by prepareEmulators(), a set of m_chips.size() per emulator
+    std::vector<AdlMIDI_SPtr<OPNChipBase > > m_spareChips;
+    //! Emulators of sets in m_spareChips
+    std::vector<int> m_spareEmulators;
+
     //! Cached patch data, needed by Touch()
     std::vector<OpnTimbre>    m_insCache;
     //! Cached per-channel LFO sensitivity flags
@@ -63,6 +99,9 @@ private:
     //! LFO setup registry cache
     uint8_t                     m_regLFOSetup;
 
+    //! Register copies of all running chips
+    std::vector<RegShadow>      m_regShadow;
+
 public:
     /**
      * @brief MIDI bank entry
@@ -71,6 +110,8 @@ public:
     {
         //! MIDI Bank instruments
         OpnInstMeta ins[128];
+        //! Offset of instruments in the lazily loaded bank file, zero when bank is loaded completely
+        size_t lazyOffset;
     };
     typedef BasicBankMap<Bank> BankMap;
     //! MIDI bank instruments data
@@ -78,12 +119,98 @@ public:
     //! MIDI bank-wide setup
     OpnBankSetup    m_insBankSetup;
 
+    /**
+     * @brief Raw data of the lazily loaded bank file
+     *
+     * Banks are created on the first use with all instruments marked by
+     * OpnInstMeta::Flag_Unloaded, each instrument is decoded on its first use.
+     */
+    struct LazyBank
+    {
+        //! Raw data of the WOPN bank file, empty when banks are loaded completely
+        std::vector<uint8_t> data;
+        //! Version of the bank file
+        uint16_t version;
+        //! Size of one instrument entry
+        size_t insSize;
+        //! Offsets of the instrument tables by bank identifier
+        std::map<size_t, size_t> tables;
+    };
+    //! Source of the banks which are not loaded yet
+    LazyBank        m_insLazy;
+    /**
+     * @brief Revision of the bank map, never zero
+     *
+     * Must be increased on every change of the bank map or of its instruments
+     * except of lazy loading, this invalidates banks cached by MIDI channels.
+     */
+    uint32_t        m_insBanksRevision;
+
+    /**
+     * @brief Find the bank, creating it from the lazily loaded bank file on the first use
+     * @param bank Bank identifier
+     * @return Bank iterator or end() if there is no such bank
+     */
+    BankMap::iterator findBank(size_t bank);
+
+    /**
+     * @brief Get the instrument, decoding it from the lazily loaded bank file on the first use
+     * @param bank Bank which contains the instrument
+     * @param index Index of the instrument in the bank
+     * @return Pointer to the instrument
+     */
+    const OpnInstMeta *bankInstrument(Bank &bank, size_t index)
+    {
+        OpnInstMeta &ins = bank.ins[index];
+        if(ins.flags & OpnInstMeta::Flag_Unloaded)
+            loadLazyInstrument(bank, index);
+        return &ins;
+    }
+
+    /**
+     * @brief Decode every remaining bank of the lazily loaded bank file and drop its raw data
+     */
+    void loadLazyBanks();
+
+    /**
+     * @brief Drop the lazily loaded bank file without of the decoding of remaining banks
+     */
+    void clearLazyBanks();
+
+private:
+    /**
+     * @brief Decode the instrument from the lazily loaded bank file
+     */
+    void loadLazyInstrument(Bank &bank, size_t index);
+
 public:
     //! Blank instrument template
     static const OpnInstMeta m_emptyInstrument;
 
     //! Total number of running concurrent emulated chips
     uint32_t m_numChips;
+    //! Number of first chips which are rendered and may take new notes
+    uint32_t m_numActiveChips;
+    //! Emulator of the lead chips, or -1 when all chips run the same emulator
+    int m_leadEmulator;
+    //! Number of first chips which run m_leadEmulator and take exposed voices
+    uint32_t m_leadChips;
+#ifndef OPNMIDI_DISABLE_STATS
+    //! Count of register writes of every chip
+    std::vector<uint64_t> m_statRegWrites;
+#endif
+#ifndef OPNMIDI_DISABLE_TRACE
+    //! Active trace log of register writes, owned by the player
+    OPNMIDITrace *m_trace;
+#endif
+#ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+    //! Recorder of register writes while the parallel render plays the song, chips aren't written then
+    OPNMIDIParallelRender *m_parallelRender;
+#endif
+#ifndef OPNMIDI_DISABLE_STEMS
+    //! Renderer of stems which receives register writes too, owned by the player
+    OPNMIDIStems *m_stems;
+#endif
     //! Carriers-only are scaled by default by volume level. This flag will tell to scale modulators too.
     bool m_scaleModulators;
     //! Run emulator at PCM rate if that possible. Reduces sounding accuracy, but decreases CPU usage on lower rates.
@@ -244,6 +371,26 @@ public:
      */
     OPNMIDI_VolumeModels getVolumeScaleModel();
 
+    /**
+     * @brief Is the chip one of lead chips which run the separate emulator
+     * @param chip Index of the chip
+     */
+    bool isLeadChip(size_t chip) const
+    {
+        return m_leadEmulator >= 0 && chip < m_leadChips;
+    }
+
+    /**
+     * @brief Emulator which runs the chip
+     * @param emulator Type of emulator of regular chips
+     * @param chip Index of the chip
+     * @return Type of the chip emulator
+     */
+    int chipEmulator(int emulator, size_t chip) const
+    {
+        return isLeadChip(chip) ? m_leadEmulator : emulator;
+    }
+
     /**
      * @brief Clean up all running emulated chip instances
      */
@@ -251,17 +398,82 @@ public:
 
     /**
      * @brief Reset chip properties and initialize them
-     * @param emulator Type of chip emulator
+     * @param emulator Type of chip emulator, lead chips run m_leadEmulator
      * @param PCM_RATE Output sample rate to generate on output
      * @param audioTickHandler PCM-accurate clock hook
      */
     void reset(int emulator, unsigned long PCM_RATE, OPNFamily family, void *audioTickHandler);
 
+#ifndef OPNMIDI_DISABLE_TRACE
+    /**
+     * @brief Log the current state of all chips into the trace, so the replay can start from it
+     */
+    void traceSnapshot();
+#endif
+
+    /**
+     * @brief Replace running chip emulators without reset, playing notes are kept
+     * @param emulator Type of chip emulator, lead chips keep their emulator
+     * @param PCM_RATE Output sample rate to generate on output
+     * @param audioTickHandler PCM-accurate clock hook
+     */
+    void switchEmulator(int emulator, unsigned long PCM_RATE, void *audioTickHandler);
+
+    /**
+     * @brief Create chips of other emulators ahead, so switchEmulator() takes them without allocations
+     * @param emulators Types of chip emulators, the running one is skipped
+     * @param count Count of emulators, 0 releases chips created before
+     * @param PCM_RATE Output sample rate to generate on output
+     * @param audioTickHandler PCM-accurate clock hook
+     */
+    void prepareEmulators(const int *emulators, size_t count, unsigned long PCM_RATE, void *audioTickHandler);
+
+    /**
+     * @brief Serialize register caches and states of all chips
+     * @param out Destination of the state
+     * @return false when the running emulator can't save its state
+     */
+    bool saveState(OPNMIDIStateWriter &out) const;
+
+    /**
+     * @brief Restore the state written by saveState() with the same chips setup
+     * @param in Source of the state
+     * @param apply Restore the state, otherwise only validate and skip it
+     * @return false when the state doesn't match running chips, nothing is changed then
+     */
+    bool loadState(OPNMIDIStateReader &in, bool apply);
+
+    /**
+     * @brief Serialize register caches without states of emulators
+     * @param out Destination of registers
+     */
+    void saveRegisters(OPNMIDIStateWriter &out) const;
+
     /**
      * @brief Gets the family of current chips
      * @return the chip family
      */
     OPNFamily chipFamily() const;
+
+private:
+    /**
+     * @brief Create the chip emulator instance
+     * @param emulator Type of chip emulator
+     * @param index Index of the chip
+     * @param family Chip family
+     * @param PCM_RATE Output sample rate to generate on output
+     * @param audioTickHandler PCM-accurate clock hook
+     * @return New chip emulator instance
+     */
+    OPNChipBase *createChip(int emulator, size_t index, OPNFamily family,
+                            unsigned long PCM_RATE, void *audioTickHandler);
+
+    /**
+     * @brief Write the register copy into the fresh chip emulator
+     * @param chip Chip emulator instance
+     * @param regs Register copy to write
+     */
+    static void restoreRegisters(OPNChipBase *chip, const RegShadow &regs);
 };
 
 /**
@@ -0,0 +1,238 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+
+#include "opnmidi_parallel.hpp"
+#include "opnmidi_private.hpp"
+#include "chips/opn_chip_base.h"
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#endif
+
+
+/***************************************************************
+ *                         Threads                             *
+ ***************************************************************/
+
+struct OPNMIDIParallelRender::Thread
+{
+#ifdef _WIN32
+    HANDLE thread;
+    void (*proc)(void *);
+    void *arg;
+
+    static DWORD WINAPI entry(LPVOID self)
+    {
+        Thread *t = static_cast<Thread *>(self);
+        t->proc(t->arg);
+        return 0;
+    }
+
+    bool create(void (*threadProc)(void *), void *threadArg)
+    {
+        proc = threadProc;
+        arg = threadArg;
+        thread = CreateThread(NULL, 0, &entry, this, 0, NULL);
+        return thread != NULL;
+    }
+
+    void join()
+    {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+#else
+    pthread_t thread;
+    void (*proc)(void *);
+    void *arg;
+
+    static void *entry(void *self)
+    {
+        Thread *t = static_cast<Thread *>(self);
+        t->proc(t->arg);
+        return NULL;
+    }
+
+    bool create(void (*threadProc)(void *), void *threadArg)
+    {
+        proc = threadProc;
+        arg = threadArg;
+        return pthread_create(&thread, NULL, &entry, this) == 0;
+    }
+
+    void join()
+    {
+        pthread_join(thread, NULL);
+    }
+#endif
+};
+
+/**
+ * @brief Chips emulated by one thread: every N-th chip from the first one
+ */
+struct OPNMIDIParallelRender::Job
+{
+    OPNMIDIParallelRender *self;
+    const std::vector<OPNChipBase *> *chips;
+    size_t first;
+    size_t step;
+};
+
+
+/***************************************************************
+ *                     Parallel renderer                       *
+ ***************************************************************/
+
+OPNMIDIParallelRender::OPNMIDIParallelRender() :
+    m_frames(0)
+{}
+
+OPNMIDIParallelRender::~OPNMIDIParallelRender()
+{}
+
+void OPNMIDIParallelRender::begin(size_t chips)
+{
+    if(m_writes.size() != chips)
+    {
+        m_writes.resize(chips);
+        m_output.resize(chips);
+    }
+
+    for(size_t i = 0; i < chips; ++i)
+        m_writes[i].clear();
+    m_chunks.clear();
+    m_frames = 0;
+}
+
+int32_t *OPNMIDIParallelRender::render(const std::vector<OPNChipBase *> &chips, size_t threads)
+{
+    const size_t numChips = chips.size();
+    assert(numChips == m_writes.size());
+
+    if(threads < 1)
+        threads = 1;
+    if(threads > numChips)
+        threads = numChips;
+
+    std::vector<Job> jobs(threads);
+    for(size_t i = 0; i < threads; ++i)
+    {
+        Job &job = jobs[i];
+        job.self = this;
+        job.chips = &chips;
+        job.first = i;
+        job.step = threads;
+    }
+
+    // The calling thread takes the first job
+    std::vector<Thread> workers(threads);
+    std::vector<char> started(threads, 0);
+    for(size_t i = 1; i < threads; ++i)
+        started[i] = workers[i].create(&jobProc, &jobs[i]) ? 1 : 0;
+
+    jobProc(&jobs[0]);
+
+    for(size_t i = 1; i < threads; ++i)
+    {
+        if(started[i])
+            workers[i].join();
+        else
+            jobProc(&jobs[i]); // Thread can't be created, do its job here
+    }
+
+    // Mix chips which have generated anything
+    size_t mixChips = 0;
+    for(size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        if(m_chunks[i].activeChips > mixChips)
+            mixChips = m_chunks[i].activeChips;
+    }
+    if(mixChips > numChips)
+        mixChips = numChips;
+
+    const size_t samples = m_frames * 2;
+    m_mix.resize(BlockFrames * 2);
+    if(mixChips == 0)
+        std::memset(&m_mix[0], 0, samples * sizeof(int32_t));
+    else
+        std::memcpy(&m_mix[0], &m_output[0][0], samples * sizeof(int32_t));
+
+    for(size_t c = 1; c < mixChips; ++c)
+    {
+        const int32_t *src = &m_output[c][0];
+        int32_t *dst = &m_mix[0];
+        for(size_t i = 0; i < samples; ++i)
+            dst[i] += src[i];
+    }
+
+    return &m_mix[0];
+}
+
+void OPNMIDIParallelRender::renderChip(size_t index, OPNChipBase *chip)
+{
+    const std::vector<Write> &writes = m_writes[index];
+    std::vector<int32_t> &output = m_output[index];
+    output.resize(BlockFrames * 2);
+
+    size_t w = 0;
+    size_t pos = 0;
+    // Writes made after the last chunk are applied at the extra step
+    for(size_t c = 0; c <= m_chunks.size(); ++c)
+    {
+        for(; w < writes.size() && writes[w].chunk == c; ++w)
+        {
+            const Write &wr = writes[w];
+            if(wr.port == Port_Pan)
+                chip->writePan(wr.index, wr.value);
+            else
+                chip->writeReg(wr.port, wr.index, wr.value);
+        }
+
+        if(c == m_chunks.size())
+            break;
+
+        const Chunk &chunk = m_chunks[c];
+        if(index < chunk.activeChips)
+            chip->generate32(&output[pos * 2], chunk.frames);
+        else
+            std::memset(&output[pos * 2], 0, chunk.frames * 2 * sizeof(int32_t));
+        pos += chunk.frames;
+    }
+}
+
+void OPNMIDIParallelRender::jobProc(void *arg)
+{
+    Job *job = static_cast<Job *>(arg);
+    const std::vector<OPNChipBase *> &chips = *job->chips;
+    for(size_t i = job->first; i < chips.size(); i += job->step)
+        job->self->renderChip(i, chips[i]);
+}
+
+#endif // OPNMIDI_DISABLE_PARALLEL_RENDER
@@ -0,0 +1,183 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_PARALLEL_HPP
+#define OPNMIDI_PARALLEL_HPP
+
+class OPNMIDIParallelRender;
+
+#ifndef OPNMIDI_DISABLE_PARALLEL_RENDER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class OPNChipBase;
+
+/**
+ * @brief Renderer of the song which emulates chips concurrently
+ *
+ * Chips are independent of each other, their output gets just summed. So the song
+ * gets rendered by blocks: at first, the sequencer plays the block without emulation
+ * of chips, and register writes of every chip get recorded together with the chunks
+ * of frames which the serial playback would generate between them. Then, every chip
+ * replays its own writes and generates the same chunks on a separate thread.
+ *
+ * Chip emulators receive exactly the same calls in exactly the same order as on the
+ * serial playback, so the mixed output is bit-identical to it.
+ */
+class OPNMIDIParallelRender
+{
+public:
+    enum
+    {
+        //! Count of frames recorded before the block gets emulated
+        BlockFrames = 32768,
+        //! Maximal size of one chunk of frames, the same as in opn2_playFormat()
+        MaxChunkFrames = 512
+    };
+
+    OPNMIDIParallelRender();
+    ~OPNMIDIParallelRender();
+
+    /**
+     * @brief Drop the recorded block and prepare to record the new one
+     * @param chips Count of chips
+     */
+    void begin(size_t chips);
+
+    /**
+     * @brief Record the chip register write
+     */
+    void regWrite(size_t chip, uint8_t port, uint8_t index, uint8_t value)
+    {
+        Write w = {static_cast<uint32_t>(m_chunks.size()), static_cast<uint8_t>(port & 1), index, value};
+        m_writes[chip].push_back(w);
+    }
+
+    /**
+     * @brief Record the soft panning write
+     */
+    void panWrite(size_t chip, uint8_t channel, uint8_t value)
+    {
+        Write w = {static_cast<uint32_t>(m_chunks.size()), Port_Pan, channel, value};
+        m_writes[chip].push_back(w);
+    }
+
+    /**
+     * @brief Record the chunk of frames which must be generated by chips
+     * @param frames Count of frames
+     * @param activeChips Count of first chips which are rendered
+     */
+    void advance(size_t frames, size_t activeChips)
+    {
+        Chunk c = {static_cast<uint32_t>(frames), static_cast<uint32_t>(activeChips)};
+        m_chunks.push_back(c);
+        m_frames += frames;
+    }
+
+    /**
+     * @brief Count of frames recorded in the block
+     */
+    size_t frames() const
+    {
+        return m_frames;
+    }
+
+    /**
+     * @brief Is block filled, so no more chunks can be recorded
+     */
+    bool full() const
+    {
+        return m_frames + MaxChunkFrames > BlockFrames;
+    }
+
+    /**
+     * @brief Emulate the recorded block
+     * @param chips Chip emulators to feed by recorded writes
+     * @param threads Count of threads to use, including the calling one
+     * @return Mixed output of all chips, the count of frames is frames()
+     */
+    int32_t *render(const std::vector<OPNChipBase *> &chips, size_t threads);
+
+private:
+    enum
+    {
+        //! Port value of the soft panning writes
+        Port_Pan = 2
+    };
+
+    /**
+     * @brief Recorded register write
+     */
+    struct Write
+    {
+        //! Index of the chunk which gets generated after this write
+        uint32_t chunk;
+        //! Port of the register, or Port_Pan
+        uint8_t port;
+        //! Register address or chip channel
+        uint8_t index;
+        //! Written value
+        uint8_t value;
+    };
+
+    /**
+     * @brief Recorded chunk of frames
+     */
+    struct Chunk
+    {
+        //! Count of frames
+        uint32_t frames;
+        //! Count of first chips which generate this chunk
+        uint32_t activeChips;
+    };
+
+    struct Thread;
+    struct Job;
+
+    //! Recorded writes of every chip
+    std::vector<std::vector<Write> > m_writes;
+    //! Recorded chunks of frames
+    std::vector<Chunk> m_chunks;
+    //! Count of recorded frames
+    size_t m_frames;
+    //! Output of every chip
+    std::vector<std::vector<int32_t> > m_output;
+    //! Mixed output
+    std::vector<int32_t> m_mix;
+
+    /**
+     * @brief Replay the writes of one chip and generate its output
+     */
+    void renderChip(size_t index, OPNChipBase *chip);
+
+    static void jobProc(void *job);
+
+    OPNMIDIParallelRender(const OPNMIDIParallelRender &);
+    OPNMIDIParallelRender &operator=(const OPNMIDIParallelRender &);
+};
+
+#endif // OPNMIDI_DISABLE_PARALLEL_RENDER
+
+#endif // OPNMIDI_PARALLEL_HPP
@@ -0,0 +1,266 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(OPNMIDI_DISABLE_GAPLESS_PLAYLIST) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+
+#include "opnmidi_playlist.hpp"
+#include "file_reader.hpp"
+#include "midi_sequencer.hpp"
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#endif
+
+
+static inline int s_loadState(const volatile int *p)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#else
+    return *p;
+#endif
+}
+
+static inline void s_storeState(volatile int *p, int v)
+{
+#if defined(__GNUC__)
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#else
+    *p = v;
+#endif
+}
+
+
+/***************************************************************
+ *                    Thread and mutex                         *
+ ***************************************************************/
+
+struct OPNMIDIPlaylist::Impl
+{
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION mutex;
+
+    Impl() : thread(NULL) { InitializeCriticalSection(&mutex); }
+    ~Impl() { DeleteCriticalSection(&mutex); }
+
+    void lock() { EnterCriticalSection(&mutex); }
+    bool tryLock() { return TryEnterCriticalSection(&mutex) != 0; }
+    void unlock() { LeaveCriticalSection(&mutex); }
+
+    static DWORD WINAPI entry(LPVOID arg)
+    {
+        OPNMIDIPlaylist::threadProc(arg);
+        return 0;
+    }
+
+    bool create(OPNMIDIPlaylist *self)
+    {
+        thread = CreateThread(NULL, 0, &entry, self, 0, NULL);
+        return thread != NULL;
+    }
+
+    void join()
+    {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        thread = NULL;
+    }
+#else
+    pthread_t thread;
+    pthread_mutex_t mutex;
+
+    Impl() { pthread_mutex_init(&mutex, NULL); }
+    ~Impl() { pthread_mutex_destroy(&mutex); }
+
+    void lock() { pthread_mutex_lock(&mutex); }
+    bool tryLock() { return pthread_mutex_trylock(&mutex) == 0; }
+    void unlock() { pthread_mutex_unlock(&mutex); }
+
+    static void *entry(void *arg)
+    {
+        OPNMIDIPlaylist::threadProc(arg);
+        return NULL;
+    }
+
+    bool create(OPNMIDIPlaylist *self)
+    {
+        return pthread_create(&thread, NULL, &entry, self) == 0;
+    }
+
+    void join()
+    {
+        pthread_join(thread, NULL);
+    }
+#endif
+};
+
+
+/***************************************************************
+ *                      Song loader                            *
+ ***************************************************************/
+
+OPNMIDIPlaylist::OPNMIDIPlaylist(const BW_MidiRtInterface *intrf, const Hooks &hooks) :
+    m_impl(new Impl),
+    m_interface(intrf),
+    m_hooks(hooks),
+    m_fromFile(false),
+    m_parseThreads(1),
+    m_state(State_Empty),
+    m_threadStarted(false)
+{}
+
+OPNMIDIPlaylist::~OPNMIDIPlaylist()
+{
+    wait();
+    delete m_impl;
+}
+
+bool OPNMIDIPlaylist::queueFile(const char *filePath, unsigned parseThreads)
+{
+    clear();
+    m_fromFile = true;
+    m_parseThreads = parseThreads;
+    m_filePath = filePath;
+    return start();
+}
+
+bool OPNMIDIPlaylist::queueData(const void *data, size_t size, unsigned parseThreads)
+{
+    clear();
+    m_fromFile = false;
+    m_parseThreads = parseThreads;
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    m_data.assign(p, p + size);
+    return start();
+}
+
+void OPNMIDIPlaylist::clear()
+{
+    wait();
+    // The audio thread may take the ready song right now
+    m_impl->lock();
+    s_storeState(&m_state, State_Empty);
+    m_next.reset();
+    m_impl->unlock();
+    m_errorString.clear();
+    m_filePath.clear();
+    std::vector<uint8_t>().swap(m_data);
+}
+
+int OPNMIDIPlaylist::state() const
+{
+    return s_loadState(&m_state);
+}
+
+bool OPNMIDIPlaylist::take(AdlMIDI_UPtr<MidiSequencer> &sequencer)
+{
+    if(s_loadState(&m_state) != State_Ready)
+        return false;
+
+    if(!m_impl->tryLock())
+        return false; // The song is being dropped, don't wait
+
+    bool taken = false;
+    if(s_loadState(&m_state) == State_Ready)
+    {
+        m_next.swap(sequencer);
+        m_hooks.adopt(m_hooks.userData);
+        s_storeState(&m_state, State_Empty);
+        taken = true;
+    }
+    m_impl->unlock();
+
+    return taken;
+}
+
+bool OPNMIDIPlaylist::start()
+{
+    s_storeState(&m_state, State_Parsing);
+    m_threadStarted = m_impl->create(this);
+    if(!m_threadStarted)
+        run(); // Parse in place when thread can't be created
+
+    return s_loadState(&m_state) != State_Failed;
+}
+
+void OPNMIDIPlaylist::wait()
+{
+    if(m_threadStarted)
+    {
+        m_impl->join();
+        m_threadStarted = false;
+    }
+}
+
+void OPNMIDIPlaylist::threadProc(void *self)
+{
+    reinterpret_cast<OPNMIDIPlaylist *>(self)->run();
+}
+
+void OPNMIDIPlaylist::run()
+{
+    AdlMIDI_UPtr<MidiSequencer> seq(new MidiSequencer);
+    seq->setInterface(m_interface);
+    seq->setParseThreads(m_parseThreads);
+
+    FileAndMemReader fr;
+    if(m_fromFile)
+        fr.openFile(m_filePath.c_str());
+    else
+        fr.openData(m_data.empty() ? NULL : &m_data[0], m_data.size());
+
+    bool ok = seq->loadMIDI(fr);
+    if(!ok)
+        m_errorString = seq->getErrorString();
+    else if(seq->getFormat() == MidiSequencer::Format_CMF)
+    {
+        m_errorString = "OPNMIDI doesn't supports CMF, use ADLMIDI to play this file!";
+        ok = false;
+    }
+    else if(seq->getFormat() == MidiSequencer::Format_IMF)
+    {
+        m_errorString = "OPNMIDI doesn't supports IMF, use ADLMIDI to play this file!";
+        ok = false;
+    }
+
+    // The parsed data is not needed anymore
+    std::vector<uint8_t>().swap(m_data);
+
+    m_impl->lock();
+    if(ok)
+    {
+        // The state prepared for the previous song may be adopted under this lock only
+        m_hooks.prepare(m_hooks.userData, *seq);
+        m_next.swap(seq);
+    }
+    s_storeState(&m_state, ok ? State_Ready : State_Failed);
+    m_impl->unlock();
+}
+
+#endif // OPNMIDI_DISABLE_GAPLESS_PLAYLIST
@@ -0,0 +1,172 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_PLAYLIST_HPP
+#define OPNMIDI_PLAYLIST_HPP
+
+class OPNMIDIPlaylist;
+
+#if !defined(OPNMIDI_DISABLE_GAPLESS_PLAYLIST) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "opnmidi_private.hpp"
+#include "opnmidi_ptr.hpp"
+
+/**
+ * @brief Loader of the next song for the gapless playback
+ *
+ * The next song is parsed on the worker thread into the detached sequencer.
+ * The audio thread takes it by take() at the end of the current song without
+ * blocking: the ready sequencer is swapped with the finished one, which is kept
+ * here until the next queue() call, so the audio thread never frees memory.
+ * The player builds its state for the song by hooks on the worker thread too,
+ * so the audio thread never allocates memory.
+ */
+class OPNMIDIPlaylist
+{
+public:
+    enum State
+    {
+        //! Nothing is queued
+        State_Empty = 0,
+        //! The song is being parsed
+        State_Parsing = 1,
+        //! The song is parsed and waits for the end of the current one
+        State_Ready = 2,
+        //! The song can't be loaded
+        State_Failed = -1
+    };
+
+    /**
+     * @brief Hooks of the player which prepare its state for the next song
+     */
+    struct Hooks
+    {
+        //! Build the state of the player needed by the parsed song, called on the worker thread
+        void (*prepare)(void *userData, MidiSequencer &seq);
+        //! Exchange the prepared state with the current one, called by take(), must not allocate
+        void (*adopt)(void *userData);
+        //! Player given to hooks
+        void *userData;
+    };
+
+    /**
+     * @brief Constructor
+     * @param intrf Interface of the player, given to every parsed sequencer
+     * @param hooks Hooks of the player which prepare its state for every parsed song
+     */
+    OPNMIDIPlaylist(const BW_MidiRtInterface *intrf, const Hooks &hooks);
+    ~OPNMIDIPlaylist();
+
+    /**
+     * @brief Start the parsing of the music file, replaces the previously queued song
+     * @param filePath Path to the music file
+     * @param parseThreads Count of threads to decode tracks of the song
+     * @return true if parsing has been started
+     */
+    bool queueFile(const char *filePath, unsigned parseThreads);
+
+    /**
+     * @brief Start the parsing of the music data, replaces the previously queued song
+     * @param data Music file data, copied before return
+     * @param size Size of data
+     * @param parseThreads Count of threads to decode tracks of the song
+     * @return true if parsing has been started
+     */
+    bool queueData(const void *data, size_t size, unsigned parseThreads);
+
+    /**
+     * @brief Drop the queued song
+     */
+    void clear();
+
+    /**
+     * @brief Current state of the queued song (#State)
+     */
+    int state() const;
+
+    /**
+     * @brief Is any song queued and not yet taken
+     */
+    bool pending() const
+    {
+        int s = state();
+        return s == State_Parsing || s == State_Ready;
+    }
+
+    /**
+     * @brief Error of the failed parsing
+     */
+    const std::string &errorString() const
+    {
+        return m_errorString;
+    }
+
+    /**
+     * @brief Take the ready song with the prepared state of the player, never blocks and never frees memory
+     * @param sequencer Sequencer of the finished song, gets swapped with the ready one
+     * @return true if the song has been taken
+     */
+    bool take(AdlMIDI_UPtr<MidiSequencer> &sequencer);
+
+private:
+    struct Impl;
+    Impl *m_impl;
+
+    //! Interface of the player
+    const BW_MidiRtInterface *m_interface;
+    //! Hooks of the player
+    Hooks m_hooks;
+    //! Parsed next song, or the finished one after take()
+    AdlMIDI_UPtr<MidiSequencer> m_next;
+    //! Path to the queued file
+    std::string m_filePath;
+    //! Data of the queued song
+    std::vector<uint8_t> m_data;
+    //! Is the queued song being read from the file
+    bool m_fromFile;
+    //! Count of threads to decode tracks of the queued song
+    unsigned m_parseThreads;
+    //! Error of the failed parsing
+    std::string m_errorString;
+    //! State of the queued song (#State)
+    volatile int m_state;
+    //! Is worker thread started and not joined
+    bool m_threadStarted;
+
+    bool start();
+    void wait();
+    static void threadProc(void *self);
+    void run();
+
+    OPNMIDIPlaylist(const OPNMIDIPlaylist &);
+    OPNMIDIPlaylist &operator=(const OPNMIDIPlaylist &);
+};
+
+#endif // OPNMIDI_DISABLE_GAPLESS_PLAYLIST
+
+#endif // OPNMIDI_PLAYLIST_HPP
@@ -25,8 +25,27 @@
 #include "opnmidi_opn2.hpp"
 #include "opnmidi_private.hpp"
 
+#include <ctime>
+#ifndef _WIN32
+#include <time.h>
+#endif
+
 std::string OPN2MIDI_ErrorString;
 
+double opn2_monotonicTime()
+{
+#if defined(_WIN32)
+    LARGE_INTEGER freq, count;
+    if(QueryPerformanceFrequency(&freq) && QueryPerformanceCounter(&count))
+        return static_cast<double>(count.QuadPart) / static_cast<double>(freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+#endif
+    return static_cast<double>(std::clock()) / static_cast<double>(CLOCKS_PER_SEC);
+}
+
 // Generator callback on audio rate ticks
 
 #if defined(ADLMIDI_AUDIO_TICK_HANDLER)
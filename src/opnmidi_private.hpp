@@ -135,6 +135,13 @@ class MIDIplay;
 
 #define ADL_UNUSED(x) (void)x
 
+// Increment the performance counter
+#ifndef OPNMIDI_DISABLE_STATS
+#   define OPN_STATS_INC(counter) (++(counter))
+#else
+#   define OPN_STATS_INC(counter)
+#endif
+
 #define OPN_MAX_CHIPS 100
 #define OPN_MAX_CHIPS_STR "100"
 
@@ -185,6 +192,12 @@ inline int32_t opn2_cvtU32(int32_t x)
     return (uint32_t)opn2_cvtS32(x) - (uint32_t)INT32_MIN;
 }
 
+/**
+ * @brief Monotonic clock for the render time measurements
+ * @return Time in seconds from an unspecified starting point
+ */
+extern double opn2_monotonicTime();
+
 #if defined(ADLMIDI_AUDIO_TICK_HANDLER)
 extern void opn2_audioTickHandler(void *instance, uint32_t chipId, uint32_t rate);
 #endif
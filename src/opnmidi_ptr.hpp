@@ -184,6 +184,12 @@ public:
         }
     }
 
+    void swap(AdlMIDI_SPtr &other)
+    {
+        std::swap(m_p, other.m_p);
+        std::swap(m_counter, other.m_counter);
+    }
+
     T *get() const
     {
         return m_p;
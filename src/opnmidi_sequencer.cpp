@@ -149,4 +149,14 @@ double OPNMIDIplay::Tick(double s, double granularity)
     return ret;
 }
 
+uint64_t OPNMIDIplay::TickFrames(uint64_t frames)
+{
+    MidiSequencer &seqr = *m_sequencer;
+    uint64_t ret = seqr.tickFrames(frames);
+
+    TickIterators(static_cast<double>(frames) * seqr.getTempoMultiplier() / static_cast<double>(m_setup.PCM_RATE));
+
+    return ret;
+}
+
 #endif /* OPNMIDI_DISABLE_MIDI_SEQUENCER */
@@ -0,0 +1,710 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "opnmidi_midiplay.hpp"
+#include "opnmidi_opn2.hpp"
+#include "opnmidi_private.hpp"
+#include "opnmidi_state.hpp"
+#include "chips/opn_chip_base.h"
+
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+#include "midi_sequencer.hpp"
+#endif
+
+static const char s_stateMagic[8] = {'O', 'P', 'N', 'S', 'T', 'A', 'T', 'E'};
+
+enum
+{
+    //! Version of the state format
+    StateVersion = 4,
+    //! Size of the state header: magic, version, total size
+    StateHeaderSize = 8 + 1 + 4
+};
+
+/**
+ * @brief Kinds of the instrument references stored in the state
+ */
+enum StateInstrument
+{
+    StateIns_None = 0,
+    StateIns_Empty,
+    StateIns_Bank
+};
+
+
+/***************************************************************
+ *                     Chips and registers                     *
+ ***************************************************************/
+
+bool OPN2::saveState(OPNMIDIStateWriter &out) const
+{
+    // Header: everything needed to validate the state before applying it
+    out.put(static_cast<uint32_t>(m_numChips));
+    out.put(static_cast<uint8_t>(m_chipFamily));
+    for(size_t i = 0; i < m_chips.size(); ++i)
+    {
+        size_t size = m_chips[i]->stateSize();
+        if(size == 0)
+            return false;
+        out.put(static_cast<uint32_t>(size));
+    }
+
+    saveRegisters(out);
+
+    for(size_t i = 0; i < m_chips.size(); ++i)
+    {
+        const OPNChipBase &chip = *m_chips[i];
+        chip.saveState(out.allocate(chip.stateSize()));
+    }
+
+    return true;
+}
+
+void OPN2::saveRegisters(OPNMIDIStateWriter &out) const
+{
+    out.put(static_cast<uint32_t>(m_numActiveChips));
+    out.put(m_regLFOSetup);
+    out.put(m_masterVolume);
+    out.putBytes(&m_insCache[0], m_insCache.size() * sizeof(OpnTimbre));
+    out.putBytes(&m_regLFOSens[0], m_regLFOSens.size());
+    out.putBytes(&m_regShadow[0], m_regShadow.size() * sizeof(RegShadow));
+}
+
+bool OPN2::loadState(OPNMIDIStateReader &in, bool apply)
+{
+    uint32_t numChips;
+    uint8_t family;
+
+    if(!in.get(numChips) || !in.get(family))
+        return false;
+    if(numChips != m_numChips || family != static_cast<uint8_t>(m_chipFamily))
+        return false;
+
+    size_t chipsSize = 0;
+    for(size_t i = 0; i < m_chips.size(); ++i)
+    {
+        uint32_t size;
+        if(!in.get(size) || size != m_chips[i]->stateSize())
+            return false;
+        chipsSize += size;
+    }
+
+    uint32_t numActiveChips;
+    if(!in.get(numActiveChips) || numActiveChips == 0 || numActiveChips > m_numChips)
+        return false;
+
+    const size_t payload = sizeof(m_regLFOSetup) + sizeof(m_masterVolume) +
+                           m_insCache.size() * sizeof(OpnTimbre) +
+                           m_regLFOSens.size() +
+                           m_regShadow.size() * sizeof(RegShadow) +
+                           chipsSize;
+    if(in.left() < payload)
+        return false;
+
+    if(!apply)
+    {
+        in.take(payload);
+        return in.ok();
+    }
+
+    // Everything is validated, the state can't fail from here
+    m_numActiveChips = numActiveChips;
+    in.get(m_regLFOSetup);
+    in.get(m_masterVolume);
+    in.getBytes(&m_insCache[0], m_insCache.size() * sizeof(OpnTimbre));
+    in.getBytes(&m_regLFOSens[0], m_regLFOSens.size());
+    in.getBytes(&m_regShadow[0], m_regShadow.size() * sizeof(RegShadow));
+
+    for(size_t i = 0; i < m_chips.size(); ++i)
+    {
+        OPNChipBase &chip = *m_chips[i];
+        chip.loadState(in.take(chip.stateSize()));
+    }
+
+    return true;
+}
+
+
+/***************************************************************
+ *                       MIDI channels                         *
+ ***************************************************************/
+
+static void s_putInstrument(OPNMIDIStateWriter &out, const Synth &synth, const OpnInstMeta *ains)
+{
+    if(!ains)
+    {
+        out.put(static_cast<uint8_t>(StateIns_None));
+        return;
+    }
+
+    if(ains == &Synth::m_emptyInstrument)
+    {
+        out.put(static_cast<uint8_t>(StateIns_Empty));
+        return;
+    }
+
+    for(Synth::BankMap::iterator it = synth.m_insBanks.begin(); it != synth.m_insBanks.end(); ++it)
+    {
+        const OpnInstMeta *ins = it->second.ins;
+        if(ains >= ins && ains < ins + 128)
+        {
+            out.put(static_cast<uint8_t>(StateIns_Bank));
+            out.put(static_cast<uint32_t>(it->first));
+            out.put(static_cast<uint8_t>(ains - ins));
+            return;
+        }
+    }
+
+    // Unknown instrument, should never happen
+    out.put(static_cast<uint8_t>(StateIns_Empty));
+}
+
+static bool s_getInstrument(OPNMIDIStateReader &in, Synth &synth, const OpnInstMeta *&ains)
+{
+    uint8_t kind;
+    if(!in.get(kind))
+        return false;
+
+    switch(kind)
+    {
+    case StateIns_None:
+        ains = NULL;
+        return true;
+    case StateIns_Empty:
+        ains = &Synth::m_emptyInstrument;
+        return true;
+    case StateIns_Bank:
+    {
+        uint32_t bank;
+        uint8_t index;
+        if(!in.get(bank) || !in.get(index) || index >= 128)
+            return false;
+        Synth::BankMap::iterator it = synth.findBank(bank);
+        if(it == synth.m_insBanks.end())
+            return false;
+        ains = synth.bankInstrument(it->second, index);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+static void s_putPhys(OPNMIDIStateWriter &out, const OPNMIDIplay::MIDIchannel::NoteInfo::Phys &ph)
+{
+    out.put(ph.chip_chan);
+    out.putBytes(&ph.ains, sizeof(OpnTimbre));
+}
+
+static bool s_getPhys(OPNMIDIStateReader &in, OPNMIDIplay::MIDIchannel::NoteInfo::Phys &ph)
+{
+    return in.get(ph.chip_chan) && in.getBytes(&ph.ains, sizeof(OpnTimbre));
+}
+
+static void s_putChannel(OPNMIDIStateWriter &out, const Synth &synth, const OPNMIDIplay::MIDIchannel &ch)
+{
+    typedef OPNMIDIplay::MIDIchannel MIDIchannel;
+
+    out.put(ch.def_volume);
+    out.put(static_cast<int32_t>(ch.def_bendsense_lsb));
+    out.put(static_cast<int32_t>(ch.def_bendsense_msb));
+    out.put(ch.bank_lsb);
+    out.put(ch.bank_msb);
+    out.put(ch.patch);
+    out.put(ch.volume);
+    out.put(ch.expression);
+    out.put(ch.panning);
+    out.put(ch.vibrato);
+    out.put(ch.aftertouch);
+    out.put(ch.portamento);
+    out.putBool(ch.sustain);
+    out.putBool(ch.softPedal);
+    out.putBool(ch.portamentoEnable);
+    out.put(ch.portamentoSource);
+    out.put(ch.portamentoRate);
+    out.putBytes(ch.noteAftertouch, sizeof(ch.noteAftertouch));
+    out.putBool(ch.noteAfterTouchInUse);
+    out.put(static_cast<int32_t>(ch.bend));
+    out.put(ch.bendsense);
+    out.put(static_cast<int32_t>(ch.bendsense_lsb));
+    out.put(static_cast<int32_t>(ch.bendsense_msb));
+    out.put(ch.vibpos);
+    out.put(ch.vibspeed);
+    out.put(ch.vibdepth);
+    out.put(ch.vibdelay_us);
+    out.put(ch.lastlrpn);
+    out.put(ch.lastmrpn);
+    out.putBool(ch.nrpn);
+    out.put(ch.brightness);
+    out.putBool(ch.is_xg_percussion);
+    out.put(static_cast<uint32_t>(ch.gliding_note_count));
+    out.put(static_cast<uint32_t>(ch.extended_note_count));
+
+    out.put(static_cast<uint32_t>(ch.activenotes.size()));
+    for(MIDIchannel::const_notes_iterator i = ch.activenotes.begin(); !i.is_end(); ++i)
+    {
+        const MIDIchannel::NoteInfo &ni = i->value;
+        out.put(ni.note);
+        out.put(ni.vol);
+        out.put(ni.vibrato);
+        out.put(ni.noteTone);
+        out.put(ni.currentTone);
+        out.put(ni.glideRate);
+        out.put(static_cast<uint64_t>(ni.midiins));
+        out.putBool(ni.isPercussion);
+        out.putBool(ni.isBlank);
+        out.putBool(ni.isOnExtendedLifeTime);
+        out.put(ni.ttl);
+        s_putInstrument(out, synth, ni.ains);
+        out.put(static_cast<uint32_t>(ni.chip_channels_count));
+        for(unsigned c = 0; c < ni.chip_channels_count; ++c)
+            s_putPhys(out, ni.chip_channels[c]);
+    }
+}
+
+static bool s_getChannel(OPNMIDIStateReader &in, Synth &synth, OPNMIDIplay::MIDIchannel &ch)
+{
+    typedef OPNMIDIplay::MIDIchannel MIDIchannel;
+    int32_t def_bendsense_lsb, def_bendsense_msb, bend, bendsense_lsb, bendsense_msb;
+    uint32_t gliding_note_count, extended_note_count, notesCount;
+
+    in.get(ch.def_volume);
+    in.get(def_bendsense_lsb);
+    in.get(def_bendsense_msb);
+    in.get(ch.bank_lsb);
+    in.get(ch.bank_msb);
+    in.get(ch.patch);
+    in.get(ch.volume);
+    in.get(ch.expression);
+    in.get(ch.panning);
+    in.get(ch.vibrato);
+    in.get(ch.aftertouch);
+    in.get(ch.portamento);
+    in.getBool(ch.sustain);
+    in.getBool(ch.softPedal);
+    in.getBool(ch.portamentoEnable);
+    in.get(ch.portamentoSource);
+    in.get(ch.portamentoRate);
+    in.getBytes(ch.noteAftertouch, sizeof(ch.noteAftertouch));
+    in.getBool(ch.noteAfterTouchInUse);
+    in.get(bend);
+    in.get(ch.bendsense);
+    in.get(bendsense_lsb);
+    in.get(bendsense_msb);
+    in.get(ch.vibpos);
+    in.get(ch.vibspeed);
+    in.get(ch.vibdepth);
+    in.get(ch.vibdelay_us);
+    in.get(ch.lastlrpn);
+    in.get(ch.lastmrpn);
+    in.getBool(ch.nrpn);
+    in.get(ch.brightness);
+    in.getBool(ch.is_xg_percussion);
+    in.get(gliding_note_count);
+    in.get(extended_note_count);
+    if(!in.get(notesCount) || notesCount > ch.activenotes.capacity())
+        return false;
+
+    ch.def_bendsense_lsb = def_bendsense_lsb;
+    ch.def_bendsense_msb = def_bendsense_msb;
+    ch.bend = bend;
+    ch.bendsense_lsb = bendsense_lsb;
+    ch.bendsense_msb = bendsense_msb;
+    ch.gliding_note_count = gliding_note_count;
+    ch.extended_note_count = extended_note_count;
+
+    // Erase notes one by one, it's cheaper than the clear() of the whole list
+    for(MIDIchannel::notes_iterator i = ch.activenotes.begin(); !i.is_end();)
+        i = ch.activenotes.erase(i);
+    for(uint32_t n = 0; n < notesCount; ++n)
+    {
+        MIDIchannel::NoteInfo ni;
+        uint64_t midiins;
+        uint32_t physCount;
+        in.get(ni.note);
+        in.get(ni.vol);
+        in.get(ni.vibrato);
+        in.get(ni.noteTone);
+        in.get(ni.currentTone);
+        in.get(ni.glideRate);
+        in.get(midiins);
+        in.getBool(ni.isPercussion);
+        in.getBool(ni.isBlank);
+        in.getBool(ni.isOnExtendedLifeTime);
+        in.get(ni.ttl);
+        if(!s_getInstrument(in, synth, ni.ains))
+            return false;
+        if(!in.get(physCount) || physCount > MIDIchannel::NoteInfo::MaxNumPhysItemCount || ni.note >= 128)
+            return false;
+        ni.midiins = static_cast<size_t>(midiins);
+        ni.chip_channels_count = physCount;
+        for(uint32_t c = 0; c < physCount; ++c)
+        {
+            if(!s_getPhys(in, ni.chip_channels[c]))
+                return false;
+        }
+        ch.activenotes.insert(ch.activenotes.end(), ni);
+    }
+    ch.reindex_activenotes();
+
+    return in.ok();
+}
+
+static void s_putChipChannel(OPNMIDIStateWriter &out, const OPNMIDIplay::OpnChannel &ch)
+{
+    typedef OPNMIDIplay::OpnChannel OpnChannel;
+
+    out.put(ch.koff_time_until_neglible_us);
+    s_putPhys(out, ch.recent_ins);
+    out.put(static_cast<uint32_t>(ch.users.size()));
+    for(OpnChannel::const_users_iterator i = ch.users.begin(); !i.is_end(); ++i)
+    {
+        const OpnChannel::LocationData &ld = i->value;
+        out.put(ld.loc.MidCh);
+        out.put(ld.loc.note);
+        out.put(ld.sustained);
+        s_putPhys(out, ld.ins);
+        out.putBool(ld.fixed_sustain);
+        out.put(ld.kon_time_until_neglible_us);
+        out.put(ld.vibdelay_us);
+    }
+}
+
+static bool s_getChipChannel(OPNMIDIStateReader &in, OPNMIDIplay::OpnChannel &ch)
+{
+    typedef OPNMIDIplay::OpnChannel OpnChannel;
+    uint32_t usersCount;
+
+    in.get(ch.koff_time_until_neglible_us);
+    s_getPhys(in, ch.recent_ins);
+    if(!in.get(usersCount) || usersCount > ch.users.capacity())
+        return false;
+
+    for(OpnChannel::users_iterator i = ch.users.begin(); !i.is_end();)
+        i = ch.users.erase(i);
+    for(uint32_t u = 0; u < usersCount; ++u)
+    {
+        OpnChannel::LocationData ld;
+        std::memset(&ld, 0, sizeof(ld));
+        in.get(ld.loc.MidCh);
+        in.get(ld.loc.note);
+        in.get(ld.sustained);
+        s_getPhys(in, ld.ins);
+        in.getBool(ld.fixed_sustain);
+        in.get(ld.kon_time_until_neglible_us);
+        if(!in.get(ld.vibdelay_us))
+            return false;
+        ch.users.insert(ch.users.end(), ld);
+    }
+
+    return in.ok();
+}
+
+
+/***************************************************************
+ *                       Whole player                          *
+ ***************************************************************/
+
+bool OPNMIDIplay::saveState(std::vector<uint8_t> &out)
+{
+    Synth &synth = *m_synth;
+    OPNMIDIStateWriter w(out);
+
+    out.clear();
+    w.putBytes(s_stateMagic, sizeof(s_stateMagic));
+    w.put(static_cast<uint8_t>(StateVersion));
+    w.put(static_cast<uint32_t>(0)); // Total size, filled at the end
+
+    // Setup which must match on restore
+    w.put(static_cast<uint32_t>(m_setup.PCM_RATE));
+    w.put(static_cast<int32_t>(m_governor.levels[m_governor.level]));
+    w.put(static_cast<int32_t>(synth.m_leadEmulator));
+    w.put(static_cast<uint32_t>(synth.m_leadChips));
+    w.putBool(synth.m_runAtPcmRate);
+
+    if(!synth.saveState(w))
+    {
+        // GX, NP2, MAME YM2608 and PMDWin emulators can't save their state
+        std::string name = "Unknown";
+        for(size_t i = 0; i < synth.m_chips.size(); ++i)
+        {
+            if(synth.m_chips[i]->stateSize() == 0)
+            {
+                name = synth.m_chips[i]->emulatorName();
+                break;
+            }
+        }
+        setErrorString("OPN2 MIDI: State saving is not supported by the " + name + " emulator");
+        return false;
+    }
+
+    // MIDI devices and channels
+    w.put(static_cast<uint32_t>(m_midiDevices.size()));
+    for(size_t i = 0; i < m_midiDevices.size(); ++i)
+    {
+        w.put(static_cast<uint32_t>(m_midiDevices[i].size()));
+        w.putBytes(m_midiDevices[i].c_str(), m_midiDevices[i].size());
+    }
+    w.put(static_cast<uint32_t>(m_currentMidiDevice.size()));
+    for(size_t i = 0; i < m_currentMidiDevice.size(); ++i)
+        w.put(static_cast<uint32_t>(m_currentMidiDevice[i]));
+
+    w.put(m_sysExDeviceId);
+    w.put(m_synthMode);
+    w.put(static_cast<uint64_t>(m_arpeggioCounter));
+    w.put(m_chipIdleTime);
+    w.put(m_setup.delay);
+    w.put(m_setup.carry);
+    w.put(static_cast<int64_t>(m_setup.tick_skip_samples_delay));
+    w.put(m_setup.clockDelay);
+    w.put(m_setup.clockElapsed);
+
+    w.put(static_cast<uint32_t>(m_midiChannels.size()));
+    for(size_t i = 0; i < m_midiChannels.size(); ++i)
+        s_putChannel(w, synth, m_midiChannels[i]);
+
+    w.put(static_cast<uint32_t>(m_chipChannels.size()));
+    for(size_t i = 0; i < m_chipChannels.size(); ++i)
+        s_putChipChannel(w, m_chipChannels[i]);
+
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+    w.putBool(true);
+    m_sequencer->saveState(out);
+#else
+    w.putBool(false);
+#endif
+
+    uint32_t total = static_cast<uint32_t>(out.size());
+    std::memcpy(&out[sizeof(s_stateMagic) + 1], &total, sizeof(total));
+
+    return true;
+}
+
+void OPNMIDIplay::saveLoopFingerprint(std::vector<uint8_t> &out)
+{
+    Synth &synth = *m_synth;
+    OPNMIDIStateWriter w(out);
+
+    out.clear();
+    w.put(static_cast<int32_t>(m_governor.levels[m_governor.level]));
+    synth.saveRegisters(w);
+
+    // Envelope and phase counters of emulators change the output as well, so
+    // the loop gets replayed only when the whole state of every chip repeats
+    for(size_t i = 0; i < synth.m_chips.size(); ++i)
+    {
+        const OPNChipBase &chip = *synth.m_chips[i];
+        const size_t size = chip.stateSize();
+        if(size != 0)
+            chip.saveState(w.allocate(size));
+    }
+
+    w.put(m_sysExDeviceId);
+    w.put(m_synthMode);
+    // The phase of the arpeggio matters only when it was made since the previous fingerprint
+    w.put(static_cast<uint64_t>(m_arpeggioSteps));
+    w.put(m_chipIdleTime);
+    w.put(m_setup.clockDelay);
+    w.put(m_setup.clockElapsed);
+
+    w.put(static_cast<uint32_t>(m_midiChannels.size()));
+    for(size_t i = 0; i < m_midiChannels.size(); ++i)
+        s_putChannel(w, synth, m_midiChannels[i]);
+
+    w.put(static_cast<uint32_t>(m_chipChannels.size()));
+    for(size_t i = 0; i < m_chipChannels.size(); ++i)
+        s_putChipChannel(w, m_chipChannels[i]);
+
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+    m_sequencer->saveState(out, true);
+#endif
+}
+
+bool OPNMIDIplay::loadState(const uint8_t *data, size_t size)
+{
+    OPNMIDIStateReader r(data, size);
+
+    const uint8_t *magic = r.take(sizeof(s_stateMagic));
+    uint8_t version = 0;
+    uint32_t total = 0;
+
+    r.get(version);
+    r.get(total);
+    if(!magic || std::memcmp(magic, s_stateMagic, sizeof(s_stateMagic)) != 0 || version != StateVersion)
+    {
+        setErrorString("OPN2 MIDI: Invalid or unsupported state data");
+        return false;
+    }
+
+    if(total > size)
+    {
+        setErrorString("OPN2 MIDI: State data is truncated");
+        return false;
+    }
+
+    // The whole state is parsed first, the player is changed only when all of it is valid
+    if(!readState(data, total, false))
+        return false;
+
+    const bool applied = readState(data, total, true);
+    assert(applied);
+    (void)applied;
+
+    return true;
+}
+
+bool OPNMIDIplay::readState(const uint8_t *data, size_t size, bool apply)
+{
+    Synth &synth = *m_synth;
+    OPNMIDIStateReader r(data, size);
+    uint32_t rate = 0;
+    int32_t emulator = 0, leadEmulator = 0;
+    uint32_t leadChips = 0;
+    bool runAtPcmRate = false;
+
+    r.take(StateHeaderSize);
+    r.get(rate);
+    r.get(emulator);
+    r.get(leadEmulator);
+    r.get(leadChips);
+    r.getBool(runAtPcmRate);
+
+    if(!r.ok() ||
+       rate != m_setup.PCM_RATE ||
+       emulator != m_governor.levels[m_governor.level] ||
+       leadEmulator != synth.m_leadEmulator ||
+       leadChips != synth.m_leadChips ||
+       runAtPcmRate != synth.m_runAtPcmRate ||
+       !synth.loadState(r, apply))
+    {
+        setErrorString("OPN2 MIDI: State was saved with a different synthesizer setup");
+        return false;
+    }
+
+    bool ok = true;
+    uint32_t count = 0;
+
+    uint32_t devicesCount = 0;
+    if(r.get(devicesCount) && devicesCount <= r.left())
+    {
+        if(apply)
+            m_midiDevices.resize(devicesCount);
+        for(size_t i = 0; i < devicesCount && ok; ++i)
+        {
+            uint32_t len = 0;
+            const uint8_t *name = r.get(len) ? r.take(len) : NULL;
+            if(!name)
+                ok = false;
+            else if(apply)
+                m_midiDevices[i].assign(reinterpret_cast<const char *>(name), len);
+        }
+    }
+    else
+        ok = false;
+
+    if(ok && r.get(count) && count <= r.left())
+    {
+        if(apply)
+            m_currentMidiDevice.resize(count);
+        for(size_t i = 0; i < count; ++i)
+        {
+            uint32_t channel = 0;
+            r.get(channel);
+            if(apply)
+                m_currentMidiDevice[i] = channel;
+        }
+    }
+    else
+        ok = false;
+
+    uint8_t sysExDeviceId = 0;
+    uint32_t synthMode = 0;
+    uint64_t arpeggioCounter = 0;
+    double chipIdleTime = 0.0, delay = 0.0, carry = 0.0;
+    int64_t tickSkip = 0;
+    uint32_t clockDelay = 0, clockElapsed = 0;
+    r.get(sysExDeviceId);
+    r.get(synthMode);
+    r.get(arpeggioCounter);
+    r.get(chipIdleTime);
+    r.get(delay);
+    r.get(carry);
+    r.get(tickSkip);
+    r.get(clockDelay);
+    r.get(clockElapsed);
+    if(apply)
+    {
+        m_sysExDeviceId = sysExDeviceId;
+        m_synthMode = synthMode;
+        m_arpeggioCounter = static_cast<size_t>(arpeggioCounter);
+        m_chipIdleTime = chipIdleTime;
+        m_setup.delay = delay;
+        m_setup.carry = carry;
+        m_setup.tick_skip_samples_delay = static_cast<ssize_t>(tickSkip);
+        m_setup.clockDelay = clockDelay;
+        m_setup.clockElapsed = clockElapsed;
+    }
+
+    // Channels are validated by reading into the scratch ones
+    MIDIchannel scratchChannel;
+    OpnChannel scratchChipChannel;
+
+    if(ok && r.get(count) && count == (devicesCount == 0 ? 16 : devicesCount * 16))
+    {
+        if(apply)
+            m_midiChannels.resize(count);
+        for(size_t i = 0; i < count && ok; ++i)
+            ok = s_getChannel(r, synth, apply ? m_midiChannels[i] : scratchChannel);
+    }
+    else
+        ok = false;
+
+    if(ok && r.get(count) && count == m_chipChannels.size())
+    {
+        for(size_t i = 0; i < count && ok; ++i)
+            ok = s_getChipChannel(r, apply ? m_chipChannels[i] : scratchChipChannel);
+        if(apply)
+            reindexChipChannels();
+    }
+    else
+        ok = false;
+
+    bool hasSequencer = false;
+    if(ok && r.getBool(hasSequencer) && hasSequencer)
+    {
+#ifndef OPNMIDI_DISABLE_MIDI_SEQUENCER
+        size_t consumed = m_sequencer->loadState(r.ptr(), r.left(), apply);
+        ok = (consumed != 0) && r.take(consumed);
+#else
+        ok = false;
+#endif
+    }
+
+    if(!ok || !r.ok())
+    {
+        setErrorString("OPN2 MIDI: State data is corrupted or doesn't match the loaded song");
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,156 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_STATE_HPP
+#define OPNMIDI_STATE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief Appends values to the serialized synthesizer state
+ *
+ * Values are stored in the native byte order: the state is made to be
+ * restored on the same machine by the same build of the library.
+ */
+class OPNMIDIStateWriter
+{
+    std::vector<uint8_t> &m_out;
+public:
+    explicit OPNMIDIStateWriter(std::vector<uint8_t> &out) : m_out(out) {}
+
+    template<class T>
+    void put(const T &value)
+    {
+        putBytes(&value, sizeof(T));
+    }
+
+    void putBool(bool value)
+    {
+        m_out.push_back(value ? 1 : 0);
+    }
+
+    void putBytes(const void *data, size_t size)
+    {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+        m_out.insert(m_out.end(), p, p + size);
+    }
+
+    /**
+     * @brief Reserve the space in the output and give the pointer to it
+     * @param size Count of bytes to reserve
+     * @return Pointer to the reserved space, valid until next write
+     */
+    uint8_t *allocate(size_t size)
+    {
+        size_t pos = m_out.size();
+        m_out.resize(pos + size);
+        return size ? &m_out[pos] : NULL;
+    }
+
+    std::vector<uint8_t> &buffer()
+    {
+        return m_out;
+    }
+};
+
+/**
+ * @brief Reads values from the serialized synthesizer state
+ *
+ * Every read fails once the data has ended, the state of the failure is sticky.
+ */
+class OPNMIDIStateReader
+{
+    const uint8_t *m_ptr;
+    const uint8_t *m_end;
+    bool m_ok;
+public:
+    OPNMIDIStateReader(const uint8_t *data, size_t size) :
+        m_ptr(data), m_end(data + size), m_ok(true)
+    {}
+
+    template<class T>
+    bool get(T &value)
+    {
+        return getBytes(&value, sizeof(T));
+    }
+
+    bool getBool(bool &value)
+    {
+        uint8_t b = 0;
+        if(!get(b))
+            return false;
+        value = (b != 0);
+        return true;
+    }
+
+    bool getBytes(void *data, size_t size)
+    {
+        const uint8_t *p = take(size);
+        if(p && size)
+            std::memcpy(data, p, size);
+        return p != NULL;
+    }
+
+    /**
+     * @brief Skip the block of data
+     * @param size Count of bytes to skip
+     * @return Pointer to the skipped data, or NULL if data has ended
+     */
+    const uint8_t *take(size_t size)
+    {
+        if(!m_ok || size > left())
+        {
+            m_ok = false;
+            return NULL;
+        }
+        const uint8_t *p = m_ptr;
+        m_ptr += size;
+        return p;
+    }
+
+    //! Mark the data as invalid
+    void fail()
+    {
+        m_ok = false;
+    }
+
+    bool ok() const
+    {
+        return m_ok;
+    }
+
+    size_t left() const
+    {
+        return static_cast<size_t>(m_end - m_ptr);
+    }
+
+    const uint8_t *ptr() const
+    {
+        return m_ptr;
+    }
+};
+
+#endif // OPNMIDI_STATE_HPP
@@ -0,0 +1,362 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_DISABLE_STEMS
+
+#include "opnmidi_stems.hpp"
+#include "opnmidi_opn2.hpp"
+#include "opnmidi_private.hpp"
+#include "chips/opn_chip_base.h"
+#include <cassert>
+#include <cstring>
+
+/**
+ * @brief Value of the panning and LFO register with both outputs turned off
+ */
+static inline uint8_t s_mutedPan(uint8_t value)
+{
+    return static_cast<uint8_t>(value & 0x3F);
+}
+
+/**
+ * @brief Chip channel of the panning and LFO register
+ * @return Index of the channel in the chip, or -1 for other registers
+ */
+static inline int s_panChannel(uint8_t port, uint8_t index)
+{
+    if(index < 0xB4 || index > 0xB6)
+        return -1;
+    return static_cast<int>((port & 1) * 3 + (index - 0xB4));
+}
+
+
+OPNMIDIStems::OPNMIDIStems() :
+    m_mode(Mode_Off),
+    m_emulator(0),
+    m_rate(44100),
+    m_chips(0),
+    m_drainFrames(0)
+{}
+
+OPNMIDIStems::~OPNMIDIStems()
+{}
+
+void OPNMIDIStems::setMode(OPN2 &synth, int mode, int emulator, unsigned long PCM_RATE)
+{
+    if(mode == m_mode && m_chips == synth.m_numChips)
+        return; // Copies of chips keep playing
+    m_mode = mode;
+    chipReset(synth, emulator, PCM_RATE);
+}
+
+size_t OPNMIDIStems::count() const
+{
+    switch(m_mode)
+    {
+    case Mode_MidiChannel:
+        return MidiChannelStems;
+    case Mode_Chip:
+        return m_chips;
+    default:
+        return 0;
+    }
+}
+
+void OPNMIDIStems::chipReset(OPN2 &synth, int emulator, unsigned long PCM_RATE)
+{
+    m_emulator = emulator;
+    m_rate = PCM_RATE;
+    m_chips = synth.m_numChips;
+
+    m_channelStem.assign(m_chips * 6, -1);
+    createChips(synth);
+    resizeBuffer();
+}
+
+void OPNMIDIStems::switchEmulator(OPN2 &synth, int emulator, unsigned long PCM_RATE)
+{
+    m_emulator = emulator;
+    m_rate = PCM_RATE;
+    createChips(synth);
+}
+
+void OPNMIDIStems::regWrite(size_t chip, uint8_t port, uint8_t index, uint8_t value)
+{
+    if(m_copies.empty())
+        return;
+
+    const int ch = s_panChannel(port, index);
+    const int owner = (ch >= 0) ? m_channelStem[chip * 6 + static_cast<size_t>(ch)] : -1;
+
+    // Stopped copies get the whole state of the running spare copy when they start again
+    for(size_t i = chip * CopiesPerChip, n = i + CopiesPerChip; i < n; ++i)
+    {
+        if(!m_copyRunning[i])
+            continue;
+        const int stem = m_copyStem[i];
+        if(ch >= 0 && (stem < 0 || owner != stem))
+            m_copies[i]->writeReg(port, index, s_mutedPan(value));
+        else
+            m_copies[i]->writeReg(port, index, value);
+    }
+}
+
+void OPNMIDIStems::panWrite(size_t chip, uint16_t channel, uint8_t value)
+{
+    if(m_copies.empty())
+        return;
+
+    for(size_t i = chip * CopiesPerChip, n = i + CopiesPerChip; i < n; ++i)
+    {
+        if(m_copyRunning[i])
+            m_copies[i]->writePan(channel, value);
+    }
+}
+
+void OPNMIDIStems::generate(OPN2 &synth, size_t frames)
+{
+    const size_t stems = count();
+    const size_t activeChips = synth.m_numActiveChips;
+    if(stems == 0)
+        return;
+    std::memset(&m_buffer[0], 0, m_buffer.size() * sizeof(int32_t));
+
+    if(m_mode == Mode_Chip)
+    {
+        for(size_t chip = 0; chip < activeChips && chip < stems; ++chip)
+            synth.m_chips[chip]->generate32(output(chip), frames);
+        return;
+    }
+
+    // Spare copies play nothing, their output goes into the chunk after stems
+    for(size_t i = 0; i < activeChips * CopiesPerChip; ++i)
+    {
+        if(!m_copyRunning[i])
+            continue;
+        const int stem = m_copyStem[i];
+        m_copies[i]->generateAndMix32(output(stem >= 0 ? static_cast<size_t>(stem) : stems), frames);
+
+        size_t &drain = m_copyDrain[i];
+        if(drain > 0)
+        {
+            drain = (drain > frames) ? drain - frames : 0;
+            if(drain == 0)
+                freeCopy(i);
+        }
+    }
+}
+
+void OPNMIDIStems::changeOwner(OPN2 &synth, size_t c, int stem, bool writePan)
+{
+    const size_t chip = c / 6;
+    const int previous = m_channelStem[c];
+    m_channelStem[c] = stem;
+
+    releaseCopy(chip, previous);
+    const int copy = m_stemCopy[static_cast<size_t>(stem) * m_chips + chip];
+    if(copy >= 0)
+        m_copyDrain[chip * CopiesPerChip + static_cast<size_t>(copy)] = 0; // Still runs the release of the stem
+    else
+        takeCopy(chip, stem);
+
+    if(!writePan)
+        return;
+
+    const size_t ch4 = c % 6;
+    const uint8_t port = static_cast<uint8_t>(ch4 < 3 ? 0 : 1);
+    const uint8_t index = static_cast<uint8_t>(0xB4 + ch4 % 3);
+    // Write the same value into the mixed chip too: emulators which delay buffered
+    // writes must receive the same count of writes to key notes on at the same time
+    synth.writeReg(chip, port, index, synth.m_regShadow[chip].regs[port][index]);
+}
+
+void OPNMIDIStems::createChips(OPN2 &synth)
+{
+    m_copies.clear();
+    m_copyStem.clear();
+    m_copyRunning.clear();
+    m_copyDrain.clear();
+    m_stemCopy.clear();
+    if(m_mode != Mode_MidiChannel)
+        return;
+
+    const size_t copies = CopiesPerChip * m_chips;
+    m_drainFrames = m_rate / 100 + 1;
+    m_copyStem.assign(copies, -1);
+    m_copyRunning.assign(copies, false);
+    m_copyDrain.assign(copies, 0);
+    m_stemCopy.assign(MidiChannelStems * m_chips, -1);
+
+    // Stems which own chip channels keep their copies after the switch of the emulator
+    for(size_t c = 0; c < m_channelStem.size(); ++c)
+    {
+        const int stem = m_channelStem[c];
+        if(stem < 0)
+            continue;
+        const size_t chip = c / 6;
+        int &copy = m_stemCopy[static_cast<size_t>(stem) * m_chips + chip];
+        if(copy >= 0)
+            continue;
+        copy = 0;
+        while(m_copyStem[chip * CopiesPerChip + static_cast<size_t>(copy)] >= 0)
+            ++copy;
+        m_copyStem[chip * CopiesPerChip + static_cast<size_t>(copy)] = stem;
+    }
+
+    // Copies are made ahead, but only copies of stems and one spare copy of every chip run
+    size_t stateSize = 0;
+    m_copies.resize(copies);
+    for(size_t i = 0; i < copies; ++i)
+    {
+        const size_t chip = i / CopiesPerChip;
+        m_copies[i].reset(createChip(synth, i % CopiesPerChip, chip));
+        if(m_copies[i]->stateSize() > stateSize)
+            stateSize = m_copies[i]->stateSize();
+        m_copyRunning[i] = m_copyStem[i] >= 0 || m_copies[i]->stateSize() == 0 || !hasSpare(chip, i);
+    }
+    m_state.resize(stateSize);
+}
+
+OPNChipBase *OPNMIDIStems::createChip(OPN2 &synth, size_t copy, size_t chip) const
+{
+    const OPN2::RegShadow &regs = synth.m_regShadow[chip];
+    const int stem = m_copyStem[chip * CopiesPerChip + copy];
+    OPNChipBase *mixed = synth.m_chips[chip].get();
+    OPNChipBase *c = synth.createChip(synth.chipEmulator(m_emulator, chip), chip, synth.m_chipFamily, m_rate, NULL);
+    // Only the first running chip drives the audio tick handler, copies have other ids
+    c->setChipId(static_cast<uint32_t>((copy + 1) * m_chips + chip));
+
+    // The state copy keeps the phase of the LFO, of envelopes and of delayed writes
+    const size_t stateSize = c->stateSize();
+    if(stateSize != 0 && stateSize == mixed->stateSize() &&
+       std::strcmp(c->emulatorName(), mixed->emulatorName()) == 0)
+    {
+        std::vector<uint8_t> state(stateSize);
+        mixed->saveState(&state[0]);
+        c->loadState(&state[0]);
+    }
+    else
+        OPN2::restoreRegisters(c, regs);
+
+    // Chip channels played by other stems are heard nowhere here. Channels which panning
+    // was never written since the reset weren't keyed on yet, the patch will mute them.
+    for(size_t ch = 0; ch < 6; ++ch)
+    {
+        const uint8_t port = static_cast<uint8_t>(ch < 3 ? 0 : 1);
+        const uint8_t index = static_cast<uint8_t>(0xB4 + ch % 3);
+        if((stem >= 0 && m_channelStem[chip * 6 + ch] == stem) ||
+           (regs.written[port][index >> 3] & (1u << (index & 7))) == 0)
+            continue;
+        c->writeReg(port, index, s_mutedPan(regs.regs[port][index]));
+    }
+
+    return c;
+}
+
+void OPNMIDIStems::takeCopy(size_t chip, int stem)
+{
+    // Take the spare copy, or the copy of other stem which is closest to run out.
+    // Both have all channels turned off, and got all the writes so far.
+    const size_t first = chip * CopiesPerChip;
+    size_t i = first + CopiesPerChip;
+    for(size_t j = first; j < first + CopiesPerChip; ++j)
+    {
+        if(!m_copyRunning[j])
+            continue;
+        if(m_copyStem[j] < 0)
+        {
+            i = j;
+            break;
+        }
+        if(m_copyDrain[j] > 0 && (i == first + CopiesPerChip || m_copyDrain[j] < m_copyDrain[i]))
+            i = j;
+    }
+    assert(i < first + CopiesPerChip); // Six chip channels have less owners than copies
+
+    if(m_copyStem[i] >= 0)
+        m_stemCopy[static_cast<size_t>(m_copyStem[i]) * m_chips + chip] = -1;
+    m_copyStem[i] = stem;
+    m_copyDrain[i] = 0;
+    m_stemCopy[static_cast<size_t>(stem) * m_chips + chip] = static_cast<int>(i - first);
+
+    if(hasSpare(chip, i))
+        return;
+
+    // The next spare copy starts from the state of the taken one, which is still silent
+    for(size_t j = first; j < first + CopiesPerChip; ++j)
+    {
+        if(m_copyRunning[j] || m_copyStem[j] >= 0)
+            continue;
+        m_copies[i]->saveState(&m_state[0]);
+        m_copies[j]->loadState(&m_state[0]);
+        m_copyRunning[j] = true;
+        break;
+    }
+}
+
+void OPNMIDIStems::releaseCopy(size_t chip, int stem)
+{
+    if(stem < 0)
+        return;
+    for(size_t ch = 0; ch < 6; ++ch)
+    {
+        if(m_channelStem[chip * 6 + ch] == stem)
+            return; // The copy still plays some channel
+    }
+
+    // The copy has all channels turned off now, it runs until the buffered output comes out
+    const int copy = m_stemCopy[static_cast<size_t>(stem) * m_chips + chip];
+    if(copy >= 0)
+        m_copyDrain[chip * CopiesPerChip + static_cast<size_t>(copy)] = m_drainFrames;
+}
+
+void OPNMIDIStems::freeCopy(size_t i)
+{
+    const size_t chip = i / CopiesPerChip;
+    m_stemCopy[static_cast<size_t>(m_copyStem[i]) * m_chips + chip] = -1;
+    m_copyStem[i] = -1;
+    m_copyDrain[i] = 0;
+    // The emulator which can't save the state keeps all copies running
+    if(hasSpare(chip, i) && m_copies[i]->stateSize() != 0)
+        m_copyRunning[i] = false;
+}
+
+bool OPNMIDIStems::hasSpare(size_t chip, size_t except) const
+{
+    for(size_t j = chip * CopiesPerChip, n = j + CopiesPerChip; j < n; ++j)
+    {
+        if(j != except && m_copyRunning[j] && m_copyStem[j] < 0)
+            return true;
+    }
+    return false;
+}
+
+void OPNMIDIStems::resizeBuffer()
+{
+    // Per MIDI channel, one more chunk takes the silent output of spare copies
+    const size_t chunks = count() + (m_mode == Mode_MidiChannel ? 1 : 0);
+    std::vector<int32_t> buffer(chunks * MaxChunkFrames * 2, 0);
+    m_buffer.swap(buffer);
+}
+
+#endif // OPNMIDI_DISABLE_STEMS
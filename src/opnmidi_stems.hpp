@@ -0,0 +1,202 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_STEMS_HPP
+#define OPNMIDI_STEMS_HPP
+
+class OPNMIDIStems;
+
+#ifndef OPNMIDI_DISABLE_STEMS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "opnmidi_ptr.hpp"
+
+class OPN2;
+class OPNChipBase;
+
+/**
+ * @brief Renderer of separate outputs per MIDI channel or per chip in one pass
+ *
+ * Per chip, every chip just writes its own output instead of the mix.
+ *
+ * Per MIDI channel, copies of chips receive all register writes, but the hard
+ * panning of chip channels played by other MIDI channels is turned off, so only
+ * the notes of the stem which takes the copy are heard. The release of the note
+ * stays in the stem of the last MIDI channel played on the chip channel. Six chip
+ * channels have at most six owners, so only a few copies of every chip run: one
+ * per stem which owns channels of the chip, and one spare copy with all channels
+ * turned off. The stem takes the spare copy on its first note on the chip, and
+ * the next spare one starts from its state, so all copies keep the same phase of
+ * the LFO, envelopes and delayed writes as the mixed chip, and receive the same
+ * count of writes. When the stem owns no channel of the chip anymore, its copy
+ * runs a bit longer while the output buffered by the emulator comes out, then it
+ * becomes free. The panning gate works the same way with every emulator and
+ * doesn't change the voice allocation, so the stems sum up into the mixed output.
+ */
+class OPNMIDIStems
+{
+public:
+    enum Mode
+    {
+        //! Stems aren't rendered
+        Mode_Off = 0,
+        //! One stem per MIDI channel, channels of all MIDI ports are joined
+        Mode_MidiChannel = 1,
+        //! One stem per emulated chip
+        Mode_Chip = 2
+    };
+
+    enum
+    {
+        //! Count of stems rendered per MIDI channel
+        MidiChannelStems = 16,
+        //! Copies of every chip per MIDI channel: owners of six chip channels, the spare copy and one running out
+        CopiesPerChip = 8,
+        //! Maximal count of frames rendered at once, the same as in opn2_playFormat()
+        MaxChunkFrames = 512
+    };
+
+    OPNMIDIStems();
+    ~OPNMIDIStems();
+
+    /**
+     * @brief Set the stems mode (#Mode), makes copies of chips again when the mode gets changed
+     * @param synth Chips manager
+     * @param mode Stems mode
+     * @param emulator Type of chip emulator
+     * @param PCM_RATE Output sample rate
+     */
+    void setMode(OPN2 &synth, int mode, int emulator, unsigned long PCM_RATE);
+
+    /**
+     * @brief Current stems mode (#Mode)
+     */
+    int mode() const
+    {
+        return m_mode;
+    }
+
+    /**
+     * @brief Count of rendered stems
+     */
+    size_t count() const;
+
+    /**
+     * @brief Make copies of chips again after the reset of chips
+     * @param synth Chips manager
+     * @param emulator Type of chip emulator
+     * @param PCM_RATE Output sample rate
+     */
+    void chipReset(OPN2 &synth, int emulator, unsigned long PCM_RATE);
+
+    /**
+     * @brief Replace copies of chips by the other emulator, like OPN2::switchEmulator()
+     */
+    void switchEmulator(OPN2 &synth, int emulator, unsigned long PCM_RATE);
+
+    /**
+     * @brief Pass the chip register write to copies of the chip
+     */
+    void regWrite(size_t chip, uint8_t port, uint8_t index, uint8_t value);
+
+    /**
+     * @brief Pass the soft panning write to copies of the chip
+     */
+    void panWrite(size_t chip, uint16_t channel, uint8_t value);
+
+    /**
+     * @brief Assign the chip channel to the stem of the MIDI channel which plays the note on it
+     * @param synth Chips manager, rewrites the panning register
+     * @param c Chip channel
+     * @param midiChannel MIDI channel of the note
+     * @param writePan Rewrite the panning register of the chip channel, not needed
+     *        when the patch or the panning gets written next
+     */
+    void setChannelOwner(OPN2 &synth, size_t c, size_t midiChannel, bool writePan)
+    {
+        if(m_mode == Mode_MidiChannel && m_channelStem[c] != static_cast<int>(midiChannel % MidiChannelStems))
+            changeOwner(synth, c, static_cast<int>(midiChannel % MidiChannelStems), writePan);
+    }
+
+    /**
+     * @brief Render the chunk of every stem
+     * @param synth Chips manager
+     * @param frames Count of frames, not more than MaxChunkFrames
+     */
+    void generate(OPN2 &synth, size_t frames);
+
+    /**
+     * @brief Output of the stem rendered by generate()
+     */
+    int32_t *output(size_t stem)
+    {
+        return &m_buffer[stem * MaxChunkFrames * 2];
+    }
+
+private:
+    //! Stems mode
+    int m_mode;
+    //! Type of emulator of regular chips, lead chips run OPN2::m_leadEmulator
+    int m_emulator;
+    //! Output sample rate
+    unsigned long m_rate;
+    //! Count of chips
+    size_t m_chips;
+    //! Copies of every chip per MIDI channel, [chip * CopiesPerChip + copy]
+    std::vector<AdlMIDI_SPtr<OPNChipBase> > m_copies;
+    //! Stem which takes every copy, or -1 when the copy is free
+    std::vector<int> m_copyStem;
+    //! Every copy is running and receives writes, free copies of emulators which save the state may stop
+    std::vector<bool> m_copyRunning;
+    //! Frames left to run for copies of stems which own no channel of the chip anymore, 0 for owners
+    std::vector<size_t> m_copyDrain;
+    //! Copy taken by the stem, [stem * m_chips + chip], or -1
+    std::vector<int> m_stemCopy;
+    //! Frames a copy runs after its stem lost the chip, longer than buffers of emulators
+    size_t m_drainFrames;
+    //! Buffer of the chip state, used to start the next spare copy
+    std::vector<uint8_t> m_state;
+    //! Stem of the last MIDI channel played on every chip channel, or -1
+    std::vector<int> m_channelStem;
+    //! Rendered chunks of every stem
+    std::vector<int32_t> m_buffer;
+
+    void changeOwner(OPN2 &synth, size_t c, int stem, bool writePan);
+    void createChips(OPN2 &synth);
+    OPNChipBase *createChip(OPN2 &synth, size_t copy, size_t chip) const;
+    void takeCopy(size_t chip, int stem);
+    void releaseCopy(size_t chip, int stem);
+    void freeCopy(size_t i);
+    bool hasSpare(size_t chip, size_t except) const;
+    void resizeBuffer();
+
+    OPNMIDIStems(const OPNMIDIStems &);
+    OPNMIDIStems &operator=(const OPNMIDIStems &);
+};
+
+#endif // OPNMIDI_DISABLE_STEMS
+
+#endif // OPNMIDI_STEMS_HPP
@@ -0,0 +1,365 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(OPNMIDI_DISABLE_STREAM_LOADER) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+
+#include "opnmidi_stream.hpp"
+#include "midi_sequencer.hpp"
+
+#include <cstring>
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#endif
+
+//! Count of bytes requested by one call of the read callback
+static const size_t s_readChunk = 16384;
+//! Size of received data to parse the first beginning of the song
+static const size_t s_firstParse = 16384;
+
+
+static inline int s_loadState(const volatile int *p)
+{
+#if defined(__GNUC__)
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#else
+    return *p;
+#endif
+}
+
+static inline void s_storeState(volatile int *p, int v)
+{
+#if defined(__GNUC__)
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#else
+    *p = v;
+#endif
+}
+
+
+/***************************************************************
+ *                    Thread and mutex                         *
+ ***************************************************************/
+
+struct OPNMIDIStreamLoader::Impl
+{
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION mutex;
+
+    Impl() : thread(NULL) { InitializeCriticalSection(&mutex); }
+    ~Impl() { DeleteCriticalSection(&mutex); }
+
+    void lock() { EnterCriticalSection(&mutex); }
+    bool tryLock() { return TryEnterCriticalSection(&mutex) != 0; }
+    void unlock() { LeaveCriticalSection(&mutex); }
+
+    static DWORD WINAPI entry(LPVOID arg)
+    {
+        OPNMIDIStreamLoader::threadProc(arg);
+        return 0;
+    }
+
+    bool create(OPNMIDIStreamLoader *self)
+    {
+        thread = CreateThread(NULL, 0, &entry, self, 0, NULL);
+        return thread != NULL;
+    }
+
+    void join()
+    {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        thread = NULL;
+    }
+#else
+    pthread_t thread;
+    pthread_mutex_t mutex;
+
+    Impl() { pthread_mutex_init(&mutex, NULL); }
+    ~Impl() { pthread_mutex_destroy(&mutex); }
+
+    void lock() { pthread_mutex_lock(&mutex); }
+    bool tryLock() { return pthread_mutex_trylock(&mutex) == 0; }
+    void unlock() { pthread_mutex_unlock(&mutex); }
+
+    static void *entry(void *arg)
+    {
+        OPNMIDIStreamLoader::threadProc(arg);
+        return NULL;
+    }
+
+    bool create(OPNMIDIStreamLoader *self)
+    {
+        return pthread_create(&thread, NULL, &entry, self) == 0;
+    }
+
+    void join()
+    {
+        pthread_join(thread, NULL);
+    }
+#endif
+};
+
+
+/***************************************************************
+ *                     Stream loader                           *
+ ***************************************************************/
+
+OPNMIDIStreamLoader::OPNMIDIStreamLoader(const BW_MidiRtInterface *intrf) :
+    m_impl(new Impl),
+    m_interface(intrf),
+    m_read(NULL),
+    m_userData(NULL),
+    m_prebuffer(0.0),
+    m_parseThreads(1),
+    m_nextParse(s_firstParse),
+    m_fresh(0),
+    m_state(State_Empty),
+    m_stop(0),
+    m_threadStarted(false)
+{}
+
+OPNMIDIStreamLoader::~OPNMIDIStreamLoader()
+{
+    s_storeState(&m_stop, 1);
+    wait();
+    delete m_impl;
+}
+
+bool OPNMIDIStreamLoader::open(ReadFunc read, void *userData, double prebuffer, unsigned parseThreads,
+                               AdlMIDI_UPtr<MidiSequencer> &sequencer)
+{
+    clear();
+    m_read = read;
+    m_userData = userData;
+    m_prebuffer = prebuffer;
+    m_parseThreads = parseThreads;
+    m_nextParse = s_firstParse;
+    s_storeState(&m_state, State_Receiving);
+
+    // Receive on the calling thread until the beginning of the song is enough to play
+    AdlMIDI_UPtr<MidiSequencer> seq;
+    for(;;)
+    {
+        int got = receive();
+        if(got < 0)
+        {
+            s_storeState(&m_state, State_Failed);
+            return false;
+        }
+
+        if(got == 0)
+        {
+            if(!parse(seq, false))
+            {
+                s_storeState(&m_state, State_Failed);
+                return false;
+            }
+            std::vector<uint8_t>().swap(m_data);
+            s_storeState(&m_state, State_Complete);
+            sequencer.swap(seq);
+            return true;
+        }
+
+        if(m_data.size() < m_nextParse)
+            continue;
+
+        m_nextParse = m_data.size() * 2;
+        if(parse(seq, true) && (seq->readyAheadTime() >= m_prebuffer))
+            break;
+    }
+
+    sequencer.swap(seq);
+
+    m_threadStarted = m_impl->create(this);
+    if(!m_threadStarted)
+        run(); // Receive in place when thread can't be created
+
+    return true;
+}
+
+void OPNMIDIStreamLoader::clear()
+{
+    s_storeState(&m_stop, 1);
+    wait();
+    s_storeState(&m_stop, 0);
+
+    // The audio thread may take the newer song right now
+    m_impl->lock();
+    s_storeState(&m_state, State_Empty);
+    s_storeState(&m_fresh, 0);
+    m_next.reset();
+    m_impl->unlock();
+    m_errorString.clear();
+    std::vector<uint8_t>().swap(m_data);
+}
+
+int OPNMIDIStreamLoader::state() const
+{
+    return s_loadState(&m_state);
+}
+
+bool OPNMIDIStreamLoader::take(AdlMIDI_UPtr<MidiSequencer> &sequencer)
+{
+    if(!s_loadState(&m_fresh))
+    {
+        if(s_loadState(&m_state) == State_Failed)
+            sequencer->finishPartial(); // Play until end of the received data
+        return false;
+    }
+
+    if(!m_impl->tryLock())
+        return false; // The newer song is being published, don't wait
+
+    bool taken = false;
+    if(s_loadState(&m_fresh) && m_next->continueFrom(*sequencer, m_stateBuffer))
+    {
+        m_next.swap(sequencer);
+        taken = true;
+    }
+    s_storeState(&m_fresh, 0);
+    m_impl->unlock();
+
+    return taken;
+}
+
+int OPNMIDIStreamLoader::receive()
+{
+    const size_t begin = m_data.size();
+    m_data.resize(begin + s_readChunk);
+
+    long got = m_read(m_userData, &m_data[begin], static_cast<unsigned long>(s_readChunk));
+    if(got < 0)
+    {
+        m_data.resize(begin);
+        m_errorString = "Can't read the music data";
+        return -1;
+    }
+
+    if(static_cast<unsigned long>(got) > s_readChunk)
+        got = static_cast<long>(s_readChunk);
+    m_data.resize(begin + static_cast<size_t>(got));
+
+    return got > 0 ? 1 : 0;
+}
+
+bool OPNMIDIStreamLoader::parse(AdlMIDI_UPtr<MidiSequencer> &seq, bool partial)
+{
+    // Only the Standard MIDI file can be played before end of its data
+    if(partial && ((m_data.size() < 4) || (std::memcmp(&m_data[0], "MThd", 4) != 0)))
+        return false;
+
+    seq.reset(new MidiSequencer);
+    seq->setInterface(m_interface);
+    seq->setParseThreads(m_parseThreads);
+    seq->setPartialData(partial);
+
+    bool ok = seq->loadMIDI(m_data.empty() ? NULL : &m_data[0], m_data.size());
+    if(!ok)
+        m_errorString = seq->getErrorString();
+    else if(seq->getFormat() == MidiSequencer::Format_CMF)
+    {
+        m_errorString = "OPNMIDI doesn't supports CMF, use ADLMIDI to play this file!";
+        ok = false;
+    }
+    else if(seq->getFormat() == MidiSequencer::Format_IMF)
+    {
+        m_errorString = "OPNMIDI doesn't supports IMF, use ADLMIDI to play this file!";
+        ok = false;
+    }
+
+    if(!ok)
+    {
+        seq.reset();
+        if(partial)
+            m_errorString.clear(); // The rest of data may fix it
+    }
+
+    return ok;
+}
+
+void OPNMIDIStreamLoader::publish(AdlMIDI_UPtr<MidiSequencer> &seq)
+{
+    m_impl->lock();
+    m_next.swap(seq);
+    s_storeState(&m_fresh, 1);
+    m_impl->unlock();
+
+    // The replaced sequencer is freed here, not by the audio thread
+    seq.reset();
+}
+
+void OPNMIDIStreamLoader::wait()
+{
+    if(m_threadStarted)
+    {
+        m_impl->join();
+        m_threadStarted = false;
+    }
+}
+
+void OPNMIDIStreamLoader::threadProc(void *self)
+{
+    reinterpret_cast<OPNMIDIStreamLoader *>(self)->run();
+}
+
+void OPNMIDIStreamLoader::run()
+{
+    AdlMIDI_UPtr<MidiSequencer> seq;
+
+    while(!s_loadState(&m_stop))
+    {
+        int got = receive();
+        if(got < 0)
+        {
+            s_storeState(&m_state, State_Failed);
+            return;
+        }
+
+        if(got == 0)
+        {
+            const bool ok = parse(seq, false);
+            if(ok)
+                publish(seq);
+            // The received data is not needed anymore
+            std::vector<uint8_t>().swap(m_data);
+            s_storeState(&m_state, ok ? State_Complete : State_Failed);
+            return;
+        }
+
+        if(m_data.size() < m_nextParse)
+            continue;
+
+        m_nextParse = m_data.size() * 2;
+        if(parse(seq, true))
+            publish(seq);
+    }
+}
+
+#endif // OPNMIDI_DISABLE_STREAM_LOADER
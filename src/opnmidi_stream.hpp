@@ -0,0 +1,178 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_STREAM_HPP
+#define OPNMIDI_STREAM_HPP
+
+class OPNMIDIStreamLoader;
+
+#if !defined(OPNMIDI_DISABLE_STREAM_LOADER) && !defined(OPNMIDI_DISABLE_MIDI_SEQUENCER)
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "opnmidi_private.hpp"
+#include "opnmidi_ptr.hpp"
+
+/**
+ * @brief Loader of the song which data is received progressively by the read callback
+ *
+ * The beginning of the received Standard MIDI file is parsed again every time
+ * the received data doubles, each parse goes into the new sequencer. The audio
+ * thread takes the newest one by take() without blocking and continues playing
+ * it from the position of the previous one. The replaced sequencer is freed
+ * by the worker thread. Other formats are parsed once the data is received fully.
+ */
+class OPNMIDIStreamLoader
+{
+public:
+    enum State
+    {
+        //! Nothing is received
+        State_Empty = 0,
+        //! The song data is being received, the loaded song is provisional
+        State_Receiving = 1,
+        //! The song data is received and parsed fully
+        State_Complete = 2,
+        //! The song data can't be received or parsed
+        State_Failed = -1
+    };
+
+    /**
+     * @brief Read callback of the song data
+     * @param userData Pointer to user data
+     * @param buffer Destination of the data
+     * @param size Count of bytes to read
+     * @return Count of bytes read, 0 at end of data, <0 on error
+     */
+    typedef long (*ReadFunc)(void *userData, void *buffer, unsigned long size);
+
+    /**
+     * @brief Constructor
+     * @param intrf Interface of the player, given to every parsed sequencer
+     */
+    explicit OPNMIDIStreamLoader(const BW_MidiRtInterface *intrf);
+    ~OPNMIDIStreamLoader();
+
+    /**
+     * @brief Receive the beginning of the song, the rest is received on the worker thread
+     *
+     * Blocks until the song is ready to play for the prebuffer time, or until
+     * the song data ends.
+     *
+     * @param read Read callback of the song data
+     * @param userData Pointer to user data given to the read callback
+     * @param prebuffer Time of the song to receive before the playback, in seconds
+     * @param parseThreads Count of threads to decode tracks of the song
+     * @param [_out] sequencer Receives the beginning of the song
+     * @return true if the song is ready to play
+     */
+    bool open(ReadFunc read, void *userData, double prebuffer, unsigned parseThreads,
+              AdlMIDI_UPtr<MidiSequencer> &sequencer);
+
+    /**
+     * @brief Stop receiving of the song data
+     */
+    void clear();
+
+    /**
+     * @brief Current state of the received song (#State)
+     */
+    int state() const;
+
+    /**
+     * @brief Error of the failed receiving or parsing
+     */
+    const std::string &errorString() const
+    {
+        return m_errorString;
+    }
+
+    /**
+     * @brief Time of the song to receive before the playback, in seconds
+     */
+    double prebuffer() const
+    {
+        return m_prebuffer;
+    }
+
+    /**
+     * @brief Take the newer beginning of the song, never blocks and never frees memory
+     *
+     * The taken sequencer continues from the position of the given one. When the rest
+     * of the song can't be received, the given one is finished at end of its data.
+     *
+     * @param sequencer Sequencer of the playing song, gets swapped with the newer one
+     * @return true if the newer beginning of the song has been taken
+     */
+    bool take(AdlMIDI_UPtr<MidiSequencer> &sequencer);
+
+private:
+    struct Impl;
+    Impl *m_impl;
+
+    //! Interface of the player
+    const BW_MidiRtInterface *m_interface;
+    //! Read callback of the song data
+    ReadFunc m_read;
+    //! User data of the read callback
+    void *m_userData;
+    //! Time of the song to receive before the playback, in seconds
+    double m_prebuffer;
+    //! Count of threads to decode tracks of the song
+    unsigned m_parseThreads;
+    //! Received song data
+    std::vector<uint8_t> m_data;
+    //! Size of received data to parse the next beginning of the song
+    size_t m_nextParse;
+    //! Newest parsed beginning of the song, or the replaced one after take()
+    AdlMIDI_UPtr<MidiSequencer> m_next;
+    //! Is m_next newer than the playing song
+    volatile int m_fresh;
+    //! Temporary buffer of the sequencer state, used by take()
+    std::vector<uint8_t> m_stateBuffer;
+    //! Error of the failed receiving or parsing
+    std::string m_errorString;
+    //! State of the received song (#State)
+    volatile int m_state;
+    //! Is the worker thread asked to stop
+    volatile int m_stop;
+    //! Is worker thread started and not joined
+    bool m_threadStarted;
+
+    int receive();
+    bool parse(AdlMIDI_UPtr<MidiSequencer> &seq, bool partial);
+    void publish(AdlMIDI_UPtr<MidiSequencer> &seq);
+    void wait();
+    static void threadProc(void *self);
+    void run();
+
+    OPNMIDIStreamLoader(const OPNMIDIStreamLoader &);
+    OPNMIDIStreamLoader &operator=(const OPNMIDIStreamLoader &);
+};
+
+#endif // OPNMIDI_DISABLE_STREAM_LOADER
+
+#endif // OPNMIDI_STREAM_HPP
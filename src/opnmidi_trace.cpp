@@ -0,0 +1,418 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_DISABLE_TRACE
+
+#include "opnmidi_trace.hpp"
+#include "opnmidi_opn2.hpp"
+#include "opnmidi_private.hpp"
+#include "chips/opn_chip_base.h"
+
+static const char s_traceMagic[8] = {'O', 'P', 'N', 'T', 'R', 'A', 'C', 'E'};
+
+enum
+{
+    //! Buffered records are written into the file when this size is reached
+    TraceFlushSize = 60 * 1024,
+    //! Maximal count of frames rendered by replay at once
+    TraceReplayChunk = 512
+};
+
+
+/***************************************************************
+ *                        Trace writer                         *
+ ***************************************************************/
+
+OPNMIDITrace::OPNMIDITrace() :
+    m_file(NULL),
+    m_frame(0),
+    m_pendingFrames(0),
+    m_activeChips(0)
+{}
+
+OPNMIDITrace::~OPNMIDITrace()
+{
+    close();
+}
+
+bool OPNMIDITrace::open(const char *path, unsigned long sampleRate)
+{
+    close();
+
+    m_file = std::fopen(path, "wb");
+    if(!m_file)
+        return false;
+
+    m_buffer.clear();
+    m_buffer.reserve(64 * 1024);
+    m_frame = 0;
+    m_pendingFrames = 0;
+    m_activeChips = 0;
+
+    m_buffer.insert(m_buffer.end(), s_traceMagic, s_traceMagic + sizeof(s_traceMagic));
+    putByte(TraceVersion);
+    putByte(static_cast<uint8_t>(sampleRate & 0xFF));
+    putByte(static_cast<uint8_t>((sampleRate >> 8) & 0xFF));
+    putByte(static_cast<uint8_t>((sampleRate >> 16) & 0xFF));
+    putByte(static_cast<uint8_t>((sampleRate >> 24) & 0xFF));
+    flush();
+
+    return true;
+}
+
+void OPNMIDITrace::close()
+{
+    if(!m_file)
+        return;
+    putAdvance();
+    flush();
+    std::fclose(m_file);
+    m_file = NULL;
+}
+
+void OPNMIDITrace::regWrite(size_t chip, uint8_t port, uint8_t index, uint8_t value)
+{
+    beginRecord((port & 1) ? TraceRec_Reg1 : TraceRec_Reg0);
+    putVarint(chip);
+    putByte(index);
+    putByte(value);
+}
+
+void OPNMIDITrace::panWrite(size_t chip, uint8_t channel, uint8_t value)
+{
+    beginRecord(TraceRec_Pan);
+    putVarint(chip);
+    putByte(channel);
+    putByte(value);
+}
+
+void OPNMIDITrace::chipReset(size_t chips, int family)
+{
+    beginRecord(TraceRec_Reset);
+    putVarint(chips);
+    putByte(static_cast<uint8_t>(family));
+}
+
+void OPNMIDITrace::setActiveChips(size_t activeChips)
+{
+    beginRecord(TraceRec_Active);
+    putVarint(activeChips);
+    m_activeChips = activeChips;
+}
+
+void OPNMIDITrace::midiEvent(OPNMIDITraceMidi kind, size_t argc, uint8_t a, uint8_t b, uint8_t c)
+{
+    beginRecord(TraceRec_Midi);
+    putByte(static_cast<uint8_t>(kind));
+    putVarint(argc);
+    if(argc > 0)
+        putByte(a);
+    if(argc > 1)
+        putByte(b);
+    if(argc > 2)
+        putByte(c);
+}
+
+void OPNMIDITrace::midiData(OPNMIDITraceMidi kind, size_t prefix, const uint8_t *data, size_t size)
+{
+    beginRecord(TraceRec_Midi);
+    putByte(static_cast<uint8_t>(kind));
+    // Length of arguments includes the encoded prefix which takes several bytes since 128
+    size_t prefixSize = 1;
+    for(size_t v = prefix; v >= 0x80; v >>= 7)
+        ++prefixSize;
+    putVarint(prefixSize + size);
+    putVarint(prefix);
+    if(size > 0)
+        m_buffer.insert(m_buffer.end(), data, data + size);
+}
+
+void OPNMIDITrace::beginRecord(uint8_t type)
+{
+    if(m_buffer.size() >= TraceFlushSize)
+        flush();
+    putAdvance();
+    putByte(type);
+}
+
+void OPNMIDITrace::putAdvance()
+{
+    if(m_pendingFrames == 0)
+        return;
+    putByte(TraceRec_Advance);
+    putVarint(m_pendingFrames);
+    m_frame += m_pendingFrames;
+    m_pendingFrames = 0;
+}
+
+void OPNMIDITrace::putVarint(uint64_t v)
+{
+    while(v >= 0x80)
+    {
+        putByte(static_cast<uint8_t>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    putByte(static_cast<uint8_t>(v));
+}
+
+void OPNMIDITrace::flush()
+{
+    if(m_file && !m_buffer.empty())
+        std::fwrite(&m_buffer[0], 1, m_buffer.size(), m_file);
+    m_buffer.clear();
+}
+
+
+/***************************************************************
+ *                        Trace replay                         *
+ ***************************************************************/
+
+namespace
+{
+
+class TraceReader
+{
+    std::FILE *m_file;
+public:
+    explicit TraceReader(std::FILE *file) : m_file(file) {}
+    ~TraceReader() { std::fclose(m_file); }
+
+    bool byte(uint8_t &out)
+    {
+        int c = std::fgetc(m_file);
+        if(c == EOF)
+            return false;
+        out = static_cast<uint8_t>(c);
+        return true;
+    }
+
+    bool varint(uint64_t &out)
+    {
+        out = 0;
+        for(unsigned shift = 0; shift < 64; shift += 7)
+        {
+            uint8_t b;
+            if(!byte(b))
+                return false;
+            out |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if((b & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool skip(uint64_t size)
+    {
+        for(uint64_t i = 0; i < size; ++i)
+        {
+            uint8_t b;
+            if(!byte(b))
+                return false;
+        }
+        return true;
+    }
+};
+
+} // anonymous namespace
+
+long OPNMIDITrace::replay(const char *path, int emulator,
+                          void (*audio)(void *, const int16_t *, size_t),
+                          void *userData, unsigned long *sampleRate, const char **error)
+{
+    *error = NULL;
+
+    if(!opn2_isEmulatorAvailable(emulator))
+    {
+        *error = "OPN2 MIDI: Unknown emulation core!";
+        return -1;
+    }
+
+    std::FILE *file = std::fopen(path, "rb");
+    if(!file)
+    {
+        *error = "OPN2 MIDI: Can't open the trace file!";
+        return -1;
+    }
+
+    TraceReader in(file);
+
+    uint8_t header[13];
+    for(size_t i = 0; i < sizeof(header); ++i)
+    {
+        if(!in.byte(header[i]))
+        {
+            *error = "OPN2 MIDI: Trace file is truncated!";
+            return -1;
+        }
+    }
+
+    if(std::memcmp(header, s_traceMagic, sizeof(s_traceMagic)) != 0 || header[8] != TraceVersion)
+    {
+        *error = "OPN2 MIDI: Invalid or unsupported trace file!";
+        return -1;
+    }
+
+    const unsigned long rate = static_cast<unsigned long>(header[9]) |
+                               (static_cast<unsigned long>(header[10]) << 8) |
+                               (static_cast<unsigned long>(header[11]) << 16) |
+                               (static_cast<unsigned long>(header[12]) << 24);
+    if(sampleRate)
+        *sampleRate = rate;
+
+    // Synth is only used as a factory of chips, registers are written
+    // into the emulators directly
+    OPN2 factory;
+    std::vector<AdlMIDI_SPtr<OPNChipBase> > chips;
+    size_t activeChips = 0;
+    std::vector<int32_t> mix(TraceReplayChunk * 2);
+    std::vector<int16_t> out(TraceReplayChunk * 2);
+    long frames = 0;
+    bool truncated = false;
+
+    uint8_t type;
+    while(!truncated && in.byte(type))
+    {
+        switch(type)
+        {
+        case TraceRec_Advance:
+        {
+            uint64_t count;
+            if(!in.varint(count))
+            {
+                truncated = true;
+                break;
+            }
+            while(count > 0)
+            {
+                size_t n = count > TraceReplayChunk ? static_cast<size_t>(TraceReplayChunk) : static_cast<size_t>(count);
+                std::memset(&mix[0], 0, n * 2 * sizeof(int32_t));
+                for(size_t i = 0; i < activeChips && i < chips.size(); ++i)
+                    chips[i]->generateAndMix32(&mix[0], n);
+                if(audio)
+                {
+                    for(size_t i = 0; i < n * 2; ++i)
+                    {
+                        int32_t s = mix[i];
+                        out[i] = static_cast<int16_t>(s > 32767 ? 32767 : (s < -32768 ? -32768 : s));
+                    }
+                    audio(userData, &out[0], n);
+                }
+                count -= n;
+                frames += static_cast<long>(n);
+            }
+            break;
+        }
+
+        case TraceRec_Reg0:
+        case TraceRec_Reg1:
+        {
+            uint64_t chip;
+            uint8_t index, value;
+            if(!in.varint(chip) || !in.byte(index) || !in.byte(value))
+            {
+                truncated = true;
+                break;
+            }
+            if(chip < chips.size())
+                chips[static_cast<size_t>(chip)]->writeReg(type == TraceRec_Reg1 ? 1 : 0, index, value);
+            break;
+        }
+
+        case TraceRec_Pan:
+        {
+            uint64_t chip;
+            uint8_t channel, value;
+            if(!in.varint(chip) || !in.byte(channel) || !in.byte(value))
+            {
+                truncated = true;
+                break;
+            }
+            if(chip < chips.size())
+                chips[static_cast<size_t>(chip)]->writePan(channel, value);
+            break;
+        }
+
+        case TraceRec_Reset:
+        {
+            uint64_t count;
+            uint8_t family;
+            if(!in.varint(count) || !in.byte(family))
+            {
+                truncated = true;
+                break;
+            }
+            if(count > OPN_MAX_CHIPS || family >= OPNChip_Count)
+            {
+                *error = "OPN2 MIDI: Invalid trace record!";
+                return -1;
+            }
+            chips.clear();
+            for(size_t i = 0; i < count; ++i)
+            {
+                OPNChipBase *chip = factory.createChip(emulator, i, static_cast<OPNFamily>(family), rate, NULL);
+                chips.push_back(AdlMIDI_SPtr<OPNChipBase>(chip));
+            }
+            break;
+        }
+
+        case TraceRec_Active:
+        {
+            uint64_t count;
+            if(!in.varint(count))
+            {
+                truncated = true;
+                break;
+            }
+            activeChips = static_cast<size_t>(count);
+            break;
+        }
+
+        case TraceRec_Midi:
+        {
+            // MIDI calls are kept for the reference only
+            uint8_t kind;
+            uint64_t size;
+            if(!in.byte(kind) || !in.varint(size) || !in.skip(size))
+            {
+                truncated = true;
+                break;
+            }
+            break;
+        }
+
+        default:
+            *error = "OPN2 MIDI: Invalid trace record!";
+            return -1;
+        }
+    }
+
+    if(truncated)
+    {
+        *error = "OPN2 MIDI: Trace file is truncated!";
+        return -1;
+    }
+
+    return frames;
+}
+
+#endif // OPNMIDI_DISABLE_TRACE
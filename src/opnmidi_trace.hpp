@@ -0,0 +1,198 @@
+/*
+ * libOPNMIDI is a free Software MIDI synthesizer library with OPN2 (YM2612) emulation
+ *
+ * MIDI parser and player (Original code from ADLMIDI): Copyright (c) 2010-2014 Joel Yliluoma <bisqwit@iki.fi>
+ * OPNMIDI Library and YM2612 support:   Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Library is based on the ADLMIDI, a MIDI player for Linux and Windows with OPL3 emulation:
+ * http://iki.fi/bisqwit/source/adlmidi.html
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPNMIDI_TRACE_HPP
+#define OPNMIDI_TRACE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Kinds of the real-time MIDI calls which are logged into the trace
+ */
+enum OPNMIDITraceMidi
+{
+    TraceMidi_NoteOn = 0,
+    TraceMidi_NoteOff,
+    TraceMidi_NoteAfterTouch,
+    TraceMidi_ChannelAfterTouch,
+    TraceMidi_Controller,
+    TraceMidi_PatchChange,
+    TraceMidi_PitchBend,
+    TraceMidi_BankChangeLSB,
+    TraceMidi_BankChangeMSB,
+    TraceMidi_BankChange,
+    TraceMidi_SysEx,
+    TraceMidi_Panic,
+    TraceMidi_ResetState,
+    TraceMidi_DeviceSwitch
+};
+
+#ifndef OPNMIDI_DISABLE_TRACE
+
+#include <cstdio>
+#include <vector>
+
+/**
+ * @brief Binary log of the MIDI calls and chip register writes
+ *
+ * The file starts with the "OPNTRACE" magic, the format version byte and
+ * the output sample rate as 32-bit little endian value. The rest is a stream
+ * of records, each begins with the record type byte:
+ * - TraceRec_Advance: varint count of frames rendered since the previous advance
+ * - TraceRec_Reg0, TraceRec_Reg1: varint chip, register index, value
+ * - TraceRec_Pan: varint chip, chip channel, soft panning value
+ * - TraceRec_Reset: varint count of chips, chip family
+ * - TraceRec_Midi: kind of MIDI call, varint length of arguments, arguments
+ * - TraceRec_Active: varint count of first chips which are rendered
+ *
+ * All records between two advances are happened at the same frame.
+ */
+class OPNMIDITrace
+{
+public:
+    enum Record
+    {
+        TraceRec_Advance = 0x00,
+        TraceRec_Reg0    = 0x01,
+        TraceRec_Reg1    = 0x02,
+        TraceRec_Pan     = 0x03,
+        TraceRec_Reset   = 0x04,
+        TraceRec_Midi    = 0x05,
+        TraceRec_Active  = 0x06
+    };
+
+    enum
+    {
+        //! Version of the trace format
+        TraceVersion = 1
+    };
+
+    OPNMIDITrace();
+    ~OPNMIDITrace();
+
+    /**
+     * @brief Create the trace file and write the header
+     * @param path Path to the trace file
+     * @param sampleRate Output sample rate
+     * @return true on success
+     */
+    bool open(const char *path, unsigned long sampleRate);
+
+    /**
+     * @brief Flush buffered records and close the file
+     */
+    void close();
+
+    /**
+     * @brief Count of frames rendered since the trace start
+     */
+    uint64_t frame() const
+    {
+        return m_frame + m_pendingFrames;
+    }
+
+    /**
+     * @brief Account frames rendered by chips
+     * @param frames Count of rendered frames
+     * @param activeChips Count of first chips which were rendered
+     */
+    void advance(size_t frames, size_t activeChips)
+    {
+        if(activeChips != m_activeChips)
+            setActiveChips(activeChips);
+        m_pendingFrames += frames;
+    }
+
+    /**
+     * @brief Log the chip register write
+     */
+    void regWrite(size_t chip, uint8_t port, uint8_t index, uint8_t value);
+
+    /**
+     * @brief Log the soft panning write
+     */
+    void panWrite(size_t chip, uint8_t channel, uint8_t value);
+
+    /**
+     * @brief Log the re-creation of chips
+     */
+    void chipReset(size_t chips, int family);
+
+    /**
+     * @brief Log the real-time MIDI call with up to three byte arguments
+     */
+    void midiEvent(OPNMIDITraceMidi kind, size_t argc, uint8_t a, uint8_t b = 0, uint8_t c = 0);
+
+    /**
+     * @brief Log the real-time MIDI call with the raw data
+     * @param kind Kind of the call
+     * @param prefix Leading number (track number for the device switch)
+     * @param data Raw data
+     * @param size Size of raw data
+     */
+    void midiData(OPNMIDITraceMidi kind, size_t prefix, const uint8_t *data, size_t size);
+
+    /**
+     * @brief Feed the register trace into the chip emulator
+     * @param path Path to the trace file
+     * @param emulator Emulator to use (OPNMIDI_Emulator)
+     * @param audio Receiver of the rendered 16-bit stereo audio, may be NULL
+     * @param userData Pointer passed into the receiver
+     * @param sampleRate Receives the sample rate of the trace, may be NULL
+     * @param error Error description on failure
+     * @return Count of rendered frames, or -1 on failure
+     */
+    static long replay(const char *path, int emulator,
+                       void (*audio)(void *, const int16_t *, size_t),
+                       void *userData, unsigned long *sampleRate, const char **error);
+
+private:
+    //! Output file
+    std::FILE *m_file;
+    //! Records are collected here before writing into the file
+    std::vector<uint8_t> m_buffer;
+    //! Count of frames written into the trace
+    uint64_t m_frame;
+    //! Count of frames rendered after the last written record
+    uint64_t m_pendingFrames;
+    //! Count of chips rendered at the last advance
+    size_t m_activeChips;
+
+    void beginRecord(uint8_t type);
+    void putAdvance();
+    void setActiveChips(size_t activeChips);
+    void putByte(uint8_t b)
+    {
+        m_buffer.push_back(b);
+    }
+    void putVarint(uint64_t v);
+    void flush();
+
+    OPNMIDITrace(const OPNMIDITrace &);
+    OPNMIDITrace &operator=(const OPNMIDITrace &);
+};
+
+#endif // OPNMIDI_DISABLE_TRACE
+
+#endif // OPNMIDI_TRACE_HPP
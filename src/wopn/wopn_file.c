@@ -361,6 +361,105 @@ WOPNFile *WOPN_LoadBankFromMem(void *mem, size_t length, int *error)
     return outFile;
 }
 
+int WOPN_LocateBanksInMem(void *mem, size_t length, WOPNFile *header, WOPNBankLocation *locations, size_t *ins_size)
+{
+    uint16_t i = 0, j = 0;
+    uint16_t version = 0;
+    uint16_t counts[2];
+    uint16_t insSize = 0;
+    uint8_t *cursor = (uint8_t *)mem;
+    uint8_t *begin = cursor;
+    WOPNBankLocation *loc = locations;
+
+    if(!cursor || !header)
+        return WOPN_ERR_NULL_POINTER;
+
+#define GO_FORWARD(bytes) { cursor += bytes; length -= bytes; }
+
+    {/* Magic number */
+        if(length < 11)
+            return WOPN_ERR_UNEXPECTED_ENDING;
+        if(memcmp(cursor, wopn2_magic1, 11) == 0)
+            version = 1;
+        else if(memcmp(cursor, wopn2_magic2, 11) != 0)
+            return WOPN_ERR_BAD_MAGIC;
+        GO_FORWARD(11);
+    }
+
+    if (version == 0)
+    {/* Version code */
+        if(length < 2)
+            return WOPN_ERR_UNEXPECTED_ENDING;
+        version = toUint16LE(cursor);
+        if(version > wopn_latest_version)
+            return WOPN_ERR_NEWER_VERSION;
+        GO_FORWARD(2);
+    }
+
+    {/* Header of WOPN */
+        if(length < 5)
+            return WOPN_ERR_UNEXPECTED_ENDING;
+        counts[0] = toUint16BE(cursor);
+        counts[1] = toUint16BE(cursor + 2);
+        if(counts[0] == 0 || counts[1] == 0)
+            return WOPN_ERR_INVALID_BANKS_COUNT;
+
+        memset(header, 0, sizeof(WOPNFile));
+        header->version = version;
+        header->banks_count_melodic = counts[0];
+        header->banks_count_percussion = counts[1];
+        header->lfo_freq = cursor[4] & 0xf;
+        if(version >= 2)
+            header->chip_type = (cursor[4] >> 4) & 1;
+        header->volume_model = 0;
+        GO_FORWARD(5);
+    }
+
+    insSize = (version > 1) ? WOPN_INST_SIZE_V2 : WOPN_INST_SIZE_V1;
+    if(ins_size)
+        *ins_size = insSize;
+
+    if(!locations)
+        return WOPN_ERR_OK;
+
+    for(i = 0; i < 2; i++)
+    {
+        for(j = 0; j < counts[i]; j++)
+        {
+            loc->is_percussion = (uint8_t)i;
+            loc->bank_midi_lsb = 0;
+            loc->bank_midi_msb = 0;
+            if(version >= 2) /* Bank names and LSB/MSB titles */
+            {
+                if(length < 34)
+                    return WOPN_ERR_UNEXPECTED_ENDING;
+                loc->bank_midi_lsb = cursor[32];
+                loc->bank_midi_msb = cursor[33];
+                GO_FORWARD(34);
+            }
+            loc++;
+        }
+    }
+
+    {/* Instruments data */
+        size_t total = (size_t)counts[0] + (size_t)counts[1];
+        size_t k;
+        if(length < (insSize * 128) * total)
+            return WOPN_ERR_UNEXPECTED_ENDING;
+        for(k = 0; k < total; k++)
+            locations[k].offset = (size_t)(cursor - begin) + (insSize * 128) * k;
+    }
+
+#undef GO_FORWARD
+
+    return WOPN_ERR_OK;
+}
+
+void WOPN_LoadBankInstFromMem(WOPNInstrument *ins, void *mem, uint16_t version)
+{
+    WOPN_parseInstrument(ins, (uint8_t *)mem, version, 1);
+}
+
 int WOPN_LoadInstFromMem(OPNIFile *file, void *mem, size_t length)
 {
     uint16_t version = 0;
@@ -141,6 +141,19 @@ typedef struct WOPNBank
     WOPNInstrument ins[128];
 } WOPNBank;
 
+/* Location of the bank instruments inside of the raw bank file data */
+typedef struct WOPNBankLocation
+{
+    /* MIDI Bank LSB code */
+    uint8_t bank_midi_lsb;
+    /* MIDI Bank MSB code */
+    uint8_t bank_midi_msb;
+    /* Is this a percussion bank */
+    uint8_t is_percussion;
+    /* Offset of the first of 128 instrument entries of this bank */
+    size_t  offset;
+} WOPNBankLocation;
+
 /* Instrument data file */
 typedef struct OPNIFile
 {
@@ -207,6 +220,26 @@ extern int WOPN_BanksCmp(const WOPNFile *bank1, const WOPNFile *bank2);
  */
 extern WOPNFile *WOPN_LoadBankFromMem(void *mem, size_t length, int *error);
 
+/**
+ * @brief Locate the instrument entries of every bank in the WOPN bank file without of parsing them.
+ * Call it with NULL locations to get the banks counts, then again with the array of enough size.
+ * @param mem Pointer to memory block contains raw WOPN bank file data
+ * @param length Length of given memory block
+ * @param header Destination for the bank file properties, bank data pointers will be set to NULL
+ * @param locations Destination array of (banks_count_melodic + banks_count_percussion) entries, melodic first, or NULL
+ * @param ins_size Destination for the size of one instrument entry, or NULL
+ * @return 0 if no errors occouped, or an error code of WOPN_ErrorCodes enumeration
+ */
+extern int WOPN_LocateBanksInMem(void *mem, size_t length, WOPNFile *header, WOPNBankLocation *locations, size_t *ins_size);
+
+/**
+ * @brief Parse single instrument entry of the WOPN bank file, located by WOPN_LocateBanksInMem()
+ * @param ins Destination instrument
+ * @param mem Pointer to the instrument entry in the raw WOPN bank file data
+ * @param version Version of the bank file
+ */
+extern void WOPN_LoadBankInstFromMem(WOPNInstrument *ins, void *mem, uint16_t version);
+
 /**
  * @brief Load WOPI instrument file from the memory.
  * You must allocate OPNIFile structure by yourself and give the pointer to it.
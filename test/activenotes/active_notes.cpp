@@ -20,7 +20,7 @@ TEST_CASE( "MIDI Channel manipulating", "[OPNMIDIplay::MIDIchannel]" )
                 OPNMIDIplay::MIDIchannel::notes_iterator
                 i = midi_ch.find_activenote(note);
                 if(!i.is_end())
-                    midi_ch.activenotes.erase(i);
+                    midi_ch.erase_activenote(i);
             }
 
             const OpnInstMeta &ains = Synth::m_emptyInstrument;
@@ -62,7 +62,7 @@ TEST_CASE( "MIDI Channel manipulating", "[OPNMIDIplay::MIDIchannel]" )
             OPNMIDIplay::MIDIchannel::notes_iterator
             i = midi_ch.find_activenote(note);
             if(!i.is_end())
-                midi_ch.activenotes.erase(i);
+                midi_ch.erase_activenote(i);
         }
     }
 
@@ -74,5 +74,34 @@ TEST_CASE( "MIDI Channel manipulating", "[OPNMIDIplay::MIDIchannel]" )
             REQUIRE( !j.is_end() );
         }
     }
-}
 
+    SECTION("Lookup of dense chords by note index")
+    {
+        for(unsigned note = 0; note < 128; ++note)
+            midi_ch.ensure_find_or_create_activenote(note);
+        REQUIRE( midi_ch.activenotes.size() == 128 );
+
+        for(unsigned note = 0; note < 128; note += 2)
+            midi_ch.erase_activenote(midi_ch.ensure_find_activenote(note));
+
+        OPNMIDIplay::MIDIchannel copy_ch(midi_ch);
+        for(unsigned note = 0; note < 128; ++note)
+        {
+            OPNMIDIplay::MIDIchannel::notes_iterator i = midi_ch.find_activenote(note);
+            OPNMIDIplay::MIDIchannel::notes_iterator j = copy_ch.find_activenote(note);
+            REQUIRE( i.is_end() == (note % 2 == 0) );
+            REQUIRE( j.is_end() == (note % 2 == 0) );
+            if(!i.is_end())
+            {
+                REQUIRE( i->value.note == note );
+                REQUIRE( j->value.note == note );
+                REQUIRE( &*i != &*j );
+            }
+        }
+
+        unsigned expect = 1;
+        for(OPNMIDIplay::MIDIchannel::notes_iterator i = midi_ch.activenotes.begin(); !i.is_end(); ++i, expect += 2)
+            REQUIRE( i->value.note == expect );
+        REQUIRE( midi_ch.find_activenote(128).is_end() );
+    }
+}
@@ -0,0 +1,108 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "test_song.hpp"
+
+static OPN2_MIDIPlayer *makePlayer(const std::vector<uint8_t> &song)
+{
+    OPN2_MIDIPlayer *device = newPlayer(OPNMIDI_EMU_MAME, 2);
+    openSong(device, song);
+    return device;
+}
+
+/**
+ * @brief Count samples of the whole song played by opn2_play()
+ */
+static size_t songLength(OPN2_MIDIPlayer *device)
+{
+    std::vector<short> buffer(4096);
+    size_t total = 0;
+    int count;
+    while((count = opn2_play(device, static_cast<int>(buffer.size()), &buffer[0])) > 0)
+        total += static_cast<size_t>(count);
+    return total;
+}
+
+/**
+ * @brief Read the whole song from the render-ahead worker
+ * @param events Send the bunch of real-time events once the buffer got filled
+ * @return Count of read samples
+ */
+static size_t readSong(OPN2_MIDIPlayer *device, bool events)
+{
+    std::vector<short> buffer(1024);
+    size_t total = 0;
+    bool sent = !events;
+    unsigned idle = 0;
+
+    for(;;)
+    {
+        const int got = opn2_readAsync(device, static_cast<int>(buffer.size()), &buffer[0]);
+        if(got == 0)
+        {
+            // The tail of the song gets rendered after the sequencer reports the end
+            if(opn2_atEnd(device) && ++idle > 300)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        idle = 0;
+        total += static_cast<size_t>(got);
+
+        if(!sent && total >= 44100)
+        {
+            // Let the worker fill the whole buffer ahead of the reader
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            // More events than the queue holds, so some of them are applied directly
+            for(int i = 0; i < 600; ++i)
+                opn2_rt_controllerChange(device, 15, 7, static_cast<OPN2_UInt8>(i % 128));
+            REQUIRE(opn2_rt_noteOn(device, 15, 60, 100) == 1);
+            opn2_rt_pitchBend(device, 15, 0x3000);
+            const OPN2_UInt8 gmReset[] = {0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7};
+            REQUIRE(opn2_rt_systemExclusive(device, gmReset, sizeof(gmReset)) == 1);
+            opn2_rt_noteOn(device, 15, 64, 100);
+            opn2_panic(device);
+            sent = true;
+        }
+    }
+
+    return total;
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[Async] Real-time events don't drop the rendered output")
+{
+    const std::vector<uint8_t> song = buildChordSong(2, 24);
+    OPN2_MIDIPlayer *serial = makePlayer(song);
+    const size_t expected = songLength(serial);
+    REQUIRE(expected > 44100 * 2 * 2);
+
+    OPN2_MIDIPlayer *async = makePlayer(song);
+    REQUIRE(opn2_startAsync(async, 8192) == 0);
+    // Every rendered sample is played, nothing gets skipped by events
+    REQUIRE(readSong(async, true) == expected);
+    opn2_stopAsync(async);
+
+    opn2_close(async);
+    opn2_close(serial);
+}
+
+TEST_CASE("[Async] Whole song is read from the render-ahead buffer")
+{
+    const std::vector<uint8_t> song = buildChordSong(2, 24);
+    OPN2_MIDIPlayer *serial = makePlayer(song);
+    const size_t expected = songLength(serial);
+
+    OPN2_MIDIPlayer *async = makePlayer(song);
+    REQUIRE(opn2_startAsync(async, 4096) == 0);
+    REQUIRE(readSong(async, false) == expected);
+    opn2_stopAsync(async);
+
+    opn2_close(async);
+    opn2_close(serial);
+}
@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "test_song.hpp"
+
+static const char *s_imagePath = "bank_image_test.bin";
+
+static std::vector<uint8_t> readFile(const char *path)
+{
+    std::vector<uint8_t> data;
+    std::FILE *file = std::fopen(path, "rb");
+    REQUIRE(file != NULL);
+    uint8_t buffer[4096];
+    size_t got;
+    while((got = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + got);
+    std::fclose(file);
+    return data;
+}
+
+/**
+ * @brief Create the player without a bank
+ */
+static OPN2_MIDIPlayer *emptyPlayer()
+{
+    OPN2_MIDIPlayer *device = opn2_init(44100);
+    REQUIRE(device != NULL);
+    REQUIRE(opn2_switchEmulator(device, OPNMIDI_EMU_MAME) == 0);
+    REQUIRE(opn2_setNumChips(device, 2) == 0);
+    return device;
+}
+
+/**
+ * @brief Render the whole song by blocks of 4096 samples
+ */
+static std::vector<short> renderSong(OPN2_MIDIPlayer *device, const std::vector<uint8_t> &song)
+{
+    openSong(device, song);
+    std::vector<short> out;
+    std::vector<short> buffer(4096);
+    for(;;)
+    {
+        int count = opn2_play(device, static_cast<int>(buffer.size()), &buffer[0]);
+        REQUIRE(count >= 0);
+        if(count == 0)
+            break;
+        out.insert(out.end(), buffer.begin(), buffer.begin() + count);
+    }
+    return out;
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[BankImage] Saved bank image renders like the WOPN bank")
+{
+    const std::vector<uint8_t> song = buildChordSong(4, 12);
+    OPN2_MIDIPlayer *wopn = newPlayer(OPNMIDI_EMU_MAME, 2);
+    REQUIRE(opn2_saveBankImage(wopn, s_imagePath) == 0);
+    const std::vector<short> expected = renderSong(wopn, song);
+    REQUIRE(!expected.empty());
+
+    OPN2_MIDIPlayer *fromFile = emptyPlayer();
+    REQUIRE(opn2_openBankFile(fromFile, s_imagePath) == 0);
+    REQUIRE(renderSong(fromFile, song) == expected);
+
+    // The image is read in place from the memory, which may go away after the call
+    std::vector<uint8_t> image = readFile(s_imagePath);
+    OPN2_MIDIPlayer *fromData = emptyPlayer();
+    REQUIRE(opn2_openBankData(fromData, &image[0], static_cast<long>(image.size())) == 0);
+    std::vector<uint8_t>().swap(image);
+    REQUIRE(renderSong(fromData, song) == expected);
+
+    opn2_close(fromData);
+    opn2_close(fromFile);
+    opn2_close(wopn);
+    std::remove(s_imagePath);
+}
+
+TEST_CASE("[BankImage] Images of unknown versions are rejected")
+{
+    OPN2_MIDIPlayer *wopn = newPlayer(OPNMIDI_EMU_MAME, 2);
+    REQUIRE(opn2_saveBankImage(wopn, s_imagePath) == 0);
+    const std::vector<uint8_t> image = readFile(s_imagePath);
+    std::remove(s_imagePath);
+    REQUIRE(image.size() > 14);
+
+    // Versions are counted from 1, newer versions are unknown to this library
+    static const uint16_t versions[] = {0, 2, 0xFFFF};
+    for(size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); ++v)
+    {
+        INFO("Version " << versions[v]);
+        std::vector<uint8_t> broken = image;
+        broken[12] = static_cast<uint8_t>(versions[v] & 0xFF);
+        broken[13] = static_cast<uint8_t>(versions[v] >> 8);
+
+        OPN2_MIDIPlayer *device = emptyPlayer();
+        REQUIRE(opn2_openBankData(device, &broken[0], static_cast<long>(broken.size())) < 0);
+        REQUIRE(std::string(opn2_errorInfo(device)).find("Bank image") != std::string::npos);
+        opn2_close(device);
+    }
+
+    opn2_close(wopn);
+}
@@ -0,0 +1,220 @@
+/*
+ * Shared fixture of tests which play songs through the library:
+ * in-memory MIDI file builder and the setup of players
+ */
+
+#ifndef OPNMIDI_TEST_SONG_HPP
+#define OPNMIDI_TEST_SONG_HPP
+
+#include <catch.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <opnmidi.h>
+
+/***************************************************************
+ *                  In-memory MIDI file builder                *
+ ***************************************************************/
+
+class TrackWriter
+{
+public:
+    std::vector<uint8_t> data;
+
+    void delta(unsigned value)
+    {
+        uint8_t buf[5];
+        size_t n = 0;
+        buf[n++] = value & 0x7F;
+        while(value >>= 7)
+            buf[n++] = 0x80 | (value & 0x7F);
+        while(n > 0)
+            data.push_back(buf[--n]);
+    }
+
+    void event(unsigned dt, uint8_t status, uint8_t a, uint8_t b)
+    {
+        delta(dt);
+        data.push_back(status);
+        data.push_back(a);
+        if((status & 0xF0) != 0xC0 && (status & 0xF0) != 0xD0)
+            data.push_back(b);
+    }
+
+    void meta(unsigned dt, uint8_t type, const std::string &text)
+    {
+        delta(dt);
+        data.push_back(0xFF);
+        data.push_back(type);
+        data.push_back(static_cast<uint8_t>(text.size()));
+        data.insert(data.end(), text.begin(), text.end());
+    }
+
+    void marker(unsigned dt, const char *text)
+    {
+        meta(dt, 0x06, text);
+    }
+
+    void tempo(unsigned dt, uint32_t us)
+    {
+        delta(dt);
+        data.push_back(0xFF);
+        data.push_back(0x51);
+        data.push_back(0x03);
+        data.push_back((us >> 16) & 0xFF);
+        data.push_back((us >> 8) & 0xFF);
+        data.push_back(us & 0xFF);
+    }
+
+    void sysex(unsigned dt, const uint8_t *msg, size_t size)
+    {
+        delta(dt);
+        data.push_back(0xF0);
+        data.push_back(static_cast<uint8_t>(size));
+        data.insert(data.end(), msg, msg + size);
+    }
+
+    void end()
+    {
+        delta(0);
+        data.push_back(0xFF);
+        data.push_back(0x2F);
+        data.push_back(0x00);
+    }
+};
+
+static inline void putBE32(std::vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back((value >> 24) & 0xFF);
+    out.push_back((value >> 16) & 0xFF);
+    out.push_back((value >> 8) & 0xFF);
+    out.push_back(value & 0xFF);
+}
+
+/**
+ * @brief Build the format 1 MIDI file of given tracks
+ */
+static inline std::vector<uint8_t> buildMidiFile(const std::vector<TrackWriter> &tracks, unsigned division = 96)
+{
+    std::vector<uint8_t> file;
+    const char mthd[] = "MThd";
+    file.insert(file.end(), mthd, mthd + 4);
+    putBE32(file, 6);
+    file.push_back(0);
+    file.push_back(1);
+    file.push_back(static_cast<uint8_t>(tracks.size() >> 8));
+    file.push_back(static_cast<uint8_t>(tracks.size() & 0xFF));
+    file.push_back(static_cast<uint8_t>(division >> 8));
+    file.push_back(static_cast<uint8_t>(division & 0xFF));
+
+    for(size_t i = 0; i < tracks.size(); ++i)
+    {
+        const char mtrk[] = "MTrk";
+        file.insert(file.end(), mtrk, mtrk + 4);
+        putBE32(file, static_cast<uint32_t>(tracks[i].data.size()));
+        file.insert(file.end(), tracks[i].data.begin(), tracks[i].data.end());
+    }
+
+    return file;
+}
+
+/**
+ * @brief Write chords with pitch bends and vibrato
+ *
+ * Notes of chords overlap, so voices are sounding, envelopes are sustained and
+ * controllers are moving at any moment, and chip channels get passed between
+ * MIDI channels.
+ */
+static inline void writeChords(TrackWriter &t, uint8_t channel, unsigned chords)
+{
+    const unsigned seed = channel + 1u;
+    t.event(0, 0xC0 | channel, static_cast<uint8_t>(seed * 21 % 128), 0);
+    t.event(0, 0xB0 | channel, 1, static_cast<uint8_t>(seed * 30 % 128));
+    t.event(0, 0xB0 | channel, 10, static_cast<uint8_t>(seed * 40 % 128));
+    for(unsigned i = 0; i < chords; ++i)
+    {
+        const uint8_t note = static_cast<uint8_t>(40 + seed * 5 % 24 + (i * 7) % 19);
+        t.event(0, 0x90 | channel, note, static_cast<uint8_t>(70 + i % 50));
+        t.event(0, 0x90 | channel, note + 4, 90);
+        t.event(0, 0x90 | channel, note + 7, 80);
+        t.event(12 + seed, 0xE0 | channel, 0, static_cast<uint8_t>(0x30 + i % 32));
+        t.event(20, 0x80 | channel, note, 0);
+        t.event(8, 0x80 | channel, note + 4, 0);
+        t.event(8, 0x80 | channel, note + 7, 0);
+    }
+    t.end();
+}
+
+/**
+ * @brief Build the song of chords, one MIDI channel per track
+ * @param tracks Count of tracks of chords, the drum channel is skipped
+ * @param chords Count of chords on every track
+ * @param conductor Put the tempo changes and the loop onto the first track
+ */
+static inline std::vector<uint8_t> buildChordSong(unsigned tracks, unsigned chords, bool conductor = false)
+{
+    std::vector<TrackWriter> song;
+
+    if(conductor)
+    {
+        TrackWriter t;
+        t.tempo(0, 500000);
+        t.tempo(384, 400000);
+        t.marker(0, "loopStart");
+        t.tempo(384, 600000);
+        t.marker(384, "loopEnd");
+        t.end();
+        song.push_back(t);
+    }
+
+    for(unsigned tk = 0; tk < tracks; ++tk)
+    {
+        TrackWriter t;
+        writeChords(t, static_cast<uint8_t>(tk < 9 ? tk : tk + 1), chords);
+        song.push_back(t);
+    }
+
+    return buildMidiFile(song);
+}
+
+
+/***************************************************************
+ *                        Player setup                         *
+ ***************************************************************/
+
+/**
+ * @brief Create the player of given emulator and count of chips with the default bank
+ */
+static inline OPN2_MIDIPlayer *newPlayer(int emulator, int chips, long sampleRate = 44100)
+{
+    OPN2_MIDIPlayer *device = opn2_init(sampleRate);
+    REQUIRE(device != NULL);
+    REQUIRE(opn2_switchEmulator(device, emulator) == 0);
+    REQUIRE(opn2_setNumChips(device, chips) == 0);
+    REQUIRE(opn2_openBankFile(device, DEFAULT_BANK_PATH) == 0);
+    return device;
+}
+
+static inline void openSong(OPN2_MIDIPlayer *device, const std::vector<uint8_t> &song)
+{
+    REQUIRE(opn2_openData(device, &song[0], static_cast<unsigned long>(song.size())) == 0);
+}
+
+/**
+ * @brief Play given count of samples by blocks of 1024 samples
+ */
+static inline std::vector<short> render(OPN2_MIDIPlayer *device, size_t samples)
+{
+    std::vector<short> out(samples);
+    size_t done = 0;
+    while(done < samples)
+    {
+        int count = opn2_play(device, static_cast<int>(samples - done > 1024 ? 1024 : samples - done), &out[done]);
+        REQUIRE(count > 0);
+        done += static_cast<size_t>(count);
+    }
+    return out;
+}
+
+#endif // OPNMIDI_TEST_SONG_HPP
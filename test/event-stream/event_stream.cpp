@@ -0,0 +1,538 @@
+#include <catch.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "midi_sequencer_impl.hpp"
+
+/*
+ * The event stream flattened at the load must schedule every file exactly
+ * like the track-by-track scheduler it replaces: the same events are handled
+ * between the same waits. The reference scheduler below is that former
+ * algorithm, working on the rows of a song which is built in memory.
+ */
+
+// Clock rate and division which give an integer count of frames per tick
+static const uint32_t s_rate = 48000;
+static const unsigned s_division = 96;
+static const uint64_t s_framesPerTick = 250;
+
+
+/***************************************************************
+ *                       Song description                      *
+ ***************************************************************/
+
+enum EventKind
+{
+    EV_NOTEOFF = 0,
+    EV_NOTEON,
+    EV_LOOPSTART,
+    EV_LOOPEND,
+    EV_ENDTRACK
+};
+
+struct SongEvent
+{
+    unsigned tick;
+    EventKind kind;
+    uint8_t channel;
+    uint8_t note;
+};
+
+enum TrackEnd
+{
+    //! The track is finished by the End of Track event
+    END_EOT = 0,
+    //! The data ends right after the last event
+    END_CUT,
+    //! The data ends by the delta time without an event
+    END_DANGLING
+};
+
+struct SongTrack
+{
+    std::vector<SongEvent> events;
+    TrackEnd end;
+    //! Time of End of Track event or of the dangling delta
+    unsigned endTick;
+};
+
+static bool eventLess(const SongEvent &a, const SongEvent &b)
+{
+    return a.tick < b.tick;
+}
+
+static void putDelta(std::vector<uint8_t> &data, unsigned value)
+{
+    uint8_t buf[5];
+    size_t n = 0;
+    buf[n++] = value & 0x7F;
+    while(value >>= 7)
+        buf[n++] = 0x80 | (value & 0x7F);
+    while(n > 0)
+        data.push_back(buf[--n]);
+}
+
+static void putBE32(std::vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back((value >> 24) & 0xFF);
+    out.push_back((value >> 16) & 0xFF);
+    out.push_back((value >> 8) & 0xFF);
+    out.push_back(value & 0xFF);
+}
+
+static std::vector<uint8_t> buildFile(const std::vector<SongTrack> &tracks)
+{
+    std::vector<uint8_t> file;
+    const char mthd[] = "MThd";
+    file.insert(file.end(), mthd, mthd + 4);
+    putBE32(file, 6);
+    file.push_back(0);
+    file.push_back(1);
+    file.push_back(0);
+    file.push_back(static_cast<uint8_t>(tracks.size()));
+    file.push_back(0);
+    file.push_back(s_division);
+
+    for(size_t tk = 0; tk < tracks.size(); ++tk)
+    {
+        const SongTrack &t = tracks[tk];
+        std::vector<uint8_t> data;
+        unsigned time = 0;
+
+        for(size_t i = 0; i < t.events.size(); ++i)
+        {
+            const SongEvent &e = t.events[i];
+            putDelta(data, e.tick - time);
+            time = e.tick;
+            switch(e.kind)
+            {
+            case EV_NOTEON:
+            case EV_NOTEOFF:
+                data.push_back((e.kind == EV_NOTEON ? 0x90 : 0x80) | e.channel);
+                data.push_back(e.note);
+                data.push_back(e.kind == EV_NOTEON ? 100 : 0);
+                break;
+            default:
+            {
+                const std::string text = (e.kind == EV_LOOPSTART) ? "loopStart" : "loopEnd";
+                data.push_back(0xFF);
+                data.push_back(0x06);
+                data.push_back(static_cast<uint8_t>(text.size()));
+                data.insert(data.end(), text.begin(), text.end());
+                break;
+            }
+            }
+        }
+
+        if(t.end != END_CUT)
+            putDelta(data, t.endTick - time);
+        if(t.end == END_EOT)
+        {
+            data.push_back(0xFF);
+            data.push_back(0x2F);
+            data.push_back(0x00);
+        }
+
+        const char mtrk[] = "MTrk";
+        file.insert(file.end(), mtrk, mtrk + 4);
+        putBE32(file, static_cast<uint32_t>(data.size()));
+        file.insert(file.end(), data.begin(), data.end());
+    }
+
+    return file;
+}
+
+
+/***************************************************************
+ *                    Reference scheduler                      *
+ ***************************************************************/
+
+struct RefRow
+{
+    std::vector<SongEvent> events;
+    uint64_t delay;
+};
+
+struct RefTrack
+{
+    int64_t delay;
+    size_t pos;
+    bool ended;
+};
+
+/*
+ * Split the track into rows like the parser does: the first row holds the
+ * delta before the first event, and every next one holds the events of the
+ * same time. A cut track has no End of Track event, its last row keeps the
+ * delay of 2 ticks returned by the failed read of the variable-length value.
+ */
+static std::vector<RefRow> trackRows(const SongTrack &t)
+{
+    std::vector<SongEvent> events = t.events;
+    if(t.end != END_CUT)
+    {
+        SongEvent eot = {t.endTick, EV_ENDTRACK, 0, 0};
+        events.push_back(eot);
+    }
+
+    std::vector<RefRow> rows;
+    RefRow first;
+    first.delay = events.empty() ? 0 : events[0].tick;
+    rows.push_back(first);
+
+    for(size_t i = 0; i < events.size(); ++i)
+    {
+        if(i == 0 || events[i].tick != events[i - 1].tick)
+        {
+            RefRow row;
+            row.delay = 0;
+            rows.push_back(row);
+        }
+        rows.back().events.push_back(events[i]);
+        if(i + 1 < events.size() && events[i + 1].tick != events[i].tick)
+            rows.back().delay = events[i + 1].tick - events[i].tick;
+    }
+
+    if(t.end == END_CUT)
+        rows.back().delay = 2;
+
+#ifdef ENABLE_END_SILENCE_SKIPPING
+    // The last event alone on its row clears the delay of the row before
+    if(rows.back().events.size() == 1)
+        rows[rows.size() - 2].delay = 0;
+#endif
+
+    for(size_t i = 0; i < rows.size(); ++i)
+    {
+        // Note-offs go first, then loop markers, then all other events
+        std::vector<SongEvent> &e = rows[i].events;
+        std::vector<SongEvent> sorted;
+        for(size_t j = 0; j < e.size(); ++j)
+            if(e[j].kind == EV_NOTEOFF)
+                sorted.push_back(e[j]);
+        for(size_t j = 0; j < e.size(); ++j)
+            if(e[j].kind == EV_LOOPSTART || e[j].kind == EV_LOOPEND)
+                sorted.push_back(e[j]);
+        for(size_t j = 0; j < e.size(); ++j)
+            if(e[j].kind == EV_NOTEON || e[j].kind == EV_ENDTRACK)
+                sorted.push_back(e[j]);
+        e.swap(sorted);
+    }
+
+    return rows;
+}
+
+static std::string eventText(const SongEvent &e)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%s %u %u", e.kind == EV_NOTEON ? "on" : "off", e.channel, e.note);
+    return buf;
+}
+
+/*
+ * Schedule of the song: the events handled between two waits are sorted,
+ * as the order inside of the same row is not a matter of the schedule.
+ */
+typedef std::vector<std::string> Schedule;
+
+static void flushBlock(Schedule &out, std::vector<std::string> &block, const std::string &wait)
+{
+    std::sort(block.begin(), block.end());
+    out.insert(out.end(), block.begin(), block.end());
+    block.clear();
+    out.push_back(wait);
+}
+
+static std::string waitText(uint64_t frames)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "wait %lu", static_cast<unsigned long>(frames));
+    return buf;
+}
+
+static Schedule referenceSchedule(const std::vector<SongTrack> &song, bool loop, size_t maxWaits)
+{
+    std::vector<std::vector<RefRow> > rows;
+    for(size_t tk = 0; tk < song.size(); ++tk)
+        rows.push_back(trackRows(song[tk]));
+
+    RefTrack init = {0, 0, false};
+    std::vector<RefTrack> state(song.size(), init);
+    std::vector<RefTrack> loopBegin = state;
+
+    Schedule out;
+    std::vector<std::string> block;
+    size_t waits = 0;
+
+    while(waits < maxWaits)
+    {
+        const std::vector<RefTrack> stepBegin = state;
+        bool caughtStart = false, caughtEnd = false;
+
+        for(size_t tk = 0; tk < song.size(); ++tk)
+        {
+            RefTrack &t = state[tk];
+            if(t.ended || t.delay > 0)
+                continue;
+
+            if(t.pos == rows[tk].size())
+            {
+                t.ended = true;
+                break;
+            }
+
+            const RefRow &row = rows[tk][t.pos];
+            for(size_t i = 0; i < row.events.size(); ++i)
+            {
+                const SongEvent &e = row.events[i];
+                // Loop markers are ignored while the loop is disabled
+                if(e.kind == EV_LOOPSTART)
+                    caughtStart = loop;
+                else if(e.kind == EV_LOOPEND)
+                {
+                    caughtEnd = loop;
+                    if(loop)
+                        break;
+                }
+                else if(e.kind == EV_ENDTRACK)
+                    t.ended = true;
+                else
+                    block.push_back(eventText(e));
+            }
+
+            if(!t.ended)
+            {
+                t.delay += static_cast<int64_t>(row.delay);
+                t.pos++;
+            }
+
+            if(caughtEnd)
+                break;
+        }
+
+        bool found = false;
+        int64_t shortest = 0;
+        for(size_t tk = 0; tk < song.size(); ++tk)
+        {
+            if(!state[tk].ended && (!found || state[tk].delay < shortest))
+            {
+                shortest = state[tk].delay;
+                found = true;
+            }
+        }
+        for(size_t tk = 0; tk < song.size(); ++tk)
+            state[tk].delay -= shortest;
+
+        if(caughtStart)
+            loopBegin = stepBegin;
+
+        if(!found || caughtEnd)
+        {
+            if(!loop)
+                break;
+            state = loopBegin;
+            continue;
+        }
+
+        if(shortest > 0)
+        {
+            flushBlock(out, block, waitText(static_cast<uint64_t>(shortest) * s_framesPerTick));
+            waits++;
+        }
+    }
+
+    std::sort(block.begin(), block.end());
+    out.insert(out.end(), block.begin(), block.end());
+    return out;
+}
+
+
+/***************************************************************
+ *                   Playback by the sequencer                 *
+ ***************************************************************/
+
+static std::vector<std::string> *g_block = NULL;
+
+static void rtNoteOn(void *, uint8_t channel, uint8_t note, uint8_t)
+{
+    SongEvent e = {0, EV_NOTEON, channel, note};
+    g_block->push_back(eventText(e));
+}
+
+static void rtNoteOff(void *, uint8_t channel, uint8_t note)
+{
+    SongEvent e = {0, EV_NOTEOFF, channel, note};
+    g_block->push_back(eventText(e));
+}
+
+static void rtNoteAfterTouch(void *, uint8_t, uint8_t, uint8_t) {}
+static void rtChannelAfterTouch(void *, uint8_t, uint8_t) {}
+static void rtControllerChange(void *, uint8_t, uint8_t, uint8_t) {}
+static void rtPatchChange(void *, uint8_t, uint8_t) {}
+static void rtPitchBend(void *, uint8_t, uint8_t, uint8_t) {}
+static void rtSysEx(void *, const uint8_t *, size_t) {}
+static void rtMetaEvent(void *, uint8_t, const uint8_t *, size_t) {}
+static void rtDeviceSwitch(void *, size_t, const char *, size_t) {}
+static size_t rtCurrentDevice(void *, size_t) { return 0; }
+
+static Schedule sequencerSchedule(const std::vector<uint8_t> &file, bool loop, size_t maxWaits)
+{
+    BW_MidiRtInterface iface;
+    std::memset(&iface, 0, sizeof(iface));
+    iface.rt_noteOn = rtNoteOn;
+    iface.rt_noteOff = rtNoteOff;
+    iface.rt_noteAfterTouch = rtNoteAfterTouch;
+    iface.rt_channelAfterTouch = rtChannelAfterTouch;
+    iface.rt_controllerChange = rtControllerChange;
+    iface.rt_patchChange = rtPatchChange;
+    iface.rt_pitchBend = rtPitchBend;
+    iface.rt_systemExclusive = rtSysEx;
+    iface.rt_metaEvent = rtMetaEvent;
+    iface.rt_deviceSwitch = rtDeviceSwitch;
+    iface.rt_currentDevice = rtCurrentDevice;
+
+    BW_MidiSequencer seq;
+    seq.setInterface(&iface);
+    seq.setLoopEnabled(loop);
+    seq.setClockRate(s_rate);
+    REQUIRE(seq.loadMIDI(&file[0], file.size()));
+
+    Schedule out;
+    std::vector<std::string> block;
+    g_block = &block;
+
+    uint64_t frames = 0;
+    for(size_t waits = 0; waits < maxWaits; ++waits)
+    {
+        frames = seq.tickFrames(frames);
+        if(seq.positionAtEnd())
+            break;
+        flushBlock(out, block, waitText(frames));
+    }
+
+    std::sort(block.begin(), block.end());
+    out.insert(out.end(), block.begin(), block.end());
+    g_block = NULL;
+    return out;
+}
+
+
+/***************************************************************
+ *                        Random songs                         *
+ ***************************************************************/
+
+class Random
+{
+    uint32_t m_state;
+public:
+    explicit Random(uint32_t seed) : m_state(seed * 2654435761u + 1) {}
+    unsigned next(unsigned range)
+    {
+        m_state = m_state * 1664525u + 1013904223u;
+        return (m_state >> 8) % range;
+    }
+};
+
+static std::vector<SongTrack> randomSong(uint32_t seed, bool loopPoints)
+{
+    Random rnd(seed);
+    std::vector<SongTrack> song(1 + rnd.next(4));
+
+    for(size_t tk = 0; tk < song.size(); ++tk)
+    {
+        // The first track always lasts to its last note, so the song is never empty
+        SongTrack &t = song[tk];
+        t.end = (tk == 0) ? END_EOT : static_cast<TrackEnd>(rnd.next(3));
+        unsigned notes = rnd.next(12) + ((tk == 0 || t.end == END_CUT) ? 1 : 0);
+        unsigned time = 0;
+
+        for(unsigned i = 0; i < notes; ++i)
+        {
+            uint8_t note = static_cast<uint8_t>(40 + rnd.next(40));
+            time += rnd.next(3) ? rnd.next(200) : 0;
+            SongEvent on = {time, EV_NOTEON, static_cast<uint8_t>(tk), note};
+            t.events.push_back(on);
+            time += 1 + rnd.next(150);
+            SongEvent off = {time, EV_NOTEOFF, static_cast<uint8_t>(tk), note};
+            t.events.push_back(off);
+        }
+
+        t.endTick = time;
+        if(t.end == END_EOT && tk > 0)
+            t.endTick += rnd.next(2) ? 0 : rnd.next(300);
+        else if(t.end == END_DANGLING)
+            t.endTick += 1 + rnd.next(300);
+    }
+
+    SongTrack &first = song[0];
+    const unsigned length = first.events.empty() ? 0 : first.events.back().tick;
+    if(loopPoints && length > 4)
+    {
+        unsigned begin = rnd.next(length / 2);
+        unsigned end = begin + 1 + rnd.next(length - begin - 1);
+        SongEvent loopStart = {begin, EV_LOOPSTART, 0, 0};
+        SongEvent loopEnd = {end, EV_LOOPEND, 0, 0};
+        first.events.push_back(loopStart);
+        first.events.push_back(loopEnd);
+        std::stable_sort(first.events.begin(), first.events.end(), eventLess);
+    }
+
+    return song;
+}
+
+static void checkSong(const std::vector<SongTrack> &song, bool loop)
+{
+    const std::vector<uint8_t> file = buildFile(song);
+    const Schedule expected = referenceSchedule(song, loop, 300);
+    const Schedule actual = sequencerSchedule(file, loop, 300);
+    REQUIRE(actual == expected);
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[EventStream] Ended truncated track keeps its own step")
+{
+    // The cut track ends before the others: its last step has nothing to handle
+    std::vector<SongTrack> song(3);
+    SongEvent a[] = {{0, EV_NOTEON, 0, 60}, {48, EV_NOTEOFF, 0, 60}};
+    SongEvent b[] = {{0, EV_NOTEON, 1, 64}, {20, EV_NOTEOFF, 1, 64}};
+    SongEvent c[] = {{10, EV_NOTEON, 2, 67}, {96, EV_NOTEOFF, 2, 67}};
+    song[0].events.assign(a, a + 2);
+    song[0].end = END_EOT;
+    song[0].endTick = 120;
+    song[1].events.assign(b, b + 2);
+    song[1].end = END_CUT;
+    song[1].endTick = 20;
+    song[2].events.assign(c, c + 2);
+    song[2].end = END_DANGLING;
+    song[2].endTick = 130;
+
+    checkSong(song, false);
+    checkSong(song, true);
+}
+
+TEST_CASE("[EventStream] Truncated and multi-track songs are scheduled as before")
+{
+    for(uint32_t seed = 1; seed <= 300; ++seed)
+    {
+        INFO("Seed " << seed);
+        const std::vector<SongTrack> song = randomSong(seed, false);
+        checkSong(song, false);
+    }
+}
+
+TEST_CASE("[EventStream] Looped songs are scheduled as before")
+{
+    for(uint32_t seed = 1; seed <= 300; ++seed)
+    {
+        INFO("Seed " << seed);
+        const std::vector<SongTrack> song = randomSong(seed, (seed % 3) != 0);
+        checkSong(song, true);
+        checkSong(song, false);
+    }
+}
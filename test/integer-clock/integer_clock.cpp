@@ -0,0 +1,218 @@
+#include <cstdlib>
+#include <vector>
+
+#include "test_song.hpp"
+#include "midi_sequencer_impl.hpp"
+
+/*
+ * The integer clock must handle every event at the output frame where the
+ * floating-point clock of the player handles it, and must count the tempo
+ * from the begin again after the rewind or the seek. Both clocks are driven
+ * here like the player drives them while it renders long buffers.
+ */
+
+static const uint32_t s_rate = 44100;
+
+/*
+ * Chords under the tempo changes which don't give an integer count of frames
+ * per tick. The last tempo is the first one again, so the segment of the same
+ * tempo counted before the rewind would continue after it.
+ */
+static std::vector<uint8_t> buildSong()
+{
+    std::vector<TrackWriter> song;
+
+    TrackWriter conductor;
+    conductor.tempo(0, 500000);
+    conductor.tempo(100, 433333);
+    conductor.tempo(150, 612345);
+    conductor.tempo(170, 500000);
+    conductor.end();
+    song.push_back(conductor);
+
+    for(uint8_t channel = 0; channel < 3; ++channel)
+    {
+        TrackWriter t;
+        writeChords(t, channel, 10);
+        song.push_back(t);
+    }
+
+    return buildMidiFile(song);
+}
+
+
+/***************************************************************
+ *                     Playback by both clocks                 *
+ ***************************************************************/
+
+struct HandledEvent
+{
+    uint64_t frame;
+    int type;
+    int subtype;
+    int channel;
+
+    bool operator==(const HandledEvent &o) const
+    {
+        return frame == o.frame && type == o.type && subtype == o.subtype && channel == o.channel;
+    }
+};
+
+struct EventLog
+{
+    uint64_t frame;
+    std::vector<HandledEvent> events;
+};
+
+static void logEvent(void *userdata, uint8_t type, uint8_t subtype, uint8_t channel, const uint8_t *, size_t)
+{
+    EventLog *log = static_cast<EventLog *>(userdata);
+    HandledEvent e = {log->frame, type, subtype, channel};
+    log->events.push_back(e);
+}
+
+static void rtNoteOn(void *, uint8_t, uint8_t, uint8_t) {}
+static void rtNoteOff(void *, uint8_t, uint8_t) {}
+static void rtNoteAfterTouch(void *, uint8_t, uint8_t, uint8_t) {}
+static void rtChannelAfterTouch(void *, uint8_t, uint8_t) {}
+static void rtControllerChange(void *, uint8_t, uint8_t, uint8_t) {}
+static void rtPatchChange(void *, uint8_t, uint8_t) {}
+static void rtPitchBend(void *, uint8_t, uint8_t, uint8_t) {}
+static void rtSysEx(void *, const uint8_t *, size_t) {}
+
+class Player
+{
+    BW_MidiRtInterface m_iface;
+public:
+    BW_MidiSequencer seq;
+    EventLog log;
+
+    Player(const std::vector<uint8_t> &song, bool integerClock)
+    {
+        std::memset(&m_iface, 0, sizeof(m_iface));
+        m_iface.onEvent = logEvent;
+        m_iface.onEvent_userData = &log;
+        m_iface.rt_noteOn = rtNoteOn;
+        m_iface.rt_noteOff = rtNoteOff;
+        m_iface.rt_noteAfterTouch = rtNoteAfterTouch;
+        m_iface.rt_channelAfterTouch = rtChannelAfterTouch;
+        m_iface.rt_controllerChange = rtControllerChange;
+        m_iface.rt_patchChange = rtPatchChange;
+        m_iface.rt_pitchBend = rtPitchBend;
+        m_iface.rt_systemExclusive = rtSysEx;
+
+        seq.setInterface(&m_iface);
+        seq.setLoopEnabled(false);
+        seq.setClockRate(integerClock ? s_rate : 0);
+        REQUIRE(seq.loadMIDI(&song[0], song.size()));
+    }
+
+    /**
+     * @brief Play the rest of the song by the floating-point clock
+     * @param delay Delay until the next event, as given by the seek
+     */
+    std::vector<HandledEvent> playSeconds(double delay = 0.0)
+    {
+        const double mindelay = 1.0 / s_rate, maxdelay = 512.0 / s_rate;
+        double carry = 0.0;
+        log.frame = 0;
+        log.events.clear();
+        while(!seq.positionAtEnd() || delay > 0.0)
+        {
+            const double eat = delay < maxdelay ? delay : maxdelay;
+            carry += s_rate * eat;
+            const uint64_t frames = static_cast<uint64_t>(carry);
+            carry -= static_cast<double>(frames);
+            log.frame += frames;
+            delay = seq.Tick(eat, mindelay);
+        }
+        return log.events;
+    }
+
+    /**
+     * @brief Play the rest of the song by the integer clock
+     */
+    std::vector<HandledEvent> playFrames()
+    {
+        uint64_t frames = seq.clockWaitFrames();
+        log.frame = 0;
+        log.events.clear();
+        while(!seq.positionAtEnd() || frames > 0)
+        {
+            log.frame += frames;
+            frames = seq.tickFrames(frames);
+        }
+        return log.events;
+    }
+};
+
+/**
+ * @brief Check the same events got handled, each within one frame of the expected one
+ */
+static void requireSameTiming(const std::vector<HandledEvent> &actual, const std::vector<HandledEvent> &expected)
+{
+    REQUIRE(actual.size() == expected.size());
+    for(size_t i = 0; i < actual.size(); ++i)
+    {
+        INFO("Event " << i);
+        REQUIRE(actual[i].type == expected[i].type);
+        REQUIRE(actual[i].subtype == expected[i].subtype);
+        REQUIRE(actual[i].channel == expected[i].channel);
+        REQUIRE(std::labs(static_cast<long>(actual[i].frame) - static_cast<long>(expected[i].frame)) <= 1);
+    }
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[IntegerClock] Events are handled at the frames of the floating-point clock")
+{
+    const std::vector<uint8_t> song = buildSong();
+    Player floating(song, false);
+    Player integer(song, true);
+
+    const std::vector<HandledEvent> expected = floating.playSeconds();
+    REQUIRE(expected.size() > 200);
+    REQUIRE(expected.back().frame > s_rate * 2);
+    requireSameTiming(integer.playFrames(), expected);
+}
+
+TEST_CASE("[IntegerClock] Rewind and seek start counting of the tempo again")
+{
+    const std::vector<uint8_t> song = buildSong();
+    Player floating(song, false);
+    Player integer(song, true);
+
+    // The second pass after the rewind repeats the first one exactly
+    const std::vector<HandledEvent> first = integer.playFrames();
+    integer.seq.rewind();
+    REQUIRE(integer.playFrames() == first);
+
+    // After the first step of the rewound song, the clock is where it was on the first pass
+    Player fresh(song, true);
+    std::vector<uint8_t> begin, rewound;
+    fresh.seq.tickFrames(0);
+    fresh.seq.saveState(begin);
+    integer.seq.rewind();
+    integer.seq.tickFrames(0);
+    integer.seq.saveState(rewound);
+    REQUIRE(rewound == begin);
+
+    // Events after the seek come at the frames of the whole song played by the floating-point clock
+    const uint64_t seekFrame = 57330;
+    const std::vector<HandledEvent> whole = floating.playSeconds();
+    std::vector<HandledEvent> expected;
+    for(size_t i = 0; i < whole.size(); ++i)
+    {
+        if(whole[i].frame <= seekFrame)
+            continue;
+        expected.push_back(whole[i]);
+        expected.back().frame -= seekFrame;
+    }
+    REQUIRE(!expected.empty());
+
+    integer.seq.seek(static_cast<double>(seekFrame) / s_rate, 1.0 / s_rate);
+    requireSameTiming(integer.playFrames(), expected);
+}
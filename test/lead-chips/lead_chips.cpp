@@ -0,0 +1,201 @@
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "test_song.hpp"
+
+/*
+ * The held chord of six notes on one channel, and optionally the melody of
+ * single notes on another channel which starts after the chord
+ */
+static std::vector<uint8_t> buildSong(bool melody)
+{
+    std::vector<TrackWriter> tracks(1);
+    TrackWriter &chord = tracks[0];
+    static const uint8_t notes[] = {48, 52, 55, 60, 64, 67};
+    chord.event(0, 0xC1, 48, 0);
+    for(size_t i = 0; i < sizeof(notes); ++i)
+        chord.event(0, 0x91, notes[i], 90);
+    for(size_t i = 0; i < sizeof(notes); ++i)
+        chord.event(i == 0 ? 960 : 0, 0x81, notes[i], 0);
+    chord.end();
+
+    if(melody)
+    {
+        TrackWriter t;
+        t.event(0, 0xC0, 73, 0);
+        for(unsigned i = 0; i < 8; ++i)
+        {
+            const uint8_t note = static_cast<uint8_t>(72 + (i * 5) % 12);
+            t.event(i == 0 ? 96 : 0, 0x90, note, 100);
+            t.event(48, 0x80, note, 0);
+        }
+        t.end();
+        tracks.push_back(t);
+    }
+
+    return buildMidiFile(tracks);
+}
+
+static OPN2_MIDIPlayer *makePlayer(int chips, int leadChips, int stemMode = OPNMIDI_StemMode_Off)
+{
+    OPN2_MIDIPlayer *device = newPlayer(OPNMIDI_EMU_MAME, chips);
+    REQUIRE(opn2_setLeadChipsEmulator(device, OPNMIDI_EMU_NUKED, leadChips) == 0);
+    REQUIRE(opn2_setStemMode(device, stemMode) == 0);
+    return device;
+}
+
+/**
+ * @brief Render the whole song into separate stems
+ */
+static std::vector<std::vector<short> > renderStems(OPN2_MIDIPlayer *device)
+{
+    OPNMIDI_AudioFormat format;
+    format.type = OPNMIDI_SampleType_S16;
+    format.containerSize = sizeof(int16_t);
+    format.sampleOffset = 2 * sizeof(int16_t);
+
+    const size_t chunk = 2048;
+    const size_t stemCount = static_cast<size_t>(opn2_getStemCount(device));
+    std::vector<std::vector<short> > buffers(stemCount, std::vector<short>(chunk));
+    std::vector<std::vector<short> > stems(stemCount);
+    std::vector<OPN2_UInt8 *> left(stemCount), right(stemCount);
+    for(size_t i = 0; i < stemCount; ++i)
+    {
+        left[i] = reinterpret_cast<OPN2_UInt8 *>(&buffers[i][0]);
+        right[i] = reinterpret_cast<OPN2_UInt8 *>(&buffers[i][1]);
+    }
+
+    for(;;)
+    {
+        int count = opn2_playStems(device, static_cast<int>(chunk), &left[0], &right[0], &format);
+        REQUIRE(count >= 0);
+        if(count == 0)
+            break;
+        for(size_t i = 0; i < stemCount; ++i)
+            stems[i].insert(stems[i].end(), buffers[i].begin(), buffers[i].begin() + count);
+    }
+
+    return stems;
+}
+
+static std::vector<uint8_t> saveState(OPN2_MIDIPlayer *device)
+{
+    long size = opn2_saveState(device, NULL, 0);
+    REQUIRE(size > 0);
+    std::vector<uint8_t> state(static_cast<size_t>(size));
+    REQUIRE(opn2_saveState(device, &state[0], static_cast<unsigned long>(state.size())) == size);
+    return state;
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[LeadChips] Exposed notes are played by lead chips")
+{
+    const std::vector<uint8_t> chord = buildSong(false), withMelody = buildSong(true);
+
+    // Stems of chips differ only where the melody has been played
+    OPN2_MIDIPlayer *alone = makePlayer(3, 1, OPNMIDI_StemMode_Chip);
+    OPN2_MIDIPlayer *both = makePlayer(3, 1, OPNMIDI_StemMode_Chip);
+    openSong(alone, chord);
+    openSong(both, withMelody);
+    const std::vector<std::vector<short> > chordStems = renderStems(alone);
+    const std::vector<std::vector<short> > melodyStems = renderStems(both);
+    REQUIRE(chordStems.size() == 3);
+    REQUIRE(melodyStems.size() == 3);
+
+    // Notes of the dense chord past the first two left the lead chip for the melody
+    REQUIRE(melodyStems[0] != chordStems[0]);
+    REQUIRE(melodyStems[1] == chordStems[1]);
+    REQUIRE(melodyStems[2] == chordStems[2]);
+
+    opn2_close(both);
+    opn2_close(alone);
+}
+
+/*
+ * The note hook, called on every update of voices, takes longer than the played
+ * time, so the governor switches to the cheaper emulator in the middle of playback
+ */
+static void slowNoteHook(void *, int, int, int, int, double)
+{
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+    while(std::chrono::steady_clock::now() < end)
+        {}
+}
+
+struct Switches
+{
+    OPN2_MIDIPlayer *device;
+    int count;
+    std::string leadEmulator;
+};
+
+static void countSwitch(void *userdata, int, int toEmulator, double)
+{
+    Switches *s = static_cast<Switches *>(userdata);
+    ++s->count;
+    REQUIRE(toEmulator != OPNMIDI_EMU_NUKED);
+    // The first chip is the lead one
+    s->leadEmulator = opn2_chipEmulatorName(s->device);
+}
+
+TEST_CASE("[LeadChips] The quality governor keeps the emulator of lead chips")
+{
+    OPN2_MIDIPlayer *device = newPlayer(OPNMIDI_EMU_NUKED, 3);
+    REQUIRE(opn2_setLeadChipsEmulator(device, OPNMIDI_EMU_NUKED, 1) == 0);
+    const std::string leadEmulator = opn2_chipEmulatorName(device);
+    const std::vector<uint8_t> song = buildChordSong(1, 40);
+    opn2_setLoopEnabled(device, 1);
+    openSong(device, song);
+    REQUIRE(opn2_setQualityGovernor(device, 1) == 0);
+
+    Switches switches = {device, 0, std::string()};
+    opn2_setNoteHook(device, &slowNoteHook, NULL);
+    opn2_setEmulatorSwitchHook(device, &countSwitch, &switches);
+
+    std::vector<short> buffer(1024);
+    for(int i = 0; i < 1000 && switches.count == 0; ++i)
+        opn2_play(device, 1024, &buffer[0]);
+
+    REQUIRE(switches.count > 0);
+    REQUIRE(switches.leadEmulator == leadEmulator);
+    REQUIRE(opn2_chipEmulatorName(device) == leadEmulator);
+    opn2_close(device);
+}
+
+TEST_CASE("[LeadChips] Saved state keeps the setup of lead chips")
+{
+    const std::vector<uint8_t> song = buildChordSong(4, 24);
+    OPN2_MIDIPlayer *device = makePlayer(3, 2);
+    openSong(device, song);
+
+    render(device, 2 * 12345);
+    const std::vector<uint8_t> state = saveState(device);
+    // Format version follows the magic
+    REQUIRE(state[8] == 4);
+    const std::vector<short> expected = render(device, 2 * 30000);
+
+    // The state restores into another player of the same setup
+    OPN2_MIDIPlayer *same = makePlayer(3, 2);
+    openSong(same, song);
+    REQUIRE(opn2_loadState(same, &state[0], static_cast<unsigned long>(state.size())) == 0);
+    REQUIRE(render(same, 2 * 30000) == expected);
+
+    // Players of other setups of lead chips reject it
+    OPN2_MIDIPlayer *fewer = makePlayer(3, 1);
+    openSong(fewer, song);
+    REQUIRE(opn2_loadState(fewer, &state[0], static_cast<unsigned long>(state.size())) < 0);
+
+    OPN2_MIDIPlayer *plain = newPlayer(OPNMIDI_EMU_MAME, 3);
+    openSong(plain, song);
+    REQUIRE(opn2_loadState(plain, &state[0], static_cast<unsigned long>(state.size())) < 0);
+
+    opn2_close(plain);
+    opn2_close(fewer);
+    opn2_close(same);
+    opn2_close(device);
+}
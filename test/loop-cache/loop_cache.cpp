@@ -0,0 +1,122 @@
+#include <vector>
+
+#include "test_song.hpp"
+
+/*
+ * Loop of 4 quarters at 120 BPM (exactly 2 seconds) with notes on two
+ * channels. The second half is silent, so voices end before the loop repeats.
+ */
+static std::vector<uint8_t> buildSong()
+{
+    TrackWriter t;
+    t.marker(0, "loopStart");
+    t.event(0, 0xC0, 0, 0);
+    t.event(0, 0xC1, 33, 0);
+    t.event(0, 0x90, 60, 100);
+    t.event(0, 0x91, 36, 90);
+    t.event(24, 0x90, 64, 100);
+    t.event(24, 0x80, 60, 0);
+    t.event(0, 0x81, 36, 0);
+    t.event(24, 0x90, 67, 100);
+    t.event(24, 0x80, 64, 0);
+    t.event(24, 0x80, 67, 0);
+    t.marker(264, "loopEnd");
+    t.end();
+
+    return buildMidiFile(std::vector<TrackWriter>(1, t));
+}
+
+static void countNote(void *userdata, int, int, int, int, double)
+{
+    ++*static_cast<size_t *>(userdata);
+}
+
+static OPN2_MIDIPlayer *makePlayer(int emulator, const std::vector<uint8_t> &song, bool cache, size_t *notes)
+{
+    OPN2_MIDIPlayer *device = newPlayer(emulator, 1, 48000);
+    REQUIRE(opn2_setRunAtPcmRate(device, 1) == 0);
+    // The LFO counter runs all the time, the state would never repeat
+    opn2_setLfoEnabled(device, 0);
+    opn2_setIntegerClock(device, 1);
+    opn2_setLoopEnabled(device, 1);
+    openSong(device, song);
+    REQUIRE(opn2_setLoopCache(device, cache ? 4.0 : 0.0) == 0);
+    opn2_setNoteHook(device, countNote, notes);
+    return device;
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[LoopCache] Replayed loops match the rendered ones")
+{
+    static const int emulators[] = {OPNMIDI_EMU_GENS, OPNMIDI_EMU_MAME, OPNMIDI_EMU_NUKED};
+    const std::vector<uint8_t> song = buildSong();
+
+    for(size_t e = 0; e < sizeof(emulators) / sizeof(emulators[0]); ++e)
+    {
+        INFO("Emulator " << emulators[e]);
+        const bool replays = emulators[e] == OPNMIDI_EMU_GENS;
+        size_t cachedNotes = 0, liveNotes = 0;
+        OPN2_MIDIPlayer *cached = makePlayer(emulators[e], song, true, &cachedNotes);
+        OPN2_MIDIPlayer *live = makePlayer(emulators[e], song, false, &liveNotes);
+
+        // Eight repeats of the loop, every frame must be the same
+        for(size_t i = 0; i < 8; ++i)
+        {
+            INFO("Loop " << i);
+            REQUIRE(render(cached, 2 * 2 * 48000) == render(live, 2 * 2 * 48000));
+        }
+
+        // GENS has no global envelope counters: its state repeats when the
+        // loop ends by silence, so the later loops are really replayed
+        if(replays)
+            REQUIRE(cachedNotes < liveNotes);
+
+        // The change of the setup leaves the replay at once with the same output
+        REQUIRE(render(cached, 2 * 1000) == render(live, 2 * 1000));
+        opn2_setVolumeRangeModel(cached, OPNMIDI_VolumeModel_Generic);
+        opn2_setVolumeRangeModel(live, OPNMIDI_VolumeModel_Generic);
+        REQUIRE(render(cached, 2 * 95000) == render(live, 2 * 95000));
+
+        // Two loops to see the repeat and one loop to record it again
+        for(size_t i = 0; i < 3; ++i)
+            REQUIRE(render(cached, 2 * 2 * 48000) == render(live, 2 * 2 * 48000));
+
+        // The real-time event in the middle of the replayed loop gets applied
+        // once the replay reaches the next state saved every 4800 frames
+        const size_t notes = cachedNotes;
+        REQUIRE(render(cached, 2 * 49000) == render(live, 2 * 49000));
+        if(replays)
+            REQUIRE(cachedNotes == notes);
+        const size_t delay = replays ? 52800 - 49000 : 0;
+        REQUIRE(opn2_rt_noteOn(cached, 2, 72, 100) == 1);
+        if(delay > 0)
+            REQUIRE(render(cached, 2 * delay) == render(live, 2 * delay));
+        REQUIRE(opn2_rt_noteOn(live, 2, 72, 100) == 1);
+        REQUIRE(render(cached, 2 * 48000) == render(live, 2 * 48000));
+
+        opn2_close(live);
+        opn2_close(cached);
+    }
+}
+
+TEST_CASE("[LoopCache] Loops are rendered when the state doesn't repeat")
+{
+    const std::vector<uint8_t> song = buildSong();
+    size_t cachedNotes = 0, liveNotes = 0;
+    OPN2_MIDIPlayer *cached = makePlayer(OPNMIDI_EMU_GENS, song, true, &cachedNotes);
+    OPN2_MIDIPlayer *live = makePlayer(OPNMIDI_EMU_GENS, song, false, &liveNotes);
+    // The counter of the running LFO has other phase at every loop start
+    opn2_setLfoEnabled(cached, 1);
+    opn2_setLfoEnabled(live, 1);
+
+    for(size_t i = 0; i < 6; ++i)
+        REQUIRE(render(cached, 2 * 2 * 48000) == render(live, 2 * 2 * 48000));
+    REQUIRE(cachedNotes == liveNotes);
+
+    opn2_close(live);
+    opn2_close(cached);
+}
@@ -0,0 +1,122 @@
+#include <vector>
+
+#include "test_song.hpp"
+
+/*
+ * Five tracks of chords after the conductor track with tempo changes and the
+ * loop, so every chip of four gets some voices
+ */
+static std::vector<uint8_t> buildSong()
+{
+    return buildChordSong(5, 16, true);
+}
+
+static OPN2_MIDIPlayer *makePlayer(int emulator, const std::vector<uint8_t> &song, int parseThreads = 1)
+{
+    OPN2_MIDIPlayer *device = newPlayer(emulator, 4);
+    opn2_setParseThreads(device, parseThreads);
+    openSong(device, song);
+    return device;
+}
+
+static OPNMIDI_AudioFormat s16Format()
+{
+    OPNMIDI_AudioFormat format;
+    format.type = OPNMIDI_SampleType_S16;
+    format.containerSize = sizeof(int16_t);
+    format.sampleOffset = 2 * sizeof(int16_t);
+    return format;
+}
+
+/**
+ * @brief Render the whole song by opn2_playFormat() or by opn2_renderSongParallel()
+ * @param threads Count of threads of the parallel render, 0 to render by opn2_playFormat()
+ */
+static std::vector<int16_t> renderSong(OPN2_MIDIPlayer *device, int threads, size_t chunk)
+{
+    const OPNMIDI_AudioFormat format = s16Format();
+    std::vector<int16_t> out;
+    std::vector<int16_t> buffer(chunk);
+
+    for(;;)
+    {
+        OPN2_UInt8 *left = reinterpret_cast<OPN2_UInt8 *>(&buffer[0]);
+        OPN2_UInt8 *right = reinterpret_cast<OPN2_UInt8 *>(&buffer[1]);
+        int count;
+        if(threads == 0)
+            count = opn2_playFormat(device, static_cast<int>(chunk), left, right, &format);
+        else
+            count = opn2_renderSongParallel(device, threads, static_cast<int>(chunk), left, right, &format);
+        REQUIRE(count >= 0);
+        if(count == 0)
+            break;
+        out.insert(out.end(), buffer.begin(), buffer.begin() + count);
+    }
+
+    return out;
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[Parallel] Parallel render matches opn2_playFormat()")
+{
+    static const int emulators[] = {OPNMIDI_EMU_MAME, OPNMIDI_EMU_NUKED, OPNMIDI_EMU_GENS};
+    static const int threads[] = {-1, 3};
+    const std::vector<uint8_t> song = buildSong();
+
+    for(size_t e = 0; e < sizeof(emulators) / sizeof(emulators[0]); ++e)
+    {
+        INFO("Emulator " << emulators[e]);
+        OPN2_MIDIPlayer *serial = makePlayer(emulators[e], song);
+        const std::vector<int16_t> expected = renderSong(serial, 0, 8192);
+        REQUIRE(expected.size() > 44100 * 2 * 2);
+
+        for(size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t)
+        {
+            INFO("Threads " << threads[t]);
+            OPN2_MIDIPlayer *parallel = makePlayer(emulators[e], song);
+            REQUIRE(renderSong(parallel, threads[t], 8192) == expected);
+            opn2_close(parallel);
+        }
+
+        opn2_close(serial);
+    }
+}
+
+TEST_CASE("[Parallel] Whole song rendered at once matches opn2_playFormat()")
+{
+    const std::vector<uint8_t> song = buildSong();
+    OPN2_MIDIPlayer *serial = makePlayer(OPNMIDI_EMU_MAME, song);
+    OPN2_MIDIPlayer *parallel = makePlayer(OPNMIDI_EMU_MAME, song);
+
+    // The buffer is bigger than the song
+    const size_t whole = static_cast<size_t>(opn2_totalTimeLength(serial) * 44100.0 + 1.0) * 2 + 2 * 4096;
+    REQUIRE(renderSong(parallel, -1, whole) == renderSong(serial, 0, whole));
+
+    opn2_close(parallel);
+    opn2_close(serial);
+}
+
+TEST_CASE("[Parallel] Song decoded by several threads is the same")
+{
+    const std::vector<uint8_t> song = buildSong();
+    OPN2_MIDIPlayer *serial = makePlayer(OPNMIDI_EMU_MAME, song);
+    const std::vector<int16_t> expected = renderSong(serial, 0, 4096);
+
+    static const int threads[] = {2, 3, 6, 16};
+    for(size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t)
+    {
+        INFO("Threads " << threads[t]);
+        OPN2_MIDIPlayer *parallel = makePlayer(OPNMIDI_EMU_MAME, song, threads[t]);
+        REQUIRE(opn2_totalTimeLength(parallel) == opn2_totalTimeLength(serial));
+        REQUIRE(opn2_loopStartTime(parallel) == opn2_loopStartTime(serial));
+        REQUIRE(opn2_loopEndTime(parallel) == opn2_loopEndTime(serial));
+        REQUIRE(renderSong(parallel, 0, 4096) == expected);
+        opn2_close(parallel);
+    }
+
+    opn2_close(serial);
+}
@@ -0,0 +1,130 @@
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "test_song.hpp"
+
+/*
+ * Two different songs of chords, the second one has more tracks and plays on
+ * two MIDI devices, so the player gets new MIDI channels at the handover
+ */
+static std::vector<uint8_t> firstSong()
+{
+    return buildChordSong(2, 6);
+}
+
+static std::vector<uint8_t> secondSong()
+{
+    std::vector<TrackWriter> song;
+    for(uint8_t tk = 0; tk < 5; ++tk)
+    {
+        TrackWriter t;
+        t.meta(0, 0x09, tk < 3 ? "Port A" : "Port B");
+        writeChords(t, tk % 3, 4);
+        song.push_back(t);
+    }
+    return buildMidiFile(song);
+}
+
+static OPN2_MIDIPlayer *makePlayer(const std::vector<uint8_t> &song, bool integerClock)
+{
+    OPN2_MIDIPlayer *device = newPlayer(OPNMIDI_EMU_MAME, 2);
+    opn2_setIntegerClock(device, integerClock ? 1 : 0);
+    openSong(device, song);
+    return device;
+}
+
+/**
+ * @brief Play until the end of all songs
+ */
+static std::vector<short> renderAll(OPN2_MIDIPlayer *device)
+{
+    std::vector<short> out;
+    std::vector<short> buffer(2048);
+    for(;;)
+    {
+        int count = opn2_play(device, static_cast<int>(buffer.size()), &buffer[0]);
+        REQUIRE(count >= 0);
+        if(count == 0)
+            break;
+        out.insert(out.end(), buffer.begin(), buffer.begin() + count);
+    }
+    return out;
+}
+
+/**
+ * @brief Wait until the queued song is parsed
+ * @return State of the queued song after the parsing
+ */
+static int waitParsed(OPN2_MIDIPlayer *device)
+{
+    int state;
+    while((state = opn2_nextSongState(device)) == 1)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return state;
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[Playlist] Queued song follows the end of the current one without a gap")
+{
+    const std::vector<uint8_t> song1 = firstSong(), song2 = secondSong();
+
+    for(int integerClock = 0; integerClock < 2; ++integerClock)
+    {
+        INFO("Integer clock " << integerClock);
+        OPN2_MIDIPlayer *alone1 = makePlayer(song1, integerClock != 0);
+        OPN2_MIDIPlayer *alone2 = makePlayer(song2, integerClock != 0);
+        const double songLength = opn2_totalTimeLength(alone1);
+        const std::vector<short> first = renderAll(alone1);
+        const std::vector<short> second = renderAll(alone2);
+        REQUIRE(!first.empty());
+        REQUIRE(!second.empty());
+
+        OPN2_MIDIPlayer *device = makePlayer(song1, integerClock != 0);
+        REQUIRE(opn2_nextSongState(device) == 0);
+        REQUIRE(opn2_queueNextData(device, &song2[0], static_cast<unsigned long>(song2.size())) == 0);
+        REQUIRE(waitParsed(device) == 2);
+
+        // The song played alone ends by the wait of one second after its end of track,
+        // the next song starts right at the end of track instead
+        const size_t endOfTrack = static_cast<size_t>((songLength - 1.0) * 44100.0 + 0.5) * 2;
+        REQUIRE(endOfTrack < first.size());
+
+        const std::vector<short> both = renderAll(device);
+        REQUIRE(both.size() == endOfTrack + second.size());
+        REQUIRE(std::vector<short>(both.begin(), both.begin() + endOfTrack) ==
+                std::vector<short>(first.begin(), first.begin() + endOfTrack));
+        REQUIRE(opn2_nextSongState(device) == 0);
+
+        opn2_close(device);
+        opn2_close(alone2);
+        opn2_close(alone1);
+    }
+}
+
+TEST_CASE("[Playlist] Invalid queued song doesn't start")
+{
+    const std::vector<uint8_t> song1 = firstSong();
+    const char garbage[] = "This is not a music file";
+
+    OPN2_MIDIPlayer *alone = makePlayer(song1, false);
+    const std::vector<short> first = renderAll(alone);
+
+    OPN2_MIDIPlayer *device = makePlayer(song1, false);
+    // The error is given by the queue call or by the state after the parsing
+    if(opn2_queueNextData(device, garbage, sizeof(garbage)) == 0)
+        REQUIRE(waitParsed(device) < 0);
+    REQUIRE(opn2_nextSongState(device) < 0);
+    REQUIRE(std::string(opn2_errorInfo(device)) != "");
+
+    // The current song ends as if nothing was queued
+    REQUIRE(renderAll(device) == first);
+    REQUIRE(opn2_nextSongState(device) < 0);
+
+    opn2_close(device);
+    opn2_close(alone);
+}
@@ -0,0 +1,343 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_song.hpp"
+
+/*
+ * Every heap allocation made while g_counting is set is counted. The C++
+ * allocation functions are replaced on every platform, the C allocator is
+ * interposed with glibc only (its internal entry points are used to forward).
+ */
+static volatile bool g_counting = false;
+static volatile unsigned long g_allocations = 0;
+
+static inline void countAllocation()
+{
+    if(g_counting)
+        g_allocations = g_allocations + 1;
+}
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+extern "C" void *malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#endif
+
+void *operator new(size_t size)
+{
+    countAllocation();
+    void *p = std::malloc(size ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+struct AllocationCounter
+{
+    AllocationCounter()
+    {
+        g_allocations = 0;
+        g_counting = true;
+    }
+    unsigned long stop()
+    {
+        g_counting = false;
+        return g_allocations;
+    }
+    ~AllocationCounter()
+    {
+        g_counting = false;
+    }
+};
+
+static void notes(TrackWriter &t, uint8_t channel, uint8_t first, unsigned count)
+{
+    for(unsigned i = 0; i < count; ++i)
+    {
+        uint8_t note = static_cast<uint8_t>(first + (i * 5) % 24);
+        t.event(0, 0x90 | channel, note, 100);
+        t.event(0, 0x90 | channel, note + 4, 90);
+        t.event(60, 0xB0 | channel, 7, static_cast<uint8_t>(60 + i));
+        t.event(0, 0xE0 | channel, 0, static_cast<uint8_t>(0x40 + i % 16));
+        t.event(60, 0x80 | channel, note, 0);
+        t.event(0, 0x80 | channel, note + 4, 0);
+    }
+}
+
+/*
+ * Two tracks on two named devices, a loop, a GS reset, drums, a missing bank
+ * and a program which is absent in the bank
+ */
+static std::vector<uint8_t> buildSong()
+{
+    static const uint8_t gsReset[] = {0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7};
+
+    std::vector<TrackWriter> tracks(2);
+    TrackWriter &t0 = tracks[0];
+    t0.meta(0, 0x09, "PortA");
+    t0.tempo(0, 500000);
+    t0.sysex(0, gsReset, sizeof(gsReset));
+    t0.event(0, 0xC0, 16, 0);
+    t0.meta(0, 0x06, "loopStart");
+    notes(t0, 0, 48, 8);
+    t0.event(0, 0xB1, 0, 77);
+    t0.event(0, 0xB1, 32, 3);
+    t0.event(0, 0xC1, 101, 0);
+    notes(t0, 1, 60, 4);
+    notes(t0, 9, 35, 4);
+    t0.meta(0, 0x06, "loopEnd");
+    t0.end();
+
+    TrackWriter &t1 = tracks[1];
+    t1.meta(0, 0x09, "PortB");
+    t1.event(0, 0xC2, 40, 0);
+    notes(t1, 2, 55, 20);
+    t1.end();
+
+    return buildMidiFile(tracks);
+}
+
+static void debugHook(void *, const char *, ...)
+{}
+
+static OPN2_MIDIPlayer *makePlayer()
+{
+    OPN2_MIDIPlayer *device = newPlayer(OPNMIDI_EMU_MAME, 4);
+    opn2_setDebugMessageHook(device, &debugHook, NULL);
+    return device;
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[RealTime] Sequencer playback doesn't allocate")
+{
+    OPN2_MIDIPlayer *device = makePlayer();
+    std::vector<uint8_t> song = buildSong();
+    opn2_setLoopEnabled(device, 1);
+    openSong(device, song);
+
+    std::vector<short> buffer(4096);
+    std::vector<float> left(2048), right(2048);
+    OPNMIDI_AudioFormat format;
+    format.type = OPNMIDI_SampleType_F32;
+    format.containerSize = sizeof(float);
+    format.sampleOffset = sizeof(float);
+
+    unsigned long allocations;
+    {
+        AllocationCounter counter;
+        // Several passes through the loop
+        for(int i = 0; i < 400; ++i)
+        {
+            opn2_play(device, 4096, &buffer[0]);
+            opn2_playFormat(device, 4096,
+                            reinterpret_cast<OPN2_UInt8 *>(&left[0]),
+                            reinterpret_cast<OPN2_UInt8 *>(&right[0]),
+                            &format);
+        }
+        opn2_panic(device);
+        opn2_positionRewind(device);
+        opn2_play(device, 4096, &buffer[0]);
+        allocations = counter.stop();
+    }
+
+    REQUIRE(allocations == 0);
+    opn2_close(device);
+}
+
+TEST_CASE("[RealTime] Real-time MIDI calls don't allocate")
+{
+    OPN2_MIDIPlayer *device = makePlayer();
+
+    static const OPN2_UInt8 gsReset[] = {0xF0, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7};
+    static const OPN2_UInt8 xgReset[] = {0xF0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E, 0x00, 0xF7};
+
+    std::vector<short> buffer(512);
+    std::vector<OPN2_SInt16> left(256), right(256);
+    OPNMIDI_AudioFormat format;
+    format.type = OPNMIDI_SampleType_S16;
+    format.containerSize = sizeof(OPN2_SInt16);
+    format.sampleOffset = sizeof(OPN2_SInt16);
+
+    unsigned long allocations;
+    {
+        AllocationCounter counter;
+        for(unsigned i = 0; i < 2000; ++i)
+        {
+            OPN2_UInt8 ch = static_cast<OPN2_UInt8>(i % 16);
+            OPN2_UInt8 note = static_cast<OPN2_UInt8>(24 + (i * 7) % 96);
+
+            if(i % 100 == 0)
+                opn2_rt_systemExclusive(device, (i % 200) ? gsReset : xgReset, (i % 200) ? sizeof(gsReset) : sizeof(xgReset));
+            if(i % 13 == 0)
+            {
+                // Missing banks and instruments are reported once
+                opn2_rt_bankChangeMSB(device, ch, static_cast<OPN2_UInt8>(i % 128));
+                opn2_rt_bankChangeLSB(device, ch, static_cast<OPN2_UInt8>(i % 7));
+            }
+            if(i % 29 == 0)
+                opn2_rt_bankChange(device, ch, static_cast<OPN2_SInt16>(i % 300));
+            opn2_rt_patchChange(device, ch, static_cast<OPN2_UInt8>((i * 11) % 128));
+            opn2_rt_controllerChange(device, ch, 7, static_cast<OPN2_UInt8>(i % 128));
+            opn2_rt_controllerChange(device, ch, 64, (i % 3) ? 0 : 127);
+            opn2_rt_noteOn(device, ch, note, 100);
+            opn2_rt_noteAfterTouch(device, ch, note, 50);
+            opn2_rt_channelAfterTouch(device, ch, 40);
+            opn2_rt_pitchBend(device, ch, static_cast<OPN2_UInt16>((i * 97) % 16384));
+            opn2_rt_pitchBendML(device, ch, 0x40, 0x00);
+
+            if(i % 2)
+                opn2_generate(device, 512, &buffer[0]);
+            else
+                opn2_generateFormat(device, 512,
+                                    reinterpret_cast<OPN2_UInt8 *>(&left[0]),
+                                    reinterpret_cast<OPN2_UInt8 *>(&right[0]),
+                                    &format);
+
+            if(i % 3)
+                opn2_rt_noteOff(device, ch, note);
+            if(i % 500 == 0)
+                opn2_rt_resetState(device);
+        }
+        opn2_panic(device);
+        opn2_generate(device, 512, &buffer[0]);
+        allocations = counter.stop();
+    }
+
+    REQUIRE(allocations == 0);
+    opn2_close(device);
+}
+
+/*
+ * The note hook takes longer than the played time, so the governor switches
+ * to the cheaper emulator in the middle of playback
+ */
+static void slowNoteHook(void *, int, int, int, int, double)
+{
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(150);
+    while(std::chrono::steady_clock::now() < end)
+        {}
+}
+
+static void countSwitch(void *userdata, int, int, double)
+{
+    ++*static_cast<int *>(userdata);
+}
+
+TEST_CASE("[RealTime] Emulator switch by the quality governor doesn't allocate")
+{
+    OPN2_MIDIPlayer *device = makePlayer();
+    std::vector<uint8_t> song = buildSong();
+    REQUIRE(opn2_switchEmulator(device, OPNMIDI_EMU_NUKED) == 0);
+    opn2_setLoopEnabled(device, 1);
+    openSong(device, song);
+    REQUIRE(opn2_setQualityGovernor(device, 1) == 0);
+
+    int switches = 0;
+    opn2_setNoteHook(device, &slowNoteHook, NULL);
+    opn2_setEmulatorSwitchHook(device, &countSwitch, &switches);
+
+    std::vector<short> buffer(1024);
+    unsigned long allocations;
+    {
+        AllocationCounter counter;
+        // Up to 20 seconds of the song
+        for(int i = 0; i < 1000 && switches == 0; ++i)
+            opn2_play(device, 1024, &buffer[0]);
+        opn2_setNoteHook(device, NULL, NULL);
+        for(int i = 0; i < 50; ++i)
+            opn2_play(device, 1024, &buffer[0]);
+        allocations = counter.stop();
+    }
+
+    REQUIRE(switches > 0);
+    REQUIRE(allocations == 0);
+    opn2_close(device);
+}
+
+TEST_CASE("[RealTime] Start of the queued song doesn't allocate")
+{
+    OPN2_MIDIPlayer *device = makePlayer();
+    // The first song plays on the single unnamed device, the next one adds two devices
+    std::vector<TrackWriter> tracks(1);
+    notes(tracks[0], 0, 48, 4);
+    tracks[0].end();
+    std::vector<uint8_t> first = buildMidiFile(tracks);
+    std::vector<uint8_t> next = buildSong();
+    openSong(device, first);
+
+    REQUIRE(opn2_queueNextData(device, &next[0], static_cast<unsigned long>(next.size())) == 0);
+    while(opn2_nextSongState(device) == 1)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    REQUIRE(opn2_nextSongState(device) == 2);
+
+    std::vector<short> buffer(4096);
+    unsigned long allocations;
+    {
+        AllocationCounter counter;
+        while(opn2_play(device, 4096, &buffer[0]) > 0)
+        {}
+        allocations = counter.stop();
+    }
+
+    REQUIRE(opn2_nextSongState(device) == 0);
+    REQUIRE(allocations == 0);
+    opn2_close(device);
+}
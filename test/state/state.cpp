@@ -0,0 +1,102 @@
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "test_song.hpp"
+
+static OPN2_MIDIPlayer *makePlayer(int emulator, const std::vector<uint8_t> &song)
+{
+    OPN2_MIDIPlayer *device = newPlayer(emulator, 2);
+    openSong(device, song);
+    return device;
+}
+
+static std::vector<uint8_t> saveState(OPN2_MIDIPlayer *device)
+{
+    long size = opn2_saveState(device, NULL, 0);
+    REQUIRE(size > 0);
+    std::vector<uint8_t> state(static_cast<size_t>(size));
+    REQUIRE(opn2_saveState(device, &state[0], static_cast<unsigned long>(state.size())) == size);
+    return state;
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[State] Restored state renders bit-identically")
+{
+    static const int emulators[] = {OPNMIDI_EMU_MAME, OPNMIDI_EMU_NUKED, OPNMIDI_EMU_GENS};
+    const std::vector<uint8_t> song = buildChordSong(2, 24);
+
+    for(size_t e = 0; e < sizeof(emulators) / sizeof(emulators[0]); ++e)
+    {
+        INFO("Emulator " << emulators[e]);
+        OPN2_MIDIPlayer *device = makePlayer(emulators[e], song);
+
+        // Save in the middle of sounding notes
+        render(device, 2 * 12345);
+        const std::vector<uint8_t> state = saveState(device);
+        const std::vector<short> first = render(device, 2 * 30000);
+
+        REQUIRE(opn2_loadState(device, &state[0], static_cast<unsigned long>(state.size())) == 0);
+        const std::vector<short> second = render(device, 2 * 30000);
+        REQUIRE(first == second);
+
+        // The state restores into another player of the same setup
+        OPN2_MIDIPlayer *other = makePlayer(emulators[e], song);
+        REQUIRE(opn2_loadState(other, &state[0], static_cast<unsigned long>(state.size())) == 0);
+        const std::vector<short> third = render(other, 2 * 30000);
+        REQUIRE(first == third);
+
+        opn2_close(other);
+        opn2_close(device);
+    }
+}
+
+TEST_CASE("[State] Invalid state doesn't change the player")
+{
+    const std::vector<uint8_t> song = buildChordSong(2, 24);
+    OPN2_MIDIPlayer *device = makePlayer(OPNMIDI_EMU_MAME, song);
+    OPN2_MIDIPlayer *twin = makePlayer(OPNMIDI_EMU_MAME, song);
+
+    // Both players are rendered by the same blocks
+    render(device, 10 * 1024);
+    const std::vector<uint8_t> early = saveState(device);
+    render(device, 40 * 1024);
+    render(twin, 50 * 1024);
+
+    // The tail holding the sequencer position gets lost, while the header stays valid
+    std::vector<uint8_t> broken(early.begin(), early.end() - 8);
+    const uint32_t size = static_cast<uint32_t>(broken.size());
+    std::memcpy(&broken[9], &size, sizeof(size));
+
+    REQUIRE(opn2_loadState(device, &broken[0], static_cast<unsigned long>(broken.size())) < 0);
+    REQUIRE(std::string(opn2_errorInfo(device)).find("corrupted") != std::string::npos);
+
+    REQUIRE(render(device, 40 * 1024) == render(twin, 40 * 1024));
+
+    opn2_close(twin);
+    opn2_close(device);
+}
+
+TEST_CASE("[State] Emulators without state support are rejected")
+{
+    static const int emulators[] = {OPNMIDI_EMU_GX, OPNMIDI_EMU_NP2, OPNMIDI_EMU_MAME_2608, OPNMIDI_EMU_PMDWIN};
+
+    for(size_t e = 0; e < sizeof(emulators) / sizeof(emulators[0]); ++e)
+    {
+        OPN2_MIDIPlayer *device = opn2_init(44100);
+        REQUIRE(device != NULL);
+        // Emulators which aren't built into the library are skipped
+        if(opn2_switchEmulator(device, emulators[e]) == 0)
+        {
+            INFO("Emulator " << opn2_chipEmulatorName(device));
+            REQUIRE(opn2_saveState(device, NULL, 0) < 0);
+            const std::string error = opn2_errorInfo(device);
+            REQUIRE(error.find(opn2_chipEmulatorName(device)) != std::string::npos);
+        }
+        opn2_close(device);
+    }
+}
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "test_song.hpp"
+
+/*
+ * Chords on four channels, so several chips get voices, and chip channels get
+ * passed between MIDI channels
+ */
+static std::vector<uint8_t> buildSong()
+{
+    return buildChordSong(4, 20);
+}
+
+static OPN2_MIDIPlayer *makePlayer(int emulator, const std::vector<uint8_t> &song, int stemMode)
+{
+    OPN2_MIDIPlayer *device = newPlayer(emulator, 3);
+    // Stems are set before the song gets opened, so copies of chips start from the reset
+    REQUIRE(opn2_setStemMode(device, stemMode) == 0);
+    openSong(device, song);
+    return device;
+}
+
+static OPNMIDI_AudioFormat f64Format()
+{
+    OPNMIDI_AudioFormat format;
+    format.type = OPNMIDI_SampleType_F64;
+    format.containerSize = sizeof(double);
+    format.sampleOffset = 2 * sizeof(double);
+    return format;
+}
+
+/**
+ * @brief Render the whole song as the mix or as the sum of all stems
+ */
+static std::vector<double> renderSong(OPN2_MIDIPlayer *device, bool stems)
+{
+    const OPNMIDI_AudioFormat format = f64Format();
+    const size_t chunk = 2048;
+    const size_t stemCount = stems ? static_cast<size_t>(opn2_getStemCount(device)) : 1;
+    std::vector<std::vector<double> > buffers(stemCount, std::vector<double>(chunk));
+    std::vector<OPN2_UInt8 *> left(stemCount), right(stemCount);
+    for(size_t i = 0; i < stemCount; ++i)
+    {
+        left[i] = reinterpret_cast<OPN2_UInt8 *>(&buffers[i][0]);
+        right[i] = reinterpret_cast<OPN2_UInt8 *>(&buffers[i][1]);
+    }
+
+    std::vector<double> out;
+    for(;;)
+    {
+        int count;
+        if(stems)
+            count = opn2_playStems(device, static_cast<int>(chunk), &left[0], &right[0], &format);
+        else
+            count = opn2_playFormat(device, static_cast<int>(chunk), left[0], right[0], &format);
+        REQUIRE(count >= 0);
+        if(count == 0)
+            break;
+
+        for(int s = 0; s < count; ++s)
+        {
+            double sum = 0.0;
+            for(size_t i = 0; i < stemCount; ++i)
+                sum += buffers[i][static_cast<size_t>(s)];
+            out.push_back(sum);
+        }
+    }
+
+    return out;
+}
+
+/**
+ * @brief The biggest difference between two renders, relative to the peak of the mix
+ */
+static double maxDeviation(const std::vector<double> &mix, const std::vector<double> &sum)
+{
+    double peak = 0.0, diff = 0.0;
+    for(size_t i = 0; i < mix.size(); ++i)
+    {
+        peak = std::max(peak, std::fabs(mix[i]));
+        diff = std::max(diff, std::fabs(mix[i] - sum[i]));
+    }
+    REQUIRE(peak > 0.0);
+    return diff / peak;
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[Stems] Chip stems sum up into the mix")
+{
+    static const int emulators[] = {OPNMIDI_EMU_MAME, OPNMIDI_EMU_NUKED, OPNMIDI_EMU_GENS};
+    const std::vector<uint8_t> song = buildSong();
+
+    for(size_t e = 0; e < sizeof(emulators) / sizeof(emulators[0]); ++e)
+    {
+        INFO("Emulator " << emulators[e]);
+        OPN2_MIDIPlayer *mixed = makePlayer(emulators[e], song, OPNMIDI_StemMode_Off);
+        OPN2_MIDIPlayer *split = makePlayer(emulators[e], song, OPNMIDI_StemMode_Chip);
+        REQUIRE(opn2_getStemCount(split) == 3);
+
+        const std::vector<double> mix = renderSong(mixed, false);
+        const std::vector<double> sum = renderSong(split, true);
+        REQUIRE(mix.size() == sum.size());
+        // Only the rounding of the floating point sum differs
+        REQUIRE(maxDeviation(mix, sum) < 1e-9);
+
+        opn2_close(split);
+        opn2_close(mixed);
+    }
+}
+
+TEST_CASE("[Stems] MIDI channel stems sum up into the mix")
+{
+    const std::vector<uint8_t> song = buildSong();
+    OPN2_MIDIPlayer *mixed = makePlayer(OPNMIDI_EMU_MAME, song, OPNMIDI_StemMode_Off);
+    OPN2_MIDIPlayer *split = makePlayer(OPNMIDI_EMU_MAME, song, OPNMIDI_StemMode_MidiChannel);
+    REQUIRE(opn2_getStemCount(split) == 16);
+
+    const std::vector<double> mix = renderSong(mixed, false);
+    const std::vector<double> sum = renderSong(split, true);
+    REQUIRE(mix.size() == sum.size());
+    // Stems run copies of chips with the panning of other channels turned off,
+    // the emulator rounds and clips the sum of its channels, so stems are very
+    // close to the mix, but not exact
+    REQUIRE(maxDeviation(mix, sum) < 0.005);
+
+    opn2_close(split);
+    opn2_close(mixed);
+}
@@ -0,0 +1,67 @@
+#include <cstdio>
+#include <vector>
+
+#include "test_song.hpp"
+
+static const char *s_tracePath = "trace_test.bin";
+
+/*
+ * Chords on the first track and on the last one of 130 tracks, the last track
+ * switches the device, so the trace gets the record with the track number above 127
+ */
+static std::vector<uint8_t> buildSong()
+{
+    std::vector<TrackWriter> tracks(130);
+    tracks[0].tempo(0, 500000);
+    writeChords(tracks[0], 0, 12);
+    for(size_t i = 1; i < 129; ++i)
+        tracks[i].end();
+    tracks[129].meta(0, 0x09, "OPN2 device B");
+    writeChords(tracks[129], 1, 12);
+    return buildMidiFile(tracks);
+}
+
+static void collectAudio(void *userdata, const short *samples, size_t frames)
+{
+    std::vector<short> &out = *static_cast<std::vector<short> *>(userdata);
+    out.insert(out.end(), samples, samples + frames * 2);
+}
+
+
+/***************************************************************
+ *                           Tests                             *
+ ***************************************************************/
+
+TEST_CASE("[Trace] Replayed trace sounds like the traced song")
+{
+    const std::vector<uint8_t> song = buildSong();
+    OPN2_MIDIPlayer *device = newPlayer(OPNMIDI_EMU_MAME, 2);
+    openSong(device, song);
+    REQUIRE(opn2_trackCount(device) == 130);
+    REQUIRE(opn2_startTrace(device, s_tracePath) == 0);
+
+    std::vector<short> played = render(device, 2 * 22050);
+    // Long SysEx message needs several bytes to encode its length
+    std::vector<OPN2_UInt8> sysex(200, 0x10);
+    sysex.front() = 0xF0;
+    sysex.back() = 0xF7;
+    opn2_rt_systemExclusive(device, &sysex[0], sysex.size());
+    opn2_rt_noteOn(device, 2, 60, 100);
+
+    std::vector<short> buffer(4096);
+    int count;
+    while((count = opn2_play(device, static_cast<int>(buffer.size()), &buffer[0])) > 0)
+        played.insert(played.end(), buffer.begin(), buffer.begin() + count);
+    opn2_stopTrace(device);
+    opn2_close(device);
+
+    std::vector<short> replayed;
+    unsigned long rate = 0;
+    const long frames = opn2_replayTrace(s_tracePath, OPNMIDI_EMU_MAME, collectAudio, &replayed, &rate);
+    INFO(opn2_errorString());
+    REQUIRE(frames == static_cast<long>(played.size() / 2));
+    REQUIRE(rate == 44100);
+    REQUIRE(replayed == played);
+
+    std::remove(s_tracePath);
+}
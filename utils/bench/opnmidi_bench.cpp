@@ -0,0 +1,803 @@
+/*
+ * Benchmark suite for libOPNMIDI emulators and the MIDI engine
+ *
+ * Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   include <windows.h>
+#   include <psapi.h>
+#else
+#   include <sys/resource.h>
+#endif
+
+#include <opnmidi.h>
+
+#ifndef DEFAULT_BANK_PATH
+#define DEFAULT_BANK_PATH "fm_banks/gm.wopn"
+#endif
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double secondsSince(const BenchClock::time_point &begin)
+{
+    return std::chrono::duration<double>(BenchClock::now() - begin).count();
+}
+
+/**
+ * @brief Start counting the peak resident set size anew
+ * @return false when only the peak of the whole process is known
+ */
+static bool resetPeakRss()
+{
+#if defined(__linux__)
+    std::FILE *f = std::fopen("/proc/self/clear_refs", "w");
+    if(!f)
+        return false;
+    bool ok = std::fputs("5", f) >= 0;
+    ok = (std::fclose(f) == 0) && ok;
+    return ok;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Peak resident set size in kilobytes since resetPeakRss(), or of the whole process
+ */
+static long peakRssKb()
+{
+#if defined(__linux__)
+    // VmHWM follows the reset, but ru_maxrss keeps the maximum of the process
+    std::FILE *f = std::fopen("/proc/self/status", "r");
+    if(f)
+    {
+        char line[256];
+        long kb = -1;
+        while(std::fgets(line, sizeof(line), f))
+        {
+            if(std::strncmp(line, "VmHWM:", 6) == 0)
+            {
+                kb = std::strtol(line + 6, NULL, 10);
+                break;
+            }
+        }
+        std::fclose(f);
+        if(kb >= 0)
+            return kb;
+    }
+#endif
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return static_cast<long>(pmc.PeakWorkingSetSize / 1024);
+    return -1;
+#else
+    struct rusage ru;
+    if(getrusage(RUSAGE_SELF, &ru) != 0)
+        return -1;
+#   if defined(__APPLE__)
+    return static_cast<long>(ru.ru_maxrss / 1024); // Bytes on macOS
+#   else
+    return static_cast<long>(ru.ru_maxrss);
+#   endif
+#endif
+}
+
+
+/***************************************************************
+ *              Synthetic MIDI workloads                       *
+ ***************************************************************/
+
+/**
+ * @brief Deterministic pseudo-random generator, same sequence on every platform
+ */
+class BenchRandom
+{
+    uint32_t m_state;
+public:
+    explicit BenchRandom(uint32_t seed) : m_state(seed) {}
+    uint32_t next()
+    {
+        m_state = m_state * 1664525u + 1013904223u;
+        return m_state >> 8;
+    }
+    int range(int min, int max)
+    {
+        return min + static_cast<int>(next() % static_cast<uint32_t>(max - min + 1));
+    }
+};
+
+/**
+ * @brief Writer of Standard MIDI File with absolute timed events
+ */
+class SmfWriter
+{
+public:
+    enum { Division = 480 };
+
+private:
+    struct Event
+    {
+        uint32_t time;
+        uint32_t order;
+        std::vector<uint8_t> data;
+        bool operator<(const Event &o) const
+        {
+            return time != o.time ? time < o.time : order < o.order;
+        }
+    };
+
+    std::vector<std::vector<Event> > m_tracks;
+    uint32_t m_order;
+
+    static void putVarLen(std::vector<uint8_t> &out, uint32_t value)
+    {
+        uint8_t buf[5];
+        int n = 0;
+        buf[n++] = value & 0x7F;
+        while((value >>= 7) != 0)
+            buf[n++] = static_cast<uint8_t>(0x80 | (value & 0x7F));
+        while(n > 0)
+            out.push_back(buf[--n]);
+    }
+
+    static void putBE32(std::vector<uint8_t> &out, uint32_t value)
+    {
+        out.push_back(static_cast<uint8_t>(value >> 24));
+        out.push_back(static_cast<uint8_t>(value >> 16));
+        out.push_back(static_cast<uint8_t>(value >> 8));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+public:
+    explicit SmfWriter(size_t tracks) : m_tracks(tracks), m_order(0) {}
+
+    void event(size_t track, uint32_t time, uint8_t status, uint8_t d1, int d2 = -1)
+    {
+        Event e;
+        e.time = time;
+        e.order = m_order++;
+        e.data.push_back(status);
+        e.data.push_back(d1);
+        if(d2 >= 0)
+            e.data.push_back(static_cast<uint8_t>(d2));
+        m_tracks[track].push_back(e);
+    }
+
+    void meta(size_t track, uint32_t time, uint8_t type, const void *data, size_t len)
+    {
+        Event e;
+        e.time = time;
+        e.order = m_order++;
+        e.data.push_back(0xFF);
+        e.data.push_back(type);
+        putVarLen(e.data, static_cast<uint32_t>(len));
+        const uint8_t *d = static_cast<const uint8_t *>(data);
+        e.data.insert(e.data.end(), d, d + len);
+        m_tracks[track].push_back(e);
+    }
+
+    void note(size_t track, uint32_t time, uint32_t length, uint8_t channel, uint8_t key, uint8_t velocity)
+    {
+        event(track, time, static_cast<uint8_t>(0x90 | channel), key, velocity);
+        event(track, time + length, static_cast<uint8_t>(0x80 | channel), key, 0);
+    }
+
+    std::vector<uint8_t> build()
+    {
+        std::vector<uint8_t> out;
+        const char *mthd = "MThd";
+        out.insert(out.end(), mthd, mthd + 4);
+        putBE32(out, 6);
+        out.push_back(0);
+        out.push_back(1); // Format 1
+        out.push_back(0);
+        out.push_back(static_cast<uint8_t>(m_tracks.size()));
+        out.push_back(Division >> 8);
+        out.push_back(Division & 0xFF);
+
+        for(size_t t = 0; t < m_tracks.size(); ++t)
+        {
+            std::vector<Event> &events = m_tracks[t];
+            std::stable_sort(events.begin(), events.end());
+            std::vector<uint8_t> body;
+            uint32_t last = 0;
+            for(size_t i = 0; i < events.size(); ++i)
+            {
+                putVarLen(body, events[i].time - last);
+                last = events[i].time;
+                body.insert(body.end(), events[i].data.begin(), events[i].data.end());
+            }
+            putVarLen(body, 0);
+            body.push_back(0xFF);
+            body.push_back(0x2F);
+            body.push_back(0x00);
+
+            const char *mtrk = "MTrk";
+            out.insert(out.end(), mtrk, mtrk + 4);
+            putBE32(out, static_cast<uint32_t>(body.size()));
+            out.insert(out.end(), body.begin(), body.end());
+        }
+        return out;
+    }
+};
+
+//! Ticks per second at the default tempo of 120 BPM
+static const uint32_t s_ticksPerSecond = SmfWriter::Division * 2;
+
+static void programs(SmfWriter &w, size_t track, BenchRandom &rnd, uint8_t channels)
+{
+    for(uint8_t ch = 0; ch < channels; ++ch)
+    {
+        if(ch != 9)
+            w.event(track, 0, static_cast<uint8_t>(0xC0 | ch), static_cast<uint8_t>(rnd.range(0, 127)));
+    }
+}
+
+static std::vector<uint8_t> workloadDenseChords(double seconds)
+{
+    SmfWriter w(1);
+    BenchRandom rnd(1);
+    uint32_t end = static_cast<uint32_t>(seconds * s_ticksPerSecond);
+    programs(w, 0, rnd, 4);
+    for(uint32_t t = 0; t < end; t += SmfWriter::Division)
+    {
+        for(uint8_t ch = 0; ch < 4; ++ch)
+        {
+            int root = rnd.range(36, 72);
+            for(int n = 0; n < 6; ++n)
+                w.note(0, t, SmfWriter::Division - 10, ch,
+                       static_cast<uint8_t>(root + n * 4 + rnd.range(0, 2)),
+                       static_cast<uint8_t>(rnd.range(60, 120)));
+        }
+    }
+    return w.build();
+}
+
+static std::vector<uint8_t> workloadFastArpeggios(double seconds)
+{
+    SmfWriter w(1);
+    BenchRandom rnd(2);
+    uint32_t end = static_cast<uint32_t>(seconds * s_ticksPerSecond);
+    const uint32_t step = SmfWriter::Division / 8; // 32nd notes
+    static const int pattern[] = {0, 4, 7, 12, 16, 12, 7, 4};
+    programs(w, 0, rnd, 3);
+    for(uint8_t ch = 0; ch < 3; ++ch)
+    {
+        int root = 48 + ch * 7;
+        for(uint32_t t = 0, i = 0; t < end; t += step, ++i)
+        {
+            if(i % 32 == 0)
+                root = rnd.range(40, 64);
+            w.note(0, t + ch * 7, step - 5, ch,
+                   static_cast<uint8_t>(root + pattern[i % 8]),
+                   static_cast<uint8_t>(rnd.range(70, 127)));
+        }
+    }
+    return w.build();
+}
+
+static std::vector<uint8_t> workloadPitchBend(double seconds)
+{
+    SmfWriter w(1);
+    BenchRandom rnd(3);
+    uint32_t end = static_cast<uint32_t>(seconds * s_ticksPerSecond);
+    programs(w, 0, rnd, 6);
+    for(uint8_t ch = 0; ch < 6; ++ch)
+    {
+        w.event(0, 0, static_cast<uint8_t>(0xB0 | ch), 1, 64); // Modulation
+        for(uint32_t t = 0; t < end; t += SmfWriter::Division * 2)
+            w.note(0, t, SmfWriter::Division * 2 - 10, ch,
+                   static_cast<uint8_t>(rnd.range(40, 80)),
+                   static_cast<uint8_t>(rnd.range(80, 120)));
+        for(uint32_t t = 0; t < end; t += 10)
+        {
+            double phase = (static_cast<double>(t) / SmfWriter::Division + ch * 0.3) * 3.14159265358979;
+            int bend = 8192 + static_cast<int>(std::sin(phase) * 8000.0);
+            w.event(0, t, static_cast<uint8_t>(0xE0 | ch),
+                    static_cast<uint8_t>(bend & 0x7F), (bend >> 7) & 0x7F);
+        }
+    }
+    return w.build();
+}
+
+static std::vector<uint8_t> workloadMultiDevice(double seconds)
+{
+    const size_t devices = 4;
+    SmfWriter w(devices);
+    BenchRandom rnd(4);
+    uint32_t end = static_cast<uint32_t>(seconds * s_ticksPerSecond);
+    for(size_t d = 0; d < devices; ++d)
+    {
+        char name[16];
+        std::snprintf(name, sizeof(name), "Port%u", static_cast<unsigned>(d + 1));
+        w.meta(d, 0, 0x09, name, std::strlen(name));
+        programs(w, d, rnd, 16);
+        for(uint8_t ch = 0; ch < 16; ++ch)
+        {
+            uint32_t step = SmfWriter::Division / static_cast<uint32_t>(rnd.range(1, 4));
+            for(uint32_t t = static_cast<uint32_t>(rnd.range(0, 60)); t < end; t += step)
+            {
+                uint8_t key = static_cast<uint8_t>(ch == 9 ? rnd.range(35, 59) : rnd.range(36, 84));
+                w.note(d, t, step - 5, ch, key, static_cast<uint8_t>(rnd.range(50, 110)));
+            }
+        }
+    }
+    return w.build();
+}
+
+static std::vector<uint8_t> workloadDrumRolls(double seconds)
+{
+    SmfWriter w(1);
+    BenchRandom rnd(5);
+    uint32_t end = static_cast<uint32_t>(seconds * s_ticksPerSecond);
+    const uint32_t step = SmfWriter::Division / 16; // 64th notes
+    for(uint32_t t = 0, i = 0; t < end; t += step, ++i)
+    {
+        uint8_t key = static_cast<uint8_t>((i % 64 < 48) ? 38 + (i / 64) % 4 : rnd.range(35, 59));
+        uint8_t vel = static_cast<uint8_t>(40 + (i % 16) * 5);
+        w.note(0, t, step / 2, 9, key, vel);
+        if(i % 8 == 0)
+            w.note(0, t, step, 9, 36, 120); // Bass drum
+    }
+    return w.build();
+}
+
+/*
+ * Wide clusters held on many channels, with the polyphonic aftertouch on every
+ * held key and the release in random order: every event looks up the note among
+ * many active notes of the channel, and note-offs erase them from the middle
+ */
+static std::vector<uint8_t> workloadHeldNotes(double seconds)
+{
+    SmfWriter w(1);
+    BenchRandom rnd(6);
+    uint32_t end = static_cast<uint32_t>(seconds * s_ticksPerSecond);
+    const uint32_t bar = SmfWriter::Division * 2;
+    const int keys = 12;
+    programs(w, 0, rnd, 12);
+    for(uint32_t t = 0; t < end; t += bar)
+    {
+        for(uint8_t ch = 0; ch < 12; ++ch)
+        {
+            if(ch == 9)
+                continue;
+            int root = rnd.range(36, 60);
+            int order[keys];
+            for(int n = 0; n < keys; ++n)
+            {
+                order[n] = n;
+                w.event(0, t + n * 5, static_cast<uint8_t>(0x90 | ch),
+                        static_cast<uint8_t>(root + n * 2), rnd.range(60, 120));
+            }
+            for(uint32_t at = t + keys * 5; at < t + bar / 2; at += 20)
+            {
+                for(int n = 0; n < keys; ++n)
+                    w.event(0, at, static_cast<uint8_t>(0xA0 | ch),
+                            static_cast<uint8_t>(root + n * 2), rnd.range(0, 127));
+            }
+            for(int n = keys - 1; n > 0; --n)
+                std::swap(order[n], order[rnd.range(0, n)]);
+            for(int n = 0; n < keys; ++n)
+                w.event(0, t + bar / 2 + n * 30, static_cast<uint8_t>(0x80 | ch),
+                        static_cast<uint8_t>(root + order[n] * 2), 0);
+        }
+    }
+    return w.build();
+}
+
+struct Workload
+{
+    const char *name;
+    std::vector<uint8_t> (*generate)(double seconds);
+};
+
+static const Workload s_workloads[] =
+{
+    {"dense_chords", workloadDenseChords},
+    {"fast_arpeggios", workloadFastArpeggios},
+    {"pitch_bend", workloadPitchBend},
+    {"multi_device", workloadMultiDevice},
+    {"drum_rolls", workloadDrumRolls},
+    {"held_notes", workloadHeldNotes}
+};
+
+static const size_t s_workloadsCount = sizeof(s_workloads) / sizeof(s_workloads[0]);
+
+
+/***************************************************************
+ *                     Benchmark runner                        *
+ ***************************************************************/
+
+struct BenchResult
+{
+    std::string workload;
+    std::string bank;
+    std::string emulator;
+    int         chips;
+    long        rate;
+    uint64_t    frames;
+    double      audioSeconds;
+    double      wallSeconds;
+    double      realtimeFactor;
+    double      nsPerFrameChip;
+    double      noteOnMeanNs;
+    double      noteOnMaxNs;
+    long        peakRssKb;
+    //! "run" when the peak is counted for this run only, "process" for the whole process
+    const char *peakRssScope;
+};
+
+static std::string baseName(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static bool runBench(const Workload &wl, const std::vector<uint8_t> &midi,
+                     const std::string &bank, int emulator, int chips, long rate,
+                     double seconds, BenchResult &res)
+{
+    res.peakRssScope = resetPeakRss() ? "run" : "process";
+
+    OPN2_MIDIPlayer *p = opn2_init(rate);
+    if(!p)
+        return false;
+
+    if(opn2_switchEmulator(p, emulator) < 0)
+    {
+        // Emulator is not compiled in
+        opn2_close(p);
+        return false;
+    }
+
+    if(opn2_setNumChips(p, chips) < 0 ||
+       opn2_openBankFile(p, bank.c_str()) < 0 ||
+       opn2_openData(p, &midi[0], static_cast<unsigned long>(midi.size())) < 0)
+    {
+        std::fprintf(stderr, "Skipping %s: %s\n", wl.name, opn2_errorInfo(p));
+        opn2_close(p);
+        return false;
+    }
+
+    opn2_setLoopEnabled(p, 0);
+
+    res.workload = wl.name;
+    res.bank = baseName(bank);
+    res.emulator = opn2_chipEmulatorName(p);
+    res.chips = opn2_getNumChipsObtained(p);
+    res.rate = rate;
+
+    // Rendering of the song
+    enum { BlockSamples = 4096 };
+    std::vector<short> buf(BlockSamples);
+    uint64_t frames = 0;
+    const uint64_t maxFrames = static_cast<uint64_t>(seconds * static_cast<double>(rate));
+    BenchClock::time_point begin = BenchClock::now();
+    while(frames < maxFrames)
+    {
+        int got = opn2_play(p, BlockSamples, &buf[0]);
+        if(got <= 0)
+            break;
+        frames += static_cast<uint64_t>(got / 2);
+    }
+    res.wallSeconds = secondsSince(begin);
+    res.frames = frames;
+    res.audioSeconds = static_cast<double>(frames) / static_cast<double>(rate);
+    res.realtimeFactor = res.wallSeconds > 0.0 ? res.audioSeconds / res.wallSeconds : 0.0;
+    res.nsPerFrameChip = frames > 0 ?
+                res.wallSeconds * 1e9 / static_cast<double>(frames) / res.chips : 0.0;
+
+    // Latency of real-time note-on calls while other notes are held
+    opn2_rt_resetState(p);
+    enum { LatencyNotes = 96, LatencyFrames = 64 };
+    double sum = 0.0, max = 0.0;
+    for(int i = 0; i < LatencyNotes; ++i)
+    {
+        uint8_t ch = static_cast<uint8_t>(i % 16);
+        uint8_t key = static_cast<uint8_t>(36 + (i * 7) % 60);
+        BenchClock::time_point t = BenchClock::now();
+        opn2_rt_noteOn(p, ch, key, 100);
+        double ns = secondsSince(t) * 1e9;
+        sum += ns;
+        max = std::max(max, ns);
+        opn2_generate(p, LatencyFrames * 2, &buf[0]);
+        if(i >= 24) // Keep up to 24 notes held
+            opn2_rt_noteOff(p, static_cast<uint8_t>((i - 24) % 16), static_cast<uint8_t>(36 + ((i - 24) * 7) % 60));
+    }
+    res.noteOnMeanNs = sum / LatencyNotes;
+    res.noteOnMaxNs = max;
+
+    opn2_close(p);
+    res.peakRssKb = peakRssKb();
+    return true;
+}
+
+/**
+ * @brief Render the register trace by every emulator without the MIDI layer
+ */
+static int runReplay(const char *tracePath, int onlyEmulator)
+{
+    std::printf("%-26s %10s %11s %10s\n", "emulator", "frames", "wall s", "realtime");
+
+    OPN2_MIDIPlayer *p = opn2_init(44100);
+    bool any = false;
+    for(int e = 0; e < OPNMIDI_EMU_end; ++e)
+    {
+        if(e == OPNMIDI_VGM_DUMPER || (onlyEmulator >= 0 && e != onlyEmulator))
+            continue;
+        if(opn2_switchEmulator(p, e) < 0)
+            continue; // Not compiled in
+        const std::string name = opn2_chipEmulatorName(p);
+
+        BenchClock::time_point begin = BenchClock::now();
+        unsigned long rate = 0;
+        long frames = opn2_replayTrace(tracePath, e, NULL, NULL, &rate);
+        double wall = secondsSince(begin);
+        if(frames < 0)
+        {
+            std::fprintf(stderr, "Can't replay %s: %s\n", tracePath, opn2_errorString());
+            opn2_close(p);
+            return 1;
+        }
+
+        double audio = rate ? static_cast<double>(frames) / static_cast<double>(rate) : 0.0;
+        std::printf("%-26s %10ld %11.3f %9.2fx\n", name.c_str(), frames, wall,
+                    wall > 0.0 ? audio / wall : 0.0);
+        std::fflush(stdout);
+        any = true;
+    }
+    opn2_close(p);
+    return any ? 0 : 1;
+}
+
+static std::vector<long> parseList(const char *arg)
+{
+    std::vector<long> out;
+    const char *s = arg;
+    while(*s)
+    {
+        char *end;
+        long v = std::strtol(s, &end, 10);
+        if(end == s)
+            break;
+        out.push_back(v);
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return out;
+}
+
+static std::string jsonEscape(const std::string &s)
+{
+    std::string out;
+    for(size_t i = 0; i < s.size(); ++i)
+    {
+        if(s[i] == '"' || s[i] == '\\')
+            out.push_back('\\');
+        out.push_back(s[i]);
+    }
+    return out;
+}
+
+static bool writeCsv(const char *path, const std::vector<BenchResult> &results)
+{
+    FILE *f = std::fopen(path, "w");
+    if(!f)
+        return false;
+    std::fprintf(f, "workload,bank,emulator,chips,rate,frames,audio_s,wall_s,realtime_factor,ns_per_frame_chip,noteon_mean_ns,noteon_max_ns,peak_rss_kb,peak_rss_scope\n");
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult &r = results[i];
+        std::fprintf(f, "%s,%s,\"%s\",%d,%ld,%llu,%.3f,%.6f,%.3f,%.2f,%.1f,%.1f,%ld,%s\n",
+                     r.workload.c_str(), r.bank.c_str(), r.emulator.c_str(), r.chips, r.rate,
+                     static_cast<unsigned long long>(r.frames), r.audioSeconds, r.wallSeconds,
+                     r.realtimeFactor, r.nsPerFrameChip, r.noteOnMeanNs, r.noteOnMaxNs, r.peakRssKb,
+                     r.peakRssScope);
+    }
+    std::fclose(f);
+    return true;
+}
+
+static bool writeJson(const char *path, const std::vector<BenchResult> &results)
+{
+    FILE *f = std::fopen(path, "w");
+    if(!f)
+        return false;
+    std::fprintf(f, "{\n  \"library\": \"%s\",\n  \"results\": [\n", opn2_linkedLibraryVersion());
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult &r = results[i];
+        std::fprintf(f, "    {\"workload\": \"%s\", \"bank\": \"%s\", \"emulator\": \"%s\", "
+                        "\"chips\": %d, \"rate\": %ld, \"frames\": %llu, \"audio_s\": %.3f, "
+                        "\"wall_s\": %.6f, \"realtime_factor\": %.3f, \"ns_per_frame_chip\": %.2f, "
+                        "\"noteon_mean_ns\": %.1f, \"noteon_max_ns\": %.1f, \"peak_rss_kb\": %ld, "
+                        "\"peak_rss_scope\": \"%s\"}%s\n",
+                     r.workload.c_str(), jsonEscape(r.bank).c_str(), jsonEscape(r.emulator).c_str(),
+                     r.chips, r.rate, static_cast<unsigned long long>(r.frames), r.audioSeconds,
+                     r.wallSeconds, r.realtimeFactor, r.nsPerFrameChip, r.noteOnMeanNs,
+                     r.noteOnMaxNs, r.peakRssKb, r.peakRssScope, (i + 1 < results.size()) ? "," : "");
+    }
+    std::fprintf(f, "  ]\n}\n");
+    std::fclose(f);
+    return true;
+}
+
+static void printHelp(const char *self)
+{
+    std::printf(
+        "Usage: %s [options] [bank.wopn ...]\n"
+        "\n"
+        "Renders deterministic synthetic MIDI workloads through every compiled emulator.\n"
+        "Without bank files given, " DEFAULT_BANK_PATH " is used.\n"
+        "\n"
+        "Options:\n"
+        "  --seconds N        Length of every workload in seconds (default 10)\n"
+        "  --chips LIST       Comma-separated counts of chips (default 1,4)\n"
+        "  --rates LIST       Comma-separated sample rates (default 22050,44100,48000)\n"
+        "  --emulator ID      Run the single emulator only (see Opn2_Emulator)\n"
+        "  --workload NAME    Run the single workload only\n"
+        "  --csv FILE         Write results as CSV\n"
+        "  --json FILE        Write results as JSON\n"
+        "  --replay TRACE     Replay the register trace (see opn2_startTrace) by every emulator\n"
+        "  --list             List workloads and available emulators\n"
+        "  --help             Show this help\n", self);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 10.0;
+    std::vector<long> chips = parseList("1,4");
+    std::vector<long> rates = parseList("22050,44100,48000");
+    std::vector<std::string> banks;
+    int onlyEmulator = -1;
+    const char *onlyWorkload = NULL;
+    const char *csvPath = NULL;
+    const char *jsonPath = NULL;
+    const char *replayPath = NULL;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string a(argv[i]);
+        bool hasValue = (i + 1 < argc);
+        if(a == "--help" || a == "-h")
+        {
+            printHelp(argv[0]);
+            return 0;
+        }
+        else if(a == "--list")
+        {
+            std::printf("Workloads:\n");
+            for(size_t w = 0; w < s_workloadsCount; ++w)
+                std::printf("  %s\n", s_workloads[w].name);
+            std::printf("Emulators:\n");
+            OPN2_MIDIPlayer *p = opn2_init(44100);
+            for(int e = 0; e < OPNMIDI_EMU_end; ++e)
+            {
+                if(e != OPNMIDI_VGM_DUMPER && opn2_switchEmulator(p, e) == 0)
+                    std::printf("  %d: %s\n", e, opn2_chipEmulatorName(p));
+            }
+            opn2_close(p);
+            return 0;
+        }
+        else if(a == "--seconds" && hasValue)
+            seconds = std::atof(argv[++i]);
+        else if(a == "--chips" && hasValue)
+            chips = parseList(argv[++i]);
+        else if(a == "--rates" && hasValue)
+            rates = parseList(argv[++i]);
+        else if(a == "--emulator" && hasValue)
+            onlyEmulator = std::atoi(argv[++i]);
+        else if(a == "--workload" && hasValue)
+            onlyWorkload = argv[++i];
+        else if(a == "--csv" && hasValue)
+            csvPath = argv[++i];
+        else if(a == "--json" && hasValue)
+            jsonPath = argv[++i];
+        else if(a == "--replay" && hasValue)
+            replayPath = argv[++i];
+        else if(a.compare(0, 2, "--") == 0)
+        {
+            std::fprintf(stderr, "Unknown or incomplete option: %s\n", a.c_str());
+            printHelp(argv[0]);
+            return 1;
+        }
+        else
+            banks.push_back(a);
+    }
+
+    if(replayPath)
+        return runReplay(replayPath, onlyEmulator);
+
+    if(banks.empty())
+        banks.push_back(DEFAULT_BANK_PATH);
+
+    if(seconds <= 0.0 || chips.empty() || rates.empty())
+    {
+        std::fprintf(stderr, "Invalid length, chips or rates given\n");
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+
+    // Without the reset, the peak of every run includes all previous runs
+    if(!resetPeakRss())
+        std::printf("Note: peak RSS is the maximum of the whole process, not of every run\n");
+
+    std::printf("%-15s %-22s %-26s %5s %6s %9s %11s %11s %11s %9s\n",
+                "workload", "bank", "emulator", "chips", "rate",
+                "realtime", "ns/frm/chip", "noteon avg", "noteon max", "rss KiB");
+
+    for(size_t w = 0; w < s_workloadsCount; ++w)
+    {
+        const Workload &wl = s_workloads[w];
+        if(onlyWorkload && std::strcmp(onlyWorkload, wl.name) != 0)
+            continue;
+        std::vector<uint8_t> midi = wl.generate(seconds);
+
+        for(size_t b = 0; b < banks.size(); ++b)
+        {
+            for(int e = 0; e < OPNMIDI_EMU_end; ++e)
+            {
+                if(e == OPNMIDI_VGM_DUMPER || (onlyEmulator >= 0 && e != onlyEmulator))
+                    continue;
+
+                for(size_t c = 0; c < chips.size(); ++c)
+                {
+                    for(size_t r = 0; r < rates.size(); ++r)
+                    {
+                        BenchResult res;
+                        if(!runBench(wl, midi, banks[b], e, static_cast<int>(chips[c]), rates[r], seconds, res))
+                            continue;
+                        std::printf("%-15s %-22s %-26s %5d %6ld %8.2fx %11.1f %9.0fns %9.0fns %9ld\n",
+                                    res.workload.c_str(), res.bank.c_str(), res.emulator.c_str(),
+                                    res.chips, res.rate, res.realtimeFactor, res.nsPerFrameChip,
+                                    res.noteOnMeanNs, res.noteOnMaxNs, res.peakRssKb);
+                        std::fflush(stdout);
+                        results.push_back(res);
+                    }
+                }
+            }
+        }
+    }
+
+    if(csvPath && !writeCsv(csvPath, results))
+    {
+        std::fprintf(stderr, "Can't write %s\n", csvPath);
+        return 1;
+    }
+
+    if(jsonPath && !writeJson(jsonPath, results))
+    {
+        std::fprintf(stderr, "Can't write %s\n", jsonPath);
+        return 1;
+    }
+
+    return results.empty() ? 1 : 0;
+}
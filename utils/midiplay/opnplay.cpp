@@ -232,7 +232,7 @@ int main(int argc, char **argv)
         std::printf(
             "Usage:\n"
             "   opnmidiplay [-s] [-w] [-nl] [--emu-mame|--emu-nuked|--emu-gens|--emu-gx|--emu-np2|--emu-mame-opna|--emu-pmdwin] \\\n"
-            "               [--chips <count>] [<bankfile>.wopn] <midifilename>\n"
+            "               [--chips <count>] [--threads <count>] [<bankfile>.wopn] <midifilename>\n"
             "\n"
             " <bankfile>.wopn   Path to WOPN bank file\n"
             " <midifilename>    Path to music file to play\n"
@@ -258,6 +258,7 @@ int main(int argc, char **argv)
             " --emu-mame-opna   Use MAME YM2608 Emulator\n"
             " --emu-pmdwin      Use PMDWin Emulator\n"
             " --chips <count>   Choose a count of emulated concurrent chips\n"
+            " --threads <count> Count of threads to write WAV file, 0 - one thread per chip\n"
             "\n"
         );
         std::fflush(stdout);
@@ -300,6 +301,7 @@ int main(int argc, char **argv)
     int volumeModel = OPNMIDI_VolumeModel_AUTO;
     size_t soloTrack = ~static_cast<size_t>(0u);
     int chipsCount = -1;//Auto-choose chips count by emulator (Nuked 3, others 8)
+    int renderThreads = 1;
 
     std::string bankPath;
     std::string musPath;
@@ -351,6 +353,15 @@ int main(int argc, char **argv)
             }
             chipsCount = static_cast<int>(std::strtoul(argv[++arg], NULL, 10));
         }
+        else if(!std::strcmp("--threads", argv[arg]))
+        {
+            if(arg + 1 >= argc)
+            {
+                printError("The option --threads requires an argument!\n");
+                return 1;
+            }
+            renderThreads = static_cast<int>(std::strtol(argv[++arg], NULL, 10));
+        }
         else if(!std::strcmp("--solo", argv[arg]))
         {
             if(arg + 1 >= argc)
@@ -595,15 +606,26 @@ int main(int argc, char **argv)
         if(wave_open(static_cast<int>(sampleRate), wave_out.c_str()) == 0)
         {
             wave_enable_stereo();
-            short buff[4096];
+            // Bigger blocks let the parallel render to use threads efficiently
+            std::vector<short> buff(renderThreads != 1 ? 65536 : 4096);
+            OPNMIDI_AudioFormat format;
+            format.type = OPNMIDI_SampleType_S16;
+            format.containerSize = sizeof(short);
+            format.sampleOffset = sizeof(short) * 2;
             int complete_prev = -1;
             while(!stop)
             {
-                size_t got = static_cast<size_t>(opn2_play(myDevice, 4096, buff));
+                int got;
+                if(renderThreads != 1)
+                    got = opn2_renderSongParallel(myDevice, renderThreads, static_cast<int>(buff.size()),
+                                                  reinterpret_cast<OPN2_UInt8 *>(&buff[0]),
+                                                  reinterpret_cast<OPN2_UInt8 *>(&buff[1]), &format);
+                else
+                    got = opn2_play(myDevice, static_cast<int>(buff.size()), &buff[0]);
                 if(got <= 0)
                     break;
 
-                wave_write(buff, static_cast<long>(got));
+                wave_write(&buff[0], static_cast<long>(got));
 
                 int complete = static_cast<int>(std::floor(100.0 * opn2_positionTell(myDevice) / total));
                 if(complete_prev != complete)
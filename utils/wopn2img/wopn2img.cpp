@@ -0,0 +1,59 @@
+/*
+ * wopn2img - converter of WOPN bank files into pre-baked bank images of libOPNMIDI
+ *
+ * Copyright (c) 2017-2021 Vitaly Novichkov <admin@wohlnet.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <opnmidi.h>
+
+int main(int argc, char **argv)
+{
+    if(argc < 3)
+    {
+        std::fprintf(stderr, "Converts WOPN bank into the pre-baked bank image of libOPNMIDI\n");
+        std::fprintf(stderr, "Usage: %s <input.wopn> <output.opnimg>\n", argv[0]);
+        return 1;
+    }
+
+    OPN2_MIDIPlayer *device = opn2_init(44100);
+    if(!device)
+    {
+        std::fprintf(stderr, "Failed to initialize libOPNMIDI: %s\n", opn2_errorString());
+        return 1;
+    }
+
+    if(opn2_openBankFile(device, argv[1]) < 0)
+    {
+        std::fprintf(stderr, "Failed to load bank %s: %s\n", argv[1], opn2_errorInfo(device));
+        opn2_close(device);
+        return 1;
+    }
+
+    if(opn2_saveBankImage(device, argv[2]) < 0)
+    {
+        std::fprintf(stderr, "Failed to save bank image %s: %s\n", argv[2], opn2_errorInfo(device));
+        opn2_close(device);
+        return 1;
+    }
+
+    opn2_close(device);
+    return 0;
+}